@@ -10,6 +10,7 @@
 **********************************************************************************/
 #include "common/util/hash_util.h"
 #include "common/util/string_util.h"
+#include <nmmintrin.h>
 
 STD_USE_NAMESPACE;
 COMMON_BEGIN_NAMESPACE
@@ -97,4 +98,23 @@ uint64_t DBHashImpl::HashNumber64(int32_t number) {
     return nHash;
 }
 
+uint32_t Crc32c::Extend(uint32_t crc, const uint8_t* data, size_t len) {
+    uint64_t c = ~crc & 0xFFFFFFFFul;
+    //align to 8 bytes, then consume 8 bytes by one instruction
+    while (len > 0 && 0 != ((uintptr_t)data & 7)) {
+        c = _mm_crc32_u8((uint32_t)c, *data++);
+        --len;
+    }
+    while (len >= 8) {
+        c = _mm_crc32_u64(c, *(const uint64_t*)data);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        c = _mm_crc32_u8((uint32_t)c, *data++);
+        --len;
+    }
+    return ~(uint32_t)c;
+}
+
 COMMON_END_NAMESPACE
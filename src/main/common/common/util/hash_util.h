@@ -614,5 +614,13 @@ public:
     }
 };
 
+///crc32c(Castagnoli polynomial) checksum computed by sse4.2 crc32 instruction
+class Crc32c {
+public:
+    ///extend checksum 'crc' of data before by 'len' bytes of 'data', start from 0
+    static uint32_t Extend(uint32_t crc, const uint8_t* data, size_t len);
+    static uint32_t Value(const uint8_t* data, size_t len) { return Extend(0, data, len); }
+};
+
 COMMON_END_NAMESPACE
 #endif //__COMMON_HASH_UTIL__H__
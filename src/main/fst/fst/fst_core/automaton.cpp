@@ -9,6 +9,7 @@
   *Description:    file implements automaton responding class and its implementation
 **********************************************************************************/
 #include "fst/fst_core/automaton.h"
+#include "fst/fst_core/byte_dfa_automaton.h"
 #include <stack>
 #include <cassert>
 
@@ -50,6 +51,115 @@ AutomatonPtr StartsWith(AutomatonPtr& aut) {
     return std::make_shared<StartsWithAutomaton>(aut);
 }
 
+const uint32_t MultiUnionAutomaton::DEAD_STATE_ID;
+
+///union state id of state, checked only in debug build because this is the hottest path of fst iterator
+static inline uint32_t getUnionStateId(const AutomatonStatePtr& state) {
+    assert(nullptr != dynamic_cast<const MultiUnionAutomatonState*>(state.get()));
+    return static_cast<const MultiUnionAutomatonState*>(state.get())->m_unionStateId;
+}
+
+MultiUnionAutomaton::MultiUnionAutomaton(const vector<AutomatonPtr>& automatons)
+: m_automatons(automatons)
+{
+    //dead state has no members
+    m_unionStates.push_back(UnionState{0, 0, false});
+    m_states.push_back(nullptr);
+}
+
+void MultiUnionAutomaton::addNextMember(uint32_t member, const AutomatonStatePtr& memberState) {
+    const AutomatonPtr& aut = m_automatons[member];
+    if (!aut->CanMatch(memberState) && !aut->IsMatch(memberState)) return;
+    uint64_t memberStateId = 0;
+    bool hasStateId = aut->GetStateId(memberState, memberStateId);
+    assert(hasStateId);
+    (void)hasStateId;
+    m_nextMemberIndexes.push_back(member);
+    m_nextMemberStates.push_back(memberState);
+    m_nextMembersKey.append((const char*)&member, sizeof(member));
+    m_nextMembersKey.append((const char*)&memberStateId, sizeof(memberStateId));
+}
+
+uint32_t MultiUnionAutomaton::getUnionState() {
+    uint32_t unionStateId = DEAD_STATE_ID;
+    if (!m_nextMemberIndexes.empty()) {
+        auto it = m_members2UnionStateMap.find(m_nextMembersKey);
+        if (it != m_members2UnionStateMap.end()) {
+            unionStateId = it->second;
+        }
+        else {
+            unionStateId = m_unionStates.size();
+            UnionState unionState{m_memberIndexes.size(), m_memberIndexes.size() + m_nextMemberIndexes.size(), false};
+            for (size_t i = 0; i < m_nextMemberIndexes.size(); ++i) {
+                unionState.m_isMatch = unionState.m_isMatch || m_automatons[m_nextMemberIndexes[i]]->IsMatch(m_nextMemberStates[i]);
+            }
+            m_memberIndexes.insert(m_memberIndexes.end(), m_nextMemberIndexes.begin(), m_nextMemberIndexes.end());
+            m_memberStates.insert(m_memberStates.end(), m_nextMemberStates.begin(), m_nextMemberStates.end());
+            m_unionStates.push_back(unionState);
+            m_states.push_back(std::make_shared<MultiUnionAutomatonState>(unionStateId));
+            m_members2UnionStateMap.insert(std::make_pair(m_nextMembersKey, unionStateId));
+        }
+    }
+    m_nextMemberIndexes.clear();
+    m_nextMemberStates.clear();
+    m_nextMembersKey.clear();
+    return unionStateId;
+}
+
+AutomatonStatePtr MultiUnionAutomaton::Start() {
+    for (uint32_t i = 0; i < m_automatons.size(); ++i) {
+        addNextMember(i, m_automatons[i]->Start());
+    }
+    return m_states[getUnionState()];
+}
+
+bool MultiUnionAutomaton::IsMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return m_unionStates[getUnionStateId(state)].m_isMatch;
+}
+
+bool MultiUnionAutomaton::CanMatch(const AutomatonStatePtr &state) {
+    //dead state has no state object
+    return nullptr != state;
+}
+
+AutomatonStatePtr MultiUnionAutomaton::Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) {
+    if (nullptr == ptr || byteVec.empty()) return ptr;
+    uint32_t unionStateId = getUnionStateId(ptr);
+    uint64_t transKey = ((uint64_t)unionStateId << 8) | byteVec.back();
+    auto it = m_transMap.find(transKey);
+    if (it != m_transMap.end()) {
+        return m_states[it->second];
+    }
+    //NOTE THAT copied range, since interning new union state may reallocate member pools
+    UnionState unionState = m_unionStates[unionStateId];
+    for (size_t i = unionState.m_memberBegin; i < unionState.m_memberEnd; ++i) {
+        uint32_t member = m_memberIndexes[i];
+        AutomatonStatePtr memberState = m_memberStates[i];
+        addNextMember(member, m_automatons[member]->Accept(memberState, byteVec));
+    }
+    uint32_t nextUnionStateId = getUnionState();
+    m_transMap.insert(std::make_pair(transKey, nextUnionStateId));
+    return m_states[nextUnionStateId];
+}
+
+bool MultiUnionAutomaton::GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+    if (nullptr == state) return false;
+    stateId = getUnionStateId(state);
+    return true;
+}
+
+void MultiUnionAutomaton::GetMatchedMembers(const AutomatonStatePtr& state, vector<uint32_t>& members) const {
+    members.clear();
+    if (nullptr == state) return;
+    const UnionState& unionState = m_unionStates[getUnionStateId(state)];
+    for (size_t i = unionState.m_memberBegin; i < unionState.m_memberEnd; ++i) {
+        if (m_automatons[m_memberIndexes[i]]->IsMatch(m_memberStates[i])) {
+            members.push_back(m_memberIndexes[i]);
+        }
+    }
+}
+
 StrAutomaton::StrAutomaton(const string& str)
 : m_str(str)
 {
@@ -228,6 +338,13 @@ bool LevenshteinAutomaton::IsMatch(const AutomatonStatePtr &state) {
     return st->m_curEdits.back() <= m_editDistance;
 }
 
+bool LevenshteinAutomaton::GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) {
+    LevenshteinAutomatonStatePtr st = dynamic_pointer_cast<LevenshteinAutomatonState>(state);
+    if (!st) return false;
+    distance = (uint32_t)st->m_curEdits.back();
+    return true;
+}
+
 bool LevenshteinAutomaton::CanMatch(const AutomatonStatePtr &state) {
     if (nullptr == state) return false;
     LevenshteinAutomatonStatePtr st = dynamic_pointer_cast<LevenshteinAutomatonState>(state);
@@ -325,6 +442,29 @@ void LevenshteinAutomaton::buildDfa() {
     }
 }
 
+ByteDfaAutomatonPtr LevenshteinAutomaton::CompileToByteDfa() {
+    Utf8ByteDfaBuilder builder;
+    unordered_map<LevenshteinAutomatonStatePtr,uint32_t,
+            LevenshteinAutomatonStateHash,LevenshteinAutomatonStateEqual> state2IdMap;
+    auto getStateId = [&](const LevenshteinAutomatonStatePtr& st) -> uint32_t {
+        auto it = state2IdMap.find(st);
+        if (it != state2IdMap.end()) return it->second;
+        uint32_t stateId = builder.AddState(IsMatch(st));
+        state2IdMap.insert(std::make_pair(st,stateId));
+        return stateId;
+    };
+    uint32_t startStateId = getStateId(dynamic_pointer_cast<LevenshteinAutomatonState>(Start()));
+    for (auto& kv : m_statesCacheMap) {
+        uint32_t from = getStateId(kv.first);
+        for (auto& trans : *(kv.second)) {
+            uint32_t to = getStateId(trans.second);
+            if (trans.first.empty()) builder.SetDefaultTransition(from, to);
+            else builder.AddTransition(from, trans.first, to);
+        }
+    }
+    return builder.Build(startStateId);
+}
+
 DamerauLevenshteinAutomatonState::DamerauLevenshteinAutomatonState(DISTANCE_SEQUENCE_PTR curEdits,
                                                                    DISTANCE_SEQUENCE_PTR prevEdits,
                                                                    const string&         prevStr,
@@ -493,6 +633,13 @@ bool DamerauLevenshteinAutomaton::IsMatch(const AutomatonStatePtr &state) {
     return st->curEdits_->back() <= m_editDistance;
 }
 
+bool DamerauLevenshteinAutomaton::GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) {
+    DamerauLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<DamerauLevenshteinAutomatonState>(state);
+    if (!st) return false;
+    distance = (uint32_t)st->curEdits_->back();
+    return true;
+}
+
 bool DamerauLevenshteinAutomaton::CanMatch(const AutomatonStatePtr &state) {
     if (nullptr == state) return false;
     DamerauLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<DamerauLevenshteinAutomatonState>(state);
@@ -523,4 +670,27 @@ AutomatonStatePtr DamerauLevenshteinAutomaton::Accept(const AutomatonStatePtr &p
     }
 }
 
-COMMON_END_NAMESPACE
\ No newline at end of file
+ByteDfaAutomatonPtr DamerauLevenshteinAutomaton::CompileToByteDfa() {
+    Utf8ByteDfaBuilder builder;
+    unordered_map<DamerauLevenshteinAutomatonStatePtr,uint32_t,
+            DamerauLevenshteinAutomatonStateHash,DamerauLevenshteinAutomatonStateEqual> state2IdMap;
+    auto getStateId = [&](const DamerauLevenshteinAutomatonStatePtr& st) -> uint32_t {
+        auto it = state2IdMap.find(st);
+        if (it != state2IdMap.end()) return it->second;
+        uint32_t stateId = builder.AddState(IsMatch(st));
+        state2IdMap.insert(std::make_pair(st,stateId));
+        return stateId;
+    };
+    uint32_t startStateId = getStateId(dynamic_pointer_cast<DamerauLevenshteinAutomatonState>(Start()));
+    for (auto& kv : m_statesCacheMap) {
+        uint32_t from = getStateId(kv.first);
+        for (auto& trans : *(kv.second)) {
+            uint32_t to = getStateId(trans.second);
+            if (trans.first.empty()) builder.SetDefaultTransition(from, to);
+            else builder.AddTransition(from, trans.first, to);
+        }
+    }
+    return builder.Build(startStateId);
+}
+
+COMMON_END_NAMESPACE
@@ -78,6 +78,10 @@ public:
 };
 TYPEDEF_PTR(DfaAutomatonState);
 
+//byte level dfa automaton compiled from utf8 character level automaton, see byte_dfa_automaton.h
+class ByteDfaAutomaton;
+TYPEDEF_PTR(ByteDfaAutomaton);
+
 //Automaton base class
 class Automaton;
 TYPEDEF_PTR(Automaton);
@@ -91,6 +95,13 @@ public:
     virtual bool  IsMatch(const AutomatonStatePtr& state) = 0;
     virtual bool  CanMatch(const AutomatonStatePtr& state) = 0;
     virtual AutomatonStatePtr Accept(const AutomatonStatePtr& state, const vector<uint8_t>& byteVec) = 0;
+    ///id of state which alone decides what can be matched from now on, so that fst iterator can memoize
+    ///fruitless (fst node, state) pairs. false if automaton can not tell, such as character level automatons
+    ///whose next states also depend on pending bytes of last incomplete utf8 character
+    virtual bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) { return false; }
+    ///edit distance between accepted string and query of matched state, for fuzzy automatons. false if
+    ///automaton can not tell, such as compiled byte dfa which keeps no distances
+    virtual bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) { return false; }
 
 public:
     static string IsLastValidUtf8Str(const vector<uint8_t>& byteVec);
@@ -130,6 +141,19 @@ public:
     }
     virtual bool  IsMatch(const AutomatonStatePtr& state) = 0;
     virtual bool  CanMatch(const AutomatonStatePtr& state) = 0;
+    ///ids of states of two automatons packed into one, false if either can not tell or exceeds 32 bits
+    virtual bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+        ComplexAutomatonStatePtr st = dynamic_pointer_cast<ComplexAutomatonState>(state);
+        if (!st || m_automatons.size() != 2) return false;
+        uint64_t stateId1 = 0, stateId2 = 0;
+        if (!m_automatons[0]->GetStateId(st->m_states[0],stateId1)
+            || !m_automatons[1]->GetStateId(st->m_states[1],stateId2)
+            || stateId1 > UINT32_MAX || stateId2 > UINT32_MAX) {
+            return false;
+        }
+        stateId = (stateId1 << 32) | stateId2;
+        return true;
+    }
 public:
     std::vector<AutomatonPtr>     m_automatons;
 };
@@ -160,6 +184,15 @@ public:
         }
         return true;
     }
+    ///edit distance told by the first member which can tell, such as fuzzy automaton intersected with prefix
+    virtual bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) {
+        ComplexAutomatonStatePtr st = dynamic_pointer_cast<ComplexAutomatonState>(state);
+        if (!st) return false;
+        for (size_t i = 0; i < m_automatons.size(); ++i) {
+            if (m_automatons[i]->GetEditDistance(st->m_states[i],distance)) return true;
+        }
+        return false;
+    }
 };
 
 //union for multiple automatons
@@ -287,16 +320,97 @@ public:
     virtual bool  IsMatch(const AutomatonStatePtr& state) {
         if (state == StartsWithAutomaton::DoneState::s_doneState) return true;
         StartsWithAutomaton::RunningStatePtr runningSt = dynamic_pointer_cast<StartsWithAutomaton::RunningState>(state);
-        return m_automaton->IsMatch(runningSt);
+        return runningSt && m_automaton->IsMatch(runningSt->m_innerState);
     }
     virtual bool  CanMatch(const AutomatonStatePtr& state)  {
         if (state == StartsWithAutomaton::DoneState::s_doneState) return true;
         StartsWithAutomaton::RunningStatePtr runningSt = dynamic_pointer_cast<StartsWithAutomaton::RunningState>(state);
-        return m_automaton->CanMatch(runningSt);
+        return runningSt && m_automaton->CanMatch(runningSt->m_innerState);
+    }
+    ///0 for done state, otherwise id of inner state plus 1
+    virtual bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+        if (state == StartsWithAutomaton::DoneState::s_doneState) {
+            stateId = 0;
+            return true;
+        }
+        StartsWithAutomaton::RunningStatePtr runningSt = dynamic_pointer_cast<StartsWithAutomaton::RunningState>(state);
+        uint64_t innerStateId = 0;
+        if (!runningSt || !m_automaton->GetStateId(runningSt->m_innerState,innerStateId) || innerStateId == UINT64_MAX) {
+            return false;
+        }
+        stateId = innerStateId + 1;
+        return true;
     }
 };
 
 
+/// state of multi union automaton, only holds id of union state
+class MultiUnionAutomatonState : public AutomatonState {
+public:
+    MultiUnionAutomatonState(uint32_t unionStateId)
+    : m_unionStateId(unionStateId)
+    {}
+public:
+    uint32_t        m_unionStateId;
+};
+TYPEDEF_PTR(MultiUnionAutomatonState);
+
+/**
+ *@brief   union of many automatons driving all members by one fst traversal. Union state is the tuple of
+ *         members still alive with their states, dead members are dropped so that they cost nothing in
+ *         deeper subtrees, and subtree is pruned only when all members are dead. Union states are interned
+ *         in flat pools and their transitions memoized by byte, so following a known transition costs one
+ *         hash lookup and allocates nothing. Which members matched can be told from the matched state.
+ *         NOTE THAT every member must tell its state ids by 'GetStateId', and walking it builds it, so it
+ *         is not thread safe.
+ */
+class MultiUnionAutomaton;
+TYPEDEF_PTR(MultiUnionAutomaton);
+class MultiUnionAutomaton : public Automaton {
+public:
+    ///union state id of dead state, whose members are all dead
+    const static uint32_t DEAD_STATE_ID = 0;
+public:
+    MultiUnionAutomaton(const vector<AutomatonPtr>& automatons);
+public:
+    AutomatonStatePtr Start() override;
+    bool IsMatch(const AutomatonStatePtr &state) override;
+    bool CanMatch(const AutomatonStatePtr &state) override;
+    AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) override;
+public:
+    ///indexes of members matched by 'state', ascending
+    void GetMatchedMembers(const AutomatonStatePtr& state, vector<uint32_t>& members) const;
+    ///count of union states built so far
+    uint32_t GetUnionStateCount() const { return (uint32_t)m_unionStates.size(); }
+private:
+    struct UnionState {
+        ///range of members in 'm_memberIndexes' and 'm_memberStates'
+        size_t      m_memberBegin;
+        size_t      m_memberEnd;
+        bool        m_isMatch;
+    };
+private:
+    ///intern union state of members in 'm_nextMemberIndexes' and 'm_nextMemberStates'
+    uint32_t getUnionState();
+    void addNextMember(uint32_t member, const AutomatonStatePtr& memberState);
+private:
+    vector<AutomatonPtr>                        m_automatons;
+    ///member indexes ascending and member states of all union states
+    vector<uint32_t>                            m_memberIndexes;
+    vector<AutomatonStatePtr>                   m_memberStates;
+    vector<UnionState>                          m_unionStates;
+    ///union states are created once, so 'Accept' never allocates, nullptr for dead state
+    vector<AutomatonStatePtr>                   m_states;
+    ///(member index, member state id) tuple -> union state id
+    std::unordered_map<string, uint32_t>        m_members2UnionStateMap;
+    ///(union state id, byte) -> next union state id
+    std::unordered_map<uint64_t, uint32_t>      m_transMap;
+    ///members of union state being computed
+    vector<uint32_t>                            m_nextMemberIndexes;
+    vector<AutomatonStatePtr>                   m_nextMemberStates;
+    string                                      m_nextMembersKey;
+};
 
 AutomatonPtr Intersect(AutomatonPtr& aut1, AutomatonPtr& aut2);
 AutomatonPtr Union(AutomatonPtr& aut1, AutomatonPtr& aut2);
@@ -508,6 +622,10 @@ public:
     bool IsMatch(const AutomatonStatePtr &state) override;
     bool CanMatch(const AutomatonStatePtr &state) override;
     AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) override;
+
+    ///compile into byte level dfa automaton which accepts the same keys
+    ByteDfaAutomatonPtr CompileToByteDfa();
 
 protected:
     string                             m_str;
@@ -607,6 +725,10 @@ public:
     bool IsMatch(const AutomatonStatePtr &state) override;
     bool CanMatch(const AutomatonStatePtr &state) override;
     AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) override;
+
+    ///compile into byte level dfa automaton which accepts the same keys
+    ByteDfaAutomatonPtr CompileToByteDfa();
 
 protected:
     string                             m_str;
@@ -0,0 +1,175 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       bit_parallel_levenshtein_automaton.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements bit-parallel levenshtein automaton
+**********************************************************************************/
+#include "fst/fst_core/bit_parallel_levenshtein_automaton.h"
+#include <cassert>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+namespace {
+///sum and minimum prefix sum of the 8 vertical deltas encoded by one byte of vp and one byte of vn
+struct DeltaByteSummary {
+    int8_t  m_sum;
+    int8_t  m_minPrefixSum;
+};
+
+const DeltaByteSummary* getDeltaByteSummaryTable() {
+    static const vector<DeltaByteSummary> s_table = []() {
+        vector<DeltaByteSummary> table(1 << 16);
+        for (uint32_t vp = 0; vp < 256; ++vp) {
+            for (uint32_t vn = 0; vn < 256; ++vn) {
+                int32_t sum = 0, minPrefixSum = 0;
+                for (uint32_t k = 0; k < 8; ++k) {
+                    sum += (int32_t)((vp >> k) & 1) - (int32_t)((vn >> k) & 1);
+                    minPrefixSum = std::min(minPrefixSum, sum);
+                }
+                table[(vp << 8) | vn].m_sum = sum;
+                table[(vp << 8) | vn].m_minPrefixSum = minPrefixSum;
+            }
+        }
+        return table;
+    }();
+    return s_table.data();
+}
+}
+
+BitParallelLevenshteinAutomaton::BitParallelLevenshteinAutomaton(const string& str,
+                                                                 uint32_t editDistance,
+                                                                 bool isUseDamerauLevenshtein)
+: m_str(str)
+, m_editDistance(editDistance)
+, m_isUseDamerauLevenshtein(isUseDamerauLevenshtein)
+, m_queryLen(0)
+{
+    vector<string> utf8strs;
+    Utf8Util::String2utf8(m_str, utf8strs);
+    for (const string& s : utf8strs) {
+        if (!s.empty()) ++m_queryLen;
+    }
+    m_blockCount = (m_queryLen + 63) / 64;
+    m_lastBlockMask = (m_queryLen % 64 == 0) ? ~0ul : ((1ul << (m_queryLen % 64)) - 1);
+
+    //bit i of block b is set if character equals query[b*64+i]
+    m_peqs.assign(m_blockCount, 0);
+    uint32_t pos = 0;
+    for (const string& s : utf8strs) {
+        if (s.empty()) continue;
+        auto it = m_char2IndexMap.find(s);
+        if (it == m_char2IndexMap.end()) {
+            it = m_char2IndexMap.insert(std::make_pair(s, (uint32_t)m_char2IndexMap.size() + 1)).first;
+            m_peqs.resize(m_peqs.size() + m_blockCount, 0);
+        }
+        m_peqs[(size_t)it->second * m_blockCount + pos / 64] |= (1ul << (pos % 64));
+        ++pos;
+    }
+    getDeltaByteSummaryTable();
+}
+
+AutomatonStatePtr BitParallelLevenshteinAutomaton::Start() {
+    BitParallelLevenshteinAutomatonStatePtr st = std::make_shared<BitParallelLevenshteinAutomatonState>();
+    st->m_vp.assign(m_blockCount, ~0ul);
+    st->m_vn.assign(m_blockCount, 0);
+    if (m_isUseDamerauLevenshtein) st->m_d0.assign(m_blockCount, 0);
+    st->m_distance = m_queryLen;
+    st->m_canMatch = true;
+    return st;
+}
+
+bool BitParallelLevenshteinAutomaton::IsMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    BitParallelLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<BitParallelLevenshteinAutomatonState>(state);
+    return st->m_distance <= m_editDistance;
+}
+
+bool BitParallelLevenshteinAutomaton::CanMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    BitParallelLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<BitParallelLevenshteinAutomatonState>(state);
+    return st->m_canMatch;
+}
+
+bool BitParallelLevenshteinAutomaton::GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) {
+    BitParallelLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<BitParallelLevenshteinAutomatonState>(state);
+    if (!st) return false;
+    distance = st->m_distance;
+    return true;
+}
+
+bool BitParallelLevenshteinAutomaton::canMatch(const BitParallelLevenshteinAutomatonState& st) const {
+    //walk down the column from D[0][j], which equals consumed length
+    int32_t cur = st.m_consumedLen;
+    if (cur <= (int32_t)m_editDistance || st.m_distance <= m_editDistance) return true;
+    const DeltaByteSummary* table = getDeltaByteSummaryTable();
+    for (uint32_t b = 0; b < m_blockCount; ++b) {
+        uint64_t mask = (b + 1 == m_blockCount) ? m_lastBlockMask : ~0ul;
+        uint64_t vp = st.m_vp[b] & mask;
+        uint64_t vn = st.m_vn[b] & mask;
+        for (uint32_t k = 0; k < 64; k += 8) {
+            const DeltaByteSummary& summary = table[(((vp >> k) & 0xFF) << 8) | ((vn >> k) & 0xFF)];
+            if (cur + summary.m_minPrefixSum <= (int32_t)m_editDistance) return true;
+            cur += summary.m_sum;
+        }
+    }
+    return false;
+}
+
+AutomatonStatePtr BitParallelLevenshteinAutomaton::Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) {
+    if (nullptr == ptr) return nullptr;
+    string s = Automaton::IsLastValidUtf8Str(byteVec);
+    if (s.empty()) return ptr;
+
+    BitParallelLevenshteinAutomatonStatePtr st = dynamic_pointer_cast<BitParallelLevenshteinAutomatonState>(ptr);
+    auto it = m_char2IndexMap.find(s);
+    uint32_t charIndex = (it == m_char2IndexMap.end()) ? 0 : it->second;
+    const uint64_t* peq = &m_peqs[(size_t)charIndex * m_blockCount];
+    const uint64_t* prevPeq = &m_peqs[(size_t)st->m_lastCharIndex * m_blockCount];
+
+    BitParallelLevenshteinAutomatonStatePtr next = std::make_shared<BitParallelLevenshteinAutomatonState>();
+    next->m_vp.resize(m_blockCount);
+    next->m_vn.resize(m_blockCount);
+    if (m_isUseDamerauLevenshtein) next->m_d0.resize(m_blockCount);
+    next->m_lastCharIndex = charIndex;
+    next->m_consumedLen = st->m_consumedLen + 1;
+    next->m_distance = st->m_distance;
+
+    //horizontal delta coming into the top of block, first row D[0][j] always increases by one
+    int32_t hin = 1;
+    uint64_t trCarry = 0;
+    for (uint32_t b = 0; b < m_blockCount; ++b) {
+        uint64_t vp = st->m_vp[b];
+        uint64_t vn = st->m_vn[b];
+        uint64_t eq = peq[b] | (hin < 0 ? 1ul : 0ul);
+        uint64_t d0 = 0;
+        if (m_isUseDamerauLevenshtein) {
+            //transposition: query[i-1..i] equals reversed last two accepted characters
+            uint64_t tr = (~st->m_d0[b]) & peq[b];
+            d0 = ((tr << 1) | trCarry) & prevPeq[b];
+            trCarry = tr >> 63;
+        }
+        d0 |= (((eq & vp) + vp) ^ vp) | eq | vn;
+        uint64_t hp = vn | ~(d0 | vp);
+        uint64_t hn = d0 & vp;
+
+        uint32_t outBit = (b + 1 == m_blockCount) ? (m_queryLen - 1) % 64 : 63;
+        int32_t hout = ((hp >> outBit) & 1) ? 1 : (((hn >> outBit) & 1) ? -1 : 0);
+
+        uint64_t x = (hp << 1) | (hin > 0 ? 1ul : 0ul);
+        next->m_vn[b] = x & d0;
+        next->m_vp[b] = (hn << 1) | (hin < 0 ? 1ul : 0ul) | ~(x | d0);
+        if (m_isUseDamerauLevenshtein) next->m_d0[b] = d0;
+        hin = hout;
+    }
+    next->m_distance = (m_blockCount == 0) ? next->m_consumedLen : st->m_distance + hin;
+    next->m_canMatch = canMatch(*next);
+    if (!next->m_canMatch) return nullptr;
+    return next;
+}
+
+COMMON_END_NAMESPACE
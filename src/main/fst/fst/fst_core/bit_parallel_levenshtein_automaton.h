@@ -0,0 +1,85 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       bit_parallel_levenshtein_automaton.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines bit-parallel levenshtein automaton based on Myers' algorithm and
+  *                Hyyro's extension for Damerau-Levenshtein (restricted edit distance).
+  *                State is one column of dynamic programming matrix encoded by vertical positive
+  *                and negative delta bit vectors, 64 query characters per machine word, so every
+  *                step costs O(query length / 64) word operations and no dfa is built at all.
+  *                That makes it suitable for long query string or large edit distance where
+  *                building dfa blows up.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_BIT_PARALLEL_LEVENSHTEIN_AUTOMATON__H__
+#define __CPPFST_FST_CORE_BIT_PARALLEL_LEVENSHTEIN_AUTOMATON__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "fst/fst_core/automaton.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+/// state of bit-parallel levenshtein automaton, which is one column of dp matrix
+class BitParallelLevenshteinAutomatonState : public AutomatonState {
+public:
+    BitParallelLevenshteinAutomatonState()
+    : m_lastCharIndex(0)
+    , m_consumedLen(0)
+    , m_distance(0)
+    , m_canMatch(true)
+    {}
+public:
+    ///vertical positive delta bits of every block
+    vector<uint64_t>    m_vp;
+    ///vertical negative delta bits of every block
+    vector<uint64_t>    m_vn;
+    ///diagonal zero delta bits of every block, only kept for transposition
+    vector<uint64_t>    m_d0;
+    ///index of last accepted character in query characters, 0 means not in query
+    uint32_t            m_lastCharIndex;
+    ///count of accepted utf8 characters, also distance between accepted string and empty query prefix
+    uint32_t            m_consumedLen;
+    ///edit distance between accepted string and whole query
+    uint32_t            m_distance;
+    ///whether some query prefix is within edit distance
+    bool                m_canMatch;
+};
+TYPEDEF_PTR(BitParallelLevenshteinAutomatonState);
+
+/// levenshtein or Damerau levenshtein automaton computed by bit-parallel dp column
+class BitParallelLevenshteinAutomaton : public Automaton {
+public:
+    BitParallelLevenshteinAutomaton(const string& str, uint32_t editDistance, bool isUseDamerauLevenshtein);
+public:
+    AutomatonStatePtr Start() override;
+    bool IsMatch(const AutomatonStatePtr &state) override;
+    bool CanMatch(const AutomatonStatePtr &state) override;
+    AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) override;
+private:
+    ///minimum of dp column is within edit distance or not
+    bool canMatch(const BitParallelLevenshteinAutomatonState& st) const;
+protected:
+    string                                          m_str;
+    uint32_t                                        m_editDistance;
+    bool                                            m_isUseDamerauLevenshtein;
+    uint32_t                                        m_queryLen;
+    uint32_t                                        m_blockCount;
+    ///valid bits mask of last block
+    uint64_t                                        m_lastBlockMask;
+    ///utf8 character -> index of its match bit vectors, index 0 is for characters not in query
+    std::unordered_map<string, uint32_t>            m_char2IndexMap;
+    ///'m_blockCount' match bit vector blocks for every character index
+    vector<uint64_t>                                m_peqs;
+};
+TYPEDEF_PTR(BitParallelLevenshteinAutomaton);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_BIT_PARALLEL_LEVENSHTEIN_AUTOMATON__H__
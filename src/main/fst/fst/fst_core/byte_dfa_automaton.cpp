@@ -0,0 +1,298 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       byte_dfa_automaton.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements byte level dfa automaton and its utf8 compiler
+**********************************************************************************/
+#include "fst/fst_core/byte_dfa_automaton.h"
+#include <queue>
+#include <cassert>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,ByteDfaAutomaton);
+TLOG_SETUP(COMMON_NS,Utf8ByteDfaBuilder);
+
+const uint32_t ByteDfaAutomaton::DEAD_STATE_ID;
+
+ByteDfaAutomaton::ByteDfaAutomaton(uint32_t startStateId,
+                                   const vector<uint8_t>& byteClasses,
+                                   uint32_t classCount,
+                                   vector<uint32_t> trans,
+                                   vector<uint8_t> finals)
+: m_startStateId(startStateId)
+, m_classCount(classCount)
+, m_trans(std::move(trans))
+, m_finals(std::move(finals))
+{
+    assert(byteClasses.size() == 256);
+    std::copy(byteClasses.begin(), byteClasses.end(), m_byteClasses);
+    m_states.reserve(m_finals.size());
+    for (uint32_t i = 0; i < m_finals.size(); ++i) {
+        m_states.push_back(std::make_shared<ByteDfaAutomatonState>(i));
+    }
+}
+
+AutomatonStatePtr ByteDfaAutomaton::Start() {
+    return m_states[m_startStateId];
+}
+
+bool ByteDfaAutomaton::IsMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return IsFinal(static_cast<const ByteDfaAutomatonState*>(state.get())->m_stateId);
+}
+
+bool ByteDfaAutomaton::CanMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return static_cast<const ByteDfaAutomatonState*>(state.get())->m_stateId != DEAD_STATE_ID;
+}
+
+AutomatonStatePtr ByteDfaAutomaton::Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) {
+    if (nullptr == ptr || byteVec.empty()) return ptr;
+    //NOTE THAT static cast here because this is the hottest path of fst iterator
+    uint32_t nextStateId = Next(static_cast<const ByteDfaAutomatonState*>(ptr.get())->m_stateId, byteVec.back());
+    if (nextStateId == DEAD_STATE_ID) return nullptr;
+    return m_states[nextStateId];
+}
+
+bool ByteDfaAutomaton::GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+    if (nullptr == state) return false;
+    stateId = static_cast<const ByteDfaAutomatonState*>(state.get())->m_stateId;
+    return true;
+}
+
+uint64_t ByteDfaAutomaton::GetMemoryBytes() const {
+    //every state object is allocated together with its shared_ptr control block
+    return sizeof(ByteDfaAutomaton)
+           + m_trans.capacity() * sizeof(uint32_t)
+           + m_finals.capacity() * sizeof(uint8_t)
+           + m_states.capacity() * sizeof(AutomatonStatePtr)
+           + m_states.size() * (sizeof(ByteDfaAutomatonState) + 2 * sizeof(void*) + 2 * sizeof(uint32_t));
+}
+
+ByteDfaAutomatonPtr ByteDfaAutomaton::RestrictPrefix(const string& prefix) const {
+    uint32_t stateId = m_startStateId;
+    for (size_t i = 0; i < prefix.size() && stateId != DEAD_STATE_ID; ++i) {
+        stateId = Next(stateId, (uint8_t)prefix[i]);
+    }
+    //states of this automaton keep their ids, followed by a chain of states for prefix bytes
+    uint32_t stateCount = GetStateCount();
+    vector<uint32_t> denseTrans(((size_t)stateCount + prefix.size()) * 256, DEAD_STATE_ID);
+    vector<uint8_t> finals(m_finals);
+    for (uint32_t s = 0; s < stateCount; ++s) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            denseTrans[(size_t)s * 256 + b] = Next(s, b);
+        }
+    }
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        uint32_t chainStateId = stateCount + i;
+        uint32_t to = (i + 1 < prefix.size()) ? chainStateId + 1 : stateId;
+        denseTrans[(size_t)chainStateId * 256 + (uint8_t)prefix[i]] = to;
+        finals.push_back(false);
+    }
+    return CompressDenseDfa(denseTrans, finals, prefix.empty() ? m_startStateId : stateCount);
+}
+
+ByteDfaAutomatonPtr ByteDfaAutomaton::ToPrefixSink() const {
+    uint32_t stateCount = GetStateCount();
+    vector<uint32_t> denseTrans((size_t)stateCount * 256, DEAD_STATE_ID);
+    for (uint32_t s = 0; s < stateCount; ++s) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            denseTrans[(size_t)s * 256 + b] = IsFinal(s) ? s : Next(s, b);
+        }
+    }
+    return CompressDenseDfa(denseTrans, m_finals, m_startStateId);
+}
+
+ByteDfaAutomatonPtr ByteDfaAutomaton::CompressDenseDfa(const vector<uint32_t>& denseTrans,
+                                                       const vector<uint8_t>& finals,
+                                                       uint32_t startStateId) {
+    uint32_t stateCount = finals.size();
+    assert(denseTrans.size() == (size_t)stateCount * 256 && startStateId < stateCount);
+
+    //mark states which can reach some final state by reverse bfs
+    vector<vector<uint32_t> > reverseTrans(stateCount);
+    for (uint32_t from = 1; from < stateCount; ++from) {
+        uint32_t lastTo = DEAD_STATE_ID;
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t to = denseTrans[(size_t)from * 256 + b];
+            if (to == DEAD_STATE_ID || to == lastTo) continue;
+            reverseTrans[to].push_back(from);
+            lastTo = to;
+        }
+    }
+    vector<bool> isLive(stateCount, false);
+    queue<uint32_t> q;
+    for (uint32_t i = 1; i < stateCount; ++i) {
+        if (finals[i]) {
+            isLive[i] = true;
+            q.push(i);
+        }
+    }
+    while (!q.empty()) {
+        uint32_t to = q.front();
+        q.pop();
+        for (uint32_t from : reverseTrans[to]) {
+            if (isLive[from]) continue;
+            isLive[from] = true;
+            q.push(from);
+        }
+    }
+
+    //keep only live states reachable from start state, renumbered by bfs
+    vector<uint32_t> newIds(stateCount, DEAD_STATE_ID);
+    vector<uint32_t> oldIds(1, DEAD_STATE_ID);
+    uint32_t newStartStateId = DEAD_STATE_ID;
+    if (isLive[startStateId]) {
+        newStartStateId = 1;
+        newIds[startStateId] = 1;
+        oldIds.push_back(startStateId);
+        for (size_t i = 1; i < oldIds.size(); ++i) {
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t to = denseTrans[(size_t)oldIds[i] * 256 + b];
+                if (!isLive[to] || newIds[to] != DEAD_STATE_ID) continue;
+                newIds[to] = oldIds.size();
+                oldIds.push_back(to);
+            }
+        }
+    }
+
+    //bytes with identical columns share one class
+    vector<uint8_t> byteClasses(256, 0);
+    map<vector<uint32_t>, uint8_t> column2ClassMap;
+    vector<vector<uint32_t> > columns;
+    for (uint32_t b = 0; b < 256; ++b) {
+        vector<uint32_t> column;
+        column.reserve(oldIds.size());
+        for (uint32_t oldId : oldIds) {
+            column.push_back(newIds[denseTrans[(size_t)oldId * 256 + b]]);
+        }
+        auto it = column2ClassMap.find(column);
+        if (it == column2ClassMap.end()) {
+            it = column2ClassMap.insert(std::make_pair(column, (uint8_t)columns.size())).first;
+            columns.push_back(column);
+        }
+        byteClasses[b] = it->second;
+    }
+    uint32_t classCount = columns.size();
+    vector<uint32_t> trans((size_t)oldIds.size() * classCount);
+    vector<uint8_t> newFinals(oldIds.size());
+    for (size_t i = 0; i < oldIds.size(); ++i) {
+        for (uint32_t c = 0; c < classCount; ++c) {
+            trans[i * classCount + c] = columns[c][i];
+        }
+        newFinals[i] = (i == DEAD_STATE_ID) ? 0 : finals[oldIds[i]];
+    }
+    TLOG_LOG(DEBUG,"compressed [%u] dense states into [%zu] states with [%u] byte classes.",
+             stateCount, oldIds.size(), classCount);
+    return std::make_shared<ByteDfaAutomaton>(newStartStateId, byteClasses, classCount, std::move(trans), std::move(newFinals));
+}
+
+Utf8ByteDfaBuilder::Utf8ByteDfaBuilder() {
+    //state 0 is dead state
+    m_charStates.push_back(CharState(false));
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t nByte = 0;
+        m_utf8Lengths[b] = Utf8Util::IsUtf8Beginning((uint8_t)b, nByte) ? nByte : 0;
+    }
+}
+
+uint32_t Utf8ByteDfaBuilder::AddState(bool isFinal) {
+    m_charStates.push_back(CharState(isFinal));
+    return m_charStates.size() - 1;
+}
+
+void Utf8ByteDfaBuilder::AddTransition(uint32_t from, const string& utf8Char, uint32_t to) {
+    assert(from < m_charStates.size() && to < m_charStates.size());
+    if (utf8Char.empty() || m_utf8Lengths[(uint8_t)utf8Char[0]] != utf8Char.size()) {
+        TLOG_LOG(WARN,"skip malformed utf8 character:[%s] for transition from state:[%u].", utf8Char.c_str(), from);
+        return;
+    }
+    m_charStates[from].m_trans[utf8Char] = to;
+}
+
+void Utf8ByteDfaBuilder::SetDefaultTransition(uint32_t from, uint32_t to) {
+    assert(from < m_charStates.size() && to < m_charStates.size());
+    m_charStates[from].m_defaultTo = to;
+}
+
+uint32_t Utf8ByteDfaBuilder::newByteState(bool isFinal) {
+    m_denseTrans.resize(m_denseTrans.size() + 256, ByteDfaAutomaton::DEAD_STATE_ID);
+    m_finals.push_back(isFinal);
+    return m_finals.size() - 1;
+}
+
+static inline bool isContinuationByte(uint32_t b) {
+    return (b & 0xC0) == 0x80;
+}
+
+uint32_t Utf8ByteDfaBuilder::getSkipState(uint32_t n, uint32_t target) {
+    if (n == 0 || target == ByteDfaAutomaton::DEAD_STATE_ID) return target;
+    auto it = m_skipStatesMap.find(std::make_pair(n, target));
+    if (it != m_skipStatesMap.end()) return it->second;
+
+    uint32_t next = getSkipState(n - 1, target);
+    uint32_t stateId = newByteState(false);
+    for (uint32_t b = 0x80; b < 0xC0; ++b) {
+        m_denseTrans[(size_t)stateId * 256 + b] = next;
+    }
+    m_skipStatesMap.insert(std::make_pair(std::make_pair(n, target), stateId));
+    return stateId;
+}
+
+void Utf8ByteDfaBuilder::compileCharState(uint32_t stateId) {
+    const CharState& charState = m_charStates[stateId];
+    uint32_t defaultTo = charState.m_defaultTo;
+    //other characters
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t to = m_utf8Lengths[b] == 0 ? ByteDfaAutomaton::DEAD_STATE_ID : getSkipState(m_utf8Lengths[b] - 1, defaultTo);
+        m_denseTrans[(size_t)stateId * 256 + b] = to;
+    }
+    //explicit characters, whose bytes prefixes share intermediate states in a trie
+    map<string, uint32_t> prefix2StateMap;
+    for (auto& kv : charState.m_trans) {
+        const string& utf8Char = kv.first;
+        uint32_t cur = stateId;
+        for (size_t i = 0; i + 1 < utf8Char.size(); ++i) {
+            string prefix = utf8Char.substr(0, i + 1);
+            auto it = prefix2StateMap.find(prefix);
+            if (it == prefix2StateMap.end()) {
+                uint32_t skipTo = getSkipState(utf8Char.size() - i - 2, defaultTo);
+                uint32_t next = newByteState(false);
+                for (uint32_t b = 0x80; b < 0xC0; ++b) {
+                    m_denseTrans[(size_t)next * 256 + b] = skipTo;
+                }
+                m_denseTrans[(size_t)cur * 256 + (uint8_t)utf8Char[i]] = next;
+                it = prefix2StateMap.insert(std::make_pair(prefix, next)).first;
+            }
+            cur = it->second;
+        }
+        assert(utf8Char.size() == 1 || isContinuationByte((uint8_t)utf8Char.back()));
+        m_denseTrans[(size_t)cur * 256 + (uint8_t)utf8Char.back()] = kv.second;
+    }
+}
+
+ByteDfaAutomatonPtr Utf8ByteDfaBuilder::Build(uint32_t startStateId) {
+    assert(startStateId < m_charStates.size());
+    //character states keep their ids as byte states
+    m_denseTrans.assign((size_t)m_charStates.size() * 256, ByteDfaAutomaton::DEAD_STATE_ID);
+    m_finals.clear();
+    for (const CharState& charState : m_charStates) {
+        m_finals.push_back(charState.m_isFinal);
+    }
+    m_finals[ByteDfaAutomaton::DEAD_STATE_ID] = false;
+    m_skipStatesMap.clear();
+    for (uint32_t i = 1; i < m_charStates.size(); ++i) {
+        compileCharState(i);
+    }
+
+    TLOG_LOG(DEBUG,"compiled [%zu] utf8 character states into [%zu] byte states.", m_charStates.size(), m_finals.size());
+    return ByteDfaAutomaton::CompressDenseDfa(m_denseTrans, m_finals, startStateId);
+}
+
+COMMON_END_NAMESPACE
@@ -0,0 +1,140 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       byte_dfa_automaton.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines byte level dfa automaton compiled from utf8 character level
+  *                automaton. Character level automatons such as LevenshteinAutomaton key
+  *                their transitions by whole utf8 character strings, so every step of fst
+  *                iterator has to extract last utf8 character and hash it. Compiled byte dfa
+  *                expands every multiple bytes utf8 character (and the 'other character' edge)
+  *                into byte transitions, so fst iterator follows it one byte at a time by
+  *                array lookups only.
+  *
+  *                Transition table is compressed by byte classes: bytes which always go to
+  *                the same state from every state share one column.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_BYTE_DFA_AUTOMATON__H__
+#define __CPPFST_FST_CORE_BYTE_DFA_AUTOMATON__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <map>
+#include "fst/fst_core/automaton.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+/// state of byte dfa automaton, only holds state id in transition table
+class ByteDfaAutomatonState : public AutomatonState {
+public:
+    ByteDfaAutomatonState(uint32_t stateId)
+    : m_stateId(stateId)
+    {}
+public:
+    uint32_t        m_stateId;
+};
+TYPEDEF_PTR(ByteDfaAutomatonState);
+
+/// byte level dfa automaton, which is immutable after compiled so can be shared among threads
+class ByteDfaAutomaton : public Automaton {
+public:
+    ///state id of dead state, which can never match anymore
+    const static uint32_t DEAD_STATE_ID = 0;
+public:
+    ByteDfaAutomaton(uint32_t startStateId,
+                     const vector<uint8_t>& byteClasses,
+                     uint32_t classCount,
+                     vector<uint32_t> trans,
+                     vector<uint8_t> finals);
+public:
+    AutomatonStatePtr Start() override;
+    bool IsMatch(const AutomatonStatePtr &state) override;
+    bool CanMatch(const AutomatonStatePtr &state) override;
+    AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) override;
+public:
+    uint32_t GetStartStateId() const { return m_startStateId; }
+    uint32_t Next(uint32_t stateId, uint8_t b) const { return m_trans[(size_t)stateId * m_classCount + m_byteClasses[b]]; }
+    bool IsFinal(uint32_t stateId) const { return m_finals[stateId] != 0; }
+    uint32_t GetStateCount() const { return (uint32_t)m_finals.size(); }
+    uint32_t GetClassCount() const { return m_classCount; }
+    ///memory used by this automaton in bytes
+    uint64_t GetMemoryBytes() const;
+    ///new automaton which only accepts keys starting with 'prefix' bytes and accepted by this automaton
+    ByteDfaAutomatonPtr RestrictPrefix(const string& prefix) const;
+    ///new automaton which accepts keys having a prefix accepted by this automaton, that is every final
+    ///state becomes an accepting sink
+    ByteDfaAutomatonPtr ToPrefixSink() const;
+public:
+    /**
+     *@brief     keep states which are reachable from start state and can reach some final state,
+     *           then compress columns of dense transitions into byte classes
+     *@param     denseTrans    ---- 256 next state ids for every state, state 0 must be dead state
+     *@param     finals        ---- whether every state is final
+     *@param     startStateId  ---- start state id
+     *@return    compiled byte dfa automaton
+     */
+    static ByteDfaAutomatonPtr CompressDenseDfa(const vector<uint32_t>& denseTrans,
+                                                const vector<uint8_t>& finals,
+                                                uint32_t startStateId);
+private:
+    uint32_t                                 m_startStateId;
+    uint8_t                                  m_byteClasses[256];
+    uint32_t                                 m_classCount;
+    ///'m_classCount' next state ids for every state
+    vector<uint32_t>                         m_trans;
+    vector<uint8_t>                          m_finals;
+    ///states are created once, so 'Accept' never allocates
+    vector<AutomatonStatePtr>                m_states;
+private:
+    TLOG_DECLARE();
+};
+
+/**
+ *@brief   builder which compiles utf8 character level dfa into byte level dfa. Usage:
+ *         1) add character states by 'AddState', state id 0 is reserved as dead state;
+ *         2) add transitions by 'AddTransition' for every explicit utf8 character, and
+ *            'SetDefaultTransition' for all other utf8 characters;
+ *         3) call 'Build' with start state id.
+ *         Malformed utf8 byte sequences always go to dead state.
+ */
+class Utf8ByteDfaBuilder {
+public:
+    Utf8ByteDfaBuilder();
+public:
+    uint32_t AddState(bool isFinal);
+    void AddTransition(uint32_t from, const string& utf8Char, uint32_t to);
+    void SetDefaultTransition(uint32_t from, uint32_t to);
+    ByteDfaAutomatonPtr Build(uint32_t startStateId);
+private:
+    struct CharState {
+        CharState(bool isFinal) : m_isFinal(isFinal), m_defaultTo(ByteDfaAutomaton::DEAD_STATE_ID) {}
+        bool                         m_isFinal;
+        uint32_t                     m_defaultTo;
+        map<string, uint32_t>        m_trans;
+    };
+private:
+    uint32_t newByteState(bool isFinal);
+    ///state which skips 'n' continuation bytes then reach 'target'
+    uint32_t getSkipState(uint32_t n, uint32_t target);
+    void compileCharState(uint32_t stateId);
+private:
+    vector<CharState>                        m_charStates;
+    ///dense 256 transitions for every byte state
+    vector<uint32_t>                         m_denseTrans;
+    vector<uint8_t>                          m_finals;
+    ///(skipped bytes count, target state) -> state id
+    map<pair<uint32_t,uint32_t>, uint32_t>   m_skipStatesMap;
+    ///utf8 character length in bytes for every leading byte, 0 means not a leading byte
+    uint32_t                                 m_utf8Lengths[256];
+private:
+    TLOG_DECLARE();
+};
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_BYTE_DFA_AUTOMATON__H__
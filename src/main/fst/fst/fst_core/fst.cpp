@@ -10,6 +10,9 @@
 **********************************************************************************/
 #include <cassert>
 #include "fst/fst_core/fst.h"
+#include "fst/fst_core/parametric_levenshtein_automaton.h"
+#include "fst/fst_core/byte_dfa_automaton.h"
+#include "fst/fst_core/bit_parallel_levenshtein_automaton.h"
 #include "common/util/utf8_util.h"
 
 STD_USE_NAMESPACE;
@@ -108,15 +111,44 @@ uint64_t FstBuilder::FreezeNode(FstWriteNodePtr node) {
     if (m_node2AddrOffsetMap.Get(node,addr)) {
         return addr;
     }
-    uint64_t addrOffset = m_outputStream->GetTotalBytesCnt();
+    uint64_t addrOffset = getAddrOffset();
     m_node2AddrOffsetMap.Put(node,addrOffset);
-    node->Dump(m_outputStream,m_hasOutput);
+    node->Dump(&m_checksumStream,m_hasOutput);
+    ++m_nodeCount;
     return addrOffset;
 }
 
 void FstBuilder::Finish() {
     uint64_t rootAddrOffset = FreezeNodes(m_rootNode);
-    m_outputStream->WriteAt(0,(uint8_t*)&rootAddrOffset,8);
+    uint64_t bodyLength = m_checksumStream.GetTotalBytesCnt();
+    const vector<uint32_t>& blockCrcs = m_checksumStream.FinishBlocks();
+    uint32_t blockSize = FstFormat::CHECKSUM_BLOCK_SIZE;
+    uint32_t blockCount = blockCrcs.size();
+
+    //footer: block checksums, then trailer checksummed together with them
+    string footer((const char*)blockCrcs.data(), blockCount * sizeof(uint32_t));
+    footer.append((const char*)&m_nodeCount, 8);
+    footer.append((const char*)&m_keyCount, 8);
+    footer.append((const char*)&bodyLength, 8);
+    footer.append((const char*)&blockSize, 4);
+    footer.append((const char*)&blockCount, 4);
+    uint32_t trailerCrc = Crc32c::Value((const uint8_t*)footer.data(), footer.size());
+    footer.append((const char*)&trailerCrc, 4);
+    footer.append(4, '\0');
+    footer.append(FstFormat::MAGIC, sizeof(FstFormat::MAGIC));
+    m_outputStream->Write((const uint8_t*)footer.data(), footer.size());
+
+    uint8_t header[FstFormat::HEADER_LENGTH] = {0};
+    uint32_t version = FstFormat::VERSION;
+    uint64_t totalLength = FstFormat::HEADER_LENGTH + bodyLength + footer.size();
+    memcpy(header, FstFormat::MAGIC, sizeof(FstFormat::MAGIC));
+    memcpy(header + 8, &version, 4);
+    header[12] = m_hasOutput ? 1 : 0;
+    memcpy(header + 16, &rootAddrOffset, 8);
+    memcpy(header + 24, &totalLength, 8);
+    uint32_t headerCrc = Crc32c::Value(header, 32);
+    memcpy(header + 32, &headerCrc, 4);
+    m_outputStream->WriteAt(0,header,sizeof(header));
     m_outputStream->Flush();
 }
 
@@ -182,6 +214,7 @@ bool FstBuilder::Insert(const uint8_t* key, uint32_t len, uint64_t value) {
             }
             else {
                 pNode->SetIsFinal(true);
+                ++m_keyCount;
             }
             if (m_hasOutput) {
                 pNode->m_finalOutput = value;
@@ -214,6 +247,7 @@ bool FstBuilder::Insert(const uint8_t* key, uint32_t len, uint64_t value) {
             tmpNode = nextNode;
             ++keyPos;
         }
+        ++m_keyCount;
         return true;
     }
 }
@@ -329,12 +363,14 @@ bool FstReaderNode::FindInput(uint8_t input, uint32_t* result) {
                 st = mid + 1;
             }
         }
+        //'st' passed 'ed', which is insertion position
+        *result = st;
         return false;
     }
 }
 
 void FstReader::DotDraw( std::ostream& os) {
-    FstReaderNodePtr rootNode = FstReaderNode::Mount(m_pData,*(uint64_t*)m_pData,m_hasOutput);
+    FstReaderNodePtr rootNode = FstReaderNode::Mount(m_pData,m_rootAddrOffset,m_hasOutput);
     os << "digraph fst {" << endl;
     os << "\t\tlabelloc=\"l\";" << endl;
     os << "\t\tlabeljust=\"l\";" << endl;
@@ -420,20 +456,28 @@ FstReader::Iterator::Iterator(uint8_t* startPtr,
 , m_min(min)
 , m_max(max)
 , m_automaton(aut)
+, m_maxResultCount(0)
+, m_resultCount(0)
+, m_isMemoEnabled(false)
+, m_maxMemoEntryCount(0)
+, m_matchCount(0)
+, m_memoPrunedCount(0)
 {
-    m_hasOutput = *(m_startPtr+8);
+    m_hasOutput = FstFormat::HasOutput(m_startPtr);
     SeekMin();
 }
 
 void FstReader::Iterator::SeekMin() {
     FstReaderNodePtr rootNode = FstReaderNode::Mount(m_startPtr,m_addrOffset,m_hasOutput);
+    //empty input equals empty prefix of max bound
+    bool isOnMaxBound = (m_max.m_type != FstIterBound::FST_ITER_BOUND_TYPE_UNBOUNDED);
     if (m_min.IsEmpty()) {
         if (m_min.IsInclusive()) {
             if (rootNode->m_isFinal) {
                 m_emptyOutput.push_back(rootNode->m_finalOutput);
             }
         }
-        m_iterStack.push(IteratorNode(rootNode, m_automaton->Start(),0,0));
+        m_iterStack.push(IteratorNode(rootNode, m_automaton->Start(),0,0,isOnMaxBound));
         return;
     }
     FstReaderNodePtr lastFstNode = rootNode;
@@ -442,8 +486,15 @@ void FstReader::Iterator::SeekMin() {
     for (uint8_t b : m_min.m_bound) {
         uint32_t idx = 0;
         if (lastFstNode->FindInput(b,&idx)) {
-            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,idx+1,sumOutput));
-
+            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,idx+1,sumOutput,isOnMaxBound));
+
+            //min bound beyond max bound, nothing to iterate
+            if (isOnMaxBound && m_max.ExceededByNextByte(m_sumInputs.size(),b,isOnMaxBound)) {
+                m_iterStack = stack<IteratorNode>();
+                m_emptyOutput.clear();
+                m_sumInputs.clear();
+                return;
+            }
             m_sumInputs.push_back(b);
 
             sumOutput += lastFstNode->m_trans[idx]->m_output;
@@ -452,7 +503,7 @@ void FstReader::Iterator::SeekMin() {
 
         }
         else {
-            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,idx,sumOutput));
+            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,idx,sumOutput,isOnMaxBound));
             return;
         }
     }
@@ -462,13 +513,63 @@ void FstReader::Iterator::SeekMin() {
             m_sumInputs.pop_back();
         }
         else {
-            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,0,sumOutput));
+            m_iterStack.push(IteratorNode(lastFstNode, lastAutState,0,sumOutput,isOnMaxBound));
         }
     }
 }
 
 
+void FstReader::Iterator::SeekTo(const vector<uint8_t>& key) {
+    m_min = FstIterBound(FstIterBound::FST_ITER_BOUND_TYPE_INCLUDED, string(key.begin(), key.end()));
+    m_iterStack = stack<IteratorNode>();
+    m_sumInputs.clear();
+    m_emptyOutput.clear();
+    SeekMin();
+}
+
 FstReader::IteratorResultPtr FstReader::Iterator::Next() {
+    if (m_maxResultCount > 0 && m_resultCount >= m_maxResultCount) {
+        return nullptr;
+    }
+    IteratorResultPtr result = nextResult();
+    if (nullptr != result) {
+        ++m_resultCount;
+    }
+    return result;
+}
+
+bool FstReader::Iterator::EnableDeadStateMemo(uint64_t maxMemoBytes) {
+    uint64_t stateId = 0;
+    if (!m_automaton->GetStateId(m_automaton->Start(),stateId)) {
+        return false;
+    }
+    //key plus node and bucket pointer of hash set
+    const uint64_t entryBytes = sizeof(DeadStateMemoKey) + 3 * sizeof(void*);
+    m_isMemoEnabled = true;
+    m_maxMemoEntryCount = maxMemoBytes / entryBytes;
+    return true;
+}
+
+bool FstReader::Iterator::isDeadStateMemoized(uint64_t addrOffset, const AutomatonStatePtr& autState) {
+    uint64_t stateId = 0;
+    if (!m_automaton->GetStateId(autState,stateId)) {
+        return false;
+    }
+    return m_deadStateMemo.count(DeadStateMemoKey(addrOffset,stateId)) > 0;
+}
+
+void FstReader::Iterator::memoizeDeadState(const IteratorNode& node) {
+    if (!node.m_isMemoizable || node.m_matchCountOnEnter != m_matchCount
+        || m_deadStateMemo.size() >= m_maxMemoEntryCount) {
+        return;
+    }
+    uint64_t stateId = 0;
+    if (m_automaton->GetStateId(node.m_lastAutState,stateId)) {
+        m_deadStateMemo.insert(DeadStateMemoKey(node.m_lastNode->m_addrOffset,stateId));
+    }
+}
+
+FstReader::IteratorResultPtr FstReader::Iterator::nextResult() {
     if (m_emptyOutput.size()) {
         uint64_t emptyOut = m_emptyOutput.back();
         m_emptyOutput.clear();
@@ -480,6 +581,7 @@ FstReader::IteratorResultPtr FstReader::Iterator::Next() {
         if (m_automaton->IsMatch(startAutState)) {
             IteratorResultPtr result = std::make_shared<IteratorResult>();
             result->m_output = emptyOut;
+            result->m_autState = startAutState;
             return result;
         }
     }
@@ -492,6 +594,9 @@ FstReader::IteratorResultPtr FstReader::Iterator::Next() {
             if (curNode.m_lastNode->m_addrOffset != m_addrOffset) {
                 m_sumInputs.pop_back();
             }
+            if (m_isMemoEnabled) {
+                memoizeDeadState(curNode);
+            }
             continue;
         }
 
@@ -506,16 +611,25 @@ FstReader::IteratorResultPtr FstReader::Iterator::Next() {
         uint64_t sumOutput = curNode.m_sumOutput + curTrans->m_output;
         FstReaderNodePtr  subNode = curNode.m_lastNode->GetTransNode(curNode.m_curTransIndex);
         AutomatonStatePtr nextAutState = m_automaton->Accept(curNode.m_lastAutState,m_sumInputs);
-
-        m_iterStack.push(IteratorNode(subNode, nextAutState,0,sumOutput));
-        if (m_max.ExceededBy(m_sumInputs)) {
+        //only inputs still equal to prefix of max bound can exceed it
+        bool isOnMaxBound = false;
+        if (curNode.m_isOnMaxBound && m_max.ExceededByNextByte(m_sumInputs.size() - 1,curTrans->m_input,isOnMaxBound)) {
             m_iterStack = stack<IteratorNode>();
             return nullptr;
         }
+        if (m_isMemoEnabled && isDeadStateMemoized(subNode->m_addrOffset,nextAutState)) {
+            ++m_memoPrunedCount;
+            m_sumInputs.pop_back();
+            continue;
+        }
+
+        m_iterStack.push(IteratorNode(subNode, nextAutState,0,sumOutput,isOnMaxBound,true,m_matchCount));
         if (subNode->m_isFinal && m_automaton->IsMatch(nextAutState)) {
+            ++m_matchCount;
             IteratorResultPtr result = std::make_shared<IteratorResult>();
             result->m_output += (sumOutput + subNode->m_finalOutput);
             result->m_inputs = m_sumInputs;
+            result->m_autState = nextAutState;
             return result;
         }
     }
@@ -523,33 +637,213 @@ FstReader::IteratorResultPtr FstReader::Iterator::Next() {
     return nullptr;
 }
 
+FstReaderPtr FstReader::Create(uint8_t* pData, uint64_t dataLength, FstFormat::VALIDATE_LEVEL_ENUM level, uint32_t threadNum) {
+    if (!FstFormat::Validate(pData, dataLength, level, threadNum)) {
+        return nullptr;
+    }
+    return std::make_shared<FstReader>(pData);
+}
+
 FstReader::Iterator FstReader::GetIterator(const FstIterBound& min,const FstIterBound& max,AutomatonPtr aut /*= std::make_shared<AlwaysAutomaton>()*/) {
-    return FstReader::Iterator(m_pData,*(uint64_t*)m_pData, min,max,aut);
+    return FstReader::Iterator(m_pData,m_rootAddrOffset, min,max,aut);
+}
+
+bool FstReader::Get(const string& key, uint64_t& output) {
+    FstReaderNodePtr node = FstReaderNode::Mount(m_pData,m_rootAddrOffset,m_hasOutput);
+    uint64_t sumOutput = 0;
+    for (char ch : key) {
+        uint32_t idx = 0;
+        if (!node->FindInput((uint8_t)ch,&idx)) {
+            return false;
+        }
+        sumOutput += node->m_trans[idx]->m_output;
+        node = node->GetTransNode(idx);
+    }
+    if (!node->m_isFinal) {
+        return false;
+    }
+    output = sumOutput + node->m_finalOutput;
+    return true;
 }
 
-FstReader::Iterator FstReader::GetFuzzyIterator(string str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein) {
+///use precomputed parametric tables for small edit distance, otherwise build dfa for the query string,
+///then compile it into byte level dfa so that fst iterator follows it by array lookups
+static ByteDfaAutomatonPtr makeFuzzyAutomaton(const string& str, uint32_t editDistance, bool isUseDamerauLevenshtein) {
+    if (ParametricLevenshteinTable::IsSupported(editDistance)) {
+        return ParametricLevenshteinAutomaton(str,editDistance,isUseDamerauLevenshtein).CompileToByteDfa();
+    }
+    return isUseDamerauLevenshtein ?
+    DamerauLevenshteinAutomaton(str,editDistance).CompileToByteDfa()
+    : LevenshteinAutomaton(str,editDistance).CompileToByteDfa();
+}
+
+ByteDfaAutomatonPtr FstReader::getFuzzyByteDfa(const string& str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                               bool isFuzzyPrefix) {
     vector<string> utf8strs;
     Utf8Util::String2utf8(str,utf8strs);
     if (samePrefixLen > utf8strs.size()) {
         samePrefixLen = utf8strs.size();
     }
-    if (samePrefixLen==0) {
-        return isUseDamerauLevenshtein ?
-          GetIterator(FstIterBound(),FstIterBound(),std::make_shared<DamerauLevenshteinAutomaton>(str,editDistance))
-        : GetIterator(FstIterBound(),FstIterBound(),std::make_shared<LevenshteinAutomaton>(str,editDistance));
+    FuzzyAutomatonCacheKey key(str,editDistance,samePrefixLen,isUseDamerauLevenshtein,isFuzzyPrefix);
+    ByteDfaAutomatonPtr levAut = m_fuzzyAutomatonCache ? m_fuzzyAutomatonCache->Get(key) : nullptr;
+    if (nullptr != levAut) {
+        return levAut;
+    }
+    //NOTE THAT compiled without lock, concurrent misses of the same key may compile it more than once
+    levAut = makeFuzzyAutomaton(str,editDistance,isUseDamerauLevenshtein);
+    if (isFuzzyPrefix) {
+        levAut = levAut->ToPrefixSink();
+    }
+    string prefix;
+    for (size_t i = 0; i < samePrefixLen; ++i) {
+        prefix += utf8strs[i];
+    }
+    if (!prefix.empty()) {
+        levAut = levAut->RestrictPrefix(prefix);
+    }
+    if (m_fuzzyAutomatonCache) {
+        m_fuzzyAutomatonCache->Put(key,levAut);
+    }
+    return levAut;
+}
+
+AutomatonPtr FstReader::getFuzzyAutomaton(const string& str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                          bool isFuzzyPrefix) {
+    if (nullptr == m_fuzzyAutomatonCache && ParametricLevenshteinTable::IsSupported(editDistance)) {
+        return std::make_shared<ParametricLevenshteinAutomaton>(str,editDistance,isUseDamerauLevenshtein,samePrefixLen,isFuzzyPrefix);
+    }
+    return getFuzzyByteDfa(str,editDistance,samePrefixLen,isUseDamerauLevenshtein,isFuzzyPrefix);
+}
+
+///only keys starting with first 'samePrefixLen' utf8 characters of 'str' are accepted by 'levAut'
+static AutomatonPtr restrictSamePrefix(AutomatonPtr levAut, const string& str, uint32_t samePrefixLen) {
+    vector<string> utf8strs;
+    Utf8Util::String2utf8(str,utf8strs);
+    string prefix;
+    for (size_t i = 0; i < samePrefixLen && i < utf8strs.size(); ++i) {
+        prefix += utf8strs[i];
+    }
+    if (prefix.empty()) {
+        return levAut;
+    }
+    AutomatonPtr prefixAut = std::make_shared<PrefixAutomaton>(prefix);
+    return Intersect(prefixAut,levAut);
+}
+
+FstReader::Iterator FstReader::GetFuzzyIterator(string str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                                FUZZY_ALGORITHM_ENUM algorithm) {
+    if (algorithm == FUZZY_ALGORITHM_BIT_PARALLEL) {
+        AutomatonPtr levAut = std::make_shared<BitParallelLevenshteinAutomaton>(str,editDistance,isUseDamerauLevenshtein);
+        return GetIterator(FstIterBound(),FstIterBound(),restrictSamePrefix(levAut,str,samePrefixLen));
+    }
+    return GetIterator(FstIterBound(),FstIterBound(),getFuzzyAutomaton(str,editDistance,samePrefixLen,isUseDamerauLevenshtein));
+}
+
+FstReader::Iterator FstReader::GetFuzzyPrefixIterator(string str, uint32_t editDistance, uint32_t samePrefixLen,
+                                                      bool isUseDamerauLevenshtein, uint64_t maxResultCount) {
+    Iterator it = GetIterator(FstIterBound(),FstIterBound(),getFuzzyAutomaton(str,editDistance,samePrefixLen,isUseDamerauLevenshtein,true));
+    it.SetMaxResultCount(maxResultCount);
+    return it;
+}
+
+bool FstReader::GetRegexIterator(const string& pattern, Iterator& it, uint64_t maxCacheBytes) {
+    RegexAutomatonPtr aut = std::make_shared<RegexAutomaton>(pattern,maxCacheBytes);
+    if (!aut->IsValid()) {
+        return false;
+    }
+    it = GetIterator(FstIterBound(),FstIterBound(),aut);
+    return true;
+}
+
+vector<FstReader::MultiFuzzyResultPtr> FstReader::GetMultiFuzzyResults(const vector<string>& queries, uint32_t editDistance,
+                                                                       uint32_t samePrefixLen, bool isUseDamerauLevenshtein) {
+    //same query strings share one member automaton
+    vector<AutomatonPtr> automatons;
+    vector<vector<uint32_t> > member2QueryIndexes;
+    std::unordered_map<string,uint32_t> query2MemberMap;
+    for (uint32_t i = 0; i < queries.size(); ++i) {
+        auto it = query2MemberMap.find(queries[i]);
+        if (it == query2MemberMap.end()) {
+            it = query2MemberMap.insert(std::make_pair(queries[i],(uint32_t)automatons.size())).first;
+            automatons.push_back(getFuzzyAutomaton(queries[i],editDistance,samePrefixLen,isUseDamerauLevenshtein));
+            member2QueryIndexes.push_back(vector<uint32_t>());
+        }
+        member2QueryIndexes[it->second].push_back(i);
+    }
+
+    MultiUnionAutomatonPtr unionAut = std::make_shared<MultiUnionAutomaton>(automatons);
+    Iterator it = GetIterator(FstIterBound(),FstIterBound(),unionAut);
+    vector<MultiFuzzyResultPtr> results;
+    vector<uint32_t> members;
+    while (true) {
+        IteratorResultPtr item = it.Next();
+        if (nullptr == item) break;
+        MultiFuzzyResultPtr result = std::make_shared<MultiFuzzyResult>();
+        result->m_inputs.swap(item->m_inputs);
+        result->m_output = item->m_output;
+        unionAut->GetMatchedMembers(item->m_autState,members);
+        for (uint32_t member : members) {
+            const vector<uint32_t>& queryIndexes = member2QueryIndexes[member];
+            result->m_queryIndexes.insert(result->m_queryIndexes.end(),queryIndexes.begin(),queryIndexes.end());
+        }
+        std::sort(result->m_queryIndexes.begin(),result->m_queryIndexes.end());
+        results.push_back(result);
+    }
+    return results;
+}
+
+///automaton of one top k pass, which must tell edit distance of matched keys, so compiled dfa is never used
+static AutomatonPtr makeTopKPassAutomaton(const string& str, uint32_t editDistance, uint32_t samePrefixLen,
+                                          bool isUseDamerauLevenshtein, FstReader::FUZZY_ALGORITHM_ENUM algorithm) {
+    if (algorithm == FstReader::FUZZY_ALGORITHM_BIT_PARALLEL) {
+        AutomatonPtr levAut = std::make_shared<BitParallelLevenshteinAutomaton>(str,editDistance,isUseDamerauLevenshtein);
+        return restrictSamePrefix(levAut,str,samePrefixLen);
+    }
+    if (ParametricLevenshteinTable::IsSupported(editDistance)) {
+        return std::make_shared<ParametricLevenshteinAutomaton>(str,editDistance,isUseDamerauLevenshtein,samePrefixLen);
+    }
+    AutomatonPtr levAut;
+    if (isUseDamerauLevenshtein) {
+        levAut = std::make_shared<DamerauLevenshteinAutomaton>(str,editDistance);
     }
     else {
-        string prefix;
-        for (size_t i = 0; i < samePrefixLen; ++i) {
-            prefix += utf8strs[i];
+        levAut = std::make_shared<LevenshteinAutomaton>(str,editDistance);
+    }
+    return restrictSamePrefix(levAut,str,samePrefixLen);
+}
+
+vector<FstReader::FuzzyResultPtr> FstReader::GetTopKFuzzyResults(string str, uint32_t maxEditDistance, uint32_t topK,
+                                                                 uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                                                 FUZZY_ALGORITHM_ENUM algorithm) {
+    vector<FuzzyResultPtr> results;
+    for (uint32_t distance = 0; distance <= maxEditDistance && results.size() < topK; ++distance) {
+        size_t passBegin = results.size();
+        AutomatonPtr levAut = makeTopKPassAutomaton(str,distance,samePrefixLen,isUseDamerauLevenshtein,algorithm);
+        Iterator it = GetIterator(FstIterBound(),FstIterBound(),levAut);
+        while (true) {
+            //without outputs results of a pass are ranked in key order, so later keys can not get in
+            if (!m_hasOutput && results.size() >= topK) break;
+            IteratorResultPtr item = it.Next();
+            if (nullptr == item) break;
+            //keys nearer than 'distance' were found by former passes
+            uint32_t keyDistance = 0;
+            bool hasDistance = levAut->GetEditDistance(item->m_autState,keyDistance);
+            assert(hasDistance);
+            (void)hasDistance;
+            if (keyDistance < distance) continue;
+            FuzzyResultPtr result = std::make_shared<FuzzyResult>();
+            result->m_inputs.swap(item->m_inputs);
+            result->m_output = item->m_output;
+            result->m_distance = distance;
+            results.push_back(result);
+        }
+        std::stable_sort(results.begin() + passBegin, results.end(),
+                         [](const FuzzyResultPtr& r1, const FuzzyResultPtr& r2) { return r1->m_output > r2->m_output; });
+        if (results.size() > topK) {
+            results.resize(topK);
         }
-        AutomatonPtr prefixAut = std::make_shared<PrefixAutomaton>(prefix);
-        AutomatonPtr levAut = ( isUseDamerauLevenshtein ?
-        (AutomatonPtr)std::make_shared<DamerauLevenshteinAutomaton>(str,editDistance)
-        : (AutomatonPtr)std::make_shared<LevenshteinAutomaton>(str,editDistance) );
-        AutomatonPtr aut = Intersect(prefixAut,levAut);
-        return GetIterator(FstIterBound(),FstIterBound(),aut);
     }
+    return results;
 }
 
 FstReader::Iterator FstReader::GetMatchIterator(const FstIterBound& min,const FstIterBound& max,string str) {
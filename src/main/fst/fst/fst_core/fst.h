@@ -96,6 +96,7 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <functional>
 #include <fstream>
 #include <stack>
@@ -104,7 +105,10 @@
 #include "common/util/hash_util.h"
 #include "common/util/lru_cache.h"
 #include "common/util/output_stream_util.h"
+#include "fst/fst_core/fst_format.h"
 #include <fst/fst_core/automaton.h>
+#include "fst/fst_core/fuzzy_automaton_cache.h"
+#include "fst/fst_core/regex_automaton.h"
 
 STD_USE_NAMESPACE;
 
@@ -202,26 +206,37 @@ public:
     : m_outputStream(outputStream)
     , m_hasOutput (hasOutput)
     , m_rootNode(std::make_shared<FstWriteNode>(false))
-    , m_node2AddrOffsetMap(std::max((uint64_t)1e8,(uint64_t)(totalNodeHashCashMemSize/20)),
+    //initial buckets follow memory budget, so that building a small fst does not allocate a huge hash table
+    , m_node2AddrOffsetMap(std::min((uint64_t)1e8,std::max((uint64_t)1024,(uint64_t)(totalNodeHashCashMemSize/20))),
                            totalNodeHashCashMemSize)
+    , m_checksumStream(outputStream)
+    , m_nodeCount(0)
+    , m_keyCount(0)
     {
-        //preserve 8 bytes to store rootNodeAddrOffset
-        uint64_t rootNodeAddrOffset = 0;
-        m_outputStream->Write((uint8_t*)&rootNodeAddrOffset,8);
+        //preserve header, which is rewritten with root node address offset when finished
+        uint8_t header[FstFormat::HEADER_LENGTH] = {0};
+        m_outputStream->Write(header,sizeof(header));
 
-        //next 1 byte to store whether is hasOutput
-        m_outputStream->Write((uint8_t*)&m_hasOutput,1);
-
-        uint64_t addrOffset = m_outputStream->GetTotalBytesCnt();
-        s_FinalTerminateNode->Dump(m_outputStream,m_hasOutput);
+        uint64_t addrOffset = getAddrOffset();
+        s_FinalTerminateNode->Dump(&m_checksumStream,m_hasOutput);
         m_node2AddrOffsetMap.Put(s_FinalTerminateNode,addrOffset);
+        ++m_nodeCount;
     }
     ~FstBuilder() {}
 public:
     bool Insert(const uint8_t* key, uint32_t len, uint64_t value);
     uint64_t FreezeNode(FstWriteNodePtr node);
     uint64_t FreezeNodes(FstWriteNodePtr header);
+    ///freeze remaining nodes, write footer of checksums and counts, then header
     void Finish();
+
+    ///nodes dumped so far
+    uint64_t GetNodeCount() const { return m_nodeCount; }
+    ///distinct keys inserted so far
+    uint64_t GetKeyCount() const { return m_keyCount; }
+private:
+    ///address offset of next node dumped, relative to start of header
+    uint64_t getAddrOffset() { return FstFormat::HEADER_LENGTH + m_checksumStream.GetTotalBytesCnt(); }
 public:
     ///static terminated final node,used this global one node for save memory
     static FstWriteNodePtr  s_FinalTerminateNode;
@@ -236,12 +251,16 @@ private:
     ///an hash data structure which stores FstWriteNode mapped its address memory offset dump out to stream
     ///so you can use memory map technology to use the fst future to handle memory limit problem
     FstBuildNodeMapType     m_node2AddrOffsetMap;
+    ///fst body goes through it to be checksummed block by block
+    FstChecksumOutputStream m_checksumStream;
+    uint64_t                m_nodeCount;
+    uint64_t                m_keyCount;
 private:
     TLOG_DECLARE();
 };
 TYPEDEF_PTR(FstBuilder);
 
-size_t FstBuilder::FstWriteNodeHash::operator()(const FstWriteNodePtr& node) const {
+inline size_t FstBuilder::FstWriteNodeHash::operator()(const FstWriteNodePtr& node) const {
     size_t seed = 0;
     HashCombine(seed,node->m_isFinal);
     HashCombine(seed,node->m_finalOutput);
@@ -255,7 +274,7 @@ size_t FstBuilder::FstWriteNodeHash::operator()(const FstWriteNodePtr& node) con
 }
 
 
-bool FstBuilder::FstWriteNodeEqual::operator()(const FstWriteNodePtr& node1, const FstWriteNodePtr& node2) const {
+inline bool FstBuilder::FstWriteNodeEqual::operator()(const FstWriteNodePtr& node1, const FstWriteNodePtr& node2) const {
     if (node1.get() == node2.get()) return true;
     bool bEqual = (
             (node1->m_isFinal == node2->m_isFinal)
@@ -326,6 +345,10 @@ TYPEDEF_PTR(FstReaderNode);
 ///Fst reader class which is charge of read fst data
 class FstReader {
 public:
+    enum FUZZY_ALGORITHM_ENUM {
+        FUZZY_ALGORITHM_DFA = 0,          //dfa compiled from parametric tables or row-based subset construction
+        FUZZY_ALGORITHM_BIT_PARALLEL,     //bit-parallel dp column, for long query or large edit distance
+    };
     class FstIterBound {
     public:
         enum FST_ITER_BOUND_TYPE_ENUM {
@@ -353,7 +376,7 @@ public:
                     break;
 
                 case FST_ITER_BOUND_TYPE_INCLUDED:
-                    for (size_t i = 0 ; i < input.size() && m_bound.size(); ++i) {
+                    for (size_t i = 0 ; i < input.size() && i < m_bound.size(); ++i) {
                         if (input[i] == m_bound[i]) continue;
                         return input[i] > m_bound[i];
                     }
@@ -361,7 +384,7 @@ public:
                     break;
 
                 case FST_ITER_BOUND_TYPE_EXCLUDED:
-                    for (size_t i = 0 ; i < input.size() && m_bound.size(); ++i) {
+                    for (size_t i = 0 ; i < input.size() && i < m_bound.size(); ++i) {
                         if (input[i] == m_bound[i]) continue;
                         return input[i] > m_bound[i];
                     }
@@ -372,6 +395,21 @@ public:
                     break;
             }
         }
+        /**
+         *@brief     incremental version of 'ExceededBy' costs O(1): input is a prefix equal to first 'depth' bytes
+         *           of bound, and byte 'b' is appended to it. input which already differs from bound prefix
+         *           while not exceeding it is less than bound, so all its extensions never exceed bound
+         *@param     isNextOnBound   ---- whether appended input still equals first 'depth'+1 bytes of bound
+         */
+        bool ExceededByNextByte(size_t depth, uint8_t b, bool& isNextOnBound) const {
+            isNextOnBound = false;
+            if (m_type == FST_ITER_BOUND_TYPE_UNBOUNDED) return false;
+            if (depth >= m_bound.size()) return true;
+            if (b != m_bound[depth]) return b > m_bound[depth];
+            isNextOnBound = true;
+            return depth + 1 == m_bound.size() && m_type == FST_ITER_BOUND_TYPE_EXCLUDED;
+        }
+
         bool IsEmpty() {
             if (m_type == FST_ITER_BOUND_TYPE_UNBOUNDED) return true;
             else return m_bound.empty();
@@ -399,6 +437,7 @@ public:
             IteratorResultPtr r = std::make_shared<IteratorResult>();
             r->m_inputs = m_inputs;
             r->m_output = m_output;
+            r->m_autState = m_autState;
             return r;
         }
 
@@ -416,32 +455,102 @@ public:
     public:
         vector<uint8_t>     m_inputs;
         uint64_t            m_output;
+        ///automaton state when matched, which tells details of matching such as matched members of union automaton
+        AutomatonStatePtr   m_autState;
+    };
+
+    ///fuzzy search result together with edit distance between key and query string
+    class FuzzyResult;
+    TYPEDEF_PTR(FuzzyResult);
+    class FuzzyResult : public IteratorResult {
+    public:
+        FuzzyResult()
+        : m_distance(0)
+        {}
+    public:
+        uint32_t            m_distance;
+    };
+
+    ///multiple queries fuzzy search result together with indexes of queries matched
+    class MultiFuzzyResult;
+    TYPEDEF_PTR(MultiFuzzyResult);
+    class MultiFuzzyResult : public IteratorResult {
+    public:
+        vector<uint32_t>    m_queryIndexes;
     };
 
     class IteratorNode {
     public:
-        IteratorNode(const FstReaderNodePtr& lastNode, AutomatonStatePtr lastAutState, uint32_t curTranIndex, uint64_t sumOutput)
+        IteratorNode(const FstReaderNodePtr& lastNode, AutomatonStatePtr lastAutState, uint32_t curTranIndex, uint64_t sumOutput,
+                     bool isOnMaxBound = false, bool isMemoizable = false, uint64_t matchCountOnEnter = 0)
         : m_lastNode(lastNode)
         , m_lastAutState(lastAutState)
         , m_curTransIndex(curTranIndex)
         , m_sumOutput(sumOutput)
+        , m_isOnMaxBound(isOnMaxBound)
+        , m_isMemoizable(isMemoizable)
+        , m_matchCountOnEnter(matchCountOnEnter)
         {}
     public:
         FstReaderNodePtr         m_lastNode;
         AutomatonStatePtr        m_lastAutState;
         uint32_t                 m_curTransIndex;
         uint64_t                 m_sumOutput;
+        ///inputs to this node equal prefix of max bound, otherwise the whole subtree is within max bound
+        bool                     m_isOnMaxBound;
+        ///whole subtree is walked from its first transition, so it can be memoized as fruitless
+        bool                     m_isMemoizable;
+        ///matches count of iterator when node is entered
+        uint64_t                 m_matchCountOnEnter;
+    };
+
+    ///(fst node address, automaton state id) of dead state memo
+    typedef pair<uint64_t, uint64_t> DeadStateMemoKey;
+    struct DeadStateMemoKeyHash {
+        size_t operator()(const DeadStateMemoKey& key) const {
+            uint64_t seed = 0;
+            HashCombine(seed, key.first);
+            HashCombine(seed, key.second);
+            return seed;
+        }
     };
 
     class Iterator {
     public:
-        Iterator() {m_startPtr = nullptr; }
+        Iterator() {
+            m_startPtr = nullptr;
+            m_maxResultCount = 0;
+            m_resultCount = 0;
+            m_isMemoEnabled = false;
+            m_maxMemoEntryCount = 0;
+            m_matchCount = 0;
+            m_memoPrunedCount = 0;
+        }
         Iterator(uint8_t* startPtr, uint64_t addrOffset, const FstIterBound& min,
                  const FstIterBound& max, AutomatonPtr aut = std::make_shared<AlwaysAutomaton>());
         IteratorResultPtr Next();
+        ///stop iterating after 'maxResultCount' results returned, 0 means no limit
+        void SetMaxResultCount(uint64_t maxResultCount) { m_maxResultCount = maxResultCount; }
+        ///reposition iterator so that next result is the first key not less than 'key' within max bound,
+        ///which costs O(key length) however many keys are skipped
+        void SeekTo(const vector<uint8_t>& key);
+        /**
+         *@brief     memoize (fst node, automaton state) pairs whose subtrees turned out to have no match, and skip
+         *           them when reached again through other prefixes, since fst is a dag sharing suffixes.
+         *           Call it before first 'Next'.
+         *@param     maxMemoBytes     ---- memory bound of memo, no more pairs are memoized when reached
+         *@return    false if automaton can not tell state ids, then memo is not enabled
+         */
+        bool EnableDeadStateMemo(uint64_t maxMemoBytes);
+        ///subtrees skipped by dead state memo
+        uint64_t GetMemoPrunedCount() const { return m_memoPrunedCount; }
+        uint64_t GetMemoEntryCount() const { return m_deadStateMemo.size(); }
 
     private:
         void SeekMin();
+        IteratorResultPtr nextResult();
+        bool isDeadStateMemoized(uint64_t addrOffset, const AutomatonStatePtr& autState);
+        void memoizeDeadState(const IteratorNode& node);
     private:
         uint8_t*                 m_startPtr;
         uint64_t                 m_addrOffset;
@@ -452,17 +561,46 @@ public:
         AutomatonPtr             m_automaton;
         vector<uint8_t>          m_sumInputs;
         vector<uint64_t>         m_emptyOutput;
+        uint64_t                 m_maxResultCount;
+        uint64_t                 m_resultCount;
+
+        bool                     m_isMemoEnabled;
+        uint64_t                 m_maxMemoEntryCount;
+        uint64_t                 m_matchCount;
+        uint64_t                 m_memoPrunedCount;
+        unordered_set<DeadStateMemoKey, DeadStateMemoKeyHash>  m_deadStateMemo;
     };
 public:
+    ///read fst data as it is, use 'Create' to validate data of untrusted source
     FstReader(uint8_t* pData)
     : m_pData (pData)
     {
-        m_hasOutput = (bool)*(m_pData+8);
+        m_hasOutput = FstFormat::HasOutput(m_pData);
+        m_rootAddrOffset = FstFormat::GetRootAddrOffset(m_pData);
     }
     ~FstReader() {}
+public:
+    /**
+     *@brief     validate fst data and create reader of it
+     *@param     pData         ---- start of fst data
+     *@param     dataLength    ---- length of fst data, such as size of fst file mapped
+     *@param     level         ---- header level costs the same for any fst size, full level checksums
+     *                            all data by 'threadNum' threads
+     *@return    nullptr if data is truncated or corrupt
+     */
+    static std::shared_ptr<FstReader> Create(uint8_t* pData, uint64_t dataLength,
+                                             FstFormat::VALIDATE_LEVEL_ENUM level = FstFormat::VALIDATE_LEVEL_HEADER,
+                                             uint32_t threadNum = 1);
+public:
+    ///share compiled fuzzy automatons among fuzzy queries, may be shared by many readers
+    void SetFuzzyAutomatonCache(const FuzzyAutomatonCachePtr& cache) { m_fuzzyAutomatonCache = cache; }
+    FuzzyAutomatonCachePtr GetFuzzyAutomatonCache() { return m_fuzzyAutomatonCache; }
 public:
     Iterator GetIterator(const FstIterBound& min,const FstIterBound& max,AutomatonPtr aut = std::make_shared<AlwaysAutomaton>());
 
+    ///accurate lookup of key by one descent without iterator, false if key not in fst
+    bool Get(const string& key, uint64_t& output);
+
     ///accurate text string query
     Iterator GetMatchIterator(const FstIterBound& min,const FstIterBound& max,string str);
 
@@ -473,8 +611,58 @@ public:
     Iterator GetPrefixIterator(const FstIterBound& min,const FstIterBound& max,string prefixstr);
 
     ///fuzzy query implements levenshtein automaton match when 'isUseDamerauLevenshtein' is false
-    /// or Damerau-Levenshtein automaton match when 'isUseDamerauLevenshtein' is true
-    Iterator GetFuzzyIterator(string str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein);
+    /// or Damerau-Levenshtein automaton match when 'isUseDamerauLevenshtein' is true, edit distance up to 3
+    /// uses precomputed parametric tables, larger one builds row-based dfa for the query.
+    /// 'algorithm' FUZZY_ALGORITHM_BIT_PARALLEL builds no dfa but computes dp column bit-parallel for every byte.
+    /// compiled dfa is looked up in and put into fuzzy automaton cache if it is set, without cache the
+    /// parametric automaton is walked as a byte dfa built lazily by the iterator so no compiling is paid
+    Iterator GetFuzzyIterator(string str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                              FUZZY_ALGORITHM_ENUM algorithm = FUZZY_ALGORITHM_DFA);
+
+    /**
+     *@brief     fuzzy prefix query for autocomplete, which matches keys who have a prefix within edit distance
+     *           of 'str'. Once a prefix matched, automaton stays in an accepting sink state for the subtree.
+     *@param     maxResultCount           ---- stop after so many results in key order, 0 means no limit
+     */
+    Iterator GetFuzzyPrefixIterator(string str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                    uint64_t maxResultCount = 0);
+
+    /**
+     *@brief     top k fuzzy query, which searches by increasing edit distance passes from 0 and stops
+     *           once a pass has collected 'topK' results, so nearest candidates are found cheaply. Every
+     *           pass reads edit distance of matched keys from automaton state to skip keys found before,
+     *           so pass automatons are never compiled into dfa nor cached. Without outputs a pass also
+     *           stops as soon as 'topK' results are collected.
+     *@param     str                      ---- query string
+     *@param     maxEditDistance          ---- max edit distance searched
+     *@param     topK                     ---- max results count
+     *@param     samePrefixLen            ---- count of first utf8 characters must be the same as query
+     *@param     isUseDamerauLevenshtein  ---- use Damerau-Levenshtein distance or Levenshtein distance
+     *@param     algorithm                ---- fuzzy automaton algorithm
+     *@return    results ordered by edit distance ascending, then output descending, then key ascending
+     */
+    vector<FuzzyResultPtr> GetTopKFuzzyResults(string str, uint32_t maxEditDistance, uint32_t topK, uint32_t samePrefixLen,
+                                               bool isUseDamerauLevenshtein, FUZZY_ALGORITHM_ENUM algorithm = FUZZY_ALGORITHM_DFA);
+
+    /**
+     *@brief     fuzzy query for many query strings by one fst traversal, subtree is pruned only when
+     *           automatons of all queries can not match. much cheaper than one fuzzy iterator every query
+     *           because top of fst is walked only once.
+     *@return    results in key order, every result tagged with indexes of queries it matched
+     */
+    vector<MultiFuzzyResultPtr> GetMultiFuzzyResults(const vector<string>& queries, uint32_t editDistance,
+                                                     uint32_t samePrefixLen, bool isUseDamerauLevenshtein);
+
+    /**
+     *@brief     regular expression query, pattern must match whole key and is determinized lazily
+     *           while iterating, see regex_automaton.h for supported syntax
+     *@param     pattern                  ---- utf8 regular expression
+     *@param     it                       ---- iterator of matched keys in key order
+     *@param     maxCacheBytes            ---- memory bound of lazy dfa state cache
+     *@return    false if pattern is invalid
+     */
+    bool GetRegexIterator(const string& pattern, Iterator& it,
+                          uint64_t maxCacheBytes = RegexAutomaton::DEFAULT_MAX_CACHE_BYTES);
 
     ///draw fst in dot file format
     void DotDraw( std::ostream& os);
@@ -482,11 +670,20 @@ public:
     ///whether is a map or set
     bool HasOutput() { return m_hasOutput; }
 private:
+    ///fuzzy automaton for query, compiled one from 'getFuzzyByteDfa' if fuzzy automaton cache is set or
+    ///edit distance is larger than parametric tables support, otherwise lazily built parametric automaton
+    AutomatonPtr getFuzzyAutomaton(const string& str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                   bool isFuzzyPrefix = false);
+    ///compiled fuzzy automaton for query, from fuzzy automaton cache if set
+    ByteDfaAutomatonPtr getFuzzyByteDfa(const string& str, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                                        bool isFuzzyPrefix = false);
     ///recursively draw fst node in dot file format
     void DotDrawRecur(FstReaderNodePtr node,uint32_t& idx,vector<pair<uint8_t,string> >& inputs,std::unordered_map<uint64_t,std::pair<uint32_t,bool> >& offset2idxMap, std::ostream& os);
 private:
-    uint8_t*            m_pData;
-    bool                m_hasOutput;
+    uint8_t*                    m_pData;
+    bool                        m_hasOutput;
+    uint64_t                    m_rootAddrOffset;
+    FuzzyAutomatonCachePtr      m_fuzzyAutomatonCache;
 };
 TYPEDEF_PTR(FstReader);
 
@@ -0,0 +1,256 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_container.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements container file packing many named fsts
+**********************************************************************************/
+#include "fst/fst_core/fst_container.h"
+#include "common/util/file_util.h"
+#include <sys/mman.h>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FstContainerWriter);
+TLOG_SETUP(COMMON_NS,FstContainer);
+
+const char FstContainerFormat::MAGIC[8] = {'O','F','S','T','P','A','C','K'};
+const uint32_t FstContainerFormat::VERSION;
+const uint64_t FstContainerFormat::HEADER_LENGTH;
+const uint64_t FstContainerFormat::DATA_ALIGNMENT;
+
+bool FstContainerWriter::EntryOutputStream::Write(const uint8_t* pData, size_t nSize) {
+    if (!m_outputStream->Write(pData, nSize)) {
+        return false;
+    }
+    writenSize_ += nSize;
+    return true;
+}
+
+bool FstContainerWriter::EntryOutputStream::WriteAt(size_t offset, const uint8_t *pData, size_t nSize) {
+    return m_outputStream->WriteAt(m_baseOffset + offset, pData, nSize);
+}
+
+FstContainerWriter::FstContainerWriter()
+: m_offset(0)
+{
+}
+
+FstContainerWriter::~FstContainerWriter() {
+    if (nullptr != m_outputStream) {
+        m_outputStream->Close();
+    }
+}
+
+bool FstContainerWriter::Open(const string& containerFile) {
+    if (FileUtility::IsFileExists(containerFile) && !FileUtility::DeleteLocalFile(containerFile)) {
+        TLOG_LOG(ERROR,"failed to replace existing container file:[%s].", containerFile.c_str());
+        return false;
+    }
+    m_containerFile = containerFile;
+    m_outputStream = std::make_shared<FileOutputStream>();
+    if (!m_outputStream->Open(containerFile)) {
+        TLOG_LOG(ERROR,"failed to open container file:[%s] to write.", containerFile.c_str());
+        m_outputStream.reset();
+        return false;
+    }
+    //header is rewritten with directory offset when finished
+    uint8_t header[FstContainerFormat::HEADER_LENGTH] = {0};
+    if (!m_outputStream->Write(header, sizeof(header))) {
+        return false;
+    }
+    m_offset = sizeof(header);
+    return true;
+}
+
+bool FstContainerWriter::writePadding() {
+    static const uint8_t s_zeros[FstContainerFormat::DATA_ALIGNMENT] = {0};
+    uint64_t padding = (FstContainerFormat::DATA_ALIGNMENT - m_offset % FstContainerFormat::DATA_ALIGNMENT)
+            % FstContainerFormat::DATA_ALIGNMENT;
+    if (padding > 0 && !m_outputStream->Write(s_zeros, padding)) {
+        return false;
+    }
+    m_offset += padding;
+    return true;
+}
+
+bool FstContainerWriter::beginEntry(const string& name) {
+    if (nullptr == m_outputStream || nullptr != m_entryOutputStream) {
+        TLOG_LOG(ERROR,"container is not opened or fst:[%s] is not ended.",
+                 nullptr == m_entryOutputStream ? "" : m_entries.back().m_name.c_str());
+        return false;
+    }
+    for (const Entry& entry : m_entries) {
+        if (entry.m_name == name) {
+            TLOG_LOG(ERROR,"fst name:[%s] is duplicated in container.", name.c_str());
+            return false;
+        }
+    }
+    if (!writePadding()) {
+        return false;
+    }
+    m_entries.push_back(Entry{name, m_offset, 0});
+    return true;
+}
+
+OutputStreamBase* FstContainerWriter::BeginFst(const string& name) {
+    if (!beginEntry(name)) {
+        return nullptr;
+    }
+    m_entryOutputStream = std::make_shared<EntryOutputStream>(m_outputStream.get(), m_offset);
+    return m_entryOutputStream.get();
+}
+
+bool FstContainerWriter::EndFst() {
+    if (nullptr == m_entryOutputStream) {
+        return false;
+    }
+    m_entries.back().m_length = m_entryOutputStream->GetTotalBytesCnt();
+    m_offset += m_entries.back().m_length;
+    m_entryOutputStream.reset();
+    return true;
+}
+
+bool FstContainerWriter::AddFstData(const string& name, const uint8_t* data, uint64_t length) {
+    if (!FstFormat::Validate(data, length, FstFormat::VALIDATE_LEVEL_HEADER)) {
+        TLOG_LOG(ERROR,"invalid fst data of length:[%lu] for name:[%s].", length, name.c_str());
+        return false;
+    }
+    if (!beginEntry(name)) {
+        return false;
+    }
+    if (!m_outputStream->Write(data, length)) {
+        return false;
+    }
+    m_entries.back().m_length = length;
+    m_offset += length;
+    return true;
+}
+
+bool FstContainerWriter::AddFstFile(const string& name, const string& fstFile) {
+    MMapDataPiece mMapDataPiece;
+    if (!mMapDataPiece.OpenRead(fstFile.c_str(), true)) {
+        TLOG_LOG(ERROR,"failed to open fst file:[%s] for name:[%s].", fstFile.c_str(), name.c_str());
+        return false;
+    }
+    return AddFstData(name, mMapDataPiece.GetData(), mMapDataPiece.GetDataLength());
+}
+
+bool FstContainerWriter::Finish() {
+    if (nullptr == m_outputStream || nullptr != m_entryOutputStream) {
+        return false;
+    }
+    uint64_t directoryOffset = m_offset;
+    string directory;
+    for (const Entry& entry : m_entries) {
+        uint32_t nameLen = entry.m_name.size();
+        directory.append((const char*)&nameLen, sizeof(nameLen));
+        directory.append(entry.m_name);
+        directory.append((const char*)&entry.m_offset, sizeof(entry.m_offset));
+        directory.append((const char*)&entry.m_length, sizeof(entry.m_length));
+    }
+    uint8_t header[FstContainerFormat::HEADER_LENGTH];
+    uint32_t version = FstContainerFormat::VERSION;
+    uint32_t fstCount = m_entries.size();
+    memcpy(header, FstContainerFormat::MAGIC, 8);
+    memcpy(header + 8, &version, 4);
+    memcpy(header + 12, &fstCount, 4);
+    memcpy(header + 16, &directoryOffset, 8);
+    bool isOk = m_outputStream->Write((const uint8_t*)directory.data(), directory.size())
+                && m_outputStream->WriteAt(0, header, sizeof(header));
+    m_outputStream->Flush();
+    m_outputStream->Close();
+    m_outputStream.reset();
+    if (!isOk) {
+        TLOG_LOG(ERROR,"failed to write directory of container file:[%s].", m_containerFile.c_str());
+        return false;
+    }
+    TLOG_LOG(INFO,"finished container file:[%s] of [%u] fsts and [%lu] bytes.", m_containerFile.c_str(),
+             fstCount, directoryOffset + directory.size());
+    return true;
+}
+
+bool FstContainer::Open(const string& containerFile, bool isWarmUp) {
+    if (!m_mmapDataPiece.OpenRead(containerFile.c_str(), true)) {
+        TLOG_LOG(ERROR,"failed to memory map container file:[%s].", containerFile.c_str());
+        return false;
+    }
+    uint8_t* data = m_mmapDataPiece.GetData();
+    uint64_t dataLength = m_mmapDataPiece.GetDataLength();
+    if (dataLength < FstContainerFormat::HEADER_LENGTH || 0 != memcmp(data, FstContainerFormat::MAGIC, 8)) {
+        TLOG_LOG(ERROR,"file:[%s] is not a fst container.", containerFile.c_str());
+        return false;
+    }
+    uint32_t version = *(uint32_t*)(data + 8);
+    uint32_t fstCount = *(uint32_t*)(data + 12);
+    uint64_t directoryOffset = *(uint64_t*)(data + 16);
+    if (version != FstContainerFormat::VERSION || directoryOffset > dataLength) {
+        TLOG_LOG(ERROR,"unsupported version:[%u] or truncated container file:[%s].", version, containerFile.c_str());
+        return false;
+    }
+    if (isWarmUp) {
+        WarmUp();
+    }
+    uint64_t pos = directoryOffset;
+    for (uint32_t i = 0; i < fstCount; ++i) {
+        uint32_t nameLen = 0;
+        if (pos + sizeof(nameLen) > dataLength) break;
+        nameLen = *(uint32_t*)(data + pos);
+        pos += sizeof(nameLen);
+        if (pos + nameLen + 16 > dataLength) break;
+        string name((const char*)data + pos, nameLen);
+        pos += nameLen;
+        Entry entry;
+        entry.m_offset = *(uint64_t*)(data + pos);
+        entry.m_length = *(uint64_t*)(data + pos + 8);
+        pos += 16;
+        if (entry.m_offset + entry.m_length > directoryOffset) {
+            break;
+        }
+        entry.m_reader = FstReader::Create(data + entry.m_offset, entry.m_length);
+        if (nullptr == entry.m_reader) {
+            TLOG_LOG(ERROR,"fst:[%s] in container file:[%s] is corrupt.", name.c_str(), containerFile.c_str());
+            break;
+        }
+        m_entries[name] = entry;
+        m_names.push_back(name);
+    }
+    if (m_names.size() != fstCount) {
+        TLOG_LOG(ERROR,"corrupt directory of container file:[%s], [%zu] of [%u] fsts valid.",
+                 containerFile.c_str(), m_names.size(), fstCount);
+        m_entries.clear();
+        m_names.clear();
+        return false;
+    }
+    return true;
+}
+
+FstReader* FstContainer::GetReader(const string& name) {
+    unordered_map<string,Entry>::iterator it = m_entries.find(name);
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    return it->second.m_reader.get();
+}
+
+bool FstContainer::GetFstData(const string& name, uint8_t*& data, uint64_t& length) {
+    unordered_map<string,Entry>::iterator it = m_entries.find(name);
+    if (it == m_entries.end()) {
+        return false;
+    }
+    data = m_mmapDataPiece.GetData() + it->second.m_offset;
+    length = it->second.m_length;
+    return true;
+}
+
+void FstContainer::WarmUp() {
+    if (0 != madvise(m_mmapDataPiece.GetData(), m_mmapDataPiece.GetDataLength(), MADV_WILLNEED)) {
+        TLOG_LOG(WARN,"madvise to read ahead container failed, errno:[%d].", errno);
+    }
+}
+
+COMMON_END_NAMESPACE
@@ -0,0 +1,140 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_container.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines container file packing many named fsts, such as one dictionary
+  *                per field of an index, so they are opened by one mmap and one file descriptor
+  *                and warmed up by one readahead. Layout of container file:
+  *                  header:    magic(8 bytes) | version(4) | fst count(4) | directory offset(8)
+  *                  fsts:      fst data one after another, each starts at 8 bytes aligned offset
+  *                  directory: for every fst, name length(4) | name | offset(8) | length(8)
+  *                Offsets inside fst data are relative to its start, so FstReader reads it in
+  *                place without copying.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_FST_CONTAINER__H__
+#define __CPPFST_FST_CORE_FST_CONTAINER__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "common/util/output_stream_util.h"
+#include "fst/fst_core/fst.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+class FstContainerFormat {
+public:
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const uint64_t HEADER_LENGTH = 24;
+    ///alignment of every fst data start
+    static const uint64_t DATA_ALIGNMENT = 8;
+};
+
+///writes fsts into a container file, either copied from fst files or built in place
+class FstContainerWriter {
+private:
+    ///output stream of one fst inside container, offsets are relative to start of the fst
+    class EntryOutputStream : public OutputStreamBase {
+    public:
+        EntryOutputStream(FileOutputStream* outputStream, uint64_t baseOffset)
+        : m_outputStream(outputStream)
+        , m_baseOffset(baseOffset)
+        {}
+    public:
+        virtual bool Write(const uint8_t* pData, size_t nSize);
+        virtual bool WriteAt(size_t offset, const uint8_t *pData, size_t nSize);
+        ///container file is synced once when finished
+        virtual void Flush() {}
+    private:
+        FileOutputStream*       m_outputStream;
+        uint64_t                m_baseOffset;
+    };
+    TYPEDEF_PTR(EntryOutputStream);
+
+    struct Entry {
+        string      m_name;
+        uint64_t    m_offset;
+        uint64_t    m_length;
+    };
+public:
+    FstContainerWriter();
+    ~FstContainerWriter();
+private:
+    FstContainerWriter(const FstContainerWriter& rhs);
+    FstContainerWriter& operator=(const FstContainerWriter& rhs);
+public:
+    ///create container file, existing one is replaced
+    bool Open(const string& containerFile);
+    /**
+     *@brief     begin fst named 'name', build it by FstBuilder on the stream returned and call 'EndFst'
+     *           after builder finished
+     *@return    nullptr if name is duplicated or another fst is not ended
+     */
+    OutputStreamBase* BeginFst(const string& name);
+    bool EndFst();
+    ///copy fst data
+    bool AddFstData(const string& name, const uint8_t* data, uint64_t length);
+    ///copy fst data file
+    bool AddFstFile(const string& name, const string& fstFile);
+    ///write directory and header, then close file
+    bool Finish();
+private:
+    bool beginEntry(const string& name);
+    bool writePadding();
+private:
+    string                              m_containerFile;
+    FileOutputStreamPtr                 m_outputStream;
+    ///end of data written, does not count header rewritten
+    uint64_t                            m_offset;
+    vector<Entry>                       m_entries;
+    EntryOutputStreamPtr                m_entryOutputStream;
+private:
+    TLOG_DECLARE();
+};
+
+///container file opened by one mmap, which hands out readers of fsts by name
+class FstContainer {
+public:
+    FstContainer() {}
+private:
+    FstContainer(const FstContainer& rhs);
+    FstContainer& operator=(const FstContainer& rhs);
+public:
+    /**
+     *@brief     map container file and read its directory
+     *@param     isWarmUp      ---- advise kernel to read ahead whole file at once
+     *@return    false if file can not be mapped or is not a valid container
+     */
+    bool Open(const string& containerFile, bool isWarmUp = false);
+    ///reader of fst named 'name', nullptr if not exist. it is valid as long as container
+    FstReader* GetReader(const string& name);
+    ///names of fsts in the order they were added
+    const vector<string>& GetNames() const { return m_names; }
+    ///data range of fst named 'name' in mapping
+    bool GetFstData(const string& name, uint8_t*& data, uint64_t& length);
+    ///advise kernel to read ahead whole container
+    void WarmUp();
+private:
+    struct Entry {
+        uint64_t        m_offset;
+        uint64_t        m_length;
+        FstReaderPtr    m_reader;
+    };
+private:
+    MMapDataPiece                       m_mmapDataPiece;
+    unordered_map<string,Entry>         m_entries;
+    vector<string>                      m_names;
+private:
+    TLOG_DECLARE();
+};
+TYPEDEF_PTR(FstContainer);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_FST_CONTAINER__H__
@@ -0,0 +1,198 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_format.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements on-disk format of fst data
+**********************************************************************************/
+#include "fst/fst_core/fst_format.h"
+#include "common/util/hash_util.h"
+#include <cstring>
+#include <thread>
+#include <atomic>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FstFormat);
+
+const char FstFormat::MAGIC[8] = {'O','R','C','H','D','F','S','T'};
+const uint32_t FstFormat::VERSION;
+const uint64_t FstFormat::HEADER_LENGTH;
+const uint64_t FstFormat::TRAILER_LENGTH;
+const uint32_t FstFormat::CHECKSUM_BLOCK_SIZE;
+const uint64_t FstFormat::LEGACY_HEADER_LENGTH;
+
+///checksummed part of header and trailer
+static const uint64_t HEADER_CRC_OFFSET = 32;
+static const uint64_t TRAILER_CRC_OFFSET = 32;
+
+bool FstFormat::IsLegacy(const uint8_t* data) {
+    return 0 != memcmp(data, MAGIC, sizeof(MAGIC));
+}
+
+bool FstFormat::HasOutput(const uint8_t* data) {
+    return IsLegacy(data) ? (bool)data[8] : (bool)data[12];
+}
+
+uint64_t FstFormat::GetRootAddrOffset(const uint8_t* data) {
+    return IsLegacy(data) ? *(const uint64_t*)data : *(const uint64_t*)(data + 16);
+}
+
+bool FstFormat::validateLegacy(const uint8_t* data, uint64_t length, FstInfo* info) {
+    uint64_t rootAddrOffset = *(const uint64_t*)data;
+    if (data[8] > 1 || rootAddrOffset < LEGACY_HEADER_LENGTH || rootAddrOffset >= length) {
+        TLOG_LOG(ERROR,"invalid fst data of length:[%lu], neither magic nor old header found.", length);
+        return false;
+    }
+    TLOG_LOG(WARN,"fst data of old format has no checksum, rebuild it to validate.");
+    if (nullptr != info) {
+        info->m_isLegacy = true;
+        info->m_hasOutput = (bool)data[8];
+        info->m_rootAddrOffset = rootAddrOffset;
+        info->m_bodyLength = length - LEGACY_HEADER_LENGTH;
+    }
+    return true;
+}
+
+bool FstFormat::Validate(const uint8_t* data, uint64_t length, VALIDATE_LEVEL_ENUM level,
+                         uint32_t threadNum, FstInfo* info) {
+    if (nullptr == data || length < LEGACY_HEADER_LENGTH) {
+        TLOG_LOG(ERROR,"invalid fst data of length:[%lu].", length);
+        return false;
+    }
+    if (VALIDATE_LEVEL_NONE == level) {
+        return true;
+    }
+    if (IsLegacy(data)) {
+        return validateLegacy(data, length, info);
+    }
+    if (length < HEADER_LENGTH + TRAILER_LENGTH) {
+        TLOG_LOG(ERROR,"truncated fst data of length:[%lu].", length);
+        return false;
+    }
+    if (*(const uint32_t*)(data + HEADER_CRC_OFFSET) != Crc32c::Value(data, HEADER_CRC_OFFSET)) {
+        TLOG_LOG(ERROR,"checksum of fst header mismatches.");
+        return false;
+    }
+    uint32_t version = *(const uint32_t*)(data + 8);
+    uint64_t totalLength = *(const uint64_t*)(data + 24);
+    if (version != VERSION) {
+        TLOG_LOG(ERROR,"unsupported fst format version:[%u].", version);
+        return false;
+    }
+    if (totalLength != length) {
+        TLOG_LOG(ERROR,"fst data of length:[%lu] is truncated or padded, [%lu] bytes written.", length, totalLength);
+        return false;
+    }
+    const uint8_t* trailer = data + length - TRAILER_LENGTH;
+    if (0 != memcmp(trailer + 40, MAGIC, sizeof(MAGIC))) {
+        TLOG_LOG(ERROR,"magic of fst trailer mismatches.");
+        return false;
+    }
+    uint64_t bodyLength = *(const uint64_t*)(trailer + 16);
+    uint32_t blockSize = *(const uint32_t*)(trailer + 24);
+    uint32_t blockCount = *(const uint32_t*)(trailer + 28);
+    if (0 == blockSize || blockCount != (bodyLength + blockSize - 1) / blockSize
+        || HEADER_LENGTH + bodyLength + blockCount * sizeof(uint32_t) + TRAILER_LENGTH != length) {
+        TLOG_LOG(ERROR,"invalid body length:[%lu] or block count:[%u] of fst.", bodyLength, blockCount);
+        return false;
+    }
+    const uint8_t* blockCrcs = trailer - blockCount * sizeof(uint32_t);
+    if (*(const uint32_t*)(trailer + TRAILER_CRC_OFFSET)
+        != Crc32c::Value(blockCrcs, blockCount * sizeof(uint32_t) + TRAILER_CRC_OFFSET)) {
+        TLOG_LOG(ERROR,"checksum of fst trailer mismatches.");
+        return false;
+    }
+    uint64_t rootAddrOffset = GetRootAddrOffset(data);
+    if (data[12] > 1 || rootAddrOffset < HEADER_LENGTH || rootAddrOffset >= HEADER_LENGTH + bodyLength) {
+        TLOG_LOG(ERROR,"invalid root address offset:[%lu] of fst.", rootAddrOffset);
+        return false;
+    }
+    if (nullptr != info) {
+        info->m_isLegacy = false;
+        info->m_version = version;
+        info->m_hasOutput = (bool)data[12];
+        info->m_rootAddrOffset = rootAddrOffset;
+        info->m_nodeCount = *(const uint64_t*)trailer;
+        info->m_keyCount = *(const uint64_t*)(trailer + 8);
+        info->m_bodyLength = bodyLength;
+        info->m_blockCount = blockCount;
+    }
+    if (VALIDATE_LEVEL_FULL != level) {
+        return true;
+    }
+
+    threadNum = std::max(1u, std::min(threadNum, blockCount));
+    if (threadNum <= 1) {
+        return ValidateBlocks(data, 0, blockCount);
+    }
+    std::atomic<bool> isOk(true);
+    vector<std::thread> threads;
+    uint32_t blocksPerThread = (blockCount + threadNum - 1) / threadNum;
+    for (uint32_t begin = 0; begin < blockCount; begin += blocksPerThread) {
+        uint32_t end = std::min(blockCount, begin + blocksPerThread);
+        threads.emplace_back([data, begin, end, &isOk]() {
+            if (!ValidateBlocks(data, begin, end)) {
+                isOk = false;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return isOk;
+}
+
+bool FstFormat::ValidateBlocks(const uint8_t* data, uint32_t beginBlock, uint32_t endBlock) {
+    uint64_t totalLength = *(const uint64_t*)(data + 24);
+    const uint8_t* trailer = data + totalLength - TRAILER_LENGTH;
+    uint64_t bodyLength = *(const uint64_t*)(trailer + 16);
+    uint32_t blockSize = *(const uint32_t*)(trailer + 24);
+    uint32_t blockCount = *(const uint32_t*)(trailer + 28);
+    const uint32_t* blockCrcs = (const uint32_t*)(trailer - blockCount * sizeof(uint32_t));
+    endBlock = std::min(endBlock, blockCount);
+    for (uint32_t i = beginBlock; i < endBlock; ++i) {
+        uint64_t blockOffset = (uint64_t)i * blockSize;
+        uint64_t blockLength = std::min((uint64_t)blockSize, bodyLength - blockOffset);
+        if (blockCrcs[i] != Crc32c::Value(data + HEADER_LENGTH + blockOffset, blockLength)) {
+            TLOG_LOG(ERROR,"checksum of fst body block:[%u] mismatches.", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FstChecksumOutputStream::Write(const uint8_t* pData, size_t nSize) {
+    if (!m_outputStream->Write(pData, nSize)) {
+        return false;
+    }
+    writenSize_ += nSize;
+    while (nSize > 0) {
+        size_t len = std::min(nSize, (size_t)(FstFormat::CHECKSUM_BLOCK_SIZE - m_blockFilled));
+        m_blockCrc = Crc32c::Extend(m_blockCrc, pData, len);
+        m_blockFilled += len;
+        pData += len;
+        nSize -= len;
+        if (m_blockFilled == FstFormat::CHECKSUM_BLOCK_SIZE) {
+            m_blockCrcs.push_back(m_blockCrc);
+            m_blockCrc = 0;
+            m_blockFilled = 0;
+        }
+    }
+    return true;
+}
+
+const vector<uint32_t>& FstChecksumOutputStream::FinishBlocks() {
+    if (m_blockFilled > 0) {
+        m_blockCrcs.push_back(m_blockCrc);
+        m_blockCrc = 0;
+        m_blockFilled = 0;
+    }
+    return m_blockCrcs;
+}
+
+COMMON_END_NAMESPACE
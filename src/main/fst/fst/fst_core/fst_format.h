@@ -0,0 +1,124 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_format.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines on-disk format of fst data, which is self describing and checksummed:
+  *                  header:  magic(8 bytes) | version(4) | has output(1) | reserved(3) |
+  *                           root address offset(8) | total length(8) | header crc(4) | reserved(4)
+  *                  body:    fst nodes, address offsets of nodes are relative to start of header
+  *                  footer:  crc of every body block(4 bytes each) | node count(8) | key count(8) |
+  *                           body length(8) | block size(4) | block count(4) | trailer crc(4) |
+  *                           reserved(4) | magic(8)
+  *                All checksums are crc32c. Header and footer are validated in constant time when
+  *                fst is opened, while body is checksummed by fixed size blocks, so that it can be
+  *                validated in parallel or block by block later. Old fst data of 8 bytes root address
+  *                offset and 1 byte has output flag is still readable, but can not be validated.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_FST_FORMAT__H__
+#define __CPPFST_FST_CORE_FST_FORMAT__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include "common/util/output_stream_util.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+class FstFormat {
+public:
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const uint64_t HEADER_LENGTH = 40;
+    ///fixed part of footer after block crcs
+    static const uint64_t TRAILER_LENGTH = 48;
+    static const uint32_t CHECKSUM_BLOCK_SIZE = 4 * 1024 * 1024;
+    ///root address offset and has output flag of old format
+    static const uint64_t LEGACY_HEADER_LENGTH = 9;
+
+    enum VALIDATE_LEVEL_ENUM {
+        VALIDATE_LEVEL_NONE,
+        ///header and footer only, whose cost does not grow with fst size
+        VALIDATE_LEVEL_HEADER,
+        ///header, footer and checksums of all body blocks
+        VALIDATE_LEVEL_FULL
+    };
+
+    ///summary of fst data read from header and footer
+    struct FstInfo {
+        FstInfo()
+        : m_isLegacy(false)
+        , m_version(0)
+        , m_hasOutput(false)
+        , m_rootAddrOffset(0)
+        , m_nodeCount(0)
+        , m_keyCount(0)
+        , m_bodyLength(0)
+        , m_blockCount(0)
+        {}
+        bool        m_isLegacy;
+        uint32_t    m_version;
+        bool        m_hasOutput;
+        uint64_t    m_rootAddrOffset;
+        ///node and key count are 0 for old format
+        uint64_t    m_nodeCount;
+        uint64_t    m_keyCount;
+        uint64_t    m_bodyLength;
+        uint32_t    m_blockCount;
+    };
+public:
+    ///whether data is of old format without header, data must have at least 9 bytes
+    static bool IsLegacy(const uint8_t* data);
+    static bool HasOutput(const uint8_t* data);
+    static uint64_t GetRootAddrOffset(const uint8_t* data);
+
+    /**
+     *@brief     validate fst data before reading it
+     *@param     data          ---- start of fst data
+     *@param     length        ---- length of fst data, which must be exactly the length written
+     *@param     level         ---- what to validate
+     *@param     threadNum     ---- threads checksumming body blocks at full level
+     *@param     info          ---- summary of fst data if not nullptr
+     *@return    false if data is truncated, corrupt or of unknown version
+     */
+    static bool Validate(const uint8_t* data, uint64_t length, VALIDATE_LEVEL_ENUM level,
+                         uint32_t threadNum = 1, FstInfo* info = nullptr);
+    /**
+     *@brief     checksum body blocks [beginBlock, endBlock) of fst data validated at header level,
+     *           so that a large fst can be validated incrementally after it is opened
+     *@return    false if any block mismatches its checksum
+     */
+    static bool ValidateBlocks(const uint8_t* data, uint32_t beginBlock, uint32_t endBlock);
+private:
+    static bool validateLegacy(const uint8_t* data, uint64_t length, FstInfo* info);
+private:
+    TLOG_DECLARE();
+};
+
+///output stream forwarding fst body to another stream while checksumming it block by block
+class FstChecksumOutputStream : public OutputStreamBase {
+public:
+    FstChecksumOutputStream(OutputStreamBase* outputStream)
+    : m_outputStream(outputStream)
+    , m_blockCrc(0)
+    , m_blockFilled(0)
+    {}
+public:
+    virtual bool Write(const uint8_t* pData, size_t nSize);
+    ///body is never rewritten
+    virtual bool WriteAt(size_t offset, const uint8_t *pData, size_t nSize) { return false; }
+    virtual void Flush() { m_outputStream->Flush(); }
+    ///checksums of all blocks including the last partial one, called once after body written
+    const vector<uint32_t>& FinishBlocks();
+private:
+    OutputStreamBase*       m_outputStream;
+    vector<uint32_t>        m_blockCrcs;
+    uint32_t                m_blockCrc;
+    uint32_t                m_blockFilled;
+};
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_FST_FORMAT__H__
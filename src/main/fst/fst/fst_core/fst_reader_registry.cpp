@@ -0,0 +1,92 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_reader_registry.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements registry of the newest fst mapping
+**********************************************************************************/
+#include "fst/fst_core/fst_reader_registry.h"
+#include <thread>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FstReaderRegistry);
+
+FstReaderRegistry::FstReaderRegistry()
+: m_current(nullptr)
+, m_epoch(0)
+, m_version(0)
+, m_liveCount(std::make_shared<std::atomic<uint64_t> >(0))
+{
+    m_readerCounts[0] = 0;
+    m_readerCounts[1] = 0;
+}
+
+FstReaderRegistry::~FstReaderRegistry() {
+    //handles still alive keep their mapping
+    FstMapping* current = m_current.exchange(nullptr);
+    if (nullptr != current) {
+        current->Unref();
+    }
+}
+
+bool FstReaderRegistry::Load(const string& fstFile) {
+    FstSegmentPtr segment = FstSegment::Load(fstFile);
+    if (nullptr == segment) {
+        return false;
+    }
+    if (!Swap(segment)) {
+        return false;
+    }
+    TLOG_LOG(INFO,"published fst file:[%s] of [%lu] bytes as version:[%lu].", fstFile.c_str(),
+             segment->GetDataLength(), GetVersion());
+    return true;
+}
+
+bool FstReaderRegistry::Swap(const FstSegmentPtr& segment) {
+    if (nullptr == segment) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_swapMutex);
+    FstMapping* old = m_current.exchange(new FstMapping(segment, ++m_version, m_liveCount));
+    if (nullptr == old) {
+        return true;
+    }
+    //a reader may have loaded old pointer but not referenced it yet. it is counted in one epoch,
+    //flipping twice waits for both, while readers coming later only see the new pointer
+    for (uint32_t i = 0; i < 2; ++i) {
+        uint32_t parity = m_epoch.load();
+        m_epoch.store(parity ^ 1);
+        waitReaders(parity);
+    }
+    old->Unref();
+    return true;
+}
+
+void FstReaderRegistry::waitReaders(uint32_t parity) {
+    while (m_readerCounts[parity].load() > 0) {
+        std::this_thread::yield();
+    }
+}
+
+FstReaderRegistry::Handle FstReaderRegistry::Acquire() {
+    uint32_t parity = m_epoch.load();
+    m_readerCounts[parity].fetch_add(1);
+    FstMapping* current = m_current.load();
+    if (nullptr != current) {
+        current->Ref();
+    }
+    m_readerCounts[parity].fetch_sub(1);
+    return Handle(current);
+}
+
+uint64_t FstReaderRegistry::GetVersion() {
+    std::lock_guard<std::mutex> lock(m_swapMutex);
+    return m_version;
+}
+
+COMMON_END_NAMESPACE
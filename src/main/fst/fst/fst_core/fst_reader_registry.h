@@ -0,0 +1,122 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_reader_registry.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines registry of the newest fst mapping, so that dictionary file can be
+  *                replaced under live readers without restarting process. Readers acquire a
+  *                reference counted handle of the current mapping without any lock: a reader only
+  *                counts itself in one of two epoch counters while it loads current mapping and
+  *                references it. Swapping publishes the new mapping, then waits until readers of both
+  *                epochs which may have seen the old pointer are gone, like userspace rcu, and drops
+  *                reference of registry. Old mapping is unmapped when its last handle is released,
+  *                so in-flight iterators always finish on the data they started with.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_FST_READER_REGISTRY__H__
+#define __CPPFST_FST_CORE_FST_READER_REGISTRY__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <string>
+#include <atomic>
+#include <mutex>
+#include "fst/fst_core/fst.h"
+#include "fst/fst_core/updatable_fst.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+class FstReaderRegistry {
+private:
+    ///fst segment published by registry together with its reference count
+    class FstMapping {
+    public:
+        FstMapping(const FstSegmentPtr& segment, uint64_t version, const std::shared_ptr<std::atomic<uint64_t> >& liveCount)
+        : m_segment(segment)
+        , m_version(version)
+        , m_refCount(1)
+        , m_liveCount(liveCount)
+        {
+            ++(*m_liveCount);
+        }
+        ~FstMapping() { --(*m_liveCount); }
+    public:
+        void Ref() { m_refCount.fetch_add(1); }
+        void Unref() {
+            if (1 == m_refCount.fetch_sub(1)) {
+                delete this;
+            }
+        }
+    public:
+        FstSegmentPtr                               m_segment;
+        uint64_t                                    m_version;
+        std::atomic<uint64_t>                       m_refCount;
+        ///live mappings of registry, which may be destructed before the mapping
+        std::shared_ptr<std::atomic<uint64_t> >     m_liveCount;
+    };
+public:
+    ///reference of one mapping, fst data stays mapped while any handle of it exists.
+    ///iterators got from the reader must not outlive the handle.
+    class Handle {
+    public:
+        Handle() : m_mapping(nullptr) {}
+        Handle(const Handle& rhs) : m_mapping(rhs.m_mapping) { if (m_mapping) m_mapping->Ref(); }
+        Handle& operator=(const Handle& rhs) {
+            if (rhs.m_mapping) rhs.m_mapping->Ref();
+            if (m_mapping) m_mapping->Unref();
+            m_mapping = rhs.m_mapping;
+            return *this;
+        }
+        ~Handle() { if (m_mapping) m_mapping->Unref(); }
+    public:
+        bool IsValid() const { return nullptr != m_mapping; }
+        FstReader* GetReader() const { return m_mapping ? m_mapping->m_segment->GetReader() : nullptr; }
+        FstReader* operator->() const { return GetReader(); }
+        FstSegmentPtr GetSegment() const { return m_mapping ? m_mapping->m_segment : nullptr; }
+        ///version of mapping, which increases by every swap from 1
+        uint64_t GetVersion() const { return m_mapping ? m_mapping->m_version : 0; }
+    private:
+        ///takes over a reference already counted
+        explicit Handle(FstMapping* mapping) : m_mapping(mapping) {}
+    private:
+        FstMapping*     m_mapping;
+        friend class FstReaderRegistry;
+    };
+public:
+    FstReaderRegistry();
+    ~FstReaderRegistry();
+private:
+    FstReaderRegistry(const FstReaderRegistry& rhs);
+    FstReaderRegistry& operator=(const FstReaderRegistry& rhs);
+public:
+    ///memory map fst file and publish it, false if file can not be mapped
+    bool Load(const string& fstFile);
+    ///publish segment loaded already, returns after no reader can newly reference the old one
+    bool Swap(const FstSegmentPtr& segment);
+    ///handle of current mapping without lock, invalid if nothing published yet
+    Handle Acquire();
+
+    uint64_t GetVersion();
+    ///current mapping plus old ones still referenced by handles
+    uint64_t GetLiveMappingCount() { return m_liveCount->load(); }
+private:
+    ///wait until readers counted in epoch 'parity' are gone
+    void waitReaders(uint32_t parity);
+private:
+    std::atomic<FstMapping*>                    m_current;
+    ///parity of epoch readers count themselves in
+    std::atomic<uint32_t>                       m_epoch;
+    std::atomic<uint64_t>                       m_readerCounts[2];
+    ///serializes swaps
+    std::mutex                                  m_swapMutex;
+    uint64_t                                    m_version;
+    std::shared_ptr<std::atomic<uint64_t> >     m_liveCount;
+private:
+    TLOG_DECLARE();
+};
+TYPEDEF_PTR(FstReaderRegistry);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_FST_READER_REGISTRY__H__
@@ -0,0 +1,189 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_set_op.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements streaming set operations across many fsts
+**********************************************************************************/
+#include "fst/fst_core/fst_set_op.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FstSetOpStream);
+
+FstSetOpStream::FstSetOpStream(const vector<FstReader::Iterator>& iterators, SET_OP_ENUM op, MERGE_FUNC_ENUM mergeFunc)
+: m_iterators(iterators)
+, m_op(op)
+, m_mergeFunc(mergeFunc)
+, m_isStarted(false)
+, m_seekCount(0)
+{
+}
+
+FstSetOpStream::FstSetOpStream(const vector<FstReader*>& readers, SET_OP_ENUM op, MERGE_FUNC_ENUM mergeFunc, AutomatonPtr aut)
+: m_op(op)
+, m_mergeFunc(mergeFunc)
+, m_isStarted(false)
+, m_seekCount(0)
+{
+    for (FstReader* reader : readers) {
+        m_iterators.push_back(reader->GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),aut));
+    }
+}
+
+FstSetOpStream::SetOpResultPtr FstSetOpStream::Next() {
+    if (!m_isStarted) {
+        m_isStarted = true;
+        for (uint32_t i = 0; i < m_iterators.size(); ++i) {
+            m_heads.push_back(m_iterators[i].Next());
+            if (m_op == SET_OP_UNION && nullptr != m_heads.back()) {
+                m_heap.push(SourceHead{m_heads.back(), i});
+            }
+        }
+    }
+    if (m_iterators.empty()) {
+        return nullptr;
+    }
+    switch (m_op) {
+        case SET_OP_UNION:
+            return nextUnion();
+        case SET_OP_INTERSECTION:
+            return nextIntersection();
+        case SET_OP_DIFFERENCE:
+            return nextDifference();
+        default:
+            return nullptr;
+    }
+}
+
+void FstSetOpStream::addSourceOutput(SetOpResultPtr& result, uint32_t sourceIndex, uint64_t output) {
+    if (result->m_sourceOutputs.empty()) {
+        result->m_output = output;
+    }
+    else {
+        switch (m_mergeFunc) {
+            case MERGE_FUNC_SUM:
+                result->m_output += output;
+                break;
+            case MERGE_FUNC_MIN:
+                result->m_output = std::min(result->m_output, output);
+                break;
+            case MERGE_FUNC_MAX:
+                result->m_output = std::max(result->m_output, output);
+                break;
+            case MERGE_FUNC_FIRST:
+            default:
+                break;
+        }
+    }
+    result->m_sourceOutputs.push_back(std::make_pair(sourceIndex, output));
+}
+
+FstSetOpStream::SetOpResultPtr FstSetOpStream::nextUnion() {
+    if (m_heap.empty()) {
+        return nullptr;
+    }
+    SetOpResultPtr result = std::make_shared<SetOpResult>();
+    result->m_inputs = m_heap.top().m_result->m_inputs;
+    //heap pops sources of the same key by source index ascending
+    while (!m_heap.empty() && m_heap.top().m_result->m_inputs == result->m_inputs) {
+        SourceHead head = m_heap.top();
+        m_heap.pop();
+        addSourceOutput(result, head.m_sourceIndex, head.m_result->m_output);
+        FstReader::IteratorResultPtr next = m_iterators[head.m_sourceIndex].Next();
+        if (nullptr != next) {
+            m_heap.push(SourceHead{next, head.m_sourceIndex});
+        }
+    }
+    return result;
+}
+
+void FstSetOpStream::catchUp(uint32_t i, const vector<uint8_t>& key) {
+    if (nullptr == m_heads[i] || !(m_heads[i]->m_inputs < key)) {
+        return;
+    }
+    //next key is often close enough, otherwise seek which skips any count of keys by one descent
+    m_heads[i] = m_iterators[i].Next();
+    if (nullptr != m_heads[i] && m_heads[i]->m_inputs < key) {
+        m_iterators[i].SeekTo(key);
+        m_heads[i] = m_iterators[i].Next();
+        ++m_seekCount;
+    }
+}
+
+FstSetOpStream::SetOpResultPtr FstSetOpStream::nextIntersection() {
+    while (true) {
+        const FstReader::IteratorResultPtr* maxHead = nullptr;
+        for (const FstReader::IteratorResultPtr& head : m_heads) {
+            if (nullptr == head) return nullptr;
+            if (nullptr == maxHead || (*maxHead)->m_inputs < head->m_inputs) maxHead = &head;
+        }
+        vector<uint8_t> candidate = (*maxHead)->m_inputs;
+        bool isAllEqual = true;
+        for (uint32_t i = 0; i < m_heads.size(); ++i) {
+            catchUp(i, candidate);
+            if (nullptr == m_heads[i]) return nullptr;
+            if (m_heads[i]->m_inputs != candidate) {
+                //passed candidate, which becomes the next candidate
+                isAllEqual = false;
+                break;
+            }
+        }
+        if (!isAllEqual) continue;
+
+        SetOpResultPtr result = std::make_shared<SetOpResult>();
+        result->m_inputs.swap(candidate);
+        for (uint32_t i = 0; i < m_heads.size(); ++i) {
+            addSourceOutput(result, i, m_heads[i]->m_output);
+            m_heads[i] = m_iterators[i].Next();
+        }
+        return result;
+    }
+}
+
+FstSetOpStream::SetOpResultPtr FstSetOpStream::nextDifference() {
+    while (nullptr != m_heads[0]) {
+        FstReader::IteratorResultPtr cur = m_heads[0];
+        bool isExcluded = false;
+        for (uint32_t i = 1; i < m_heads.size() && !isExcluded; ++i) {
+            catchUp(i, cur->m_inputs);
+            isExcluded = (nullptr != m_heads[i] && m_heads[i]->m_inputs == cur->m_inputs);
+        }
+        m_heads[0] = m_iterators[0].Next();
+        if (isExcluded) continue;
+
+        SetOpResultPtr result = std::make_shared<SetOpResult>();
+        result->m_inputs = cur->m_inputs;
+        addSourceOutput(result, 0, cur->m_output);
+        return result;
+    }
+    return nullptr;
+}
+
+bool FstSetOpStream::Build(FstBuilder& builder, uint64_t& keyCount) {
+    return Build([this]() -> FstReader::IteratorResultPtr { return Next(); }, builder, keyCount);
+}
+
+bool FstSetOpStream::Build(const std::function<FstReader::IteratorResultPtr()>& next, FstBuilder& builder, uint64_t& keyCount) {
+    keyCount = 0;
+    //builder refuses null key pointer even for empty key
+    static const uint8_t s_emptyKey = 0;
+    while (true) {
+        FstReader::IteratorResultPtr result = next();
+        if (nullptr == result) break;
+        const uint8_t* key = result->m_inputs.empty() ? &s_emptyKey : result->m_inputs.data();
+        if (!builder.Insert(key, result->m_inputs.size(), result->m_output)) {
+            TLOG_LOG(ERROR,"failed to insert key:[%s] into fst builder.", result->GetInputStr().c_str());
+            return false;
+        }
+        ++keyCount;
+    }
+    builder.Finish();
+    return true;
+}
+
+COMMON_END_NAMESPACE
@@ -0,0 +1,121 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fst_set_op.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines streaming set operations across many fsts. Iterators of source
+  *                fsts are merged k-way in key order, so union, intersection or difference of
+  *                fsts such as per-day dictionaries are computed without sorting or parsing text
+  *                again, and the merged stream can be fed into FstBuilder directly since keys
+  *                come out sorted. Intersection and difference seek lagging iterators ahead to
+  *                the candidate key instead of stepping them key by key.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_FST_SET_OP__H__
+#define __CPPFST_FST_CORE_FST_SET_OP__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <queue>
+#include <functional>
+#include "fst/fst_core/fst.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+class FstSetOpStream;
+TYPEDEF_PTR(FstSetOpStream);
+class FstSetOpStream {
+public:
+    enum SET_OP_ENUM {
+        ///keys in any source
+        SET_OP_UNION = 0,
+        ///keys in every source
+        SET_OP_INTERSECTION,
+        ///keys in first source but in none of the others
+        SET_OP_DIFFERENCE,
+    };
+    ///how outputs of a key from many sources are merged into one
+    enum MERGE_FUNC_ENUM {
+        MERGE_FUNC_SUM = 0,
+        MERGE_FUNC_MIN,
+        MERGE_FUNC_MAX,
+        ///output of the source with smallest index
+        MERGE_FUNC_FIRST,
+    };
+
+    ///merged key together with output of every source having it
+    class SetOpResult;
+    TYPEDEF_PTR(SetOpResult);
+    class SetOpResult : public FstReader::IteratorResult {
+    public:
+        ///(source index, output) pairs, source index ascending
+        vector<pair<uint32_t, uint64_t> >   m_sourceOutputs;
+    };
+public:
+    /**
+     *@brief     merge iterators of source fsts, which may have bounds and automaton of their own
+     *@param     iterators     ---- iterators not iterated yet, index in it is source index
+     *@param     op            ---- set operation
+     *@param     mergeFunc     ---- output merge function
+     */
+    FstSetOpStream(const vector<FstReader::Iterator>& iterators, SET_OP_ENUM op, MERGE_FUNC_ENUM mergeFunc);
+    ///merge whole source fsts, filtered by one automaton shared by all sources if 'aut' is set
+    FstSetOpStream(const vector<FstReader*>& readers, SET_OP_ENUM op, MERGE_FUNC_ENUM mergeFunc,
+                   AutomatonPtr aut = std::make_shared<AlwaysAutomaton>());
+public:
+    ///next merged key in key order, nullptr if finished
+    SetOpResultPtr Next();
+    /**
+     *@brief     materialize the rest of the stream into a new fst, builder is finished then
+     *@param     builder       ---- builder of new fst, which must not have any key inserted yet
+     *@param     keyCount      ---- count of keys inserted
+     *@return    false if builder refused any key
+     */
+    bool Build(FstBuilder& builder, uint64_t& keyCount);
+    /**
+     *@brief     materialize results into a new fst until 'next' returns nullptr, builder is finished then
+     *@param     next          ---- source of results in key order, such as a merged stream or iterator
+     *@param     builder       ---- builder of new fst, which must not have any key inserted yet
+     *@param     keyCount      ---- count of keys inserted
+     *@return    false if builder refused any key
+     */
+    static bool Build(const std::function<FstReader::IteratorResultPtr()>& next, FstBuilder& builder, uint64_t& keyCount);
+    ///times lagging iterators are repositioned by seek instead of stepping
+    uint64_t GetSeekCount() const { return m_seekCount; }
+private:
+    ///key and source of current head of a source iterator, greater key has lower priority in heap
+    struct SourceHead {
+        bool operator<(const SourceHead& rhs) const {
+            if (m_result->m_inputs != rhs.m_result->m_inputs) return m_result->m_inputs > rhs.m_result->m_inputs;
+            return m_sourceIndex > rhs.m_sourceIndex;
+        }
+        FstReader::IteratorResultPtr    m_result;
+        uint32_t                        m_sourceIndex;
+    };
+private:
+    SetOpResultPtr nextUnion();
+    SetOpResultPtr nextIntersection();
+    SetOpResultPtr nextDifference();
+    ///head of source 'i' not less than 'key', seek ahead if it is lagging
+    void catchUp(uint32_t i, const vector<uint8_t>& key);
+    void addSourceOutput(SetOpResultPtr& result, uint32_t sourceIndex, uint64_t output);
+private:
+    vector<FstReader::Iterator>                 m_iterators;
+    SET_OP_ENUM                                 m_op;
+    MERGE_FUNC_ENUM                             m_mergeFunc;
+    ///current head of every source, nullptr if exhausted
+    vector<FstReader::IteratorResultPtr>        m_heads;
+    ///heads for union
+    priority_queue<SourceHead>                  m_heap;
+    bool                                        m_isStarted;
+    uint64_t                                    m_seekCount;
+private:
+    TLOG_DECLARE();
+};
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_FST_SET_OP__H__
@@ -0,0 +1,99 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fuzzy_automaton_cache.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements thread safe cache of compiled fuzzy automatons
+**********************************************************************************/
+#include "fst/fst_core/fuzzy_automaton_cache.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FuzzyAutomatonCache);
+
+///heap bytes allocated by string, which is zero if short string optimization takes effect
+static uint64_t getStringHeapSize(const string& s) {
+    string empty;
+    return s.capacity() > empty.capacity() ? s.capacity() + 1 : 0;
+}
+
+uint64_t FuzzyAutomatonCache::GetFuzzyAutomatonCacheKeySize::operator()(const FuzzyAutomatonCacheKey& key) const {
+    //one copy in hash map node with its next pointer and cached hash code,
+    //another copy in lru list node with its prev and next pointers
+    uint64_t keyBytes = sizeof(FuzzyAutomatonCacheKey) + getStringHeapSize(key.m_query);
+    return 2 * keyBytes + 4 * sizeof(void*);
+}
+
+uint64_t FuzzyAutomatonCache::GetByteDfaAutomatonSize::operator()(const ByteDfaAutomatonPtr& aut) const {
+    //value in hash map node holds the shared_ptr and a pointer to lru list node
+    uint64_t bytes = sizeof(ByteDfaAutomatonPtr) + sizeof(void*);
+    if (nullptr != aut) {
+        bytes += 2 * sizeof(void*) + aut->GetMemoryBytes();
+    }
+    return bytes;
+}
+
+FuzzyAutomatonCache::FuzzyAutomatonCache(uint64_t totalMemSize, uint64_t initialHashSize)
+: m_cache(initialHashSize, totalMemSize)
+{
+}
+
+ByteDfaAutomatonPtr FuzzyAutomatonCache::Get(const FuzzyAutomatonCacheKey& key) {
+    ByteDfaAutomatonPtr aut;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_cache.Get(key, aut)) {
+        return nullptr;
+    }
+    return aut;
+}
+
+bool FuzzyAutomatonCache::Put(const FuzzyAutomatonCacheKey& key, const ByteDfaAutomatonPtr& aut) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool ret = m_cache.Put(key, aut);
+    if (!ret) {
+        TLOG_LOG(WARN,"put automaton of query:[%s],edit distance:[%u] into cache failed.",
+                 key.m_query.c_str(), key.m_editDistance);
+    }
+    return ret;
+}
+
+double FuzzyAutomatonCache::GetHitRatio() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetHitRatio();
+}
+
+uint64_t FuzzyAutomatonCache::GetTotalQueryTimes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetTotalQueryTimes();
+}
+
+uint64_t FuzzyAutomatonCache::GetHitQueryTimes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetHitQueryTimes();
+}
+
+void FuzzyAutomatonCache::ResetHitStatistics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache.ResetHitStatistics();
+}
+
+uint64_t FuzzyAutomatonCache::GetCacheSize() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetCacheSize();
+}
+
+uint64_t FuzzyAutomatonCache::GetCacheSizeUsed() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetCacheSizeUsed();
+}
+
+uint64_t FuzzyAutomatonCache::GetKeyCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache.GetKeyCount();
+}
+
+COMMON_END_NAMESPACE
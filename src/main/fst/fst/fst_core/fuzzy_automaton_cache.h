@@ -0,0 +1,120 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       fuzzy_automaton_cache.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines thread safe cache of compiled fuzzy automatons keyed by query,
+  *                edit distance, same prefix length and variant of automaton. Compiled byte dfa
+  *                automatons are immutable, so one cached automaton can be shared by concurrent
+  *                fst iterators. Memory is bounded by LRUCache with size of every entry counted
+  *                in bytes.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_FUZZY_AUTOMATON_CACHE__H__
+#define __CPPFST_FST_CORE_FUZZY_AUTOMATON_CACHE__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <string>
+#include <mutex>
+#include "common/util/hash_util.h"
+#include "common/util/lru_cache.h"
+#include "fst/fst_core/byte_dfa_automaton.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+///key of compiled fuzzy automaton
+class FuzzyAutomatonCacheKey {
+public:
+    FuzzyAutomatonCacheKey()
+    : m_editDistance(0)
+    , m_samePrefixLen(0)
+    , m_isUseDamerauLevenshtein(false)
+    , m_isFuzzyPrefix(false)
+    {}
+    FuzzyAutomatonCacheKey(const string& query, uint32_t editDistance, uint32_t samePrefixLen, bool isUseDamerauLevenshtein,
+                           bool isFuzzyPrefix = false)
+    : m_query(query)
+    , m_editDistance(editDistance)
+    , m_samePrefixLen(samePrefixLen)
+    , m_isUseDamerauLevenshtein(isUseDamerauLevenshtein)
+    , m_isFuzzyPrefix(isFuzzyPrefix)
+    {}
+    bool operator==(const FuzzyAutomatonCacheKey& rhs) const {
+        return m_editDistance == rhs.m_editDistance && m_samePrefixLen == rhs.m_samePrefixLen
+               && m_isUseDamerauLevenshtein == rhs.m_isUseDamerauLevenshtein && m_isFuzzyPrefix == rhs.m_isFuzzyPrefix
+               && m_query == rhs.m_query;
+    }
+public:
+    string          m_query;
+    uint32_t        m_editDistance;
+    uint32_t        m_samePrefixLen;
+    bool            m_isUseDamerauLevenshtein;
+    ///automaton matches keys having a prefix within edit distance
+    bool            m_isFuzzyPrefix;
+};
+
+///thread safe memory bounded LRU cache of compiled fuzzy automatons
+class FuzzyAutomatonCache {
+public:
+    class FuzzyAutomatonCacheKeyHash {
+    public:
+        size_t operator()(const FuzzyAutomatonCacheKey& key) const {
+            uint64_t seed = DBKeyHash<string>()(key.m_query);
+            HashCombine(seed, key.m_editDistance);
+            HashCombine(seed, key.m_samePrefixLen);
+            HashCombine(seed, key.m_isUseDamerauLevenshtein);
+            HashCombine(seed, key.m_isFuzzyPrefix);
+            return seed;
+        }
+    };
+
+    ///bytes of key, which is stored both in hash map node and lru list node
+    class GetFuzzyAutomatonCacheKeySize {
+    public:
+        uint64_t operator()(const FuzzyAutomatonCacheKey& key) const;
+    };
+
+    ///bytes of compiled automaton together with its shared_ptr control block
+    class GetByteDfaAutomatonSize {
+    public:
+        uint64_t operator()(const ByteDfaAutomatonPtr& aut) const;
+    };
+
+    typedef LRUCache<FuzzyAutomatonCacheKey,ByteDfaAutomatonPtr,GetFuzzyAutomatonCacheKeySize,
+    GetByteDfaAutomatonSize,FuzzyAutomatonCacheKeyHash> AutomatonCacheType;
+public:
+    /**
+     *@brief     constructor
+     *@param     totalMemSize      ---- max memory bytes used by cached automatons
+     *@param     initialHashSize   ---- initial bucket count of hash map
+     */
+    FuzzyAutomatonCache(uint64_t totalMemSize, uint64_t initialHashSize = 1024);
+private:
+    FuzzyAutomatonCache(const FuzzyAutomatonCache& rhs);
+    FuzzyAutomatonCache& operator=(const FuzzyAutomatonCache& rhs);
+public:
+    ///got cached automaton, nullptr if not in cache
+    ByteDfaAutomatonPtr Get(const FuzzyAutomatonCacheKey& key);
+    ///put compiled automaton, which may evict least recently used ones
+    bool Put(const FuzzyAutomatonCacheKey& key, const ByteDfaAutomatonPtr& aut);
+
+    double    GetHitRatio();
+    uint64_t  GetTotalQueryTimes();
+    uint64_t  GetHitQueryTimes();
+    void      ResetHitStatistics();
+    uint64_t  GetCacheSize();
+    uint64_t  GetCacheSizeUsed();
+    uint64_t  GetKeyCount();
+private:
+    std::mutex                  m_mutex;
+    AutomatonCacheType          m_cache;
+private:
+    TLOG_DECLARE();
+};
+TYPEDEF_PTR(FuzzyAutomatonCache);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_FUZZY_AUTOMATON_CACHE__H__
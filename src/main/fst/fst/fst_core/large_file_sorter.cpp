@@ -17,12 +17,27 @@
 #include <cassert>
 #include <algorithm>
 #include <map>
+#include <cstring>
+#include <set>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 
 STD_USE_NAMESPACE;
 COMMON_BEGIN_NAMESPACE
 
 TLOG_SETUP(COMMON_NS,LargeFileSorter);
 
+const uint64_t LargeFileSorter::DEFAULT_MEMORY_BUDGET;
+const uint64_t LargeFileSorter::READ_BUFFER_SIZE;
+const uint64_t LargeFileSorter::WRITE_BUFFER_SIZE;
+const uint64_t LargeFileSorter::RUN_BLOCK_SIZE;
+const uint32_t LargeFileSorter::OUTPUT_QUEUE_BLOCK_NUM;
+const uint64_t LargeFileSorter::MIN_PARALLEL_SORT_LINE_NUM;
+const uint32_t LargeFileSorter::SPLIT_SAMPLE_NUM_PER_FILE;
+const uint32_t LargeFileSorter::DEFAULT_MERGE_FAN_IN;
+const uint64_t LargeFileSorter::MIN_MERGE_READ_BUFFER_SIZE;
+const uint64_t LargeFileSorter::MAX_MERGE_READ_BUFFER_SIZE;
+
 /// remove randomed generated work sub directory at last, USE RAII idea
 class RandomDirectoryGenAndRemoveRAII {
 public:
@@ -39,221 +54,1134 @@ public:
 private:
     string      dir_;
 };
+TYPEDEF_PTR(RandomDirectoryGenAndRemoveRAII);
 
-//Main process method for sort large file
-bool LargeFileSorter::Run() {
-    uint64_t bTime = TimeUtility::CurrentTimeInMs();
-    if (!Check()) return false;
-    RandomDirectoryGenAndRemoveRAII randomDirectoryGenAndRemoveRaii(workDirPath_ + "/" + randomTmpDirName_);
-    TLOG_LOG(INFO,"Begin to sort large file under random generated directory:[%s/%s] for input file:[%s]", workDirPath_.c_str(),randomTmpDirName_.c_str(), largeFilePath_.c_str())
+///compare keys as std::string does
+static int compareKey(const char* lhs, size_t lhsLen, const char* rhs, size_t rhsLen) {
+    int ret = memcmp(lhs, rhs, std::min(lhsLen, rhsLen));
+    return 0 != ret ? ret : (lhsLen < rhsLen ? -1 : (lhsLen > rhsLen ? 1 : 0));
+}
+
+static bool isWhiteSpace(char ch) { return ' ' == ch || '\t' == ch || '\r' == ch; }
 
-    for (uint32_t t = 1; t <= threadNum_; ++t) {
-        freeThreadIdsList_.push_back(t);
+///key of line is the trimmed line, or the trimmed text before the first comma of a `key,value` record
+static void findKey(const char* line, size_t lineLen, bool isRecord, const char*& key, size_t& keyLen) {
+    key = line;
+    keyLen = lineLen;
+    if (isRecord) {
+        const char* comma = (const char*)memchr(line, ',', lineLen);
+        if (nullptr != comma) {
+            keyLen = comma - line;
+        }
     }
+    while (keyLen > 0 && isWhiteSpace(key[0])) {
+        ++key;
+        --keyLen;
+    }
+    while (keyLen > 0 && isWhiteSpace(key[keyLen - 1])) {
+        --keyLen;
+    }
+}
 
-    //check whole line count of input large file
-    uint64_t inputFileLineNum = FileUtility::GetFileLineNumber(largeFilePath_);
-    TLOG_LOG(DEBUG,"totally [%lu] lines for input file:[%s]",inputFileLineNum,largeFilePath_.c_str());
+///value after the first comma of a `key,value` record, 0 if there is none
+static uint64_t parseValue(const char* line, size_t lineLen) {
+    const char* end = line + lineLen;
+    const char* p = (const char*)memchr(line, ',', lineLen);
+    if (nullptr == p) {
+        return 0;
+    }
+    for (++p; p < end && isWhiteSpace(*p); ++p) {}
+    uint64_t value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        value = value * 10 + (*p - '0');
+    }
+    return value;
+}
 
-    //if line count smaller just sort it in memory
-    if (inputFileLineNum < (uint64_t)1e6) {
-        //small line count for input file, do not split
-        taskList_.emplace_back(largeFilePath_,Task::TASK_TYPE_SORT,Task::TASK_STATE_WAIT_START);
-        inputLineNum_ = inputFileLineNum;
+///line split at its key: head and tail are parts of line before and after its key. key is found once when
+///line is read, and line is never joined again until output, so that merges pass front coded keys along
+struct KeyedLine {
+    KeyedLine(const char* line, size_t lineLen, const char* key, size_t keyLen)
+    : head_(line)
+    , headLen_(key - line)
+    , key_(key)
+    , keyLen_(keyLen)
+    , tail_(key + keyLen)
+    , tailLen_(line + lineLen - (key + keyLen))
+    {}
+    KeyedLine(const char* head, size_t headLen, const char* key, size_t keyLen, const char* tail, size_t tailLen)
+    : head_(head)
+    , headLen_(headLen)
+    , key_(key)
+    , keyLen_(keyLen)
+    , tail_(tail)
+    , tailLen_(tailLen)
+    {}
+    const char*     head_;
+    size_t          headLen_;
+    const char*     key_;
+    size_t          keyLen_;
+    const char*     tail_;
+    size_t          tailLen_;
+};
+
+///reads lines of a file through a large buffer, line and its trimmed key point into the buffer and stay
+///valid until next line is read
+class BufferedLineReader {
+public:
+    ///key of line is the key of `key,value` record if 'isRecord'
+    BufferedLineReader(uint64_t bufferSize, bool isRecord = false)
+    : unreadSize_(0)
+    , buffer_(bufferSize)
+    , isRecord_(isRecord)
+    , begin_(0)
+    , end_(0)
+    , isEof_(false)
+    , isEnd_(false)
+    , line_(nullptr)
+    , lineLen_(0)
+    , key_(nullptr)
+    , keyLen_(0)
+    {}
+public:
+    ///read lines of byte range [beginOffset, endOffset) of file, which starts at a line
+    bool Open(const string& file, uint64_t beginOffset = 0, uint64_t endOffset = UINT64_MAX) {
+        ifs_.open(file, std::ios::in | std::ios::binary);
+        ifs_.seekg(beginOffset);
+        unreadSize_ = endOffset - beginOffset;
+        return (bool)ifs_;
     }
-    //more lines, use external sort
-    else {
-        taskList_.emplace_back(largeFilePath_,Task::TASK_TYPE_SPLIT,Task::TASK_STATE_WAIT_START);
-    }
-
-    uint64_t lastPrintWaitTime = TimeUtility::CurrentTimeInMs();
-    while (!CheckIfFinishedAllTasks()) {
-        Task::TASK_TYPE_ENUM gotTaskType;
-        vector<size_t> gotTaskIds;
-        //try to got available tasks
-        bool ret = DispatchTask(gotTaskType,gotTaskIds);
-        if (!gotTaskIds.empty()) {
-            assert(ret);
-            {
-                mutex_.lock();
-                //try got available thread
-                if (!freeThreadIdsList_.empty()) {
-                    uint32_t tid = freeThreadIdsList_.front();
-                    freeThreadIdsList_.pop_front();
-                    mutex_.unlock();
-
-                    switch (gotTaskType) {
-                        //split large file to small files
-                        case Task::TASK_TYPE_SPLIT:
-                        {
-                            uint32_t lastThreadIndex = threadStartedIndex_.load();
-                            thread t([&,tid,gotTaskIds]() {
-                                threadStartedIndex_.fetch_add(1);
-                                SplitLargeFile(gotTaskIds[0],tid);
-                            });
-                            ThreadDetachRAII threadRaii(t);
-                            while (threadStartedIndex_.load() <= lastThreadIndex) {
-                                this_thread::sleep_for(std::chrono::microseconds (10));
-                            }
-                            break;
-                        }
-                        //sort every small files
-                        case Task::TASK_TYPE_SORT:
-                        {
-                            uint32_t lastThreadIndex = threadStartedIndex_.load();
-                            thread t([&,tid,gotTaskIds]() {
-                                threadStartedIndex_.fetch_add(1);
-                                SortSplitFile(gotTaskIds[0],tid);
-                            });
-                            ThreadDetachRAII threadRaii(t);
-                            while (threadStartedIndex_.load() <= lastThreadIndex) {
-                                this_thread::sleep_for(std::chrono::microseconds (10));
-                            }
-                            break;
-                        }
-                        //external merge sorted files
-                        case Task::TASK_TYPE_MERGE:
-                        {
-                            uint32_t lastThreadIndex = threadStartedIndex_.load();
-                            thread t([&,tid,gotTaskIds]() {
-                                threadStartedIndex_.fetch_add(1);
-                                MergeSortedFile(gotTaskIds,tid);
-                            });
-                            ThreadDetachRAII  threadRaii(t);
-                            while (threadStartedIndex_.load() <= lastThreadIndex) {
-                                this_thread::sleep_for(std::chrono::microseconds (10));
-                            }
-                            break;
-                        }
-                        default:
-                            break;
-                    }
-                }
-                else {
-                    mutex_.unlock();
-                    //no thread and wait
-                    uint64_t curPrintWaitTime = TimeUtility::CurrentTimeInMs();
-                    if (curPrintWaitTime - lastPrintWaitTime >= 5000) {
-                        TLOG_LOG(INFO,"waiting available thread...")
-                        lastPrintWaitTime = curPrintWaitTime;
-                    }
-                    this_thread::sleep_for(std::chrono::microseconds (10));
+    ///read next line, false at end of file or byte range
+    bool Next() {
+        while (true) {
+            char* data = buffer_.data();
+            char* lineEnd = (char*)memchr(data + begin_, '\n', end_ - begin_);
+            if (nullptr != lineEnd) {
+                line_ = data + begin_;
+                lineLen_ = lineEnd - line_;
+                begin_ = lineEnd - data + 1;
+                break;
+            }
+            if (isEof_) {
+                //last line without line feed
+                if (begin_ < end_) {
+                    line_ = data + begin_;
+                    lineLen_ = end_ - begin_;
+                    begin_ = end_;
+                    break;
                 }
+                isEnd_ = true;
+                return false;
             }
+            fill();
         }
-        else {
-            //no task and also wait
-            uint64_t curPrintWaitTime = TimeUtility::CurrentTimeInMs();
-            if (curPrintWaitTime - lastPrintWaitTime >= 5000) {
-                TLOG_LOG(INFO,"waiting available task...")
-                lastPrintWaitTime = curPrintWaitTime;
+        //line has no line feed inside, so trimming stops at line end
+        findKey(line_, lineLen_, isRecord_, key_, keyLen_);
+        return true;
+    }
+    bool IsEnd() const { return isEnd_; }
+    const char* GetLine() const { return line_; }
+    size_t GetLineLen() const { return lineLen_; }
+    const char* GetKey() const { return key_; }
+    size_t GetKeyLen() const { return keyLen_; }
+private:
+    ///move unread data to front and read more, buffer grows for a line longer than it
+    void fill() {
+        if (begin_ > 0) {
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        ifs_.read(buffer_.data() + end_, std::min<uint64_t>(buffer_.size() - end_, unreadSize_));
+        end_ += ifs_.gcount();
+        unreadSize_ -= ifs_.gcount();
+        if (!ifs_ || 0 == unreadSize_) {
+            isEof_ = true;
+        }
+    }
+private:
+    ifstream            ifs_;
+    ///bytes of range not read into buffer yet
+    uint64_t            unreadSize_;
+    vector<char>        buffer_;
+    bool                isRecord_;
+    ///unread data in buffer
+    size_t              begin_;
+    size_t              end_;
+    bool                isEof_;
+    bool                isEnd_;
+    const char*         line_;
+    size_t              lineLen_;
+    const char*         key_;
+    size_t              keyLen_;
+};
+TYPEDEF_PTR(BufferedLineReader);
+
+///writes lines to a file through a large buffer
+class BufferedLineWriter {
+public:
+    BufferedLineWriter() {
+        buffer_.reserve(LargeFileSorter::WRITE_BUFFER_SIZE + 1024);
+    }
+public:
+    bool Open(const string& file) {
+        ofs_.open(file, std::ios::out | std::ios::binary);
+        return (bool)ofs_;
+    }
+    bool IsOpen() const { return ofs_.is_open(); }
+    bool Write(const char* line, size_t lineLen) {
+        buffer_.append(line, lineLen);
+        buffer_.push_back('\n');
+        if (buffer_.size() >= LargeFileSorter::WRITE_BUFFER_SIZE) {
+            ofs_.write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+        return (bool)ofs_;
+    }
+    bool Close() {
+        ofs_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+        ofs_.close();
+        return (bool)ofs_;
+    }
+private:
+    ofstream    ofs_;
+    string      buffer_;
+};
+
+///combines neighbour lines of the same key into one before passing them to output, lines of a key are
+///added in input order
+class DuplicateKeyCombiner {
+public:
+    DuplicateKeyCombiner(LargeFileSorter::COMBINE_FUNC_ENUM combineFunc, const LargeFileSorter::KeyedLineConsumer& output)
+    : combineFunc_(combineFunc)
+    , output_(output)
+    , hasLine_(false)
+    , headLen_(0)
+    , keyLen_(0)
+    , value_(0)
+    {}
+public:
+    bool Add(const KeyedLine& line) {
+        if (LargeFileSorter::COMBINE_FUNC_NONE == combineFunc_) {
+            return output_(line);
+        }
+        if (hasLine_ && 0 == compareKey(line.key_, line.keyLen_, line_.data() + headLen_, keyLen_)) {
+            //value is after the first comma, which is never in head or key of a record
+            switch (combineFunc_) {
+                case LargeFileSorter::COMBINE_FUNC_LAST:
+                    setLine(line);
+                    break;
+                case LargeFileSorter::COMBINE_FUNC_SUM:
+                    value_ += parseValue(line.tail_, line.tailLen_);
+                    break;
+                case LargeFileSorter::COMBINE_FUNC_MIN:
+                    value_ = std::min(value_, parseValue(line.tail_, line.tailLen_));
+                    break;
+                case LargeFileSorter::COMBINE_FUNC_MAX:
+                    value_ = std::max(value_, parseValue(line.tail_, line.tailLen_));
+                    break;
+                default:
+                    break;
             }
-            this_thread::sleep_for(std::chrono::microseconds (10));
+            return true;
         }
+        if (!Flush()) {
+            return false;
+        }
+        hasLine_ = true;
+        setLine(line);
+        value_ = parseValue(line.tail_, line.tailLen_);
+        return true;
     }
-    uint64_t eTime = TimeUtility::CurrentTimeInMs();
-    TLOG_LOG(INFO,"Totally consumed:[%lu]ms on [%lu] lines read,abandon:[%lu] empty lines, for large file:[%s],result output file is:[%s].",
-             (eTime-bTime),inputLineNum_.load(),abandonLineNum_.load(),largeFilePath_.c_str(), resultFilePath_.c_str());
-    return true;
+    ///output line of the last key added
+    bool Flush() {
+        if (!hasLine_) {
+            return true;
+        }
+        hasLine_ = false;
+        const char* key = line_.data() + headLen_;
+        if (LargeFileSorter::COMBINE_FUNC_FIRST == combineFunc_ || LargeFileSorter::COMBINE_FUNC_LAST == combineFunc_) {
+            return output_(KeyedLine(line_.data(), line_.size(), key, keyLen_));
+        }
+        //combined line is `key,value`
+        combinedTail_.assign(1, ',');
+        combinedTail_.append(std::to_string(value_));
+        return output_(KeyedLine(key, 0, key, keyLen_, combinedTail_.data(), combinedTail_.size()));
+    }
+private:
+    void setLine(const KeyedLine& line) {
+        line_.assign(line.head_, line.headLen_);
+        line_.append(line.key_, line.keyLen_);
+        line_.append(line.tail_, line.tailLen_);
+        headLen_ = line.headLen_;
+        keyLen_ = line.keyLen_;
+    }
+private:
+    LargeFileSorter::COMBINE_FUNC_ENUM          combineFunc_;
+    const LargeFileSorter::KeyedLineConsumer&   output_;
+    bool                                        hasLine_;
+    ///line kept for the last key, whose key is after its head
+    string                                      line_;
+    size_t                                      headLen_;
+    size_t                                      keyLen_;
+    uint64_t                                    value_;
+    string                                      combinedTail_;
+};
+
+static void appendVarint(string& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((char)value);
 }
 
-bool LargeFileSorter::DispatchTask(Task::TASK_TYPE_ENUM& gotTaskType, vector<size_t>& gotTaskIds) {
-    do {
-        {
-            lock_guard lockGuard(mutex_);
-            gotTaskIds.clear();
-            vector<size_t> freeTasks;
-            for (size_t i = 0; i < taskList_.size(); ++i) {
-                if (taskList_[i].IsWaitStart()) {
-                    freeTasks.push_back(i);
-                }
-            }
-            if (freeTasks.empty()) {
-                break;
+///false if varint runs over 'end'
+static bool readVarint(const char*& data, const char* end, uint64_t& value) {
+    value = 0;
+    for (uint32_t shift = 0; data < end && shift < 64; shift += 7) {
+        uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (0 == (byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+///writes sorted lines of an intermediate file in blocks. a block is [payload length:4][crc32c:4][lines],
+///every line is [shared key prefix length][key suffix length][head length][tail length] by varints and then
+///key suffix, head and tail, head and tail are parts of line before and after its key. key is front coded
+///against the key before it in block, so that shared prefix of neighbour sorted keys is written once
+class RunFileWriter {
+public:
+    RunFileWriter(bool isChecksum)
+    : isChecksum_(isChecksum)
+    {
+        block_.reserve(LargeFileSorter::RUN_BLOCK_SIZE + 1024);
+    }
+public:
+    bool Open(const string& file) {
+        ofs_.open(file, std::ios::out | std::ios::binary);
+        return (bool)ofs_;
+    }
+    bool IsOpen() const { return ofs_.is_open(); }
+    ///head, key and tail are written as they are, so line read from a sorted file is never joined to write
+    bool Write(const KeyedLine& line) {
+        if (block_.empty()) {
+            //room for block header, every block starts a new prefix
+            block_.resize(BLOCK_HEADER_SIZE);
+            lastKey_.clear();
+        }
+        const char* key = line.key_;
+        size_t keyLen = line.keyLen_;
+        size_t sharedLen = 0;
+        size_t maxSharedLen = std::min(keyLen, lastKey_.size());
+        while (sharedLen < maxSharedLen && key[sharedLen] == lastKey_[sharedLen]) {
+            ++sharedLen;
+        }
+        appendVarint(block_, sharedLen);
+        appendVarint(block_, keyLen - sharedLen);
+        appendVarint(block_, line.headLen_);
+        appendVarint(block_, line.tailLen_);
+        block_.append(key + sharedLen, keyLen - sharedLen);
+        block_.append(line.head_, line.headLen_);
+        block_.append(line.tail_, line.tailLen_);
+        lastKey_.resize(sharedLen);
+        lastKey_.append(key + sharedLen, keyLen - sharedLen);
+        if (block_.size() >= LargeFileSorter::RUN_BLOCK_SIZE) {
+            return flushBlock();
+        }
+        return (bool)ofs_;
+    }
+    bool Close() {
+        flushBlock();
+        ofs_.close();
+        return (bool)ofs_;
+    }
+public:
+    static const size_t BLOCK_HEADER_SIZE = 8;
+private:
+    bool flushBlock() {
+        if (block_.empty()) {
+            return (bool)ofs_;
+        }
+        uint32_t payloadLen = block_.size() - BLOCK_HEADER_SIZE;
+        uint32_t crc = isChecksum_ ? Crc32c::Value((const uint8_t*)block_.data() + BLOCK_HEADER_SIZE, payloadLen) : 0;
+        memcpy(&block_[0], &payloadLen, sizeof(payloadLen));
+        memcpy(&block_[4], &crc, sizeof(crc));
+        ofs_.write(block_.data(), block_.size());
+        block_.clear();
+        return (bool)ofs_;
+    }
+private:
+    bool        isChecksum_;
+    ofstream    ofs_;
+    string      block_;
+    string      lastKey_;
+};
+
+///reads sorted lines of an intermediate file written by RunFileWriter through a large buffer. key is rebuilt
+///from the key before it by appending its suffix only, while head and tail point into the buffer
+class RunFileReader {
+public:
+    RunFileReader(uint64_t bufferSize, bool isChecksum)
+    : isChecksum_(isChecksum)
+    , buffer_(std::max<uint64_t>(bufferSize, LargeFileSorter::RUN_BLOCK_SIZE * 2))
+    , begin_(0)
+    , end_(0)
+    , blockEnd_(0)
+    , isEof_(false)
+    , isEnd_(false)
+    , isFailed_(false)
+    , isBlockStart_(false)
+    , isSameKey_(false)
+    , head_(nullptr)
+    , headLen_(0)
+    , tail_(nullptr)
+    , tailLen_(0)
+    {}
+public:
+    bool Open(const string& file) {
+        file_ = file;
+        ifs_.open(file, std::ios::in | std::ios::binary);
+        return (bool)ifs_;
+    }
+    ///read next line, false at end of file or if file is corrupt
+    bool Next() {
+        if (begin_ == blockEnd_ && !nextBlock()) {
+            isEnd_ = true;
+            return false;
+        }
+        const char* data = buffer_.data() + begin_;
+        const char* blockEnd = buffer_.data() + blockEnd_;
+        uint64_t sharedLen = 0, suffixLen = 0, headLen = 0, tailLen = 0;
+        if (!readVarint(data, blockEnd, sharedLen) || !readVarint(data, blockEnd, suffixLen)
+            || !readVarint(data, blockEnd, headLen) || !readVarint(data, blockEnd, tailLen)
+            || sharedLen > key_.size() || suffixLen + headLen + tailLen > (uint64_t)(blockEnd - data)) {
+            return fail("corrupt line");
+        }
+        //key equal to the one before is not touched at all
+        isSameKey_ = !isBlockStart_ && sharedLen == key_.size() && 0 == suffixLen;
+        isBlockStart_ = false;
+        key_.resize(sharedLen);
+        key_.append(data, suffixLen);
+        data += suffixLen;
+        head_ = data;
+        headLen_ = headLen;
+        tail_ = head_ + headLen;
+        tailLen_ = tailLen;
+        begin_ = tail_ + tailLen - buffer_.data();
+        return true;
+    }
+    bool IsEnd() const { return isEnd_; }
+    bool IsFailed() const { return isFailed_; }
+    ///key of current line equals key of the line before in the same block
+    bool IsSameKey() const { return isSameKey_; }
+    const char* GetKey() const { return key_.data(); }
+    size_t GetKeyLen() const { return key_.size(); }
+    ///current line, valid until next line is read
+    KeyedLine GetKeyedLine() const { return KeyedLine(head_, headLen_, key_.data(), key_.size(), tail_, tailLen_); }
+private:
+    bool fail(const char* reason) {
+        TLOG_LOG(ERROR,"%s in sorted file:[%s]", reason, file_.c_str());
+        isFailed_ = true;
+        isEnd_ = true;
+        return false;
+    }
+    ///make next block whole in buffer and verify it, false at end of file
+    bool nextBlock() {
+        begin_ = blockEnd_;
+        if (!fill(RunFileWriter::BLOCK_HEADER_SIZE)) {
+            if (begin_ < end_) {
+                return fail("truncated block header");
             }
-            gotTaskType = taskList_[freeTasks[0] ].GetTaskType();
-            if (gotTaskType == Task::TASK_TYPE_SPLIT) {
-                //only handle in only one thread
-                taskList_[freeTasks[0] ].SetTaskRunning();
-                gotTaskIds.push_back(freeTasks[0]);
+            return false;
+        }
+        uint32_t payloadLen = 0, crc = 0;
+        memcpy(&payloadLen, buffer_.data() + begin_, sizeof(payloadLen));
+        memcpy(&crc, buffer_.data() + begin_ + 4, sizeof(crc));
+        if (!fill(RunFileWriter::BLOCK_HEADER_SIZE + payloadLen)) {
+            return fail("truncated block");
+        }
+        begin_ += RunFileWriter::BLOCK_HEADER_SIZE;
+        blockEnd_ = begin_ + payloadLen;
+        if (isChecksum_ && crc != Crc32c::Value((const uint8_t*)buffer_.data() + begin_, payloadLen)) {
+            return fail("checksum mismatches of block");
+        }
+        //every block starts a new prefix
+        key_.clear();
+        isBlockStart_ = true;
+        return true;
+    }
+    ///make at least 'size' bytes unread in buffer from begin_, buffer grows for a block larger than it
+    bool fill(size_t size) {
+        while (end_ - begin_ < size && !isEof_) {
+            if (begin_ > 0) {
+                memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                blockEnd_ -= begin_;
+                begin_ = 0;
             }
-            else if (gotTaskType == Task::TASK_TYPE_SORT) {
-                //only handle in only one thread
-                taskList_[freeTasks[0] ].SetTaskRunning();
-                gotTaskIds.push_back(freeTasks[0]);
+            if (size > buffer_.size()) {
+                buffer_.resize(size);
             }
-            else if (gotTaskType == Task::TASK_TYPE_MERGE) {
-                for (size_t i = 0; i < std::min<uint32_t>(parallelTaskNum_,freeTasks.size()); ++i) {
-                    gotTaskIds.push_back(freeTasks[i]);
-                    taskList_[freeTasks[i] ].SetTaskRunning();
-                    assert(taskList_[freeTasks[i] ].GetTaskType() == gotTaskType);
-                }
+            ifs_.read(buffer_.data() + end_, buffer_.size() - end_);
+            end_ += ifs_.gcount();
+            if (!ifs_) {
+                isEof_ = true;
             }
         }
-    } while (false);
-    return !gotTaskIds.empty();
-}
+        return end_ - begin_ >= size;
+    }
+private:
+    string              file_;
+    bool                isChecksum_;
+    ifstream            ifs_;
+    vector<char>        buffer_;
+    ///unread data in buffer
+    size_t              begin_;
+    size_t              end_;
+    ///end of current block in buffer
+    size_t              blockEnd_;
+    bool                isEof_;
+    bool                isEnd_;
+    bool                isFailed_;
+    bool                isBlockStart_;
+    bool                isSameKey_;
+    string              key_;
+    const char*         head_;
+    size_t              headLen_;
+    const char*         tail_;
+    size_t              tailLen_;
+private:
+    TLOG_DECLARE();
+};
+TYPEDEF_PTR(RunFileReader);
+TLOG_SETUP(COMMON_NS,RunFileReader);
 
-bool LargeFileSorter::SortSplitFile(size_t sortTaskId,uint32_t threadId) {
-    Task sortTask;
+///bounded queue of blocks of sorted lines passed from final merge to consumer of them
+class SortedBlockQueue {
+public:
+    SortedBlockQueue(size_t capacity)
+    : capacity_(capacity)
+    , isClosed_(false)
+    , isAborted_(false)
+    {}
+public:
+    ///wait for room, false if consumer aborted
+    bool Push(string& block) {
+        unique_lock<mutex> lock(mutex_);
+        notFullCond_.wait(lock, [this]() { return blocks_.size() < capacity_ || isAborted_; });
+        if (isAborted_) {
+            return false;
+        }
+        blocks_.push_back(std::move(block));
+        block.clear();
+        notEmptyCond_.notify_one();
+        return true;
+    }
+    ///wait for a block, false if all blocks are popped after closed
+    bool Pop(string& block) {
+        unique_lock<mutex> lock(mutex_);
+        notEmptyCond_.wait(lock, [this]() { return !blocks_.empty() || isClosed_; });
+        if (blocks_.empty()) {
+            return false;
+        }
+        block = std::move(blocks_.front());
+        blocks_.pop_front();
+        notFullCond_.notify_one();
+        return true;
+    }
+    ///no more block will be pushed
+    void Close() {
+        lock_guard<mutex> lock(mutex_);
+        isClosed_ = true;
+        notEmptyCond_.notify_all();
+    }
+    ///consumer stops, so that producer stops pushing
+    void Abort() {
+        lock_guard<mutex> lock(mutex_);
+        isAborted_ = true;
+        notFullCond_.notify_all();
+    }
+private:
+    size_t              capacity_;
+    deque<string>       blocks_;
+    bool                isClosed_;
+    bool                isAborted_;
+    mutex               mutex_;
+    condition_variable  notFullCond_;
+    condition_variable  notEmptyCond_;
+};
+
+///packs sorted lines into blocks pushed to queue, every line ends with line feed
+class SortedBlockWriter {
+public:
+    SortedBlockWriter(SortedBlockQueue& queue)
+    : queue_(queue)
     {
-        lock_guard lockGuard(mutex_);
-        sortTask = taskList_[sortTaskId];
+        block_.reserve(LargeFileSorter::WRITE_BUFFER_SIZE + 1024);
     }
-    uint64_t bTime = TimeUtility::CurrentTimeInMs();
-    TLOG_LOG(DEBUG,"begin to sort split file:[%s] in thread %u",sortTask.GetFile().c_str(),threadId);
-    string splitFile = sortTask.GetFile();
-    ifstream ifs(splitFile);
+public:
+    ///false if consumer aborted
+    bool Write(const KeyedLine& line) {
+        block_.append(line.head_, line.headLen_);
+        block_.append(line.key_, line.keyLen_);
+        block_.append(line.tail_, line.tailLen_);
+        block_.push_back('\n');
+        return block_.size() < LargeFileSorter::WRITE_BUFFER_SIZE || queue_.Push(block_);
+    }
+    ///push the last block which is not full
+    bool Flush() {
+        return block_.empty() || queue_.Push(block_);
+    }
+private:
+    SortedBlockQueue&   queue_;
+    string              block_;
+};
+
+///one line in sort buffer, whose key is the trimmed line. first 8 bytes of key are cached in big endian,
+///so most comparisons do not touch the buffer
+struct LineRecord {
+    uint64_t    keyPrefix_;
+    uint64_t    lineOffset_;
+    uint32_t    lineLen_;
+    ///offset of key in line
+    uint32_t    keyOffset_;
+    uint32_t    keyLen_;
+};
+
+class LineRecordCompare {
+public:
+    LineRecordCompare(const char* buffer) : buffer_(buffer) {}
+    bool operator()(const LineRecord& lhs, const LineRecord& rhs) const {
+        if (lhs.keyPrefix_ != rhs.keyPrefix_) {
+            return lhs.keyPrefix_ < rhs.keyPrefix_;
+        }
+        int ret = memcmp(buffer_ + lhs.lineOffset_ + lhs.keyOffset_, buffer_ + rhs.lineOffset_ + rhs.keyOffset_,
+                         std::min(lhs.keyLen_, rhs.keyLen_));
+        return ret != 0 ? ret < 0 : lhs.keyLen_ < rhs.keyLen_;
+    }
+private:
+    const char*     buffer_;
+};
+
+static bool readWholeFile(const string& file, string& buffer) {
+    ifstream ifs(file, std::ios::in | std::ios::binary);
     if (!ifs) {
-        TLOG_LOG(ERROR, "Error!!! Failed to open split file:[%s] to sort", splitFile.c_str());
+        return false;
+    }
+    ifs.seekg(0, std::ios::end);
+    buffer.resize(ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+    return buffer.empty() || (bool)ifs.read(&buffer[0], buffer.size());
+}
+
+///stable sort chunks of records by threads, then merge neighbour chunks by rounds in parallel
+static void parallelSortLineRecords(vector<LineRecord>& records, const char* buffer, uint32_t threadNum) {
+    LineRecordCompare compare(buffer);
+    size_t chunkNum = std::min<size_t>(threadNum, records.size() / LargeFileSorter::MIN_PARALLEL_SORT_LINE_NUM + 1);
+    if (chunkNum <= 1) {
+        std::stable_sort(records.begin(), records.end(), compare);
+        return;
+    }
+    vector<size_t> bounds;
+    for (size_t i = 0; i <= chunkNum; ++i) {
+        bounds.push_back(records.size() * i / chunkNum);
+    }
+    vector<thread> threads;
+    for (size_t i = 0; i < chunkNum; ++i) {
+        threads.emplace_back([&records, &bounds, &compare, i]() {
+            std::stable_sort(records.begin() + bounds[i], records.begin() + bounds[i + 1], compare);
+        });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    while (bounds.size() > 2) {
+        threads.clear();
+        vector<size_t> mergedBounds;
+        size_t i = 0;
+        for (; i + 2 < bounds.size(); i += 2) {
+            threads.emplace_back([&records, &bounds, &compare, i]() {
+                std::inplace_merge(records.begin() + bounds[i], records.begin() + bounds[i + 1],
+                                   records.begin() + bounds[i + 2], compare);
+            });
+            mergedBounds.push_back(bounds[i]);
+        }
+        //odd chunk left is merged in next round
+        if (i + 1 < bounds.size()) {
+            mergedBounds.push_back(bounds[i]);
+        }
+        mergedBounds.push_back(bounds.back());
+        for (thread& t : threads) {
+            t.join();
+        }
+        bounds.swap(mergedBounds);
+    }
+}
+
+//Main process method for sort large file
+bool LargeFileSorter::Run() {
+    if (FileUtility::IsDirExists(resultFilePath_)) {
+        TLOG_LOG(ERROR,"result file:[%s] is a directory,please check!", resultFilePath_.c_str());
+        return false;
+    }
+    if (FileUtility::IsFileExists(resultFilePath_)) {
+        TLOG_LOG(ERROR,"result file:[%s] already exist,please check!", resultFilePath_.c_str());
+        return false;
+    }
+    BufferedLineWriter writer;
+    if (!writer.Open(resultFilePath_)) {
+        TLOG_LOG(ERROR,"Failed to open result file:[%s]",resultFilePath_.c_str());
+        return false;
+    }
+    bool isOk = Run([&writer](const char* line, size_t lineLen) { return writer.Write(line, lineLen); });
+    if (!writer.Close()) {
+        TLOG_LOG(ERROR,"Failed to write result file:[%s]",resultFilePath_.c_str());
+        isOk = false;
+    }
+    if (!isOk) {
+        FileUtility::DeleteLocalFile(resultFilePath_);
+    }
+    return isOk;
+}
+
+bool LargeFileSorter::Run(const LineConsumer& consumer) {
+    uint64_t bTime = TimeUtility::CurrentTimeInMs();
+    if (!Check() || !InitWorkDirs()) return false;
+    vector<RandomDirectoryGenAndRemoveRAIIPtr> randomDirectoryGenAndRemoveRaiis;
+    for (const string& workDirPath : workDirPaths_) {
+        randomDirectoryGenAndRemoveRaiis.push_back(std::make_shared<RandomDirectoryGenAndRemoveRAII>(workDirPath + "/" + randomTmpDirName_));
+        TLOG_LOG(INFO,"Begin to sort large file under random generated directory:[%s/%s] for input file:[%s]", workDirPath.c_str(),randomTmpDirName_.c_str(), largeFilePath_.c_str())
+    }
+
+    //estimate memory to sort whole file from lines sampled instead of counting lines by a pass
+    uint64_t fileSize = 0, avgLineLen = 0;
+    if (!SampleLargeFile(largeFilePath_, splitters_, fileSize, avgLineLen)) {
+        TLOG_LOG(ERROR, "Error!!! Failed to sample large file:[%s]", largeFilePath_.c_str());
+        return false;
+    }
+    uint64_t inMemorySortSize = fileSize + (fileSize / avgLineLen + 1) * sizeof(LineRecord);
+    TLOG_LOG(DEBUG,"about [%lu] bytes to sort input file:[%s] of [%lu] bytes in memory, memory budget is [%lu] bytes",
+             inMemorySortSize,largeFilePath_.c_str(),fileSize,memoryBudget_);
+
+    //if whole file fits in memory just sort it in memory while output
+    bool isInMemory = inMemorySortSize <= memoryBudget_;
+    vector<thread> workers;
+    //larger, use external sort
+    if (!isInMemory) {
+        //every thread generates runs of a chunk
+        vector<uint64_t> offsets;
+        if (!SplitLargeFile(largeFilePath_, fileSize, threadNum_, offsets)) {
+            TLOG_LOG(ERROR, "Error!!! Failed to split large file:[%s] into chunks", largeFilePath_.c_str());
+            return false;
+        }
         {
             lock_guard lockGuard(mutex_);
-            taskList_[sortTaskId].SetTaskFinish(false);
-            freeThreadIdsList_.push_back(threadId);
+            partitionSortedFiles_.resize(splitters_.size() + 1);
+            partitionUnfinishedTaskNum_.resize(splitters_.size() + 1, 0);
+            for (size_t i = 0; i <= splitters_.size(); ++i) {
+                outputQueues_.push_back(std::make_shared<SortedBlockQueue>(OUTPUT_QUEUE_BLOCK_NUM));
+            }
+            for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+                Task task(largeFilePath_,Task::TASK_TYPE_GENERATE,Task::TASK_STATE_WAIT_START,0,i);
+                task.SetRange(offsets[i], offsets[i + 1]);
+                AddTask(task);
+            }
         }
+        //workers exit when no task is left, following tasks are queued by the task they depend on
+        for (uint32_t t = 1; t <= threadNum_; ++t) {
+            workers.emplace_back(&LargeFileSorter::WorkerLoop, this, t);
+        }
+    }
+    bool isOutputOk = OutputSortedLines(isInMemory, consumer);
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    if (isFailed_) {
+        TLOG_LOG(ERROR,"All works done but failed to sort large file:[%s]!",largeFilePath_.c_str());
         return false;
     }
-    string outputDir = workDirPath_ + "/" + randomTmpDirName_ + "/";
-    string outputFile = outputDir + TimeUtility::CurrentTimeInSecondsReadable() + "_" + Random<uint64_t>::RandomString(20);
-    assert(!FileUtility::IsFileExists(outputFile));
-    ofstream  ofs(outputFile);
-    if (!ofs) {
-        TLOG_LOG(ERROR,"Failed to open intermediate result file:[%s]",outputFile.c_str());
+    if (!isOutputOk) {
+        return false;
+    }
+    uint64_t eTime = TimeUtility::CurrentTimeInMs();
+    TLOG_LOG(INFO,"Totally consumed:[%lu]ms on [%lu] lines read,abandon:[%lu] empty lines, output [%lu] lines by [%zu] tasks, for large file:[%s].",
+             (eTime-bTime),inputLineNum_.load(),abandonLineNum_.load(),outputLineNum_.load(),taskList_.size(),largeFilePath_.c_str());
+    return true;
+}
+
+void LargeFileSorter::WorkerLoop(uint32_t threadId) {
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        taskCond_.wait(lock, [this]() { return !readyTaskIds_.empty() || 0 == unfinishedTaskNum_ || isFailed_; });
+        if (isFailed_ || readyTaskIds_.empty()) {
+            break;
+        }
+        size_t taskId = readyTaskIds_.front();
+        readyTaskIds_.pop_front();
+        taskList_[taskId].SetTaskRunning();
+        //task list may grow while running, so work on a copy
+        Task task = taskList_[taskId];
+        lock.unlock();
+
+        vector<SortedFile> outputFiles;
+        bool success = RunTask(task, threadId, outputFiles);
+
+        lock.lock();
+        FinishTask(taskId, success, outputFiles);
+    }
+}
+
+bool LargeFileSorter::RunTask(const Task& task, uint32_t threadId, vector<SortedFile>& outputFiles) {
+    switch (task.GetTaskType()) {
+        //generate sorted runs of large file
+        case Task::TASK_TYPE_GENERATE:
+            return GenerateRuns(task, threadId, outputFiles);
+        //external merge sorted files
+        case Task::TASK_TYPE_MERGE:
         {
+            SortedFile mergedFile;
+            if (!MergeSortedFile(task, threadId, mergedFile)) {
+                return false;
+            }
+            outputFiles.push_back(mergedFile);
+            return true;
+        }
+        //the last merge into output queue
+        case Task::TASK_TYPE_OUTPUT:
+            return OutputMergedFile(task, threadId);
+        default:
+            return false;
+    }
+}
+
+void LargeFileSorter::AddTask(const Task& task) {
+    taskList_.push_back(task);
+    readyTaskIds_.push_back(taskList_.size() - 1);
+    ++unfinishedTaskNum_;
+    if (Task::TASK_TYPE_MERGE == task.GetTaskType()) {
+        ++partitionUnfinishedTaskNum_[task.GetPartition()];
+    }
+    else if (Task::TASK_TYPE_GENERATE == task.GetTaskType()) {
+        unfinishedChunks_.insert(task.GetOrder());
+    }
+    taskCond_.notify_one();
+}
+
+void LargeFileSorter::FinishTask(size_t taskId, bool success, const vector<SortedFile>& outputFiles) {
+    taskList_[taskId].SetTaskFinish(success);
+    //task list grows by tasks added below
+    Task::TASK_TYPE_ENUM taskType = taskList_[taskId].GetTaskType();
+    uint32_t partition = taskList_[taskId].GetPartition();
+    --unfinishedTaskNum_;
+    if (!success) {
+        AbortOutputs();
+    }
+    else {
+        for (const SortedFile& sortedFile : outputFiles) {
+            partitionSortedFiles_[sortedFile.partition_][sortedFile.order_] = sortedFile.file_;
+        }
+        if (Task::TASK_TYPE_MERGE == taskType) {
+            --partitionUnfinishedTaskNum_[partition];
+            ScheduleMerges(partition);
+        }
+        else if (Task::TASK_TYPE_GENERATE == taskType) {
+            unfinishedChunks_.erase(taskList_[taskId].GetOrder());
+            for (uint32_t i = 0; i < partitionSortedFiles_.size(); ++i) {
+                ScheduleMerges(i);
+            }
+        }
+        ScheduleOutputs();
+    }
+    if (isFailed_ || 0 == unfinishedTaskNum_) {
+        taskCond_.notify_all();
+    }
+}
+
+bool LargeFileSorter::HasUnfinishedChunkBetween(uint64_t beginChunk, uint64_t endChunk) const {
+    set<uint64_t>::const_iterator it = unfinishedChunks_.upper_bound(beginChunk);
+    return it != unfinishedChunks_.end() && *it < endChunk;
+}
+
+void LargeFileSorter::ScheduleMerges(uint32_t partition) {
+    map<uint64_t,string>& sortedFiles = partitionSortedFiles_[partition];
+    //the last merge of key range is left to output
+    if (partitionUnfinishedTaskNum_[partition] > 0 || sortedFiles.size() <= parallelTaskNum_) {
+        return;
+    }
+    //neighbour files are merged together, so that merged file takes order of its first file
+    if (!unfinishedChunks_.empty()) {
+        //files of an unfinished chunk come later and are ordered among files of chunks around it, so only
+        //files with no unfinished chunk between them are merged, by full fan-in while runs are generated.
+        //orders of files of a chunk are chunk << 32 | run, see GenerateRuns
+        vector<map<uint64_t,string>::iterator> group;
+        for (map<uint64_t,string>::iterator it = sortedFiles.begin(); it != sortedFiles.end();) {
+            map<uint64_t,string>::iterator next = std::next(it);
+            group.push_back(it);
+            if (group.size() == parallelTaskNum_) {
+                vector<string> mergeFiles;
+                for (map<uint64_t,string>::iterator& fileIt : group) {
+                    mergeFiles.push_back(fileIt->second);
+                }
+                AddTask(Task(mergeFiles,Task::TASK_TYPE_MERGE,Task::TASK_STATE_WAIT_START,partition,group[0]->first));
+                for (map<uint64_t,string>::iterator& fileIt : group) {
+                    sortedFiles.erase(fileIt);
+                }
+                group.clear();
+            }
+            else if (next != sortedFiles.end() && HasUnfinishedChunkBetween(it->first >> 32, next->first >> 32)) {
+                group.clear();
+            }
+            it = next;
+        }
+        return;
+    }
+    size_t groupNum = (sortedFiles.size() + parallelTaskNum_ - 1) / parallelTaskNum_;
+    size_t fileNum = sortedFiles.size();
+    map<uint64_t,string>::iterator it = sortedFiles.begin();
+    for (size_t i = 0; i < groupNum; ++i) {
+        uint64_t order = it->first;
+        vector<string> mergeFiles;
+        for (size_t j = fileNum * i / groupNum; j < fileNum * (i + 1) / groupNum; ++j, ++it) {
+            mergeFiles.push_back(it->second);
+        }
+        AddTask(Task(mergeFiles,Task::TASK_TYPE_MERGE,Task::TASK_STATE_WAIT_START,partition,order));
+    }
+    sortedFiles.clear();
+}
+
+void LargeFileSorter::ScheduleOutputs() {
+    //the last merges start in order of key ranges, so that the one consumer drains is always running while
+    //later ones wait for room in their queues, and workers blocked by them never starve it
+    while (unfinishedChunks_.empty() && nextOutputPartition_ < partitionSortedFiles_.size()
+           && 0 == partitionUnfinishedTaskNum_[nextOutputPartition_]
+           && partitionSortedFiles_[nextOutputPartition_].size() <= parallelTaskNum_) {
+        map<uint64_t,string>& sortedFiles = partitionSortedFiles_[nextOutputPartition_];
+        if (sortedFiles.empty()) {
+            outputQueues_[nextOutputPartition_]->Close();
+        }
+        else {
+            vector<string> mergeFiles;
+            for (const auto& orderAndFile : sortedFiles) {
+                mergeFiles.push_back(orderAndFile.second);
+            }
+            AddTask(Task(mergeFiles,Task::TASK_TYPE_OUTPUT,Task::TASK_STATE_WAIT_START,nextOutputPartition_));
+            sortedFiles.clear();
+        }
+        ++nextOutputPartition_;
+    }
+}
+
+void LargeFileSorter::AbortOutputs() {
+    isFailed_ = true;
+    //wake up both last merges waiting for room and consumer waiting for blocks
+    for (SortedBlockQueuePtr& queue : outputQueues_) {
+        queue->Abort();
+        queue->Close();
+    }
+    taskCond_.notify_all();
+}
+
+bool LargeFileSorter::OutputSortedLines(bool isInMemory, const LineConsumer& consumer) {
+    if (!isInMemory) {
+        //the last merges of key ranges are run by workers in parallel
+        for (SortedBlockQueuePtr& queue : outputQueues_) {
+            bool isConsumeOk = ConsumeSortedBlocks(*queue, consumer);
             lock_guard lockGuard(mutex_);
-            taskList_[sortTaskId].SetTaskFinish(false);
-            freeThreadIdsList_.push_back(threadId);
+            if (!isConsumeOk) {
+                AbortOutputs();
+            }
+            if (isFailed_) {
+                return false;
+            }
         }
+        return true;
+    }
+    //lines are sorted into blocks by another thread, while consumer takes them
+    SortedBlockQueue queue(OUTPUT_QUEUE_BLOCK_NUM);
+    bool isProduceOk = true;
+    thread producer([&]() {
+        SortedBlockWriter writer(queue);
+        isProduceOk = SortInMemory(largeFilePath_, threadNum_,
+                                   [&writer](const KeyedLine& line) { return writer.Write(line); })
+                      && writer.Flush();
+        queue.Close();
+    });
+    bool isConsumeOk = ConsumeSortedBlocks(queue, consumer);
+    producer.join();
+    return isProduceOk && isConsumeOk;
+}
+
+bool LargeFileSorter::ConsumeSortedBlocks(SortedBlockQueue& queue, const LineConsumer& consumer) {
+    string block;
+    while (queue.Pop(block)) {
+        const char* data = block.data();
+        const char* end = data + block.size();
+        while (data < end) {
+            const char* lineEnd = (const char*)memchr(data, '\n', end - data);
+            if (!consumer(data, lineEnd - data)) {
+                TLOG_LOG(ERROR,"consumer stopped output of sorted lines of large file:[%s]",largeFilePath_.c_str());
+                queue.Abort();
+                return false;
+            }
+            outputLineNum_.fetch_add(1);
+            data = lineEnd + 1;
+        }
+    }
+    return true;
+}
+
+static bool getDevice(const string& path, uint64_t& device) {
+    struct stat st;
+    if (0 != stat(path.c_str(), &st)) {
         return false;
     }
-    multimap<string,string> tmpmap;
-    string line,trimedLine;
-    uint64_t handleLineNum = 0;
-    while (getline(ifs,line)) {
-        trimedLine = StringUtil::TrimString(line);
-        if (!isOutputEmptyLine_ && trimedLine.empty()) continue;
-        tmpmap.insert(std::make_pair(trimedLine,line));
-        ++handleLineNum;
+    device = st.st_dev;
+    return true;
+}
+
+bool LargeFileSorter::InitWorkDirs() {
+    workDirs_.clear();
+    for (const string& workDirPath : workDirPaths_) {
+        WorkDir workDir;
+        struct statvfs vfs;
+        if (!getDevice(workDirPath, workDir.device_) || 0 != statvfs(workDirPath.c_str(), &vfs)) {
+            TLOG_LOG(ERROR,"failed to stat workDir directory:[%s], errno:[%d]", workDirPath.c_str(), errno);
+            return false;
+        }
+        //weight of free space in MB, a full disk is still picked when it is the only one
+        workDir.path_ = workDirPath + "/" + randomTmpDirName_ + "/";
+        workDir.weight_ = std::max<int64_t>(1, (uint64_t)vfs.f_bavail * vfs.f_frsize / (1024 * 1024));
+        workDir.currentWeight_ = 0;
+        workDirs_.push_back(workDir);
+        TLOG_LOG(DEBUG,"workDir directory:[%s] of device:[%lu] has [%ld]MB free space", workDirPath.c_str(),
+                 workDir.device_, workDir.weight_);
     }
-    assert(tmpmap.size() == handleLineNum);
-    for (auto& p: tmpmap) {
-        ofs << p.second << endl;
+    return true;
+}
+
+string LargeFileSorter::NewIntermediateFile(const vector<string>& inputFiles) {
+    std::set<uint64_t> inputDevices;
+    for (const string& file : inputFiles) {
+        uint64_t device = 0;
+        if (getDevice(file, device)) {
+            inputDevices.insert(device);
+        }
     }
-    ofs.flush();
-    ofs.close();
-    {
-        lock_guard lockGuard(mutex_);
-        taskList_.emplace_back(
-                outputFile,
-                Task::TASK_TYPE_MERGE,
-                Task::TASK_STATE_WAIT_START
-                );
-        taskList_[sortTaskId].SetTaskFinish(true);
-        freeThreadIdsList_.push_back(threadId);
+    lock_guard<mutex> lockGuard(workDirMutex_);
+    //output is written while inputs are read, so it goes to another device if there is any
+    vector<WorkDir*> candidates;
+    for (WorkDir& workDir : workDirs_) {
+        if (inputDevices.count(workDir.device_) == 0) {
+            candidates.push_back(&workDir);
+        }
+    }
+    if (candidates.empty()) {
+        for (WorkDir& workDir : workDirs_) {
+            candidates.push_back(&workDir);
+        }
+    }
+    //smooth weighted round robin, so that files are spread evenly and in proportion to free space
+    int64_t totalWeight = 0;
+    WorkDir* picked = nullptr;
+    for (WorkDir* workDir : candidates) {
+        workDir->currentWeight_ += workDir->weight_;
+        totalWeight += workDir->weight_;
+        if (nullptr == picked || workDir->currentWeight_ > picked->currentWeight_) {
+            picked = workDir;
+        }
+    }
+    picked->currentWeight_ -= totalWeight;
+    return picked->path_ + "sorted_" + std::to_string(intermediateFileNum_.fetch_add(1));
+}
+
+bool LargeFileSorter::SortInMemory(const string& largeFile,uint32_t sortThreadNum,const KeyedLineConsumer& output) {
+    uint64_t bTime = TimeUtility::CurrentTimeInMs();
+    TLOG_LOG(DEBUG,"begin to sort file:[%s] in memory",largeFile.c_str());
+    //whole file is read into one buffer, lines are sorted as records pointing into it
+    string buffer;
+    if (!readWholeFile(largeFile, buffer)) {
+        TLOG_LOG(ERROR, "Error!!! Failed to read file:[%s] to sort", largeFile.c_str());
+        return false;
+    }
+    bool isRecord = COMBINE_FUNC_NONE != combineFunc_;
+    vector<LineRecord> records;
+    records.reserve(std::count(buffer.begin(), buffer.end(), '\n') + 1);
+    size_t pos = 0;
+    while (pos < buffer.size()) {
+        size_t end = buffer.find('\n', pos);
+        if (end == string::npos) {
+            end = buffer.size();
+        }
+        LineRecord record;
+        record.lineOffset_ = pos;
+        record.lineLen_ = end - pos;
+        record.keyPrefix_ = 0;
+        const char* key = nullptr;
+        size_t keyLen = 0;
+        findKey(buffer.data() + pos, end - pos, isRecord, key, keyLen);
+        record.keyOffset_ = key - (buffer.data() + pos);
+        record.keyLen_ = keyLen;
+        pos = end + 1;
+        inputLineNum_.fetch_add(1);
+        if (!isOutputEmptyLine_ && 0 == record.keyLen_) {
+            abandonLineNum_.fetch_add(1);
+            continue;
+        }
+        for (uint32_t i = 0; i < 8; ++i) {
+            record.keyPrefix_ = (record.keyPrefix_ << 8) | (i < record.keyLen_ ? (uint8_t)key[i] : 0);
+        }
+        records.push_back(record);
+    }
+    parallelSortLineRecords(records, buffer.data(), sortThreadNum);
+
+    DuplicateKeyCombiner combiner(combineFunc_, output);
+    for (const LineRecord& record : records) {
+        const char* line = buffer.data() + record.lineOffset_;
+        if (!combiner.Add(KeyedLine(line, record.lineLen_, line + record.keyOffset_, record.keyLen_))) {
+            return false;
+        }
+    }
+    if (!combiner.Flush()) {
+        return false;
     }
     uint64_t eTime = TimeUtility::CurrentTimeInMs();
-    TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished sort split file:[%s] with [%lu] line handled in thread %u.",
-             (eTime-bTime),splitFile.c_str(),handleLineNum,threadId);
+    TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished sort file:[%s] in memory with [%zu] line handled by [%u] threads.",
+             (eTime-bTime),largeFile.c_str(),records.size(),sortThreadNum);
+    return true;
+}
+
+bool LargeFileSorter::SplitLargeFile(const string& largeFile, uint64_t fileSize, uint32_t chunkNum, vector<uint64_t>& offsets) {
+    ifstream ifs(largeFile, std::ios::in | std::ios::binary);
+    if (!ifs) {
+        return false;
+    }
+    //chunk ends after the first line feed from its evenly spaced offset, which costs a seek for every chunk
+    offsets.push_back(0);
+    string line;
+    for (uint32_t i = 1; i < chunkNum; ++i) {
+        uint64_t offset = std::max(offsets.back(), fileSize * i / chunkNum);
+        ifs.clear();
+        ifs.seekg(offset);
+        if (offset > 0 && getline(ifs, line) && !ifs.eof()) {
+            offset = ifs.tellg();
+        }
+        else {
+            offset = fileSize;
+        }
+        //a line longer than chunk gives fewer chunks
+        if (offset > offsets.back() && offset < fileSize) {
+            offsets.push_back(offset);
+        }
+    }
+    offsets.push_back(fileSize);
     return true;
 }
 
@@ -265,292 +1193,394 @@ bool LargeFileSorter::Check() {
         TLOG_LOG(ERROR,"large file:[%s] does not exist!", largeFilePath_.c_str());
         return false;
     }
-    if (!FileUtility::IsDirExists(workDirPath_)) {
-        TLOG_LOG(ERROR,"workDir directory:[%s] does not exist!", workDirPath_.c_str());
+    if (workDirPaths_.empty()) {
+        TLOG_LOG(ERROR,"no workDir directory is given!");
         return false;
     }
+    for (const string& workDirPath : workDirPaths_) {
+        if (!FileUtility::IsDirExists(workDirPath)) {
+            TLOG_LOG(ERROR,"workDir directory:[%s] does not exist!", workDirPath.c_str());
+            return false;
+        }
+        if (std::count(workDirPaths_.begin(), workDirPaths_.end(), workDirPath) > 1) {
+            TLOG_LOG(ERROR,"workDir directory:[%s] is duplicated!", workDirPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (FileUtility::IsDirExists(resultFilePath_)) {
-        TLOG_LOG(ERROR,"result file:[%s] is a directory,please check!", resultFilePath_.c_str());
+bool LargeFileSorter::SampleLargeFile(const string& largeFile, vector<string>& splitters, uint64_t& fileSize, uint64_t& avgLineLen) {
+    ifstream ifs(largeFile, std::ios::in | std::ios::binary);
+    if (!ifs) {
         return false;
     }
-    if (FileUtility::IsFileExists(resultFilePath_)) {
-        TLOG_LOG(ERROR,"result file:[%s] already exist,please check!", resultFilePath_.c_str());
-        return false;
+    ifs.seekg(0, std::ios::end);
+    fileSize = ifs.tellg();
+    //line starting after every evenly spaced offset is sampled, which costs a few seeks but no pass
+    uint64_t sampleNum = (uint64_t)splitFileNum_ * SPLIT_SAMPLE_NUM_PER_FILE;
+    vector<string> samples;
+    uint64_t sampleLineNum = 0, sampleLineLen = 0;
+    string line;
+    const char* key = nullptr;
+    size_t keyLen = 0;
+    for (uint64_t i = 0; i < sampleNum && fileSize > 0; ++i) {
+        uint64_t offset = fileSize * i / sampleNum;
+        ifs.clear();
+        ifs.seekg(offset);
+        if (offset > 0 && !getline(ifs, line)) {
+            continue;
+        }
+        if (!getline(ifs, line)) {
+            continue;
+        }
+        ++sampleLineNum;
+        sampleLineLen += line.size() + 1;
+        findKey(line.data(), line.size(), COMBINE_FUNC_NONE != combineFunc_, key, keyLen);
+        if (!isOutputEmptyLine_ && 0 == keyLen) continue;
+        samples.emplace_back(key, keyLen);
+    }
+    avgLineLen = std::max(1ul, sampleLineLen / std::max(1ul, sampleLineNum));
+    std::sort(samples.begin(), samples.end());
+    for (uint32_t i = 1; i < splitFileNum_ && !samples.empty(); ++i) {
+        const string& splitter = samples[samples.size() * i / splitFileNum_];
+        //lots of the same key gives fewer key ranges
+        if (splitters.empty() || splitters.back() < splitter) {
+            splitters.push_back(splitter);
+        }
     }
     return true;
 }
 
-bool LargeFileSorter::SplitLargeFile(size_t splitTaskId,uint32_t threadId) {
-    uint64_t bTime = TimeUtility::CurrentTimeInMs();
-    Task splitTask ;
-    {
-        lock_guard lockGuard(mutex_);
-        splitTask = taskList_[splitTaskId];
-    }
-    TLOG_LOG(DEBUG,"begin to split large file:[%s] in thread %u",splitTask.GetFile().c_str(),threadId);
-    string largeFile = splitTask.GetFile();
-    ifstream ifs(largeFile);
-    if (!ifs) {
-        TLOG_LOG(ERROR, "Error!!! Failed to open large file:[%s]", largeFile.c_str());
-        {
-            lock_guard lockGuard(mutex_);
-            taskList_[splitTaskId].SetTaskFinish(false);
-            freeThreadIdsList_.push_back(threadId);
+///line in heap of replacement selection, ordered by run first and then key
+struct RunLine {
+    uint32_t    run_;
+    uint32_t    keyOffset_;
+    uint32_t    keyLen_;
+    ///first 8 bytes of key in big endian
+    uint64_t    keyPrefix_;
+    ///input order, so that lines of the same key keep it in run
+    uint64_t    seq_;
+    string      line_;
+};
+
+///greater to make a min heap by std heap functions
+class RunLineGreater {
+public:
+    bool operator()(const RunLine& lhs, const RunLine& rhs) const {
+        if (lhs.run_ != rhs.run_) {
+            return lhs.run_ > rhs.run_;
         }
-        return false;
+        if (lhs.keyPrefix_ != rhs.keyPrefix_) {
+            return lhs.keyPrefix_ > rhs.keyPrefix_;
+        }
+        int ret = compareKey(lhs.line_.data() + lhs.keyOffset_, lhs.keyLen_, rhs.line_.data() + rhs.keyOffset_, rhs.keyLen_);
+        return 0 != ret ? ret > 0 : lhs.seq_ > rhs.seq_;
     }
-    string outputDir = workDirPath_ + "/" + randomTmpDirName_ + "/";
-    vector<std::shared_ptr<ofstream> > ofsVecs;
-    vector<uint64_t> linesNumVecs;
-    vector<string> splitFileNamesVec;
-    for (uint32_t fileId = 0; fileId < splitFileNum_; ++fileId) {
-        ostringstream oss;
-        oss << fileId;
-        string splitFile = outputDir + oss.str();
-        assert(!FileUtility::IsFileExists(splitFile));
-        shared_ptr<ofstream> ofs = std::make_shared<ofstream>(splitFile);
-        if (!ofs->operator bool()) {
-            TLOG_LOG(ERROR, "Error!!! Failed to open split file:[%s]", splitFile.c_str());
-            {
-                lock_guard lockGuard(mutex_);
-                taskList_[splitTaskId].SetTaskFinish(false);
-                freeThreadIdsList_.push_back(threadId);
+};
+
+///writes lines of a run in key order to one file per key range
+class PartitionedRunWriter {
+public:
+    PartitionedRunWriter(const vector<string>& splitters, uint64_t order, vector<LargeFileSorter::SortedFile>& runFiles, bool isChecksum)
+    : splitters_(splitters)
+    , order_(order)
+    , runFiles_(runFiles)
+    , partition_(0)
+    , writer_(isChecksum)
+    {}
+public:
+    ///'newFile' is called for name of file when a key range gets its first line
+    template <typename NewFileFunc>
+    bool Write(const KeyedLine& line, NewFileFunc newFile) {
+        //lines come in key order, so that key ranges are passed one by one
+        while (partition_ < splitters_.size()
+               && compareKey(line.key_, line.keyLen_, splitters_[partition_].data(), splitters_[partition_].size()) >= 0) {
+            if (!Finish()) {
+                return false;
             }
+            ++partition_;
+        }
+        if (!writer_.IsOpen()) {
+            file_ = newFile();
+            if (!writer_.Open(file_)) {
+                return false;
+            }
+        }
+        return writer_.Write(line);
+    }
+    ///close file of current key range
+    bool Finish() {
+        if (!writer_.IsOpen()) {
+            return true;
+        }
+        if (!writer_.Close()) {
             return false;
         }
-        ofsVecs.push_back(ofs);
-        linesNumVecs.push_back(0);
-        splitFileNamesVec.push_back(splitFile);
+        runFiles_.push_back(LargeFileSorter::SortedFile{file_, partition_, order_});
+        return true;
     }
-    string line,trimedLine;
-    while (getline(ifs, line)) {
+    const string& GetFile() const { return file_; }
+private:
+    const vector<string>&                   splitters_;
+    uint64_t                                order_;
+    vector<LargeFileSorter::SortedFile>&    runFiles_;
+    uint32_t                                partition_;
+    string                                  file_;
+    RunFileWriter                           writer_;
+};
+TYPEDEF_PTR(PartitionedRunWriter);
+
+bool LargeFileSorter::GenerateRuns(const Task& generateTask,uint32_t threadId,vector<SortedFile>& runFiles) {
+    uint64_t bTime = TimeUtility::CurrentTimeInMs();
+    TLOG_LOG(DEBUG,"begin to generate sorted runs of large file:[%s] chunk:[%lu, %lu) in thread %u",generateTask.GetFile().c_str(),
+             generateTask.GetBeginOffset(),generateTask.GetEndOffset(),threadId);
+    string largeFile = generateTask.GetFile();
+    bool isRecord = COMBINE_FUNC_NONE != combineFunc_;
+    BufferedLineReader reader(READ_BUFFER_SIZE, isRecord);
+    if (!reader.Open(largeFile, generateTask.GetBeginOffset(), generateTask.GetEndOffset())) {
+        TLOG_LOG(ERROR, "Error!!! Failed to open large file:[%s]", largeFile.c_str());
+        return false;
+    }
+    //heap is lines[0, heapSize), lines popped after it are reused to keep their string buffers
+    vector<RunLine> lines;
+    size_t heapSize = 0;
+    uint64_t heapMemory = 0;
+    RunLineGreater greater;
+    uint32_t curRun = 0;
+    //runs of a chunk are ordered after runs of chunks before it, so that lines of the same key keep input order
+    uint64_t chunkOrder = generateTask.GetOrder() << 32;
+    //chunks are generated in parallel and share memory budget
+    uint64_t heapMemoryBudget = memoryBudget_ / threadNum_;
+    string lastKey;
+    bool hasLastKey = false;
+    uint64_t seq = 0;
+    PartitionedRunWriterPtr writer = std::make_shared<PartitionedRunWriter>(splitters_, chunkOrder | curRun, runFiles, isRunChecksum_);
+    vector<string> inputFiles(1, largeFile);
+    auto newFile = [this, &inputFiles]() { return NewIntermediateFile(inputFiles); };
+    //lines of the same key are popped one by one in a run, so they are combined before written
+    KeyedLineConsumer writeLine = [&](const KeyedLine& line) { return writer->Write(line, newFile); };
+    DuplicateKeyCombiner combiner(combineFunc_, writeLine);
+    //output smallest line of heap to its run
+    auto popLine = [&]() -> bool {
+        std::pop_heap(lines.begin(), lines.begin() + heapSize, greater);
+        --heapSize;
+        RunLine& minLine = lines[heapSize];
+        heapMemory -= sizeof(RunLine) + minLine.line_.size();
+        if (minLine.run_ != curRun) {
+            if (!combiner.Flush() || !writer->Finish()) {
+                return false;
+            }
+            curRun = minLine.run_;
+            writer = std::make_shared<PartitionedRunWriter>(splitters_, chunkOrder | curRun, runFiles, isRunChecksum_);
+        }
+        const char* key = minLine.line_.data() + minLine.keyOffset_;
+        lastKey.assign(key, minLine.keyLen_);
+        hasLastKey = true;
+        return combiner.Add(KeyedLine(minLine.line_.data(), minLine.line_.size(), key, minLine.keyLen_));
+    };
+    while (reader.Next()) {
         inputLineNum_.fetch_add(1);
-        trimedLine = StringUtil::TrimString(line);
-        if (!isOutputEmptyLine_ && trimedLine.empty()) {
+        if (!isOutputEmptyLine_ && 0 == reader.GetKeyLen()) {
             abandonLineNum_.fetch_add(1);
             continue;
         }
-        uint64_t hash = DBKeyHash<string>()(trimedLine);
-        uint32_t fileId = hash % splitFileNum_;
-        (*ofsVecs[fileId]) << line << endl;
-        linesNumVecs[fileId]++;
+        //make room for the line within memory budget
+        uint64_t lineMemory = sizeof(RunLine) + reader.GetLineLen();
+        while (heapSize > 0 && heapMemory + lineMemory > heapMemoryBudget) {
+            if (!popLine()) {
+                TLOG_LOG(ERROR, "Error!!! Failed to write sorted run file:[%s]", writer->GetFile().c_str());
+                return false;
+            }
+        }
+        if (heapSize == lines.size()) {
+            lines.emplace_back();
+        }
+        RunLine& line = lines[heapSize];
+        line.line_.assign(reader.GetLine(), reader.GetLineLen());
+        line.keyOffset_ = reader.GetKey() - reader.GetLine();
+        line.keyLen_ = reader.GetKeyLen();
+        line.keyPrefix_ = 0;
+        const uint8_t* key = (const uint8_t*)reader.GetKey();
+        for (uint32_t i = 0; i < 8; ++i) {
+            line.keyPrefix_ = (line.keyPrefix_ << 8) | (i < line.keyLen_ ? key[i] : 0);
+        }
+        line.seq_ = seq++;
+        //line smaller than the last output one can not join current run any more
+        bool isNextRun = hasLastKey && compareKey(reader.GetKey(), reader.GetKeyLen(), lastKey.data(), lastKey.size()) < 0;
+        line.run_ = isNextRun ? curRun + 1 : curRun;
+        ++heapSize;
+        std::push_heap(lines.begin(), lines.begin() + heapSize, greater);
+        heapMemory += lineMemory;
     }
-    for (auto &a: ofsVecs) {
-        a->flush();
-        a->close();
+    while (heapSize > 0) {
+        if (!popLine()) {
+            TLOG_LOG(ERROR, "Error!!! Failed to write sorted run file:[%s]", writer->GetFile().c_str());
+            return false;
+        }
+    }
+    if (!combiner.Flush() || !writer->Finish()) {
+        TLOG_LOG(ERROR, "Error!!! Failed to write sorted run file:[%s]", writer->GetFile().c_str());
+        return false;
     }
     TLOG_LOG(DEBUG, "Totally read:[%lu] lines,abandon:[%lu] empty lines with ratio:[%lf].", inputLineNum_.load(),
              abandonLineNum_.load(),
              ((inputLineNum_ == 0) ? 0 : (1.0f * abandonLineNum_ / inputLineNum_)));
-
-    {
-        lock_guard lockGuard(mutex_);
-        for (uint32_t fileId = 0; fileId < ofsVecs.size(); ++fileId) {
-            TLOG_LOG(DEBUG, "[%lu] lines outputted for split file:[%s]", linesNumVecs[fileId], splitFileNamesVec[fileId].c_str());
-            if (linesNumVecs[fileId] > 0) {
-                taskList_.emplace_back(splitFileNamesVec[fileId],
-                                       Task::TASK_TYPE_SORT,
-                                       Task::TASK_STATE_WAIT_START);
-            }
-            else {
-                FileUtility::DeleteLocalFile(splitFileNamesVec[fileId]);
-            }
-        }
-        taskList_[splitTaskId].SetTaskFinish(true);
-        freeThreadIdsList_.push_back(threadId);
-    }
     uint64_t eTime = TimeUtility::CurrentTimeInMs();
-    TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished split large file task for:[%s] in thread %u.",
-             (eTime-bTime),splitTask.GetFile().c_str(),threadId);
+    TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished generate [%u] sorted runs of large file:[%s] chunk into [%zu] files of key ranges in thread %u.",
+             (eTime-bTime),(0 == seq ? 0 : curRun + 1),largeFile.c_str(),runFiles.size(),threadId);
     return true;
 }
 
-struct SortedFileLineScanner {
-    SortedFileLineScanner(shared_ptr<ifstream> ifs,const string& file,const string& curLine, const string& trimedLine)
-    : ifs_(ifs)
-    , file_(file)
-    , curLine_(curLine)
-    , trimedLine_(trimedLine)
+///tournament tree of losers over readers of sorted runs, which finds the next smallest line of k runs by
+///log(k) comparisons along one leaf to root path. Equal keys are taken from the former run first.
+class SortedRunLoserTree {
+public:
+    ///readers must not be empty
+    SortedRunLoserTree(const vector<RunFileReaderPtr>& readers)
+    : readers_(readers)
+    , tree_(readers.size(), 0)
     {
+        size_t k = readers_.size();
+        assert(k > 0);
+        //winners of every node, leaves are k..2k-1
+        vector<size_t> winners(2 * k);
+        for (size_t i = 0; i < k; ++i) {
+            winners[k + i] = i;
+        }
+        for (size_t n = k - 1; n >= 1; --n) {
+            size_t lhs = winners[2 * n], rhs = winners[2 * n + 1];
+            bool isLhsWin = isLess(lhs, rhs);
+            winners[n] = isLhsWin ? lhs : rhs;
+            tree_[n] = isLhsWin ? rhs : lhs;
+        }
+        tree_[0] = winners[1];
     }
-
-    shared_ptr<ifstream>     ifs_;
-    string                   file_;
-    string                   curLine_;
-    string                   trimedLine_;
-};
-TYPEDEF_PTR(SortedFileLineScanner);
-
-class SortedFileLineScannerPtrCompare {
 public:
-    bool operator()(const SortedFileLineScannerPtr& lhs,const SortedFileLineScannerPtr& rhs) const {
-        return lhs->trimedLine_ > rhs->trimedLine_;
+    ///run of smallest line, whose reader is ended if all runs are
+    size_t GetWinner() const { return tree_[0]; }
+    ///replay winner after its reader moved to next line
+    void Replay() {
+        size_t k = readers_.size();
+        size_t winner = tree_[0];
+        for (size_t n = (winner + k) / 2; n >= 1; n /= 2) {
+            if (isLess(tree_[n], winner)) {
+                std::swap(tree_[n], winner);
+            }
+        }
+        tree_[0] = winner;
+    }
+private:
+    bool isLess(size_t lhs, size_t rhs) const {
+        const RunFileReader& lhsReader = *readers_[lhs];
+        const RunFileReader& rhsReader = *readers_[rhs];
+        if (lhsReader.IsEnd() || rhsReader.IsEnd()) {
+            return !lhsReader.IsEnd() || (rhsReader.IsEnd() && lhs < rhs);
+        }
+        int ret = compareKey(lhsReader.GetKey(), lhsReader.GetKeyLen(), rhsReader.GetKey(), rhsReader.GetKeyLen());
+        return 0 != ret ? ret < 0 : lhs < rhs;
     }
+private:
+    const vector<RunFileReaderPtr>&         readers_;
+    ///overall winner at 0, loser of every inner node at 1..k-1
+    vector<size_t>                          tree_;
 };
 
-bool LargeFileSorter::MergeSortedFile(const vector<size_t>& mergeTaskIds,uint32_t threadId) {
-    uint64_t bTime = TimeUtility::CurrentTimeInMs();
-    string fileNames;
-    {
-        lock_guard lockGuard(mutex_);
-        for (size_t taskId: mergeTaskIds) {
-            fileNames += taskList_[taskId].GetFile();
-            fileNames += "\n";
+bool LargeFileSorter::MergeSortedFiles(const vector<string>& mergeFiles, const KeyedLineConsumer& output) {
+    //merges run in parallel and share memory budget, read buffers of all runs of a merge share its part
+    uint64_t mergeMemoryBudget = memoryBudget_ / threadNum_;
+    uint64_t readBufferSize = std::min(MAX_MERGE_READ_BUFFER_SIZE,
+                                       std::max(MIN_MERGE_READ_BUFFER_SIZE, mergeMemoryBudget / mergeFiles.size()));
+    vector<RunFileReaderPtr> readers;
+    for(const string& file : mergeFiles) {
+        RunFileReaderPtr reader = std::make_shared<RunFileReader>(readBufferSize, isRunChecksum_);
+        if (!reader->Open(file)) {
+            TLOG_LOG(ERROR,"Failed to open sorted file:[%s] to merge",file.c_str());
+            return false;
         }
+        //sorted file may be empty when all lines are empty and ignored
+        reader->Next();
+        readers.push_back(reader);
     }
-    TLOG_LOG(DEBUG,"begin to merge [%zu] sorted files[%s]: in thread %u",mergeTaskIds.size(),fileNames.c_str(),threadId);
-    if (mergeTaskIds.size() == 1) {
-        {
-            bool allTaskFinished = true;
-            {
-                lock_guard lockGuard(mutex_);
-                for (size_t i = 0; i < taskList_.size(); ++i) {
-                    if (i == mergeTaskIds[0]) continue;
-                    if (!taskList_[i].IsFinished()) {
-                        allTaskFinished = false;
-                        break;
-                    }
-                }
-            }
-            if (allTaskFinished) {
-                {
-                    lock_guard lockGuard(mutex_);
-                    string srcFileName = taskList_[mergeTaskIds[0] ].GetFile();
-
-                    //transfer srcFileName to resultFilePath_
-                    std::ifstream in(srcFileName, std::ios::in | std::ios::binary);
-                    std::ofstream out(resultFilePath_, std::ios::out | std::ios::binary);
-                    out << in.rdbuf();
-                    out.flush();
-                    out.close();
-                    in.close();
-
-                    taskList_[mergeTaskIds[0] ].SetTaskFinish(true);
-                    freeThreadIdsList_.push_back(threadId);
-                }
-                uint64_t eTime = TimeUtility::CurrentTimeInMs();
-                TLOG_LOG(DEBUG,"Only 1 files need to merge.Copy it as final result file:[%s],totally consumed:[%lu]ms in thread %u.",
-                         resultFilePath_.c_str(), (eTime-bTime),threadId);
-                return true;
-            }
-            else {
-                {
-                    lock_guard lockGuard(mutex_);
-                    taskList_[mergeTaskIds[0] ].SetTaskWaitStart();
-                    freeThreadIdsList_.push_back(threadId);
-                }
-                uint64_t eTime = TimeUtility::CurrentTimeInMs();
-                TLOG_LOG(DEBUG,"Only 1 merge task,wait other merger together,totally consumed:[%lu]ms in thread %u.",
-                         (eTime-bTime),threadId);
-                return true;
-            }
+    SortedRunLoserTree loserTree(readers);
+    //lines of the same key come from runs in input order, so they are combined again across runs
+    DuplicateKeyCombiner combiner(combineFunc_, output);
+    while (!readers[loserTree.GetWinner()]->IsEnd()) {
+        RunFileReader& reader = *readers[loserTree.GetWinner()];
+        if ((isOutputEmptyLine_ || reader.GetKeyLen() > 0) && !combiner.Add(reader.GetKeyedLine())) {
+            return false;
+        }
+        //winner of a key equal to the one before is still the winner, ties go to the former run
+        if (!reader.Next() || !reader.IsSameKey()) {
+            loserTree.Replay();
         }
     }
+    for (const RunFileReaderPtr& reader : readers) {
+        if (reader->IsFailed()) {
+            return false;
+        }
+    }
+    if (!combiner.Flush()) {
+        return false;
+    }
+    //merged files are not needed any more
+    readers.clear();
+    for (const string& file: mergeFiles) {
+        FileUtility::DeleteLocalFile(file);
+    }
+    return true;
+}
 
-    string outputDir = workDirPath_ + "/" + randomTmpDirName_ + "/";
-    string outputFile = outputDir + TimeUtility::CurrentTimeInSecondsReadable() + "_" +  Random<uint64_t>::RandomString(20);
+bool LargeFileSorter::MergeSortedFile(const Task& mergeTask,uint32_t threadId,SortedFile& mergedFile) {
+    uint64_t bTime = TimeUtility::CurrentTimeInMs();
+    const vector<string>& mergeFiles = mergeTask.GetFiles();
+    string fileNames;
+    for (const string& file: mergeFiles) {
+        fileNames += file;
+        fileNames += "\n";
+    }
+    TLOG_LOG(DEBUG,"begin to merge [%zu] sorted files[%s]: in thread %u",mergeFiles.size(),fileNames.c_str(),threadId);
+
+    string outputFile = NewIntermediateFile(mergeFiles);
     assert(!FileUtility::IsFileExists(outputFile));
-    ofstream  ofs(outputFile);
-    if (!ofs) {
+    RunFileWriter writer(isRunChecksum_);
+    if (!writer.Open(outputFile)) {
         TLOG_LOG(ERROR,"Failed to open intermediate result file:[%s]",outputFile.c_str());
-        {
-            lock_guard lockGuard(mutex_);
-            for (auto id: mergeTaskIds) {
-                taskList_[id].SetTaskFinish(false);
-            }
-            freeThreadIdsList_.push_back(threadId);
-        }
         return false;
     }
-    vector<SortedFileLineScannerPtr> sortScanners;
-    {
-        lock_guard lockGuard(mutex_);
-        for(auto id : mergeTaskIds) {
-            shared_ptr<ifstream> tmpifs = std::make_shared<ifstream>(taskList_[id].GetFile());
-            assert(tmpifs);
-            string curLine;
-            assert(getline(*tmpifs.get(),curLine));
-            sortScanners.push_back(std::make_shared<SortedFileLineScanner>(
-                    tmpifs,
-                    taskList_[id].GetFile(),
-                    curLine,
-                    StringUtil::TrimString(curLine)
-            ));
-        }
-    }
-    //use heap to merge sort files
-    make_heap(sortScanners.begin(),sortScanners.end(),SortedFileLineScannerPtrCompare{});
-    string tmpCurLine, tmpOutputLine;
     uint64_t handleLineNum = 0;
-    while (!sortScanners.empty()) {
+    bool isOk = MergeSortedFiles(mergeFiles, [&writer, &handleLineNum](const KeyedLine& line) {
         ++handleLineNum;
-        pop_heap(sortScanners.begin(),sortScanners.end(),SortedFileLineScannerPtrCompare{});
-        SortedFileLineScannerPtr minElem = sortScanners.back();
-        sortScanners.pop_back();
-
-        if (isOutputEmptyLine_ || !minElem->trimedLine_.empty()) {
-            ofs << minElem->curLine_ << endl;
-        }
-        if (getline(*(minElem->ifs_),tmpCurLine)) {
-            minElem->curLine_ = tmpCurLine;
-            minElem->trimedLine_ = StringUtil::TrimString(tmpCurLine);
-            sortScanners.push_back(minElem);
-            push_heap(sortScanners.begin(),sortScanners.end(),SortedFileLineScannerPtrCompare{});
-        }
-    }
-    ofs.flush();
-    ofs.close();
-    {
-        lock_guard lockGuard(mutex_);
-        taskList_.emplace_back(
-                outputFile,Task::TASK_TYPE_MERGE,Task::TASK_STATE_WAIT_START );
-        for (auto id: mergeTaskIds) {
-            taskList_[id].SetTaskFinish(true);
-        }
-        freeThreadIdsList_.push_back(threadId);
+        return writer.Write(line);
+    });
+    if (!writer.Close() || !isOk) {
+        TLOG_LOG(ERROR,"Failed to write intermediate result file:[%s]",outputFile.c_str());
+        return false;
     }
+    mergedFile = SortedFile{outputFile, mergeTask.GetPartition(), mergeTask.GetOrder()};
     uint64_t eTime = TimeUtility::CurrentTimeInMs();
     TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished merge sorted files lines:[%lu] to intermediate file:[%s] in thread %u.",
              (eTime-bTime),handleLineNum,outputFile.c_str(),threadId);
     return true;
 }
 
-uint32_t LargeFileSorter::CountRunningOrWaitStartTasks() {
-    uint32_t count = 0;
-    for (auto& task: taskList_) {
-        if (task.GetTaskState() == Task::TASK_STATE_WAIT_START
-        || task.GetTaskState() == Task::TASK_STATE_RUNNING)
-            ++count;
-    }
-    return count;
-}
-
-bool LargeFileSorter::CheckIfFinishedAllTasks() {
-    bool allTaskFinished = true;
-    bool hasFailedTask = false;
-
-    lock_guard lockGuard(mutex_);
-    for (auto& task: taskList_) {
-        if (!hasFailedTask && task.IsFailed()) {
-            hasFailedTask = true;
-        }
-        if (!task.IsFinished()) {
-            allTaskFinished = false;
-            break;
-        }
-    }
-    if (allTaskFinished) {
-        if (hasFailedTask) {
-            TLOG_LOG(INFO,"All works done but failed to sort large file:[%s]!",largeFilePath_.c_str());
-            return false;
-        }
-        else {
-            TLOG_LOG(DEBUG,"Successfully finished all large file sort processing totally for input file:[%s] with result output file:[%s]."
-            ,largeFilePath_.c_str(), resultFilePath_.c_str());
-            return true;
-        }
+bool LargeFileSorter::OutputMergedFile(const Task& outputTask,uint32_t threadId) {
+    uint64_t bTime = TimeUtility::CurrentTimeInMs();
+    SortedBlockQueue& queue = *outputQueues_[outputTask.GetPartition()];
+    SortedBlockWriter writer(queue);
+    bool isOk = MergeSortedFiles(outputTask.GetFiles(),
+                                 [&writer](const KeyedLine& line) { return writer.Write(line); })
+                && writer.Flush();
+    queue.Close();
+    if (!isOk) {
+        TLOG_LOG(ERROR,"Failed to output the last merge of [%zu] sorted files of key range:[%u]",
+                 outputTask.GetFiles().size(),outputTask.GetPartition());
+        return false;
     }
+    uint64_t eTime = TimeUtility::CurrentTimeInMs();
+    TLOG_LOG(DEBUG,"Totally consumed:[%lu]ms,Finished the last merge of [%zu] sorted files of key range:[%u] in thread %u.",
+             (eTime-bTime),outputTask.GetFiles().size(),outputTask.GetPartition(),threadId);
+    return true;
 }
 
 COMMON_END_NAMESPACE
\ No newline at end of file
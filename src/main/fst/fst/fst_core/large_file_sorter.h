@@ -7,14 +7,34 @@
   *Version:        1.0
   *Date:           5/4/21
   *Description:    files defines class to implements sort large file data.
-  *                It directory reads all lines of file data and sort it in memory
-  *                if line number of input large file is smaller than some specified limit
-  *                threshold (such as 1000000 lines), and if line number execceeds the limit,
-  *                external disk merge sort will be used:
-  *                1. split large file into many small files by hash every line
-  *                2. read every small file into memory to sort for per thread and re-output to
-  *                   external disk file, use multiple threads.
-  *                3. at last merge the sorted disk file content by multiple ways by multiple threads
+  *                Lines are sampled at evenly spaced file offsets first, which estimates memory
+  *                needed to sort the whole file and picks splitters of disjoint key ranges.
+  *                If the whole file fits in memory budget, it is read into memory and sorted by
+  *                multiple threads directly, otherwise external disk merge sort will be used:
+  *                1. split large file into chunks at line feeds, one for every thread, and generate
+  *                   sorted runs of chunks in parallel by replacement selection, which keeps a heap
+  *                   of lines as large as memory budget shared by threads and gives runs about
+  *                   twice the heap. every run is split into files of key ranges as written.
+  *                2. merge files of every key range by a loser tree, key ranges in parallel, until
+  *                   no more files than merge fan-in are left.
+  *                3. at last merge files of every key range in parallel, each into a bounded queue of
+  *                   blocks, and the queues are drained in order of key ranges into output.
+  *                Intermediate files are binary, whose keys are front coded in checksummed blocks, so
+  *                shared prefixes of neighbour sorted keys are written and read once.
+  *                Lines may be parsed as `key,value` records, so that lines of the same key are combined
+  *                into one while runs are generated and at every merge, which shrinks data as early as
+  *                possible.
+  *                Sorted lines are output to result file, or streamed to a consumer such as fst
+  *                builder without any result file. The last merges run on worker threads and pass
+  *                lines by blocks, so that they overlap with each other and with the consumer.
+  *
+  *                Intermediate files may be striped across work directories of many disks, weighted by
+  *                their free space, and output of a task goes to a disk other than its inputs if any.
+  *
+  *                Tasks of all steps are run by a fixed pool of worker threads, which sleep on a
+  *                condition variable until a task is ready. A task is queued as soon as its inputs
+  *                exist: merges of a key range while runs of other chunks are still generated, as long
+  *                as no file of an unfinished chunk may be ordered between files merged together.
   *
   *                some parameters such as threadNum,splitFileNum,paralledMergeFileNum and so on can be
   *                customized for different performance.
@@ -25,8 +45,12 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <list>
 #include <deque>
+#include <map>
+#include <set>
+#include <functional>
 #include <cassert>
 #include <fstream>
 #include "common/common.h"
@@ -38,15 +62,21 @@
 STD_USE_NAMESPACE;
 COMMON_BEGIN_NAMESPACE
 
+///bounded queue of blocks of sorted lines, see large_file_sorter.cpp
+class SortedBlockQueue;
+TYPEDEF_PTR(SortedBlockQueue);
+///line split at its key passed among steps of sorting, see large_file_sorter.cpp
+struct KeyedLine;
+
 ///Large file sort main class
 class LargeFileSorter {
 public:
     class Task {
     public:
         enum TASK_TYPE_ENUM {
-            TASK_TYPE_SPLIT = 0,   //split large file to smale files by hash
-            TASK_TYPE_SORT,        //sort every split smale file
-            TASK_TYPE_MERGE,       //external multiple ways to merge sorted files
+            TASK_TYPE_GENERATE = 0,   //generate sorted runs of large file split by key range
+            TASK_TYPE_MERGE,          //external multiple ways to merge sorted files
+            TASK_TYPE_OUTPUT,         //the last merge of sorted files of a key range into its output queue
             TASK_TYPE_COUNT
         };
         enum TASK_STATE_ENUM {
@@ -58,10 +88,23 @@ public:
         };
 
         Task() = default;
-        Task(const string& file,TASK_TYPE_ENUM type,TASK_STATE_ENUM state)
-        : file_(file)
+        Task(const string& file,TASK_TYPE_ENUM type,TASK_STATE_ENUM state,uint32_t partition = 0,uint64_t order = 0)
+        : files_(1,file)
+        , taskType_(type)
+        , taskState_(state)
+        , partition_(partition)
+        , order_(order)
+        , beginOffset_(0)
+        , endOffset_(0)
+        {}
+        Task(const vector<string>& files,TASK_TYPE_ENUM type,TASK_STATE_ENUM state,uint32_t partition = 0,uint64_t order = 0)
+        : files_(files)
         , taskType_(type)
         , taskState_(state)
+        , partition_(partition)
+        , order_(order)
+        , beginOffset_(0)
+        , endOffset_(0)
         {}
     public:
         void SetTaskFinish(bool success) { taskState_ = (success?TASK_STATE_SUCCESS:TASK_STATE_FAILED); }
@@ -74,14 +117,51 @@ public:
 
         TASK_STATE_ENUM GetTaskState() const { return taskState_; }
         TASK_TYPE_ENUM GetTaskType() const { return taskType_; }
-        string GetFile() const { return file_; }
+        string GetFile() const { return files_[0]; }
+        ///input files, sorted files to merge together for merge task
+        const vector<string>& GetFiles() const { return files_; }
+        ///index of key range of merge task
+        uint32_t GetPartition() const { return partition_; }
+        ///order of merged file among sorted files of its key range
+        uint64_t GetOrder() const { return order_; }
+        ///byte range [begin, end) of large file chunk of generate task
+        void SetRange(uint64_t beginOffset, uint64_t endOffset) { beginOffset_ = beginOffset; endOffset_ = endOffset; }
+        uint64_t GetBeginOffset() const { return beginOffset_; }
+        uint64_t GetEndOffset() const { return endOffset_; }
 
     private:
-        string                file_;
+        vector<string>        files_;
         TASK_TYPE_ENUM        taskType_;
         TASK_STATE_ENUM       taskState_;
+        uint32_t              partition_;
+        uint64_t              order_;
+        uint64_t              beginOffset_;
+        uint64_t              endOffset_;
     };
     TYPEDEF_PTR(Task);
+
+    ///how lines of the same key are combined into one, lines are parsed as `key,value` unless none
+    enum COMBINE_FUNC_ENUM {
+        ///lines are not parsed and all output, key is the whole trimmed line
+        COMBINE_FUNC_NONE = 0,
+        ///keep the first line of key in input order
+        COMBINE_FUNC_FIRST,
+        ///keep the last line of key in input order
+        COMBINE_FUNC_LAST,
+        ///output `key,value` of sum, min or max of values of key
+        COMBINE_FUNC_SUM,
+        COMBINE_FUNC_MIN,
+        COMBINE_FUNC_MAX,
+    };
+
+    ///sorted file of a key range output by a task
+    struct SortedFile {
+        string      file_;
+        uint32_t    partition_;
+        ///sorted files of a key range are merged in this order, which is their input order, so that
+        ///lines of the same key keep input order
+        uint64_t    order_;
+    };
     /**
      *@brief     Construction method for large file sort main class
      *@param     largeFilePath        --- input large file path
@@ -89,8 +169,8 @@ public:
      *@param     resultFile           ---- result output file,which will store all sorted file data
      *@param     workDirPath          ---- work directory for all processing
      *@param     threadNum            ---- thread numbers used
-     *@param     splitFileNum         ---- how many files of input large file will be split
-     *@param     parallelTaskNum      ---- how many files to external merge once
+     *@param     splitFileNum         ---- how many key ranges sorted runs are split into, merged in parallel
+     *@param     parallelTaskNum      ---- how many files to external merge once, merged by a loser tree
      *@param     isOutputEmptyLine    ---- whether ignore or output the empty line
      *@author    dingbinthu@163.com
      *@date      5/3/21, 12:46 AM
@@ -101,55 +181,158 @@ public:
                     const string& workDirPath = "/tmp",
                     uint32_t threadNum = 4,
                     uint32_t splitFileNum = 6,
-                    uint32_t parallelTaskNum = 3,
+                    uint32_t parallelTaskNum = DEFAULT_MERGE_FAN_IN,
                     bool isOutputEmptyLine = true )
                     : largeFilePath_(largeFilePath)
                     , resultFilePath_(resultFile)
-                    , workDirPath_(workDirPath)
+                    , workDirPaths_(1,workDirPath)
                     , isOutputEmptyLine_(isOutputEmptyLine)
                     , threadNum_(threadNum)
                     , splitFileNum_(splitFileNum)
                     , parallelTaskNum_(parallelTaskNum)
-                    , threadStartedIndex_(0)
+                    , memoryBudget_(DEFAULT_MEMORY_BUDGET)
+                    , combineFunc_(COMBINE_FUNC_NONE)
+                    , isRunChecksum_(true)
+                    , unfinishedTaskNum_(0)
+                    , nextOutputPartition_(0)
+                    , isFailed_(false)
                     {
                         inputLineNum_ = abandonLineNum_ = outputLineNum_ = 0;
+                        intermediateFileNum_ = 0;
                         randomTmpDirName_ = TimeUtility::CurrentTimeInSecondsReadable() + "_" +  Random<uint64_t>::RandomString(8);
                     }
     ~LargeFileSorter() {}
+    ///receives sorted lines one by one without line feed, returns false to stop sorting
+    typedef std::function<bool(const char* line, size_t lineLen)> LineConsumer;
+    ///receives sorted lines between steps of sorting with their keys found already, returns false to stop
+    typedef std::function<bool(const KeyedLine& line)> KeyedLineConsumer;
+    ///sort large file into result file
     bool Run();
+    ///sort large file and stream sorted lines to 'consumer' in the calling thread, result file is not used
+    bool Run(const LineConsumer& consumer);
+    ///memory in bytes to hold lines sorting, input file fits in it is sorted in memory without any run
+    void SetMemoryBudget(uint64_t memoryBudget) { memoryBudget_ = memoryBudget; }
+    ///parse lines as `key,value` and sort by key, lines of the same key are combined by 'combineFunc'
+    void SetCombineFunc(COMBINE_FUNC_ENUM combineFunc) { combineFunc_ = combineFunc; }
+    ///whether blocks of intermediate files are checksummed when written and verified when merged
+    void SetRunChecksum(bool isRunChecksum) { isRunChecksum_ = isRunChecksum; }
+    ///work directories intermediate files are striped across instead of 'workDirPath', such as one per disk
+    void SetWorkDirPaths(const vector<string>& workDirPaths) { workDirPaths_ = workDirPaths; }
+public:
+    static const uint64_t DEFAULT_MEMORY_BUDGET = 1024ul * 1024 * 1024;
+    ///size of buffer input lines are read through
+    static const uint64_t READ_BUFFER_SIZE = 4 * 1024 * 1024;
+    ///size of buffer sorted lines are written through, and of block passed to consumer
+    static const uint64_t WRITE_BUFFER_SIZE = 1024 * 1024;
+    ///intermediate files are front coded in blocks of about this size, every block starts a new prefix
+    static const uint64_t RUN_BLOCK_SIZE = 64 * 1024;
+    ///blocks of sorted lines of every key range merged ahead of consumer
+    static const uint32_t OUTPUT_QUEUE_BLOCK_NUM = 4;
+    ///fewer lines are sorted by one thread
+    static const uint64_t MIN_PARALLEL_SORT_LINE_NUM = 65536;
+    ///lines sampled for every key range to pick splitters
+    static const uint32_t SPLIT_SAMPLE_NUM_PER_FILE = 128;
+    ///sorted files merged at once, so that several TB of runs are merged in one pass
+    static const uint32_t DEFAULT_MERGE_FAN_IN = 256;
+    ///bounds of read buffer of every sorted file merged, which shares memory budget of its merge
+    static const uint64_t MIN_MERGE_READ_BUFFER_SIZE = 64 * 1024;
+    static const uint64_t MAX_MERGE_READ_BUFFER_SIZE = 4 * 1024 * 1024;
 private:
     bool Check();
-    bool CheckIfFinishedAllTasks();
-    bool DispatchTask(Task::TASK_TYPE_ENUM& gotTaskType, vector<size_t>& gotTaskIds);
-
-    //Step1: split large file into small files
-    bool SplitLargeFile(size_t splitTaskId, uint32_t threadId);
-    //Step2: sort every small file in memory
-    bool SortSplitFile(size_t splitTaskId, uint32_t threadId);
-    //Step3: external merge
-    bool MergeSortedFile(const vector<size_t>& mergeTaskIds,uint32_t threadId);
+    ///worker of thread pool, runs ready tasks until all finished or any failed
+    void WorkerLoop(uint32_t threadId);
+    bool RunTask(const Task& task, uint32_t threadId, vector<SortedFile>& outputFiles);
+    ///queue task, caller holds mutex_
+    void AddTask(const Task& task);
+    ///mark task finished and queue tasks depending on its output files, caller holds mutex_
+    void FinishTask(size_t taskId, bool success, const vector<SortedFile>& outputFiles);
+    ///queue merges of sorted files of key range 'partition' when more than merge fan-in, caller holds mutex_
+    void ScheduleMerges(uint32_t partition);
+    ///whether any chunk in (beginChunk, endChunk) is still generating runs, caller holds mutex_
+    bool HasUnfinishedChunkBetween(uint64_t beginChunk, uint64_t endChunk) const;
+    ///queue the last merges of key ranges whose sorted files are all merged but the last, in order of key
+    ///ranges, caller holds mutex_
+    void ScheduleOutputs();
+    ///stop all tasks and output queues after a task failed or consumer stopped, caller holds mutex_
+    void AbortOutputs();
+    ///sort large file in memory, or drain output queues of key ranges in order, output to consumer
+    bool OutputSortedLines(bool isInMemory, const LineConsumer& consumer);
+    ///pass lines of blocks popped from 'queue' to consumer until queue is closed
+    bool ConsumeSortedBlocks(SortedBlockQueue& queue, const LineConsumer& consumer);
+    /**
+     *@brief     sample lines of large file at evenly spaced offsets, which costs a few seeks but no pass
+     *@param     splitters      ---- splitters of key ranges, ranges are [splitters[i-1], splitters[i])
+     *@param     fileSize       ---- size of large file
+     *@param     avgLineLen     ---- average length of lines sampled including line feed, at least 1
+     */
+    bool SampleLargeFile(const string& largeFile, vector<string>& splitters, uint64_t& fileSize, uint64_t& avgLineLen);
+    ///split large file into 'chunkNum' byte ranges ending at line feeds, 'offsets' are their bounds
+    bool SplitLargeFile(const string& largeFile, uint64_t fileSize, uint32_t chunkNum, vector<uint64_t>& offsets);
+    ///stat devices and free space of work directories
+    bool InitWorkDirs();
+    ///new file in work directory picked by free space, which is on a device other than 'inputFiles' if any
+    string NewIntermediateFile(const vector<string>& inputFiles);
 
-    uint32_t CountRunningOrWaitStartTasks();
+    //Step1: generate sorted runs of a large file chunk by replacement selection, every run split by key range
+    bool GenerateRuns(const Task& generateTask, uint32_t threadId, vector<SortedFile>& runFiles);
+    //or sort large file fits in memory by 'sortThreadNum' threads
+    bool SortInMemory(const string& largeFile, uint32_t sortThreadNum, const KeyedLineConsumer& output);
+    //Step2: external merge of sorted files of the same key range
+    bool MergeSortedFile(const Task& mergeTask, uint32_t threadId, SortedFile& mergedFile);
+    //Step3: the last merge of sorted files of a key range into its output queue
+    bool OutputMergedFile(const Task& outputTask, uint32_t threadId);
+    ///merge sorted files by a loser tree to 'output' and delete them
+    bool MergeSortedFiles(const vector<string>& mergeFiles, const KeyedLineConsumer& output);
 private:
     string            largeFilePath_;
     string            resultFilePath_;
-    string            workDirPath_;
+    vector<string>    workDirPaths_;
     bool              isOutputEmptyLine_;
 
     atomic<uint64_t>          inputLineNum_;
     atomic<uint64_t>          abandonLineNum_;
     atomic<uint64_t>          outputLineNum_;
+    ///sequence of intermediate file names
+    atomic<uint64_t>          intermediateFileNum_;
 
     uint32_t          threadNum_;
     uint32_t          splitFileNum_;
     uint32_t          parallelTaskNum_;
+    uint64_t          memoryBudget_;
+    COMBINE_FUNC_ENUM combineFunc_;
+    bool              isRunChecksum_;
 
     string            randomTmpDirName_;
+    vector<string>    splitters_;
+
+    ///work directory, which is picked by smooth weighted round robin of weight of its free space
+    struct WorkDir {
+        string      path_;
+        uint64_t    device_;
+        int64_t     weight_;
+        int64_t     currentWeight_;
+    };
+    vector<WorkDir>   workDirs_;
+    mutex             workDirMutex_;
 
+    ///all tasks ever added, guarded by mutex_ as below
     vector<Task>       taskList_;
-    deque<uint32_t>    freeThreadIdsList_;
+    deque<size_t>      readyTaskIds_;
+    ///sorted files not merged yet of every key range by their order
+    vector<map<uint64_t,string> > partitionSortedFiles_;
+    ///merge tasks queued or running of every key range
+    vector<uint32_t>   partitionUnfinishedTaskNum_;
+    ///chunks whose generate tasks are queued or running, which output sorted files of all key ranges at last
+    set<uint64_t>      unfinishedChunks_;
+    ///tasks queued or running
+    uint32_t           unfinishedTaskNum_;
+    ///output queue of every key range, filled by its last merge
+    vector<SortedBlockQueuePtr> outputQueues_;
+    ///key ranges before it have their last merges queued
+    uint32_t           nextOutputPartition_;
+    bool               isFailed_;
     mutex              mutex_;
-    atomic<uint32_t>   threadStartedIndex_;
+    condition_variable taskCond_;
 
 private:
     TLOG_DECLARE();
@@ -0,0 +1,420 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       parametric_levenshtein_automaton.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements parametric levenshtein automaton and its precomputed tables
+**********************************************************************************/
+#include "fst/fst_core/parametric_levenshtein_automaton.h"
+#include "fst/fst_core/byte_dfa_automaton.h"
+#include "common/util/time_util.h"
+#include <mutex>
+#include <cassert>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,ParametricLevenshteinTable);
+
+const uint32_t ParametricLevenshteinTable::MAX_PARAMETRIC_EDIT_DISTANCE;
+const uint32_t ParametricLevenshteinTable::DEAD_STATE_ID;
+
+const ParametricLevenshteinTable& ParametricLevenshteinTable::GetTable(uint32_t editDistance, bool withTransposition) {
+    assert(IsSupported(editDistance));
+    static std::once_flag s_onceFlags[MAX_PARAMETRIC_EDIT_DISTANCE + 1][2];
+    static ParametricLevenshteinTablePtr s_tables[MAX_PARAMETRIC_EDIT_DISTANCE + 1][2];
+    std::call_once(s_onceFlags[editDistance][withTransposition], [editDistance, withTransposition]() {
+        s_tables[editDistance][withTransposition] = std::make_shared<ParametricLevenshteinTable>(editDistance, withTransposition);
+    });
+    return *s_tables[editDistance][withTransposition];
+}
+
+ParametricLevenshteinTable::ParametricLevenshteinTable(uint32_t editDistance, bool withTransposition)
+: m_editDistance(editDistance)
+, m_withTransposition(withTransposition)
+, m_windowSize(2 * editDistance + 1)
+, m_inputCount((1u << (2 * editDistance + 2)) - 1)
+, m_stateCount(0)
+{
+    assert(IsSupported(editDistance));
+    uint64_t bTime = TimeUtility::CurrentTimeInMicroSeconds();
+    build();
+    uint64_t eTime = TimeUtility::CurrentTimeInMicroSeconds();
+    TLOG_LOG(DEBUG,"built parametric levenshtein table for edit distance:[%u],transposition:[%d] with [%u] states, consumed:[%lu] us.",
+             m_editDistance, m_withTransposition, m_stateCount, (eTime-bTime));
+}
+
+uint32_t ParametricLevenshteinTable::getOrAddState(const vector<uint8_t>& cells) {
+    string key(cells.begin(), cells.end());
+    auto it = m_cells2StateMap.find(key);
+    if (it != m_cells2StateMap.end()) {
+        return it->second;
+    }
+    uint32_t stateId = m_stateCount++;
+    m_cells2StateMap.insert(std::make_pair(key, stateId));
+    m_cells.insert(m_cells.end(), cells.begin(), cells.end());
+    return stateId;
+}
+
+void ParametricLevenshteinTable::build() {
+    const uint32_t W = m_windowSize;
+    const uint8_t dead = m_editDistance + 1;
+
+    //state 0 is the dead state whose all cells exceed edit distance
+    vector<uint8_t> cells(2 * W, dead);
+    uint32_t deadId = getOrAddState(cells);
+    assert(DEAD_STATE_ID == deadId);
+    UNUSED(deadId);
+
+    //start state: query prefix of k characters costs k deletions, no cell beyond query end
+    for (uint32_t queryLen = 0; queryLen <= m_editDistance; ++queryLen) {
+        std::fill(cells.begin(), cells.end(), dead);
+        for (uint32_t k = 0; k <= queryLen; ++k) {
+            cells[k] = k;
+        }
+        m_startStates.push_back(getOrAddState(cells));
+    }
+
+    vector<uint8_t> row(W + 1), cand(W + 1);
+    //states are appended while being visited, which is a breadth first traversal
+    for (uint32_t stateId = 0; stateId < m_stateCount; ++stateId) {
+        for (uint32_t len = 0; len <= W; ++len) {
+            for (uint32_t chi = 0; chi < (1u << len); ++chi) {
+                if (stateId == DEAD_STATE_ID) {
+                    m_trans.push_back(DEAD_STATE_ID);
+                    m_shifts.push_back(0);
+                    continue;
+                }
+                //NOTE THAT 'm_cells' may be reallocated by getOrAddState,so always index it here
+                const uint8_t* curRow = &m_cells[(size_t)stateId * 2 * W];
+                const uint8_t* curCand = curRow + W;
+                auto isMatch = [len, chi](uint32_t j) { return j < len && ((chi >> j) & 1); };
+
+                //one row of dynamic programming restricted in window, column k means query[offset+k]
+                for (uint32_t k = 0; k <= W; ++k) {
+                    uint32_t v = dead;
+                    if (k <= len) {
+                        if (k >= 1) v = std::min<uint32_t>(v, curRow[k-1] + (isMatch(k-1) ? 0 : 1));
+                        if (k < W) v = std::min<uint32_t>(v, curRow[k] + 1);
+                        if (k >= 1) v = std::min<uint32_t>(v, row[k-1] + 1);
+                        if (m_withTransposition && k >= 2 && k < W && isMatch(k-2)) {
+                            v = std::min<uint32_t>(v, curCand[k]);
+                        }
+                    }
+                    row[k] = std::min<uint32_t>(v, dead);
+                    cand[k] = dead;
+                    if (m_withTransposition && k >= 2 && isMatch(k-1)) {
+                        cand[k] = std::min<uint32_t>(curRow[k-2] + 1, dead);
+                    }
+                }
+                uint32_t shift = 0;
+                while (shift <= W && row[shift] >= dead) ++shift;
+                if (shift > W) {
+                    m_trans.push_back(DEAD_STATE_ID);
+                    m_shifts.push_back(0);
+                    continue;
+                }
+                //normalize window to start at the first cell within edit distance
+                for (uint32_t k = 0; k < W; ++k) {
+                    cells[k] = (k + shift <= W) ? row[k + shift] : dead;
+                    //candidate of first 2 columns can never be used for transposition
+                    cells[W + k] = (k >= 2 && k + shift <= W) ? cand[k + shift] : dead;
+                }
+                m_trans.push_back(getOrAddState(cells));
+                m_shifts.push_back(shift);
+            }
+        }
+    }
+    m_cells2StateMap.clear();
+}
+
+const uint32_t ParametricLevenshteinAutomaton::DEAD_STATE_ID;
+const uint32_t ParametricLevenshteinAutomaton::OTHER_CHAR_INDEX;
+const uint32_t ParametricLevenshteinAutomaton::UNKNOWN_STATE_ID;
+
+///utf8 character length in bytes for every leading byte, 0 means not a leading byte
+static const vector<uint32_t>& getUtf8Lengths() {
+    static vector<uint32_t> s_utf8Lengths = []() {
+        vector<uint32_t> lengths(256, 0);
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t nByte = 0;
+            lengths[b] = Utf8Util::IsUtf8Beginning((uint8_t)b, nByte) ? nByte : 0;
+        }
+        return lengths;
+    }();
+    return s_utf8Lengths;
+}
+
+static inline bool isContinuationByte(uint32_t b) {
+    return (b & 0xC0) == 0x80;
+}
+
+///byte state id of state, checked only in debug build because this is the hottest path of fst iterator
+static inline uint32_t getByteStateId(const AutomatonStatePtr& state) {
+    assert(nullptr != dynamic_cast<const ParametricLevenshteinAutomatonState*>(state.get()));
+    return static_cast<const ParametricLevenshteinAutomatonState*>(state.get())->m_byteStateId;
+}
+
+ParametricLevenshteinAutomaton::ParametricLevenshteinAutomaton(const string& str,
+                                                               uint32_t editDistance,
+                                                               bool isUseDamerauLevenshtein,
+                                                               uint32_t samePrefixLen /*= 0*/,
+                                                               bool isFuzzyPrefix /*= false*/)
+: m_str(str)
+, m_editDistance(editDistance)
+, m_table(ParametricLevenshteinTable::GetTable(editDistance, isUseDamerauLevenshtein))
+, m_queryLen(0)
+, m_trieNodes(1)
+, m_isFuzzyPrefix(isFuzzyPrefix)
+, m_sinkByteStateId(DEAD_STATE_ID)
+, m_startByteStateId(DEAD_STATE_ID)
+{
+    const vector<uint32_t>& utf8Lengths = getUtf8Lengths();
+    vector<string> utf8strs;
+    Utf8Util::String2utf8(m_str, utf8strs);
+    for (const string& s : utf8strs) {
+        if (s.empty()) continue;
+        if (m_queryLen < samePrefixLen) {
+            m_prefix += s;
+        }
+        //malformed character can never be matched, which only takes its position
+        if (utf8Lengths[(uint8_t)s[0]] == s.size()) {
+            uint32_t node = 0;
+            for (char ch : s) {
+                auto it = m_trieNodes[node].m_children.find((uint8_t)ch);
+                if (it == m_trieNodes[node].m_children.end()) {
+                    it = m_trieNodes[node].m_children.insert(std::make_pair((uint8_t)ch, (uint32_t)m_trieNodes.size())).first;
+                    m_trieNodes.push_back(TrieNode());
+                }
+                node = it->second;
+            }
+            if (m_trieNodes[node].m_charIndex == OTHER_CHAR_INDEX) {
+                m_trieNodes[node].m_charIndex = m_charPositions.size();
+                m_charPositions.push_back(vector<uint64_t>(utf8strs.size() / 64 + 1, 0));
+            }
+            vector<uint64_t>& positions = m_charPositions[m_trieNodes[node].m_charIndex];
+            positions[m_queryLen / 64] |= (1ul << (m_queryLen % 64));
+        }
+        ++m_queryLen;
+    }
+
+    newByteState(ByteState(BYTE_STATE_TYPE_DEAD));
+    if (m_prefix.empty()) {
+        m_startByteStateId = getCharState(m_table.GetStartState(m_queryLen), 0);
+    }
+    else {
+        m_startByteStateId = newByteState(ByteState(BYTE_STATE_TYPE_PREFIX));
+    }
+}
+
+uint32_t ParametricLevenshteinAutomaton::newByteState(const ByteState& byteState) {
+    uint32_t byteStateId = m_byteStates.size();
+    m_byteStates.push_back(byteState);
+    m_byteStates.back().m_transBegin = m_trans.size();
+    if (byteState.m_type == BYTE_STATE_TYPE_DEAD) {
+        m_states.push_back(nullptr);
+        return byteStateId;
+    }
+    m_trans.resize(m_trans.size() + (byteState.m_leftBytes > 0 ? 64 : 256), UNKNOWN_STATE_ID);
+    m_states.push_back(std::make_shared<ParametricLevenshteinAutomatonState>(byteStateId));
+    return byteStateId;
+}
+
+uint32_t ParametricLevenshteinAutomaton::getCharState(uint32_t stateId, uint32_t offset) {
+    if (stateId == ParametricLevenshteinTable::DEAD_STATE_ID) return DEAD_STATE_ID;
+    uint64_t key = ((uint64_t)stateId << 32) | offset;
+    auto it = m_charStatesMap.find(key);
+    if (it != m_charStatesMap.end()) return it->second;
+
+    ByteState byteState(BYTE_STATE_TYPE_CHAR);
+    byteState.m_stateId = stateId;
+    byteState.m_offset = offset;
+    byteState.m_isFinal = m_table.GetDistance(stateId, m_queryLen - offset) <= m_editDistance;
+    uint32_t byteStateId = DEAD_STATE_ID;
+    if (m_isFuzzyPrefix && byteState.m_isFinal) {
+        if (m_sinkByteStateId == DEAD_STATE_ID) {
+            ByteState sinkState(BYTE_STATE_TYPE_SINK);
+            sinkState.m_isFinal = true;
+            m_sinkByteStateId = newByteState(sinkState);
+        }
+        byteStateId = m_sinkByteStateId;
+    }
+    else {
+        byteStateId = newByteState(byteState);
+    }
+    m_charStatesMap.insert(std::make_pair(key, byteStateId));
+    return byteStateId;
+}
+
+uint32_t ParametricLevenshteinAutomaton::getPendingState(uint32_t charByteStateId, uint32_t trieNode, uint32_t leftBytes) {
+    uint64_t key = ((uint64_t)charByteStateId << 32) | trieNode;
+    auto it = m_pendingStatesMap.find(key);
+    if (it != m_pendingStatesMap.end()) return it->second;
+
+    ByteState byteState(BYTE_STATE_TYPE_PENDING);
+    byteState.m_stateId = m_byteStates[charByteStateId].m_stateId;
+    byteState.m_offset = m_byteStates[charByteStateId].m_offset;
+    byteState.m_next = trieNode;
+    byteState.m_leftBytes = leftBytes;
+    uint32_t byteStateId = newByteState(byteState);
+    m_pendingStatesMap.insert(std::make_pair(key, byteStateId));
+    return byteStateId;
+}
+
+uint32_t ParametricLevenshteinAutomaton::getSkipState(uint32_t target, uint32_t leftBytes) {
+    if (leftBytes == 0 || target == DEAD_STATE_ID || target == m_sinkByteStateId) return target;
+    uint64_t key = ((uint64_t)target << 32) | leftBytes;
+    auto it = m_skipStatesMap.find(key);
+    if (it != m_skipStatesMap.end()) return it->second;
+
+    ByteState byteState(BYTE_STATE_TYPE_SKIP);
+    byteState.m_next = target;
+    byteState.m_leftBytes = leftBytes;
+    uint32_t byteStateId = newByteState(byteState);
+    m_skipStatesMap.insert(std::make_pair(key, byteStateId));
+    return byteStateId;
+}
+
+uint32_t ParametricLevenshteinAutomaton::getCharacteristicVector(uint32_t charIndex, uint32_t offset, uint32_t len) const {
+    if (charIndex == OTHER_CHAR_INDEX) return 0;
+    const vector<uint64_t>& positions = m_charPositions[charIndex];
+    uint32_t chi = 0;
+    for (uint32_t k = 0; k < len; ++k) {
+        uint32_t pos = offset + k;
+        chi |= (uint32_t)((positions[pos / 64] >> (pos % 64)) & 1) << k;
+    }
+    return chi;
+}
+
+uint32_t ParametricLevenshteinAutomaton::getTrieChild(uint32_t trieNode, uint8_t b) const {
+    auto it = m_trieNodes[trieNode].m_children.find(b);
+    return it == m_trieNodes[trieNode].m_children.end() ? 0 : it->second;
+}
+
+uint32_t ParametricLevenshteinAutomaton::transit(uint32_t stateId, uint32_t offset, uint32_t charIndex) {
+    uint32_t len = std::min(m_table.GetWindowSize(), m_queryLen - offset);
+    uint32_t shift = 0;
+    uint32_t nextStateId = m_table.Transit(stateId, len, getCharacteristicVector(charIndex, offset, len), shift);
+    return getCharState(nextStateId, offset + shift);
+}
+
+uint32_t ParametricLevenshteinAutomaton::computeNext(uint32_t byteStateId, uint8_t b) {
+    //NOTE THAT copied, since new states may reallocate 'm_byteStates'
+    ByteState byteState = m_byteStates[byteStateId];
+    switch (byteState.m_type) {
+        case BYTE_STATE_TYPE_CHAR: {
+            uint32_t nByte = getUtf8Lengths()[b];
+            if (nByte == 0) return DEAD_STATE_ID;
+            uint32_t child = getTrieChild(0, b);
+            if (nByte == 1) {
+                return transit(byteState.m_stateId, byteState.m_offset, child ? m_trieNodes[child].m_charIndex : OTHER_CHAR_INDEX);
+            }
+            if (child) {
+                return getPendingState(byteStateId, child, nByte - 1);
+            }
+            return getSkipState(transit(byteState.m_stateId, byteState.m_offset, OTHER_CHAR_INDEX), nByte - 1);
+        }
+        case BYTE_STATE_TYPE_PENDING: {
+            uint32_t child = getTrieChild(byteState.m_next, b);
+            if (byteState.m_leftBytes == 1) {
+                return transit(byteState.m_stateId, byteState.m_offset, child ? m_trieNodes[child].m_charIndex : OTHER_CHAR_INDEX);
+            }
+            if (child) {
+                uint32_t charByteStateId = m_charStatesMap.at(((uint64_t)byteState.m_stateId << 32) | byteState.m_offset);
+                return getPendingState(charByteStateId, child, byteState.m_leftBytes - 1);
+            }
+            return getSkipState(transit(byteState.m_stateId, byteState.m_offset, OTHER_CHAR_INDEX), byteState.m_leftBytes - 1);
+        }
+        case BYTE_STATE_TYPE_SKIP:
+            return getSkipState(byteState.m_next, byteState.m_leftBytes - 1);
+        case BYTE_STATE_TYPE_SINK:
+            return byteStateId;
+        case BYTE_STATE_TYPE_PREFIX: {
+            if (b != (uint8_t)m_prefix[byteState.m_offset]) return DEAD_STATE_ID;
+            if (byteState.m_offset + 1 < m_prefix.size()) {
+                ByteState prefixState(BYTE_STATE_TYPE_PREFIX);
+                prefixState.m_offset = byteState.m_offset + 1;
+                return newByteState(prefixState);
+            }
+            //whole prefix matched, which is walked from start of query
+            uint32_t nextByteStateId = getCharState(m_table.GetStartState(m_queryLen), 0);
+            for (size_t i = 0; i < m_prefix.size() && nextByteStateId != DEAD_STATE_ID; ++i) {
+                nextByteStateId = next(nextByteStateId, (uint8_t)m_prefix[i]);
+            }
+            return nextByteStateId;
+        }
+        default:
+            return DEAD_STATE_ID;
+    }
+}
+
+uint32_t ParametricLevenshteinAutomaton::next(uint32_t byteStateId, uint8_t b) {
+    const ByteState& byteState = m_byteStates[byteStateId];
+    size_t idx = byteState.m_transBegin;
+    if (byteState.m_leftBytes > 0) {
+        if (!isContinuationByte(b)) return DEAD_STATE_ID;
+        idx += b & 0x3F;
+    }
+    else {
+        idx += b;
+    }
+    if (m_trans[idx] == UNKNOWN_STATE_ID) {
+        //NOTE THAT index but not reference of transition, since computing may reallocate 'm_trans'
+        uint32_t nextByteStateId = computeNext(byteStateId, b);
+        m_trans[idx] = nextByteStateId;
+    }
+    return m_trans[idx];
+}
+
+AutomatonStatePtr ParametricLevenshteinAutomaton::Start() {
+    return m_states[m_startByteStateId];
+}
+
+bool ParametricLevenshteinAutomaton::IsMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return m_byteStates[getByteStateId(state)].m_isFinal;
+}
+
+bool ParametricLevenshteinAutomaton::CanMatch(const AutomatonStatePtr &state) {
+    //dead state has no state object
+    return nullptr != state;
+}
+
+AutomatonStatePtr ParametricLevenshteinAutomaton::Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) {
+    if (nullptr == ptr || byteVec.empty()) return ptr;
+    return m_states[next(getByteStateId(ptr), byteVec.back())];
+}
+
+bool ParametricLevenshteinAutomaton::GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+    if (nullptr == state) return false;
+    stateId = getByteStateId(state);
+    return true;
+}
+
+bool ParametricLevenshteinAutomaton::GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) {
+    if (nullptr == state) return false;
+    const ByteState& byteState = m_byteStates[getByteStateId(state)];
+    if (byteState.m_type != BYTE_STATE_TYPE_CHAR) return false;
+    distance = m_table.GetDistance(byteState.m_stateId, m_queryLen - byteState.m_offset);
+    return true;
+}
+
+ByteDfaAutomatonPtr ParametricLevenshteinAutomaton::CompileToByteDfa() {
+    //byte states keep their ids in dense transitions, new states are appended while being visited
+    vector<uint32_t> denseTrans(256, DEAD_STATE_ID);
+    for (uint32_t byteStateId = 1; byteStateId < m_byteStates.size(); ++byteStateId) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            denseTrans.push_back(next(byteStateId, (uint8_t)b));
+        }
+    }
+    vector<uint8_t> finals;
+    for (const ByteState& byteState : m_byteStates) {
+        finals.push_back(byteState.m_isFinal);
+    }
+    return ByteDfaAutomaton::CompressDenseDfa(denseTrans, finals, m_startByteStateId);
+}
+
+COMMON_END_NAMESPACE
@@ -0,0 +1,231 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       parametric_levenshtein_automaton.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines parametric levenshtein automaton (Schulz-Mihov style), whose
+  *                transition table only depends on the edit distance and whether transposition
+  *                is allowed, NOT on the query string. So tables for small edit distances
+  *                (0~3) are computed only once at first use, and every query just instantiates
+  *                an automaton on it in O(query length) instead of running a whole subset
+  *                construction like LevenshteinAutomaton::buildDfa does.
+  *
+  *                A parametric state is a window of 2*d+1 dynamic programming cells (capped at
+  *                d+1) relative to a base offset in the query string, plus the same window of
+  *                transposition candidates for Damerau-Levenshtein (restricted edit distance).
+  *                The input of the table is the characteristic vector of the accepted character
+  *                over the window, together with how many query characters are left in window.
+  *                The automaton instantiated on query is walked byte by byte as a lazily built
+  *                byte level dfa, see ParametricLevenshteinAutomaton.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_PARAMETRIC_LEVENSHTEIN_AUTOMATON__H__
+#define __CPPFST_FST_CORE_PARAMETRIC_LEVENSHTEIN_AUTOMATON__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include "fst/fst_core/automaton.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+/// query independent transition table for parametric levenshtein automaton
+class ParametricLevenshteinTable;
+TYPEDEF_PTR(ParametricLevenshteinTable);
+class ParametricLevenshteinTable {
+public:
+    ///max edit distance whose table is precomputed, larger distance falls back to row-based automaton
+    const static uint32_t MAX_PARAMETRIC_EDIT_DISTANCE = 3;
+    ///state id of dead state, which can never match anymore
+    const static uint32_t DEAD_STATE_ID = 0;
+public:
+    ParametricLevenshteinTable(uint32_t editDistance, bool withTransposition);
+    ~ParametricLevenshteinTable() {}
+private:
+    ParametricLevenshteinTable(const ParametricLevenshteinTable& rhs);
+    ParametricLevenshteinTable& operator=(const ParametricLevenshteinTable& rhs);
+public:
+    ///got the shared table computed at first use, thread safe
+    static const ParametricLevenshteinTable& GetTable(uint32_t editDistance, bool withTransposition);
+    static bool IsSupported(uint32_t editDistance) { return editDistance <= MAX_PARAMETRIC_EDIT_DISTANCE; }
+
+    uint32_t GetWindowSize() const { return m_windowSize; }
+    uint32_t GetStateCount() const { return m_stateCount; }
+    ///start state for query string with 'queryLen' utf8 characters
+    uint32_t GetStartState(uint32_t queryLen) const {
+        return m_startStates[std::min(queryLen, m_editDistance)];
+    }
+
+    /**
+     *@brief     transit from state by one character
+     *@param     stateId    ---- current parametric state id
+     *@param     len        ---- count of query characters left in window, at most window size
+     *@param     chi        ---- characteristic vector, bit k is set if character equals query[offset+k]
+     *@param     shift      ---- output, how much the base offset moves forward
+     *@return    next parametric state id
+     */
+    uint32_t Transit(uint32_t stateId, uint32_t len, uint32_t chi, uint32_t& shift) const {
+        size_t idx = (size_t)stateId * m_inputCount + ((1u << len) - 1) + chi;
+        shift = m_shifts[idx];
+        return m_trans[idx];
+    }
+    ///edit distance between consumed input and query prefix of 'offset + k' characters, larger than
+    ///edit distance if out of window
+    uint32_t GetDistance(uint32_t stateId, uint32_t k) const {
+        if (k >= m_windowSize) return m_editDistance + 1;
+        return m_cells[(size_t)stateId * m_windowSize * 2 + k];
+    }
+private:
+    void build();
+    uint32_t getOrAddState(const vector<uint8_t>& cells);
+private:
+    uint32_t                                           m_editDistance;
+    bool                                               m_withTransposition;
+    uint32_t                                           m_windowSize;
+    ///count of distinct (len,chi) inputs: 2^(windowSize+1) - 1
+    uint32_t                                           m_inputCount;
+    uint32_t                                           m_stateCount;
+    vector<uint32_t>                                   m_startStates;
+    ///row cells followed by transposition candidate cells for every state
+    vector<uint8_t>                                    m_cells;
+    vector<uint32_t>                                   m_trans;
+    vector<uint8_t>                                    m_shifts;
+    std::unordered_map<string, uint32_t>               m_cells2StateMap;
+private:
+    TLOG_DECLARE();
+};
+
+/// state of parametric levenshtein automaton, which is a byte state of its lazily built byte level dfa
+class ParametricLevenshteinAutomatonState : public AutomatonState {
+public:
+    ParametricLevenshteinAutomatonState(uint32_t byteStateId)
+    : m_byteStateId(byteStateId)
+    {}
+public:
+    uint32_t        m_byteStateId;
+};
+TYPEDEF_PTR(ParametricLevenshteinAutomatonState);
+
+/**
+ *@brief   levenshtein or Damerau levenshtein automaton instantiated from precomputed parametric table.
+ *         Fst iterator walks it byte by byte as a byte level dfa which is built lazily: transition of a
+ *         byte state by a byte is computed from parametric table at first use then memoized, so following
+ *         steps of the same transition cost one array lookup and allocate nothing. Byte state is either a
+ *         character state, which is a (parametric state, window offset) pair, or a state inside the same
+ *         prefix or inside an utf8 character. Malformed utf8 byte sequences go to dead state.
+ *         NOTE THAT walking it builds it, so it is not thread safe and every query instantiates its own.
+ */
+class ParametricLevenshteinAutomaton : public Automaton {
+public:
+    ///byte state id of dead state, which can never match anymore
+    const static uint32_t DEAD_STATE_ID = 0;
+public:
+    /**
+     *@param     str                      ---- query string
+     *@param     editDistance             ---- max edit distance, at most MAX_PARAMETRIC_EDIT_DISTANCE
+     *@param     isUseDamerauLevenshtein  ---- use Damerau-Levenshtein distance or Levenshtein distance
+     *@param     samePrefixLen            ---- count of first utf8 characters of key must be the same as query
+     *@param     isFuzzyPrefix            ---- match keys who have a prefix within edit distance, where every
+     *                                        final character state is replaced by one accepting sink state
+     */
+    ParametricLevenshteinAutomaton(const string& str, uint32_t editDistance, bool isUseDamerauLevenshtein,
+                                   uint32_t samePrefixLen = 0, bool isFuzzyPrefix = false);
+public:
+    AutomatonStatePtr Start() override;
+    bool IsMatch(const AutomatonStatePtr &state) override;
+    bool CanMatch(const AutomatonStatePtr &state) override;
+    AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) override;
+    ///distance of character states only, states inside utf8 character or fuzzy prefix sink can not tell
+    bool GetEditDistance(const AutomatonStatePtr& state, uint32_t& distance) override;
+
+    ///compile into byte level dfa automaton which accepts the same keys, by building every transition
+    ByteDfaAutomatonPtr CompileToByteDfa();
+    ///count of byte states built so far
+    uint32_t GetByteStateCount() const { return (uint32_t)m_byteStates.size(); }
+private:
+    enum BYTE_STATE_TYPE_ENUM {
+        BYTE_STATE_TYPE_DEAD = 0,
+        BYTE_STATE_TYPE_CHAR,           //between utf8 characters
+        BYTE_STATE_TYPE_PREFIX,         //inside the same prefix
+        BYTE_STATE_TYPE_PENDING,        //inside utf8 character whose bytes so far are bytes of query characters
+        BYTE_STATE_TYPE_SKIP,           //inside utf8 character which is not a query character
+        BYTE_STATE_TYPE_SINK,           //prefix within edit distance matched, accepts every byte then
+    };
+    struct ByteState {
+        ByteState(BYTE_STATE_TYPE_ENUM type)
+        : m_type(type), m_stateId(ParametricLevenshteinTable::DEAD_STATE_ID), m_offset(0)
+        , m_next(0), m_leftBytes(0), m_transBegin(0), m_isFinal(false)
+        {}
+        BYTE_STATE_TYPE_ENUM    m_type;
+        ///parametric state id and window offset of character state, or of character state where pending
+        ///utf8 character starts. offset is count of prefix bytes matched for prefix state
+        uint32_t                m_stateId;
+        uint32_t                m_offset;
+        ///query characters trie node of pending bytes, or target byte state after skipped bytes
+        uint32_t                m_next;
+        ///continuation bytes left of pending or skipped utf8 character
+        uint32_t                m_leftBytes;
+        ///position of first transition in 'm_trans', 64 transitions by continuation bytes for states inside
+        ///utf8 character, otherwise 256 transitions
+        size_t                  m_transBegin;
+        bool                    m_isFinal;
+    };
+    ///trie of distinct utf8 characters of query, node 0 is root
+    struct TrieNode {
+        TrieNode() : m_charIndex(OTHER_CHAR_INDEX) {}
+        map<uint8_t, uint32_t>  m_children;
+        uint32_t                m_charIndex;
+    };
+    ///index of characters which are not in query
+    const static uint32_t OTHER_CHAR_INDEX = (uint32_t)-1;
+    ///transition which is not computed yet
+    const static uint32_t UNKNOWN_STATE_ID = (uint32_t)-1;
+private:
+    uint32_t next(uint32_t byteStateId, uint8_t b);
+    uint32_t computeNext(uint32_t byteStateId, uint8_t b);
+    uint32_t newByteState(const ByteState& byteState);
+    uint32_t getCharState(uint32_t stateId, uint32_t offset);
+    uint32_t getPendingState(uint32_t charByteStateId, uint32_t trieNode, uint32_t leftBytes);
+    uint32_t getSkipState(uint32_t target, uint32_t leftBytes);
+    ///byte state after character of 'charIndex' from character state (stateId, offset)
+    uint32_t transit(uint32_t stateId, uint32_t offset, uint32_t charIndex);
+    ///characteristic vector of 'len' bits from 'offset' for character of 'charIndex'
+    uint32_t getCharacteristicVector(uint32_t charIndex, uint32_t offset, uint32_t len) const;
+    ///child of trie node by byte 'b', 0 if none
+    uint32_t getTrieChild(uint32_t trieNode, uint8_t b) const;
+protected:
+    string                                              m_str;
+    uint32_t                                            m_editDistance;
+    const ParametricLevenshteinTable&                   m_table;
+    uint32_t                                            m_queryLen;
+    ///bitmap of positions in query for every distinct utf8 character
+    vector<vector<uint64_t> >                           m_charPositions;
+    vector<TrieNode>                                    m_trieNodes;
+    ///bytes of the same prefix
+    string                                              m_prefix;
+    bool                                                m_isFuzzyPrefix;
+    ///accepting sink byte state of fuzzy prefix automaton, created at first use
+    uint32_t                                            m_sinkByteStateId;
+
+    vector<ByteState>                                   m_byteStates;
+    ///byte states are created once, so 'Accept' never allocates, nullptr for dead state
+    vector<AutomatonStatePtr>                           m_states;
+    vector<uint32_t>                                    m_trans;
+    uint32_t                                            m_startByteStateId;
+    ///(parametric state id, offset) -> character byte state id
+    std::unordered_map<uint64_t, uint32_t>              m_charStatesMap;
+    ///(character byte state id, trie node) -> pending byte state id
+    std::unordered_map<uint64_t, uint32_t>              m_pendingStatesMap;
+    ///(target byte state id, left bytes) -> skip byte state id
+    std::unordered_map<uint64_t, uint32_t>              m_skipStatesMap;
+};
+TYPEDEF_PTR(ParametricLevenshteinAutomaton);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_PARAMETRIC_LEVENSHTEIN_AUTOMATON__H__
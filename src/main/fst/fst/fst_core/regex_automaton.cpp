@@ -0,0 +1,709 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       regex_automaton.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements regular expression parser, utf8 byte nfa compiler and lazy dfa
+**********************************************************************************/
+#include "fst/fst_core/regex_automaton.h"
+#include <algorithm>
+#include <cassert>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,RegexAutomaton);
+
+const uint64_t RegexAutomaton::DEFAULT_MAX_CACHE_BYTES;
+const uint32_t RegexAutomaton::MAX_REPEAT_COUNT;
+const uint32_t RegexAutomaton::UNKNOWN_STATE_INDEX;
+
+namespace {
+const uint32_t MAX_CODE_POINT = 0x10FFFF;
+///cached transition to dead state
+const uint32_t DEAD_STATE_INDEX = 0xFFFFFFFE;
+///pattern compiling into more nfa states than this is rejected
+const uint32_t MAX_NFA_STATE_COUNT = 1000000;
+
+typedef vector<pair<uint32_t, uint32_t> > CodeRanges;
+typedef vector<pair<uint8_t, uint8_t> > ByteRangeSequence;
+
+struct RegexNode;
+TYPEDEF_PTR(RegexNode);
+/// node of regular expression syntax tree
+struct RegexNode {
+    enum NodeType {
+        NODE_CHARSET,
+        NODE_CONCAT,
+        NODE_ALTERNATE,
+        NODE_REPEAT
+    };
+    RegexNode(NodeType type) : m_type(type), m_min(0), m_max(0) {}
+    NodeType                m_type;
+    ///code point ranges of charset, sorted and merged
+    CodeRanges              m_codeRanges;
+    vector<RegexNodePtr>    m_children;
+    uint32_t                m_min;
+    ///-1 means no upper bound
+    int64_t                 m_max;
+};
+
+///sort and merge code point ranges
+void normalizeRanges(CodeRanges& ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    CodeRanges merged;
+    for (const auto& r : ranges) {
+        if (!merged.empty() && (uint64_t)r.first <= (uint64_t)merged.back().second + 1) {
+            merged.back().second = std::max(merged.back().second, r.second);
+        }
+        else {
+            merged.push_back(r);
+        }
+    }
+    ranges.swap(merged);
+}
+
+void negateRanges(CodeRanges& ranges) {
+    normalizeRanges(ranges);
+    CodeRanges negated;
+    uint32_t next = 0;
+    for (const auto& r : ranges) {
+        if (r.first > next) negated.push_back(std::make_pair(next, r.first - 1));
+        next = r.second + 1;
+    }
+    if (next <= MAX_CODE_POINT) negated.push_back(std::make_pair(next, MAX_CODE_POINT));
+    ranges.swap(negated);
+}
+
+uint32_t encodeUtf8(uint32_t cp, uint8_t* bytes) {
+    if (cp <= 0x7F) {
+        bytes[0] = cp;
+        return 1;
+    }
+    if (cp <= 0x7FF) {
+        bytes[0] = 0xC0 | (cp >> 6);
+        bytes[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp <= 0xFFFF) {
+        bytes[0] = 0xE0 | (cp >> 12);
+        bytes[1] = 0x80 | ((cp >> 6) & 0x3F);
+        bytes[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    bytes[0] = 0xF0 | (cp >> 18);
+    bytes[1] = 0x80 | ((cp >> 12) & 0x3F);
+    bytes[2] = 0x80 | ((cp >> 6) & 0x3F);
+    bytes[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+///split code point range into utf8 byte range sequences, every byte of a sequence ranges independently
+void appendUtf8Sequences(uint32_t lo, uint32_t hi, vector<ByteRangeSequence>& seqs) {
+    if (lo > hi) return;
+    //surrogates are not valid utf8 characters
+    if (lo <= 0xDFFF && hi >= 0xD800) {
+        if (lo < 0xD800) appendUtf8Sequences(lo, 0xD7FF, seqs);
+        if (hi > 0xDFFF) appendUtf8Sequences(0xE000, hi, seqs);
+        return;
+    }
+    //both ends must have the same encoding length
+    for (uint32_t maxCp : {0x7Fu, 0x7FFu, 0xFFFFu}) {
+        if (lo <= maxCp && maxCp < hi) {
+            appendUtf8Sequences(lo, maxCp, seqs);
+            appendUtf8Sequences(maxCp + 1, hi, seqs);
+            return;
+        }
+    }
+    //continuation bytes must cover full ranges except the last differing one
+    for (uint32_t i = 1; i < 4; ++i) {
+        uint32_t m = (1u << (6 * i)) - 1;
+        if ((lo & ~m) != (hi & ~m)) {
+            if ((lo & m) != 0) {
+                appendUtf8Sequences(lo, lo | m, seqs);
+                appendUtf8Sequences((lo | m) + 1, hi, seqs);
+                return;
+            }
+            if ((hi & m) != m) {
+                appendUtf8Sequences(lo, (hi & ~m) - 1, seqs);
+                appendUtf8Sequences(hi & ~m, hi, seqs);
+                return;
+            }
+        }
+    }
+    uint8_t loBytes[4], hiBytes[4];
+    uint32_t len = encodeUtf8(lo, loBytes);
+    encodeUtf8(hi, hiBytes);
+    ByteRangeSequence seq;
+    for (uint32_t i = 0; i < len; ++i) {
+        seq.push_back(std::make_pair(loBytes[i], hiBytes[i]));
+    }
+    seqs.push_back(seq);
+}
+
+/// recursive descent parser of regular expression
+class RegexParser {
+public:
+    RegexParser(const string& pattern) : m_pattern(pattern), m_pos(0) {}
+public:
+    bool Parse(RegexNodePtr& root, string& errorMsg) {
+        //'^' and '$' anchors are implied since pattern always matches whole key
+        if (m_pos < m_pattern.size() && m_pattern[m_pos] == '^') ++m_pos;
+        if (!parseAlternate(root)) {
+            errorMsg = m_errorMsg;
+            return false;
+        }
+        if (m_pos < m_pattern.size()) {
+            errorMsg = makeError("unmatched ')'");
+            return false;
+        }
+        return true;
+    }
+private:
+    bool isEnd() const { return m_pos >= m_pattern.size(); }
+    char peek() const { return m_pattern[m_pos]; }
+    string makeError(const string& msg) const {
+        return msg + " at position " + std::to_string(m_pos) + " of pattern [" + m_pattern + "]";
+    }
+    bool fail(const string& msg) {
+        m_errorMsg = makeError(msg);
+        return false;
+    }
+    bool isTrailingDollar() const {
+        return m_pattern[m_pos] == '$' && m_pos + 1 == m_pattern.size();
+    }
+
+    bool parseAlternate(RegexNodePtr& node) {
+        RegexNodePtr first;
+        if (!parseConcat(first)) return false;
+        if (isEnd() || peek() != '|') {
+            node = first;
+            return true;
+        }
+        node = std::make_shared<RegexNode>(RegexNode::NODE_ALTERNATE);
+        node->m_children.push_back(first);
+        while (!isEnd() && peek() == '|') {
+            ++m_pos;
+            RegexNodePtr next;
+            if (!parseConcat(next)) return false;
+            node->m_children.push_back(next);
+        }
+        return true;
+    }
+
+    bool parseConcat(RegexNodePtr& node) {
+        node = std::make_shared<RegexNode>(RegexNode::NODE_CONCAT);
+        while (!isEnd() && peek() != '|' && peek() != ')') {
+            if (isTrailingDollar()) {
+                ++m_pos;
+                break;
+            }
+            RegexNodePtr item;
+            if (!parseRepeat(item)) return false;
+            node->m_children.push_back(item);
+        }
+        if (node->m_children.size() == 1) node = node->m_children[0];
+        return true;
+    }
+
+    bool parseNumber(uint32_t& num) {
+        size_t begin = m_pos;
+        uint64_t value = 0;
+        while (!isEnd() && isdigit((uint8_t)peek())) {
+            value = value * 10 + (peek() - '0');
+            if (value > RegexAutomaton::MAX_REPEAT_COUNT) {
+                return fail("repeat count exceeds " + std::to_string(RegexAutomaton::MAX_REPEAT_COUNT));
+            }
+            ++m_pos;
+        }
+        if (begin == m_pos) return fail("number expected");
+        num = value;
+        return true;
+    }
+
+    bool parseRepeat(RegexNodePtr& node) {
+        if (!parseAtom(node)) return false;
+        while (!isEnd()) {
+            uint32_t minCount = 0;
+            int64_t maxCount = -1;
+            char c = peek();
+            if (c == '*') {
+                ++m_pos;
+            }
+            else if (c == '+') {
+                minCount = 1;
+                ++m_pos;
+            }
+            else if (c == '?') {
+                maxCount = 1;
+                ++m_pos;
+            }
+            else if (c == '{') {
+                ++m_pos;
+                if (!parseNumber(minCount)) return false;
+                maxCount = minCount;
+                if (!isEnd() && peek() == ',') {
+                    ++m_pos;
+                    maxCount = -1;
+                    if (!isEnd() && peek() != '}') {
+                        uint32_t num = 0;
+                        if (!parseNumber(num)) return false;
+                        maxCount = num;
+                    }
+                }
+                if (isEnd() || peek() != '}') return fail("'}' expected");
+                ++m_pos;
+                if (maxCount >= 0 && maxCount < minCount) return fail("invalid repeat range");
+            }
+            else {
+                break;
+            }
+            //lazy modifier makes no difference for whole key matching
+            if (!isEnd() && peek() == '?') ++m_pos;
+            RegexNodePtr repeat = std::make_shared<RegexNode>(RegexNode::NODE_REPEAT);
+            repeat->m_min = minCount;
+            repeat->m_max = maxCount;
+            repeat->m_children.push_back(node);
+            node = repeat;
+        }
+        return true;
+    }
+
+    bool parseCodePoint(uint32_t& cp) {
+        uint8_t c = m_pattern[m_pos];
+        uint32_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (len == 0 || m_pos + len > m_pattern.size()) return fail("invalid utf8 character");
+        cp = (len == 1) ? c : (c & (0xFF >> (len + 1)));
+        for (uint32_t i = 1; i < len; ++i) {
+            uint8_t cc = m_pattern[m_pos + i];
+            if ((cc & 0xC0) != 0x80) return fail("invalid utf8 character");
+            cp = (cp << 6) | (cc & 0x3F);
+        }
+        m_pos += len;
+        return true;
+    }
+
+    ///parse escape after '\', either a class escape added to 'ranges' or a single character
+    bool parseEscape(CodeRanges& ranges) {
+        if (isEnd()) return fail("trailing '\\'");
+        char c = peek();
+        CodeRanges classRanges;
+        switch (c) {
+            case 'd': case 'D':
+                classRanges = {{'0','9'}};
+                break;
+            case 'w': case 'W':
+                classRanges = {{'0','9'},{'A','Z'},{'_','_'},{'a','z'}};
+                break;
+            case 's': case 'S':
+                classRanges = {{'\t','\r'},{' ',' '}};
+                break;
+            case 'n': ranges.push_back(std::make_pair('\n','\n')); ++m_pos; return true;
+            case 't': ranges.push_back(std::make_pair('\t','\t')); ++m_pos; return true;
+            case 'r': ranges.push_back(std::make_pair('\r','\r')); ++m_pos; return true;
+            case 'f': ranges.push_back(std::make_pair('\f','\f')); ++m_pos; return true;
+            case 'v': ranges.push_back(std::make_pair('\v','\v')); ++m_pos; return true;
+            default: {
+                if (isalnum((uint8_t)c)) return fail(string("unsupported escape '\\") + c + "'");
+                uint32_t cp = 0;
+                if (!parseCodePoint(cp)) return false;
+                ranges.push_back(std::make_pair(cp, cp));
+                return true;
+            }
+        }
+        ++m_pos;
+        if (isupper((uint8_t)c)) negateRanges(classRanges);
+        ranges.insert(ranges.end(), classRanges.begin(), classRanges.end());
+        return true;
+    }
+
+    bool parseClass(RegexNodePtr& node) {
+        node = std::make_shared<RegexNode>(RegexNode::NODE_CHARSET);
+        bool isNegated = false;
+        if (!isEnd() && peek() == '^') {
+            isNegated = true;
+            ++m_pos;
+        }
+        bool isFirst = true;
+        while (true) {
+            if (isEnd()) return fail("unmatched '['");
+            if (peek() == ']' && !isFirst) {
+                ++m_pos;
+                break;
+            }
+            isFirst = false;
+            CodeRanges itemRanges;
+            if (peek() == '\\') {
+                ++m_pos;
+                if (!parseEscape(itemRanges)) return false;
+            }
+            else {
+                uint32_t cp = 0;
+                if (!parseCodePoint(cp)) return false;
+                itemRanges.push_back(std::make_pair(cp, cp));
+            }
+            //range like a-z, '-' before ']' is literal
+            bool isSingle = itemRanges.size() == 1 && itemRanges[0].first == itemRanges[0].second;
+            if (isSingle && m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']') {
+                ++m_pos;
+                CodeRanges hiRanges;
+                if (peek() == '\\') {
+                    ++m_pos;
+                    if (!parseEscape(hiRanges)) return false;
+                }
+                else {
+                    uint32_t cp = 0;
+                    if (!parseCodePoint(cp)) return false;
+                    hiRanges.push_back(std::make_pair(cp, cp));
+                }
+                if (hiRanges.size() != 1 || hiRanges[0].first != hiRanges[0].second) return fail("invalid class range");
+                if (hiRanges[0].first < itemRanges[0].first) return fail("invalid class range");
+                itemRanges[0].second = hiRanges[0].first;
+            }
+            node->m_codeRanges.insert(node->m_codeRanges.end(), itemRanges.begin(), itemRanges.end());
+        }
+        if (isNegated) {
+            negateRanges(node->m_codeRanges);
+        }
+        else {
+            normalizeRanges(node->m_codeRanges);
+        }
+        return true;
+    }
+
+    bool parseAtom(RegexNodePtr& node) {
+        char c = peek();
+        switch (c) {
+            case '(': {
+                ++m_pos;
+                if (m_pattern.compare(m_pos, 2, "?:") == 0) m_pos += 2;
+                if (!parseAlternate(node)) return false;
+                if (isEnd() || peek() != ')') return fail("unmatched '('");
+                ++m_pos;
+                return true;
+            }
+            case '[':
+                ++m_pos;
+                return parseClass(node);
+            case '.':
+                ++m_pos;
+                node = std::make_shared<RegexNode>(RegexNode::NODE_CHARSET);
+                node->m_codeRanges.push_back(std::make_pair(0, MAX_CODE_POINT));
+                return true;
+            case '\\':
+                ++m_pos;
+                node = std::make_shared<RegexNode>(RegexNode::NODE_CHARSET);
+                if (!parseEscape(node->m_codeRanges)) return false;
+                normalizeRanges(node->m_codeRanges);
+                return true;
+            case '*': case '+': case '?': case '{':
+                return fail("nothing to repeat");
+            case '^': case '$':
+                return fail("anchor is only supported at beginning or end");
+            default: {
+                node = std::make_shared<RegexNode>(RegexNode::NODE_CHARSET);
+                uint32_t cp = 0;
+                if (!parseCodePoint(cp)) return false;
+                node->m_codeRanges.push_back(std::make_pair(cp, cp));
+                return true;
+            }
+        }
+    }
+private:
+    const string&   m_pattern;
+    size_t          m_pos;
+    string          m_errorMsg;
+};
+
+/// thompson construction of syntax tree into utf8 byte nfa
+class NfaCompiler {
+public:
+    NfaCompiler(vector<RegexAutomaton::NfaState>& nfaStates) : m_nfaStates(nfaStates) {}
+public:
+    ///compile 'node' into fragment from 'start' to 'end', false if too many nfa states
+    bool Compile(const RegexNodePtr& node, uint32_t& start, uint32_t& end) {
+        switch (node->m_type) {
+            case RegexNode::NODE_CHARSET: {
+                start = newState();
+                end = newState();
+                vector<ByteRangeSequence> seqs;
+                for (const auto& r : node->m_codeRanges) {
+                    appendUtf8Sequences(r.first, r.second, seqs);
+                }
+                for (const ByteRangeSequence& seq : seqs) {
+                    uint32_t cur = start;
+                    for (size_t i = 0; i < seq.size(); ++i) {
+                        uint32_t to = (i + 1 == seq.size()) ? end : newState();
+                        m_nfaStates[cur].m_ranges.push_back(RegexAutomaton::NfaByteRange(seq[i].first, seq[i].second, to));
+                        cur = to;
+                    }
+                }
+                break;
+            }
+            case RegexNode::NODE_CONCAT: {
+                start = end = newState();
+                for (const RegexNodePtr& child : node->m_children) {
+                    uint32_t childStart = 0, childEnd = 0;
+                    if (!Compile(child, childStart, childEnd)) return false;
+                    m_nfaStates[end].m_epsilons.push_back(childStart);
+                    end = childEnd;
+                }
+                break;
+            }
+            case RegexNode::NODE_ALTERNATE: {
+                start = newState();
+                end = newState();
+                for (const RegexNodePtr& child : node->m_children) {
+                    uint32_t childStart = 0, childEnd = 0;
+                    if (!Compile(child, childStart, childEnd)) return false;
+                    m_nfaStates[start].m_epsilons.push_back(childStart);
+                    m_nfaStates[childEnd].m_epsilons.push_back(end);
+                }
+                break;
+            }
+            case RegexNode::NODE_REPEAT: {
+                const RegexNodePtr& child = node->m_children[0];
+                start = end = newState();
+                for (uint32_t i = 0; i < node->m_min; ++i) {
+                    uint32_t childStart = 0, childEnd = 0;
+                    if (!Compile(child, childStart, childEnd)) return false;
+                    m_nfaStates[end].m_epsilons.push_back(childStart);
+                    end = childEnd;
+                }
+                if (node->m_max < 0) {
+                    //loop back to the state before child
+                    uint32_t childStart = 0, childEnd = 0;
+                    if (!Compile(child, childStart, childEnd)) return false;
+                    uint32_t loop = newState();
+                    m_nfaStates[end].m_epsilons.push_back(loop);
+                    m_nfaStates[loop].m_epsilons.push_back(childStart);
+                    m_nfaStates[childEnd].m_epsilons.push_back(loop);
+                    end = loop;
+                }
+                else {
+                    //optional copies all skip to the same end
+                    uint32_t optionalEnd = newState();
+                    for (int64_t i = node->m_min; i < node->m_max; ++i) {
+                        uint32_t childStart = 0, childEnd = 0;
+                        if (!Compile(child, childStart, childEnd)) return false;
+                        m_nfaStates[end].m_epsilons.push_back(childStart);
+                        m_nfaStates[end].m_epsilons.push_back(optionalEnd);
+                        end = childEnd;
+                    }
+                    m_nfaStates[end].m_epsilons.push_back(optionalEnd);
+                    end = optionalEnd;
+                }
+                break;
+            }
+        }
+        return m_nfaStates.size() <= MAX_NFA_STATE_COUNT;
+    }
+private:
+    uint32_t newState() {
+        m_nfaStates.push_back(RegexAutomaton::NfaState());
+        return m_nfaStates.size() - 1;
+    }
+private:
+    vector<RegexAutomaton::NfaState>&   m_nfaStates;
+};
+}
+
+RegexAutomaton::RegexAutomaton(const string& pattern, uint64_t maxCacheBytes)
+: m_pattern(pattern)
+, m_maxCacheBytes(maxCacheBytes)
+, m_isValid(false)
+, m_startNfaState(0)
+, m_matchNfaState(0)
+, m_classCount(0)
+, m_generation(0)
+, m_cacheBytes(0)
+, m_builtStateCount(0)
+, m_cacheClearCount(0)
+, m_visitStamp(0)
+{
+    memset(m_byteClasses, 0, sizeof(m_byteClasses));
+    m_isValid = compile();
+    if (!m_isValid) {
+        TLOG_LOG(ERROR,"compile regex failed: %s", m_errorMsg.c_str());
+        return;
+    }
+    TLOG_LOG(DEBUG,"compiled regex [%s] into [%zu] nfa states with [%u] byte classes.",
+             m_pattern.c_str(), m_nfaStates.size(), m_classCount);
+}
+
+bool RegexAutomaton::compile() {
+    RegexNodePtr root;
+    RegexParser parser(m_pattern);
+    if (!parser.Parse(root, m_errorMsg)) {
+        return false;
+    }
+    NfaCompiler compiler(m_nfaStates);
+    if (!compiler.Compile(root, m_startNfaState, m_matchNfaState)) {
+        m_nfaStates.clear();
+        m_errorMsg = "too many nfa states compiled from pattern [" + m_pattern + "]";
+        return false;
+    }
+    m_visitMarks.assign(m_nfaStates.size(), 0);
+    computeByteClasses();
+    computeCanReachMatch();
+    return true;
+}
+
+void RegexAutomaton::computeByteClasses() {
+    bool isBoundary[257] = {false};
+    for (const NfaState& st : m_nfaStates) {
+        for (const NfaByteRange& r : st.m_ranges) {
+            isBoundary[r.m_lo] = true;
+            isBoundary[r.m_hi + 1] = true;
+        }
+    }
+    uint32_t classId = 0;
+    for (uint32_t b = 1; b < 256; ++b) {
+        if (isBoundary[b]) ++classId;
+        m_byteClasses[b] = classId;
+    }
+    m_classCount = classId + 1;
+}
+
+void RegexAutomaton::computeCanReachMatch() {
+    vector<vector<uint32_t> > reverseEdges(m_nfaStates.size());
+    for (uint32_t s = 0; s < m_nfaStates.size(); ++s) {
+        for (uint32_t to : m_nfaStates[s].m_epsilons) reverseEdges[to].push_back(s);
+        for (const NfaByteRange& r : m_nfaStates[s].m_ranges) reverseEdges[r.m_to].push_back(s);
+    }
+    m_canReachMatch.assign(m_nfaStates.size(), 0);
+    vector<uint32_t> stack(1, m_matchNfaState);
+    m_canReachMatch[m_matchNfaState] = 1;
+    while (!stack.empty()) {
+        uint32_t s = stack.back();
+        stack.pop_back();
+        for (uint32_t from : reverseEdges[s]) {
+            if (m_canReachMatch[from]) continue;
+            m_canReachMatch[from] = 1;
+            stack.push_back(from);
+        }
+    }
+}
+
+void RegexAutomaton::closure(const vector<uint32_t>& seeds, vector<uint32_t>& nfaStates) {
+    nfaStates.clear();
+    if (++m_visitStamp == 0) {
+        std::fill(m_visitMarks.begin(), m_visitMarks.end(), 0);
+        m_visitStamp = 1;
+    }
+    vector<uint32_t> stack;
+    for (uint32_t s : seeds) {
+        if (m_visitMarks[s] == m_visitStamp) continue;
+        m_visitMarks[s] = m_visitStamp;
+        stack.push_back(s);
+    }
+    while (!stack.empty()) {
+        uint32_t s = stack.back();
+        stack.pop_back();
+        if (!m_canReachMatch[s]) continue;
+        const NfaState& st = m_nfaStates[s];
+        if (!st.m_ranges.empty() || s == m_matchNfaState) nfaStates.push_back(s);
+        for (uint32_t to : st.m_epsilons) {
+            if (m_visitMarks[to] == m_visitStamp) continue;
+            m_visitMarks[to] = m_visitStamp;
+            stack.push_back(to);
+        }
+    }
+    std::sort(nfaStates.begin(), nfaStates.end());
+}
+
+void RegexAutomaton::clearCache() {
+    TLOG_LOG(DEBUG,"regex [%s] dfa state cache cleared with [%zu] states, [%lu] bytes.",
+             m_pattern.c_str(), m_dfaStates.size(), m_cacheBytes);
+    m_nfaSet2IndexMap.clear();
+    m_dfaStates.clear();
+    m_cacheBytes = 0;
+    ++m_generation;
+    ++m_cacheClearCount;
+}
+
+uint32_t RegexAutomaton::getOrAddState(const vector<uint32_t>& nfaStates) {
+    string key((const char*)nfaStates.data(), nfaStates.size() * sizeof(uint32_t));
+    auto it = m_nfaSet2IndexMap.find(key);
+    if (it != m_nfaSet2IndexMap.end()) {
+        return it->second;
+    }
+    //key is stored in both map and state, plus hash node and shared_ptr control block
+    uint64_t stateBytes = sizeof(RegexDfaState) + 2 * key.size() + m_classCount * sizeof(uint32_t) + 64;
+    if (m_cacheBytes + stateBytes > m_maxCacheBytes && !m_dfaStates.empty()) {
+        clearCache();
+    }
+    RegexDfaStatePtr st = std::make_shared<RegexDfaState>();
+    st->m_nfaStates = nfaStates;
+    st->m_isMatch = std::binary_search(nfaStates.begin(), nfaStates.end(), m_matchNfaState);
+    st->m_generation = m_generation;
+    st->m_serialId = m_builtStateCount;
+    st->m_next.assign(m_classCount, UNKNOWN_STATE_INDEX);
+    m_nfaSet2IndexMap.insert(std::make_pair(key, (uint32_t)m_dfaStates.size()));
+    m_dfaStates.push_back(st);
+    m_cacheBytes += stateBytes;
+    ++m_builtStateCount;
+    return m_dfaStates.size() - 1;
+}
+
+AutomatonStatePtr RegexAutomaton::Start() {
+    if (!m_isValid) return nullptr;
+    if (nullptr == m_startState || m_startState->m_generation != m_generation) {
+        vector<uint32_t> nfaStates;
+        closure(vector<uint32_t>(1, m_startNfaState), nfaStates);
+        m_startState = m_dfaStates[getOrAddState(nfaStates)];
+    }
+    return m_startState;
+}
+
+bool RegexAutomaton::IsMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return static_cast<const RegexDfaState*>(state.get())->m_isMatch;
+}
+
+bool RegexAutomaton::CanMatch(const AutomatonStatePtr &state) {
+    if (nullptr == state) return false;
+    return !static_cast<const RegexDfaState*>(state.get())->m_nfaStates.empty();
+}
+
+bool RegexAutomaton::GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) {
+    if (nullptr == state) return false;
+    stateId = static_cast<const RegexDfaState*>(state.get())->m_serialId;
+    return true;
+}
+
+AutomatonStatePtr RegexAutomaton::Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) {
+    if (nullptr == ptr || byteVec.empty()) return ptr;
+    RegexDfaState* st = static_cast<RegexDfaState*>(ptr.get());
+    uint8_t b = byteVec.back();
+    uint32_t classId = m_byteClasses[b];
+    if (st->m_generation == m_generation) {
+        uint32_t nextIndex = st->m_next[classId];
+        if (nextIndex == DEAD_STATE_INDEX) return nullptr;
+        if (nextIndex != UNKNOWN_STATE_INDEX) return m_dfaStates[nextIndex];
+    }
+
+    vector<uint32_t> seeds;
+    for (uint32_t s : st->m_nfaStates) {
+        for (const NfaByteRange& r : m_nfaStates[s].m_ranges) {
+            if (r.m_lo <= b && b <= r.m_hi) seeds.push_back(r.m_to);
+        }
+    }
+    vector<uint32_t> nfaStates;
+    closure(seeds, nfaStates);
+    if (nfaStates.empty()) {
+        if (st->m_generation == m_generation) st->m_next[classId] = DEAD_STATE_INDEX;
+        return nullptr;
+    }
+    uint32_t nextIndex = getOrAddState(nfaStates);
+    //NOTE THAT cache may be cleared by getOrAddState, then 'st' is stale and its transitions are not recorded
+    if (st->m_generation == m_generation) {
+        st->m_next[classId] = nextIndex;
+    }
+    return m_dfaStates[nextIndex];
+}
+
+COMMON_END_NAMESPACE
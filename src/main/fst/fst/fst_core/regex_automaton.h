@@ -0,0 +1,145 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       regex_automaton.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines regular expression automaton for fst term queries such as
+  *                `user_[0-9]+_.*`. Pattern is parsed and compiled into a thompson nfa over
+  *                utf8 bytes, which is determinized lazily: a dfa state (set of nfa states)
+  *                and its transitions are only built when fst iterator first reaches them,
+  *                and kept in a state cache bounded by memory. Nfa states which can never
+  *                reach the match state are dropped, so subtree is pruned as soon as pattern
+  *                can not match anymore.
+  *
+  *                Pattern must match whole key. Supported syntax:
+  *                  literal utf8 characters, '.' for any character,
+  *                  classes like [a-z_], [^0-9], escapes \d \D \w \W \s \S and \ before meta characters,
+  *                  groups (...) and (?:...), alternation |,
+  *                  quantifiers * + ? {n} {n,} {n,m}, '^' at beginning and '$' at end are ignored.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_REGEX_AUTOMATON__H__
+#define __CPPFST_FST_CORE_REGEX_AUTOMATON__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "fst/fst_core/automaton.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+/// state of lazy dfa, which is a set of nfa states and its cached transitions
+class RegexDfaState : public AutomatonState {
+public:
+    RegexDfaState()
+    : m_isMatch(false)
+    , m_generation(0)
+    , m_serialId(0)
+    {}
+public:
+    ///nfa states ascending, empty means dead
+    vector<uint32_t>        m_nfaStates;
+    bool                    m_isMatch;
+    ///generation of state cache this state belongs to, transitions are only valid in the same generation
+    uint64_t                m_generation;
+    ///unique among all states ever built by the automaton, even across cache clears
+    uint64_t                m_serialId;
+    ///next state index in state cache for every byte class, UNKNOWN_STATE_INDEX if not built yet
+    vector<uint32_t>        m_next;
+};
+TYPEDEF_PTR(RegexDfaState);
+
+class RegexAutomaton;
+TYPEDEF_PTR(RegexAutomaton);
+
+/**
+ *@brief   regular expression automaton determinized lazily. It is not thread safe since state cache
+ *         is filled while iterating, so create one for every query.
+ */
+class RegexAutomaton : public Automaton {
+public:
+    const static uint64_t DEFAULT_MAX_CACHE_BYTES = 8 * 1024 * 1024;
+    ///max count in {n,m} quantifier
+    const static uint32_t MAX_REPEAT_COUNT = 1000;
+    const static uint32_t UNKNOWN_STATE_INDEX = 0xFFFFFFFF;
+public:
+    /**
+     *@brief     parse and compile pattern, check 'IsValid' before use
+     *@param     pattern          ---- utf8 regular expression matching whole key
+     *@param     maxCacheBytes    ---- memory bound of dfa state cache, cache is cleared when exceeded
+     */
+    RegexAutomaton(const string& pattern, uint64_t maxCacheBytes = DEFAULT_MAX_CACHE_BYTES);
+public:
+    AutomatonStatePtr Start() override;
+    bool IsMatch(const AutomatonStatePtr &state) override;
+    bool CanMatch(const AutomatonStatePtr &state) override;
+    AutomatonStatePtr Accept(const AutomatonStatePtr &ptr, const vector<uint8_t>& byteVec) override;
+    bool GetStateId(const AutomatonStatePtr& state, uint64_t& stateId) override;
+public:
+    bool IsValid() const { return m_isValid; }
+    ///syntax error message if not valid
+    const string& GetErrorMsg() const { return m_errorMsg; }
+    uint32_t GetNfaStateCount() const { return (uint32_t)m_nfaStates.size(); }
+    uint32_t GetClassCount() const { return m_classCount; }
+    ///dfa states in cache currently
+    uint32_t GetCachedStateCount() const { return (uint32_t)m_dfaStates.size(); }
+    ///dfa states built totally, including those evicted
+    uint64_t GetBuiltStateCount() const { return m_builtStateCount; }
+    uint64_t GetCacheClearCount() const { return m_cacheClearCount; }
+    uint64_t GetCacheBytes() const { return m_cacheBytes; }
+public:
+    ///byte transition of nfa state, from 'm_lo' to 'm_hi' inclusive
+    struct NfaByteRange {
+        NfaByteRange(uint8_t lo, uint8_t hi, uint32_t to) : m_lo(lo), m_hi(hi), m_to(to) {}
+        uint8_t         m_lo;
+        uint8_t         m_hi;
+        uint32_t        m_to;
+    };
+    struct NfaState {
+        vector<uint32_t>        m_epsilons;
+        vector<NfaByteRange>    m_ranges;
+    };
+private:
+    bool compile();
+    void computeByteClasses();
+    void computeCanReachMatch();
+    ///epsilon closure of 'seeds', only keeps states consuming bytes or matching which can reach match state
+    void closure(const vector<uint32_t>& seeds, vector<uint32_t>& nfaStates);
+    ///index of state in cache, which is built if not cached, clear cache first if memory exceeded
+    uint32_t getOrAddState(const vector<uint32_t>& nfaStates);
+    void clearCache();
+private:
+    string                                      m_pattern;
+    uint64_t                                    m_maxCacheBytes;
+    bool                                        m_isValid;
+    string                                      m_errorMsg;
+
+    vector<NfaState>                            m_nfaStates;
+    uint32_t                                    m_startNfaState;
+    uint32_t                                    m_matchNfaState;
+    vector<uint8_t>                             m_canReachMatch;
+    uint8_t                                     m_byteClasses[256];
+    uint32_t                                    m_classCount;
+
+    ///state cache, nfa states set encoded as bytes -> index in 'm_dfaStates'
+    unordered_map<string, uint32_t>             m_nfaSet2IndexMap;
+    vector<RegexDfaStatePtr>                    m_dfaStates;
+    RegexDfaStatePtr                            m_startState;
+    uint64_t                                    m_generation;
+    uint64_t                                    m_cacheBytes;
+    uint64_t                                    m_builtStateCount;
+    uint64_t                                    m_cacheClearCount;
+
+    ///visited marks of closure computing, which are valid when equal to 'm_visitStamp'
+    vector<uint32_t>                            m_visitMarks;
+    uint32_t                                    m_visitStamp;
+private:
+    TLOG_DECLARE();
+};
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_REGEX_AUTOMATON__H__
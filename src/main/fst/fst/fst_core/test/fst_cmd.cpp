@@ -15,10 +15,26 @@
 #include "common/util/file_util.h"
 #include "fst/fst_core/large_file_sorter.h"
 #include <fst/fst_core/fst.h>
+#include "fst/fst_core/fst_set_op.h"
+#include "fst/fst_core/fst_container.h"
 
 using namespace std;
 COMMON_USE_NAMESPACE;
 
+///memory map fst data file and open reader on it, which must not outlive 'mMapDataPiece'.
+///nullptr if file can not be mapped or is corrupt
+static FstReaderPtr openFstReader(const string& fstFile, MMapDataPiece& mMapDataPiece) {
+    TLOG_DECLARE_AND_SETUP_LOGGER(COMMON_NS, MAIN);
+    if (!mMapDataPiece.OpenRead(fstFile.c_str(), true)) {
+        TLOG_LOG(ERROR,"Error! failed to open fst data file:[%s],please check!", fstFile.c_str());
+        return nullptr;
+    }
+    FstReaderPtr fstReaderPtr = FstReader::Create(mMapDataPiece.GetData(), mMapDataPiece.GetDataLength());
+    if (nullptr == fstReaderPtr) {
+        TLOG_LOG(ERROR,"Error! fst data file:[%s] is corrupt,please check!", fstFile.c_str());
+    }
+    return fstReaderPtr;
+}
 
 int main(int argc, char** argv) {
     TLoggerGuard tLoggerGuard;
@@ -42,24 +58,39 @@ int main(int argc, char** argv) {
     auto prefixQuerySubCmd = app.add_subcommand("prefix", fs("execute prefix query starts with a term text in the fst."));
     auto rangeQuerySubCmd = app.add_subcommand("range", fs("execute range query in the fst."));
     auto fuzzyQuerySubCmd = app.add_subcommand("fuzzy", fs("execute fuzzy query in the fst,it works by building a Levenshtein or Damerau-Levenshtein automaton within a edit distance."));
+    auto regexQuerySubCmd = app.add_subcommand("regex", fs("execute regular expression query matching whole key in the fst, such as `user_[0-9]+_.*`."));
+    auto setOpSubCmd = app.add_subcommand("setop", fs("execute union, intersection or difference of many fst data files, show results or materialize them into a new fst data file."));
+    auto packSubCmd = app.add_subcommand("pack", fs("pack many fst data files into one container file, which is opened by one mmap and gives fst by name."));
+    auto checkSubCmd = app.add_subcommand("check", fs("validate checksums of fst data file in parallel and show its node count and key count."));
 
-    string dictFile, fstFile, dotFile, matchstr,prefixstr, gt,ge,lt,le,  fuzzyStr;
-    uint32_t editDistance, fuzzyPrefixLen;
+    string dictFile, fstFile, dotFile, matchstr,prefixstr, gt,ge,lt,le,  fuzzyStr, regexStr;
+    uint32_t editDistance, fuzzyPrefixLen, fuzzyTopK;
     uint64_t maxCacheSize;
     bool isFileSorted;
     bool isUseDamerauLevenshtein;
-    string workDir;
+    bool isUseBitParallel;
+    bool isFuzzyPrefix;
+    uint64_t fuzzyMaxResultCount;
+    uint64_t regexCacheSize;
+    vector<string> setOpFstFiles;
+    string setOpName, mergeFuncName, combineFuncName;
+    vector<string> packFstFiles, packNames;
+    string containerFile;
+    vector<string> workDirs;
     uint32_t threadNum,splitFileNum, parallelTaskNum;
+    uint64_t memoryBudget;
     if (mapSubCmd) {
         mapSubCmd->add_option("-f,--dict-file",dictFile,fs("dictionary file which with format like:`key,value` for every line."))->check(CLI::ExistingFile)->required(true);
         mapSubCmd->add_option("-o,--fst-file",fstFile,fs("output fst data file will be generated."))->check(CLI::NonexistentPath)->required(true);
         mapSubCmd->add_option("-c,--cache-size",maxCacheSize,fs("max cache size used with unit MB bytes,default 1000M if not set"))->default_val(1000)->check(CLI::NonNegativeNumber)->required(false);
 
         mapSubCmd->add_flag("-s,--sorted",isFileSorted,fs("Set this if the input data is already lexicographically sorted. This will make fst construction much faster."))->default_val(false)->required(false);
-        mapSubCmd->add_option("-w,--work-directory",workDir,fs("work directory specified for sort input dictionary file if necessary,default /tmp if not set"))->default_val("/tmp")->check(CLI::ExistingDirectory)->required(false);
+        mapSubCmd->add_option("-w,--work-directory",workDirs,fs("work directories specified for sort input dictionary file if necessary, such as one for every disk, intermediate files are spread across them by their free space,default /tmp if not set"))->check(CLI::ExistingDirectory)->required(false);
         mapSubCmd->add_option("-t,--thread-count",threadNum,fs("threads count specified for sort input dictionary file if necessary,default 4 if not set"))->default_val(4)->check(CLI::Range(1,32))->required(false);
-        mapSubCmd->add_option("-l,--split-file-count",splitFileNum,fs("count number of large file split specified for sort input dictionary file if necessary,default 8 if not set"))->default_val(6)->check(CLI::Range(1,1000))->required(false);
-        mapSubCmd->add_option("-p,--parallel-task-count",parallelTaskNum, fs("paralleled running task count for merge sorted intermediate files specified for sort input dictionary file if necessary, default 3 if not set"))->default_val(3)->check(CLI::Range(2,20))->required(false);
+        mapSubCmd->add_option("-l,--split-file-count",splitFileNum,fs("count number of key ranges sorted runs are split into and merged in parallel specified for sort input dictionary file if necessary,default 6 if not set"))->default_val(6)->check(CLI::Range(1,1000))->required(false);
+        mapSubCmd->add_option("-p,--parallel-task-count",parallelTaskNum, fs("max count of sorted intermediate files merged at once specified for sort input dictionary file if necessary, default 256 if not set"))->default_val(256)->check(CLI::Range(2,4096))->required(false);
+        mapSubCmd->add_option("-m,--memory-budget",memoryBudget,fs("memory used to sort input dictionary file if necessary with unit MB bytes, input file fits in it is sorted in memory, otherwise sorted runs about twice of it are generated and merged,default 1024M if not set"))->default_val(1024)->check(CLI::PositiveNumber)->required(false);
+        mapSubCmd->add_option("-d,--duplicate",combineFuncName,fs("how values of duplicate keys are combined into one while sorting input dictionary file if necessary, one of first, last, sum, min and max,default last if not set"))->default_val("last")->check(CLI::IsMember({"first","last","sum","min","max"}))->required(false);
     }
     if (setSubCmd) {
         setSubCmd->add_option("-f,--dict-file",dictFile,fs("dictionary file which with format like:`key,value` for every line."))->check(CLI::ExistingFile)->required(true);
@@ -67,10 +98,11 @@ int main(int argc, char** argv) {
         setSubCmd->add_option("-c,--cache-size",maxCacheSize, fs("max cache size used with unit MB bytes,default 1000M if not set"))->default_val(1000)->check(CLI::NonNegativeNumber)->required(false);
 
         setSubCmd->add_flag("-s,--sorted",isFileSorted,fs("Set this if the input data is already lexicographically sorted. This will make fst construction much faster."))->default_val(false)->required(false);
-        setSubCmd->add_option("-w,--work-directory",workDir,fs("work directory specified for sort input dictionary file if necessary,default /tmp if not set"))->default_val("/tmp")->check(CLI::ExistingDirectory)->required(false);
+        setSubCmd->add_option("-w,--work-directory",workDirs,fs("work directories specified for sort input dictionary file if necessary, such as one for every disk, intermediate files are spread across them by their free space,default /tmp if not set"))->check(CLI::ExistingDirectory)->required(false);
         setSubCmd->add_option("-t,--thread-count",threadNum,fs("threads count specified for sort input dictionary file if necessary,default 4 if not set"))->default_val(4)->check(CLI::Range(1,32))->required(false);
-        setSubCmd->add_option("-l,--split-file-count",splitFileNum,fs("count number of large file split specified for sort input dictionary file if necessary,default 8 if not set"))->default_val(6)->check(CLI::Range(1,1000))->required(false);
-        setSubCmd->add_option("-p,--parallel-task-count",parallelTaskNum,fs("paralleled running task count for merge sorted intermediate files specified for sort input dictionary file if necessary, default 3 if not set"))->default_val(3)->check(CLI::Range(2,20))->required(false);
+        setSubCmd->add_option("-l,--split-file-count",splitFileNum,fs("count number of key ranges sorted runs are split into and merged in parallel specified for sort input dictionary file if necessary,default 6 if not set"))->default_val(6)->check(CLI::Range(1,1000))->required(false);
+        setSubCmd->add_option("-p,--parallel-task-count",parallelTaskNum,fs("max count of sorted intermediate files merged at once specified for sort input dictionary file if necessary, default 256 if not set"))->default_val(256)->check(CLI::Range(2,4096))->required(false);
+        setSubCmd->add_option("-m,--memory-budget",memoryBudget,fs("memory used to sort input dictionary file if necessary with unit MB bytes, input file fits in it is sorted in memory, otherwise sorted runs about twice of it are generated and merged,default 1024M if not set"))->default_val(1024)->check(CLI::PositiveNumber)->required(false);
     }
     if (dotSubCmd) {
         dotSubCmd->add_option("-f,--fst-file",fstFile,fs("fst data file constructed before."))->check(CLI::ExistingFile)->required(true);
@@ -105,9 +137,40 @@ int main(int argc, char** argv) {
         fuzzyQuerySubCmd->add_option("-z,--fuzzy-str",fuzzyStr,fs("string to be fuzzy matched."))->required(true);
         fuzzyQuerySubCmd->add_option("-d,--distance",editDistance,fs("edit distance for levenshtein similarity search used."))->check(CLI::Range(0,100))->required(true);
         fuzzyQuerySubCmd->add_option("-l,--prefix-len",fuzzyPrefixLen,fs("same prefix length ignored for levenshtein similarity search used."))->default_val(0);
+        CLI::Option* topKOpt = fuzzyQuerySubCmd->add_option("-k,--top-k",fuzzyTopK,fs("only show top k results nearest to fuzzy string with their edit distance, ordered by edit distance then value descending. show all results in key order if 0 or not set."))->default_val(0)->check(CLI::NonNegativeNumber);
         fuzzyQuerySubCmd->add_flag("-m,--damerau-levenshtein",
                                    isUseDamerauLevenshtein,
                                    fs("Set this if use Damerau-Levenshtein Distance to measure similarity. Levenshtein Distance will be used to measure similarity if not set this option."))->default_val(false)->required(false);
+        fuzzyQuerySubCmd->add_flag("-a,--bit-parallel",
+                                   isUseBitParallel,
+                                   fs("Set this if use bit-parallel automaton which builds no dfa, suitable for long fuzzy string or large edit distance."))->default_val(false)->required(false);
+        CLI::Option* fuzzyPrefixOpt = fuzzyQuerySubCmd->add_flag("-x,--fuzzy-prefix",
+                                   isFuzzyPrefix,
+                                   fs("Set this if match keys having a prefix within edit distance of fuzzy string, which is typo tolerant autocomplete."))->default_val(false)->required(false);
+        CLI::Option* maxResultCountOpt = fuzzyQuerySubCmd->add_option("-n,--max-result-count",fuzzyMaxResultCount,fs("stop after so many results of fuzzy prefix query in key order, no limit if 0 or not set."))->default_val(0)->check(CLI::NonNegativeNumber);
+        //top k results are ranked over whole keys, neither fuzzy prefix nor key order limit applies
+        topKOpt->excludes(fuzzyPrefixOpt)->excludes(maxResultCountOpt);
+    }
+    if (regexQuerySubCmd) {
+        regexQuerySubCmd->add_option("-f,--fst-file",fstFile,fs("fst data file constructed before."))->check(CLI::ExistingFile)->required(true);
+        regexQuerySubCmd->add_option("-r,--regex",regexStr,fs("regular expression which must match whole key."))->required(true);
+        regexQuerySubCmd->add_option("-c,--cache-size",regexCacheSize,fs("max cache size of lazily built dfa states with unit MB bytes,default 8M if not set"))->default_val(8)->check(CLI::PositiveNumber)->required(false);
+    }
+    if (setOpSubCmd) {
+        setOpSubCmd->add_option("-i,--fst-files",setOpFstFiles,fs("fst data files constructed before, difference keeps keys of the first one which are in none of the others."))->check(CLI::ExistingFile)->required(true);
+        setOpSubCmd->add_option("-p,--operation",setOpName,fs("set operation, one of union, intersection and difference,default union if not set"))->default_val("union")->check(CLI::IsMember({"union","intersection","difference"}));
+        setOpSubCmd->add_option("-m,--merge",mergeFuncName,fs("how values of a key from many fsts are merged, one of sum, min, max and first,default sum if not set"))->default_val("sum")->check(CLI::IsMember({"sum","min","max","first"}));
+        setOpSubCmd->add_option("-o,--output-fst-file",fstFile,fs("output fst data file materialized from results, results are shown if not specified"))->check(CLI::NonexistentPath);
+        setOpSubCmd->add_option("-c,--cache-size",maxCacheSize,fs("max cache size used to build output fst with unit MB bytes,default 1000M if not set"))->default_val(1000)->check(CLI::NonNegativeNumber)->required(false);
+    }
+    if (packSubCmd) {
+        packSubCmd->add_option("-i,--fst-files",packFstFiles,fs("fst data files constructed before."))->check(CLI::ExistingFile)->required(true);
+        packSubCmd->add_option("-n,--names",packNames,fs("names of fst data files in container in the same order, file names without directory if not set"));
+        packSubCmd->add_option("-o,--container-file",containerFile,fs("output container file will be generated."))->check(CLI::NonexistentPath)->required(true);
+    }
+    if (checkSubCmd) {
+        checkSubCmd->add_option("-i,--fst-file",fstFile,fs("fst data file constructed before."))->check(CLI::ExistingFile)->required(true);
+        checkSubCmd->add_option("-t,--thread-count",threadNum,fs("threads count checksumming fst data file,default 4 if not set"))->default_val(4)->check(CLI::Range(1,32))->required(false);
     }
 
     CLI11_PARSE(app, argc, argv);
@@ -117,42 +180,20 @@ int main(int argc, char** argv) {
         FileOutputStreamPtr outputStream = std::make_shared<FileOutputStream>();
         outputStream->Open(fstFile);
         FstBuilder builder(outputStream.get(),mapSubCmd->parsed(),maxCacheSize * 1000000);
-        ifstream ifs;
-        string line;
-        RemoveFileRAIIPtr removeFileRaii = std::make_shared<RemoveFileRAII>();
-        if (!isFileSorted) {
-            string outputSortFile = TimeUtility::CurrentTimeInSecondsReadable() + "_" +  Random<uint32_t>::RandomString(8);
-            removeFileRaii->SetFilePath(outputSortFile);
-
-            LargeFileSorter largeFileSorter(dictFile,outputSortFile,workDir,threadNum,splitFileNum,parallelTaskNum,false);
-            bool bSortSucc = largeFileSorter.Run();
-            if (!bSortSucc) {
-                TLOG_LOG(ERROR,"failed to sort dictionary file:[%s],please check!", dictFile.c_str());
-                return -1;
-            }
-            ifs.open(outputSortFile);
-            if (!ifs) {
-                TLOG_LOG(ERROR,"failed to read data from sorted output dictionary file:[%s],please check!", outputSortFile.c_str());
-                return -1;
-            }
-        }
-        else {
-            //dictionary file has been sorted
-            ifs.open(dictFile);
-        }
-        while (getline(ifs,line)) {
-            if (line.empty()) continue;
+        auto insertLine = [&](const string& line) {
+            if (line.empty()) return;
             vector<string> arr;
             StringUtil::Split( line, ",",arr,false);
             if (arr.size() < 2 && mapSubCmd->parsed()) {
                 TLOG_LOG(ERROR, "invalid input data line:[%s],items count < 2!omit it", line.c_str());
-                continue;
+                return;
             }
             if (arr.size() < 1 && setSubCmd->parsed()) {
                 TLOG_LOG(ERROR, "invalid input data line:[%s],items count < 1!omit it", line.c_str());
-                continue;
+                return;
             }
-            string key = arr[0];
+            //key is trimmed as sorted
+            string key = StringUtil::TrimString(arr[0]);
 //            TLOG_LOG(INFO,"key:[%s] in string,while [%ws] in wstring.",key.c_str(), s2ws(key).c_str());
             uint64_t value = 0;
             if (mapSubCmd->parsed()) {
@@ -161,6 +202,39 @@ int main(int argc, char** argv) {
                 ss >> value;
             }
             builder.Insert((uint8_t*)key.c_str(), strlen(key.c_str()),value);
+        };
+        if (!isFileSorted) {
+            //sorted lines are inserted while the last merge goes on, no sorted dictionary file is written
+            //duplicate keys are combined while sorting, so that every key is inserted once
+            LargeFileSorter::COMBINE_FUNC_ENUM combineFunc = setSubCmd->parsed() ? LargeFileSorter::COMBINE_FUNC_FIRST :
+                                                             combineFuncName == "first" ? LargeFileSorter::COMBINE_FUNC_FIRST :
+                                                             combineFuncName == "sum" ? LargeFileSorter::COMBINE_FUNC_SUM :
+                                                             combineFuncName == "min" ? LargeFileSorter::COMBINE_FUNC_MIN :
+                                                             combineFuncName == "max" ? LargeFileSorter::COMBINE_FUNC_MAX : LargeFileSorter::COMBINE_FUNC_LAST;
+            LargeFileSorter largeFileSorter(dictFile,"","/tmp",threadNum,splitFileNum,parallelTaskNum,false);
+            if (!workDirs.empty()) {
+                largeFileSorter.SetWorkDirPaths(workDirs);
+            }
+            largeFileSorter.SetMemoryBudget(memoryBudget * 1024 * 1024);
+            largeFileSorter.SetCombineFunc(combineFunc);
+            string line;
+            bool bSortSucc = largeFileSorter.Run([&](const char* data, size_t len) {
+                line.assign(data, len);
+                insertLine(line);
+                return true;
+            });
+            if (!bSortSucc) {
+                TLOG_LOG(ERROR,"failed to sort dictionary file:[%s],please check!", dictFile.c_str());
+                return -1;
+            }
+        }
+        else {
+            //dictionary file has been sorted
+            ifstream ifs(dictFile);
+            string line;
+            while (getline(ifs,line)) {
+                insertLine(line);
+            }
         }
         builder.Finish();
         outputStream->Close();
@@ -172,9 +246,11 @@ int main(int argc, char** argv) {
             return 1;
         }
         MMapDataPiece mMapDataPiece;
-        bool openOk = mMapDataPiece.OpenRead(fstFile.c_str(), true);
-        assert(openOk);
-        FstReader fstReader(mMapDataPiece.GetData());
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
         fstReader.DotDraw(ofs);
         ofs.flush();
         ofs.close();
@@ -218,9 +294,11 @@ int main(int argc, char** argv) {
         }
 
         MMapDataPiece mMapDataPiece;
-        bool openOk = mMapDataPiece.OpenRead(fstFile.c_str(), true);
-        assert(openOk);
-        FstReader fstReader(mMapDataPiece.GetData());
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
 
         int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
         FstReader::Iterator it = fstReader.GetMatchIterator(leftBound, rightBound,matchstr);
@@ -277,9 +355,11 @@ int main(int argc, char** argv) {
         }
 
         MMapDataPiece mMapDataPiece;
-        bool openOk = mMapDataPiece.OpenRead(fstFile.c_str(), true);
-        assert(openOk);
-        FstReader fstReader(mMapDataPiece.GetData());
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
 
         int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
         FstReader::Iterator it = fstReader.GetPrefixIterator(leftBound, rightBound,prefixstr);
@@ -302,9 +382,11 @@ int main(int argc, char** argv) {
     }
     else if (rangeQuerySubCmd->parsed()) {
         MMapDataPiece mMapDataPiece;
-        bool openOk = mMapDataPiece.OpenRead(fstFile.c_str(), true);
-        assert(openOk);
-        FstReader fstReader(mMapDataPiece.GetData());
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
 
 
         FstReader::FstIterBound leftBound, rightBound;
@@ -363,12 +445,36 @@ int main(int argc, char** argv) {
     }
     else if (fuzzyQuerySubCmd->parsed()) {
         MMapDataPiece mMapDataPiece;
-        bool openOk = mMapDataPiece.OpenRead(fstFile.c_str(), true);
-        assert(openOk);
-        FstReader fstReader(mMapDataPiece.GetData());
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
+
+        FstReader::FUZZY_ALGORITHM_ENUM algorithm = isUseBitParallel ? FstReader::FUZZY_ALGORITHM_BIT_PARALLEL : FstReader::FUZZY_ALGORITHM_DFA;
+        if (fuzzyTopK > 0) {
+            int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
+            vector<FstReader::FuzzyResultPtr> results = fstReader.GetTopKFuzzyResults(fuzzyStr,editDistance,fuzzyTopK,fuzzyPrefixLen,
+                                                                                      isUseDamerauLevenshtein,algorithm);
+            for (const FstReader::FuzzyResultPtr& item : results) {
+                if (fstReader.HasOutput()) {
+                    TLOG_LOG(INFO, "[%s]->[%lu], distance:[%u]", item->GetInputStr().c_str(), item->m_output, item->m_distance);
+                }
+                else {
+                    TLOG_LOG(INFO, "[%s], distance:[%u]", item->GetInputStr().c_str(), item->m_distance);
+                }
+            }
+            int64_t edTime = TimeUtility::CurrentTimeInMicroSeconds();
+            TLOG_LOG(INFO, "Totally got [%zu] results, time consumed:[%lu] us.", results.size(), edTime - stTime);
+            return 0;
+        }
 
         int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
-        FstReader::Iterator it = fstReader.GetFuzzyIterator(fuzzyStr,editDistance,fuzzyPrefixLen,isUseDamerauLevenshtein);
+        FstReader::Iterator it = isFuzzyPrefix ?
+                                 fstReader.GetFuzzyPrefixIterator(fuzzyStr,editDistance,fuzzyPrefixLen,isUseDamerauLevenshtein,
+                                                                  fuzzyMaxResultCount) :
+                                 fstReader.GetFuzzyIterator(fuzzyStr,editDistance,fuzzyPrefixLen,isUseDamerauLevenshtein,
+                                                            algorithm);
 
         uint64_t hitCount = 0;
         bool isMap = fstReader.HasOutput();
@@ -386,6 +492,126 @@ int main(int argc, char** argv) {
         int64_t edTime = TimeUtility::CurrentTimeInMicroSeconds();
         TLOG_LOG(INFO, "Totally got [%lu] results, time consumed:[%lu] us.", hitCount, edTime - stTime);
     }
+    else if (regexQuerySubCmd->parsed()) {
+        MMapDataPiece mMapDataPiece;
+        FstReaderPtr fstReaderPtr = openFstReader(fstFile, mMapDataPiece);
+        if (nullptr == fstReaderPtr) {
+            return 1;
+        }
+        FstReader& fstReader = *fstReaderPtr;
+
+        int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
+        FstReader::Iterator it;
+        if (!fstReader.GetRegexIterator(regexStr,it,regexCacheSize * 1024 * 1024)) {
+            TLOG_LOG(ERROR, "invalid regular expression:[%s]", regexStr.c_str());
+            return -1;
+        }
+
+        uint64_t hitCount = 0;
+        bool isMap = fstReader.HasOutput();
+        while (true) {
+            FstReader::IteratorResultPtr item = it.Next();
+            if (nullptr == item) break;
+            if (isMap) {
+                TLOG_LOG(INFO, "[%s]->[%lu]", item->GetInputStr().c_str(), item->m_output);
+            }
+            else {
+                TLOG_LOG(INFO, "[%s]", item->GetInputStr().c_str());
+            }
+            ++hitCount;
+        }
+        int64_t edTime = TimeUtility::CurrentTimeInMicroSeconds();
+        TLOG_LOG(INFO, "Totally got [%lu] results, time consumed:[%lu] us.", hitCount, edTime - stTime);
+    }
+    else if (setOpSubCmd->parsed()) {
+        vector<MMapDataPiecePtr> mMapDataPieces;
+        vector<FstReaderPtr> fstReaders;
+        vector<FstReader*> readers;
+        bool isMap = false;
+        for (const string& file : setOpFstFiles) {
+            MMapDataPiecePtr mMapDataPiece = std::make_shared<MMapDataPiece>();
+            mMapDataPieces.push_back(mMapDataPiece);
+            fstReaders.push_back(openFstReader(file, *mMapDataPiece));
+            if (nullptr == fstReaders.back()) {
+                return 1;
+            }
+            readers.push_back(fstReaders.back().get());
+            isMap = isMap || fstReaders.back()->HasOutput();
+        }
+        FstSetOpStream::SET_OP_ENUM op = setOpName == "intersection" ? FstSetOpStream::SET_OP_INTERSECTION :
+                                         setOpName == "difference" ? FstSetOpStream::SET_OP_DIFFERENCE : FstSetOpStream::SET_OP_UNION;
+        FstSetOpStream::MERGE_FUNC_ENUM mergeFunc = mergeFuncName == "min" ? FstSetOpStream::MERGE_FUNC_MIN :
+                                                    mergeFuncName == "max" ? FstSetOpStream::MERGE_FUNC_MAX :
+                                                    mergeFuncName == "first" ? FstSetOpStream::MERGE_FUNC_FIRST : FstSetOpStream::MERGE_FUNC_SUM;
+        FstSetOpStream stream(readers, op, mergeFunc);
+
+        int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
+        uint64_t hitCount = 0;
+        if (!fstFile.empty()) {
+            FileOutputStreamPtr outputStream = std::make_shared<FileOutputStream>();
+            outputStream->Open(fstFile);
+            FstBuilder builder(outputStream.get(),isMap,maxCacheSize * 1000000);
+            bool buildOk = stream.Build(builder,hitCount);
+            outputStream->Close();
+            if (!buildOk) {
+                TLOG_LOG(ERROR,"failed to build fst data file:[%s],please check!", fstFile.c_str());
+                return -1;
+            }
+        }
+        else {
+            while (true) {
+                FstSetOpStream::SetOpResultPtr item = stream.Next();
+                if (nullptr == item) break;
+                if (isMap) {
+                    TLOG_LOG(INFO, "[%s]->[%lu]", item->GetInputStr().c_str(), item->m_output);
+                }
+                else {
+                    TLOG_LOG(INFO, "[%s]", item->GetInputStr().c_str());
+                }
+                ++hitCount;
+            }
+        }
+        int64_t edTime = TimeUtility::CurrentTimeInMicroSeconds();
+        TLOG_LOG(INFO, "Totally got [%lu] results, time consumed:[%lu] us.", hitCount, edTime - stTime);
+    }
+    else if (packSubCmd->parsed()) {
+        if (!packNames.empty() && packNames.size() != packFstFiles.size()) {
+            TLOG_LOG(ERROR, "count of names:[%zu] differs from count of fst data files:[%zu].", packNames.size(), packFstFiles.size());
+            return -1;
+        }
+        FstContainerWriter writer;
+        if (!writer.Open(containerFile)) {
+            return -1;
+        }
+        for (size_t i = 0; i < packFstFiles.size(); ++i) {
+            string name = packNames.empty() ? packFstFiles[i].substr(packFstFiles[i].find_last_of('/') + 1) : packNames[i];
+            if (!writer.AddFstFile(name, packFstFiles[i])) {
+                return -1;
+            }
+            TLOG_LOG(INFO, "packed fst data file:[%s] as name:[%s].", packFstFiles[i].c_str(), name.c_str());
+        }
+        if (!writer.Finish()) {
+            return -1;
+        }
+    }
+    else if (checkSubCmd->parsed()) {
+        MMapDataPiece mMapDataPiece;
+        if (!mMapDataPiece.OpenRead(fstFile.c_str(), true)) {
+            TLOG_LOG(ERROR,"Error! failed to open fst data file:[%s],please check!", fstFile.c_str());
+            return 1;
+        }
+        FstFormat::FstInfo info;
+        int64_t  stTime = TimeUtility::CurrentTimeInMicroSeconds();
+        bool isOk = FstFormat::Validate(mMapDataPiece.GetData(), mMapDataPiece.GetDataLength(),
+                                        FstFormat::VALIDATE_LEVEL_FULL, threadNum, &info);
+        int64_t edTime = TimeUtility::CurrentTimeInMicroSeconds();
+        if (!isOk) {
+            TLOG_LOG(ERROR,"fst data file:[%s] is corrupt, time consumed:[%lu] us.", fstFile.c_str(), edTime - stTime);
+            return 1;
+        }
+        TLOG_LOG(INFO,"fst data file:[%s] is valid, version:[%u], is map:[%d], nodes:[%lu], keys:[%lu], old format:[%d], time consumed:[%lu] us.",
+                 fstFile.c_str(), info.m_version, info.m_hasOutput, info.m_nodeCount, info.m_keyCount, info.m_isLegacy, edTime - stTime);
+    }
     return 0;
 }
 
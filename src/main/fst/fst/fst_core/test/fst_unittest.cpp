@@ -14,7 +14,20 @@
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <thread>
+#include <regex>
+#include <set>
+#include <atomic>
+#include <functional>
 #include "fst/fst_core/large_file_sorter.h"
+#include "fst/fst_core/parametric_levenshtein_automaton.h"
+#include "fst/fst_core/byte_dfa_automaton.h"
+#include "fst/fst_core/bit_parallel_levenshtein_automaton.h"
+#include "fst/fst_core/fst_set_op.h"
+#include "fst/fst_core/updatable_fst.h"
+#include "fst/fst_core/fst_reader_registry.h"
+#include "fst/fst_core/fst_container.h"
+#include "fst/fst_core/fst_format.h"
 
 STD_USE_NAMESPACE;
 COMMON_BEGIN_NAMESPACE
@@ -22,6 +35,89 @@ COMMON_BEGIN_NAMESPACE
 CPPUNIT_TEST_SUITE_REGISTRATION(FstTest);
 TLOG_SETUP(COMMON_NS,FstTest);
 
+///build fst into memory string from keys which must be sorted already
+static void buildFstInMemory(const vector<string>& keys, bool isMap, string& fstData) {
+    ostringstream oss;
+    StdostreamOutputStream outputStream(oss);
+    FstBuilder builder(&outputStream,isMap, 1000000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        builder.Insert((const uint8_t*)keys[i].c_str(), keys[i].size(), i + 1);
+    }
+    builder.Finish();
+    fstData = oss.str();
+}
+
+///build set fst file from an unsorted dictionary file
+static void buildFstFromDictFile(const string& dictFile, const string& sortOutputFile, const string& fstOutputFile) {
+    LargeFileSorter largeFileSorter(dictFile,sortOutputFile,"/tmp",4,10,3,false);
+    bool bSortSucc = largeFileSorter.Run();
+    CPPUNIT_ASSERT_EQUAL(true,bSortSucc);
+    FileOutputStreamPtr outputStream = std::make_shared<FileOutputStream>();
+    outputStream->Open(fstOutputFile);
+    FstBuilder builder(outputStream.get(),false, 1000000);
+    ifstream ifs(sortOutputFile);
+    string line;
+    while (getline(ifs,line)) {
+        if (line.empty()) continue;
+        vector<string> arr;
+        StringUtil::Split( line, ",",arr,false);
+        builder.Insert((uint8_t*)arr[0].c_str(), arr[0].size(),0);
+    }
+    builder.Finish();
+    outputStream->Close();
+}
+
+///set fst built from fst_test_dict2.txt and mapped for reading, built files are removed on destruction
+class Dict2Fst {
+public:
+    Dict2Fst()
+    : m_sortOutputFile(string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32))
+    , m_fstOutputFile(string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32))
+    , m_removeSortOutputFile(m_sortOutputFile)
+    , m_removeFstOutputFile(m_fstOutputFile)
+    {
+        buildFstFromDictFile(string() + TEST_DATA_PATH + "/fst_test_dict2.txt",m_sortOutputFile,m_fstOutputFile);
+        bool openOk = m_mMapDataPiece.OpenRead(m_fstOutputFile.c_str(), true);
+        CPPUNIT_ASSERT(openOk);
+    }
+public:
+    uint8_t* GetData() { return m_mMapDataPiece.GetData(); }
+    ///sorted dictionary lines the fst is built from
+    const string& GetSortOutputFile() const { return m_sortOutputFile; }
+private:
+    string             m_sortOutputFile;
+    string             m_fstOutputFile;
+    RemoveFileRAII     m_removeSortOutputFile;
+    RemoveFileRAII     m_removeFstOutputFile;
+    MMapDataPiece      m_mMapDataPiece;
+};
+
+///edit distance by full dynamic programming, restricted edit distance if 'withTransposition'
+static uint32_t editDistanceByDp(const string& s1, const string& s2, bool withTransposition) {
+    vector<vector<uint32_t> > dp(s1.size() + 1, vector<uint32_t>(s2.size() + 1, 0));
+    for (size_t i = 0; i <= s1.size(); ++i) dp[i][0] = i;
+    for (size_t j = 0; j <= s2.size(); ++j) dp[0][j] = j;
+    for (size_t i = 1; i <= s1.size(); ++i) {
+        for (size_t j = 1; j <= s2.size(); ++j) {
+            dp[i][j] = std::min(std::min(dp[i-1][j] + 1, dp[i][j-1] + 1), dp[i-1][j-1] + (s1[i-1] == s2[j-1] ? 0 : 1));
+            if (withTransposition && i > 1 && j > 1 && s1[i-1] == s2[j-2] && s1[i-2] == s2[j-1]) {
+                dp[i][j] = std::min(dp[i][j], dp[i-2][j-2] + 1);
+            }
+        }
+    }
+    return dp[s1.size()][s2.size()];
+}
+
+static vector<string> collectKeys(FstReader::Iterator it) {
+    vector<string> results;
+    while (true) {
+        FstReader::IteratorResultPtr item = it.Next();
+        if (nullptr == item) break;
+        results.push_back(item->GetInputStr());
+    }
+    return results;
+}
+
 void FstTest::testFstFuzzy() {
 
     string standardFile = string() + TEST_DATA_PATH + "/fst_test_dict2_standard.txt";
@@ -253,4 +349,1128 @@ void FstTest::testFst() {
     CPPUNIT_ASSERT_EQUAL(oss1.str(),oss2.str());
 }
 
-COMMON_END_NAMESPACE
\ No newline at end of file
+void FstTest::testParametricLevenshteinFstFuzzy() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+
+    //parametric automaton must get exactly the same results as the row-based automatons
+    vector<string> queries = {"hair","hello","aardvarks","mississippi","a","zz","abc"};
+    for (const string& query : queries) {
+        for (uint32_t d = 0; d <= ParametricLevenshteinTable::MAX_PARAMETRIC_EDIT_DISTANCE; ++d) {
+            for (bool isDamerau : {false,true}) {
+                AutomatonPtr parametricAut = std::make_shared<ParametricLevenshteinAutomaton>(query,d,isDamerau);
+                AutomatonPtr rowAut = isDamerau ?
+                        (AutomatonPtr)std::make_shared<DamerauLevenshteinAutomaton>(query,d)
+                        : (AutomatonPtr)std::make_shared<LevenshteinAutomaton>(query,d);
+                vector<string> expected = collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),rowAut));
+                vector<string> actual = collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),parametricAut));
+                TLOG_LOG(DEBUG,"query:[%s],distance:[%u],damerau:[%d] got [%zu] results",query.c_str(),d,isDamerau,actual.size());
+                CPPUNIT_ASSERT(expected == actual);
+
+                AutomatonPtr prefixAut = std::make_shared<PrefixAutomaton>(query.substr(0,2));
+                AutomatonPtr samePrefixAut = std::make_shared<ParametricLevenshteinAutomaton>(query,d,isDamerau,2);
+                expected = collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),Intersect(prefixAut,rowAut)));
+                actual = collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),samePrefixAut));
+                CPPUNIT_ASSERT(expected == actual);
+            }
+        }
+    }
+
+    //transitions are built by the first walk, walking again builds nothing and gets the same results
+    ParametricLevenshteinAutomatonPtr lazyAut = std::make_shared<ParametricLevenshteinAutomaton>("hair",2,false);
+    vector<string> expected = collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),lazyAut));
+    uint32_t byteStateCount = lazyAut->GetByteStateCount();
+    CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(FstReader::FstIterBound(),FstReader::FstIterBound(),lazyAut)));
+    CPPUNIT_ASSERT_EQUAL(byteStateCount,lazyAut->GetByteStateCount());
+    CPPUNIT_ASSERT_EQUAL(214ul,collectKeys(fstReader.GetFuzzyIterator("hair",2,0,false)).size());
+    CPPUNIT_ASSERT_EQUAL(220ul,collectKeys(fstReader.GetFuzzyIterator("hair",2,0,true)).size());
+
+    //utf8 multiple bytes characters
+    vector<string> keys = {"中国","中国人","中国人民","中国心","北七","北七家","北京","北平"};
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader utf8FstReader((uint8_t*)fstData.data());
+    vector<string> results = collectKeys(utf8FstReader.GetFuzzyIterator("中国人",1,0,false));
+    CPPUNIT_ASSERT(vector<string>({"中国","中国人","中国人民","中国心"}) == results);
+    results = collectKeys(utf8FstReader.GetFuzzyIterator("北平家",1,1,true));
+    CPPUNIT_ASSERT(vector<string>({"北七家","北平"}) == results);
+    results = collectKeys(utf8FstReader.GetFuzzyIterator("国中",1,0,true));
+    CPPUNIT_ASSERT(vector<string>({"中国"}) == results);
+}
+
+void FstTest::testByteDfaFstFuzzy() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+    FstReader::FstIterBound noBound;
+
+    //compiled byte dfa must get exactly the same results as utf8 character level automatons
+    vector<string> queries = {"hair","aardvarks","zz","abc"};
+    for (const string& query : queries) {
+        for (uint32_t d = 1; d <= 3; ++d) {
+            for (bool isDamerau : {false,true}) {
+                AutomatonPtr rowAut;
+                ByteDfaAutomatonPtr rowByteDfa;
+                if (isDamerau) {
+                    DamerauLevenshteinAutomatonPtr aut = std::make_shared<DamerauLevenshteinAutomaton>(query,d);
+                    rowByteDfa = aut->CompileToByteDfa();
+                    rowAut = aut;
+                }
+                else {
+                    LevenshteinAutomatonPtr aut = std::make_shared<LevenshteinAutomaton>(query,d);
+                    rowByteDfa = aut->CompileToByteDfa();
+                    rowAut = aut;
+                }
+                ParametricLevenshteinAutomatonPtr parametricAut = std::make_shared<ParametricLevenshteinAutomaton>(query,d,isDamerau);
+                vector<string> expected = collectKeys(fstReader.GetIterator(noBound,noBound,rowAut));
+                CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(noBound,noBound,rowByteDfa)));
+                CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(noBound,noBound,parametricAut->CompileToByteDfa())));
+
+                AutomatonPtr prefixAut = std::make_shared<PrefixAutomaton>(query.substr(0,1));
+                expected = collectKeys(fstReader.GetIterator(noBound,noBound,Intersect(prefixAut,rowAut)));
+                CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(noBound,noBound,rowByteDfa->RestrictPrefix(query.substr(0,1)))));
+                CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetFuzzyIterator(query,d,1,isDamerau)));
+            }
+        }
+    }
+
+    //utf8 multiple bytes characters, and byte sequences which can never be a character
+    vector<string> keys = {"\xe4\xb8","中国","中国人","中国人民","中国心","中国心\xbf","北七","北七家","北京","北平"};
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader utf8FstReader((uint8_t*)fstData.data());
+    ByteDfaAutomatonPtr byteDfa = ParametricLevenshteinAutomaton("中国人",1,false).CompileToByteDfa();
+    CPPUNIT_ASSERT(vector<string>({"中国","中国人","中国人民","中国心"}) == collectKeys(utf8FstReader.GetIterator(noBound,noBound,byteDfa)));
+    AutomatonPtr lazyAut = std::make_shared<ParametricLevenshteinAutomaton>("中国人",1,false);
+    CPPUNIT_ASSERT(vector<string>({"中国","中国人","中国人民","中国心"}) == collectKeys(utf8FstReader.GetIterator(noBound,noBound,lazyAut)));
+    byteDfa = LevenshteinAutomaton("北京",1).CompileToByteDfa();
+    CPPUNIT_ASSERT(vector<string>({"北七","北京","北平"}) == collectKeys(utf8FstReader.GetIterator(noBound,noBound,byteDfa)));
+    CPPUNIT_ASSERT(vector<string>({"北七"}) == collectKeys(utf8FstReader.GetIterator(noBound,noBound,byteDfa->RestrictPrefix("北七"))));
+}
+
+void FstTest::testBitParallelFstFuzzy() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+    FstReader::FstIterBound noBound;
+
+    vector<string> queries = {"hair","aardvarks","zz","abc",""};
+    for (const string& query : queries) {
+        for (uint32_t d = 0; d <= 3; ++d) {
+            for (bool isDamerau : {false,true}) {
+                vector<string> expected = collectKeys(fstReader.GetFuzzyIterator(query,d,0,isDamerau));
+                vector<string> actual = collectKeys(fstReader.GetFuzzyIterator(query,d,0,isDamerau,FstReader::FUZZY_ALGORITHM_BIT_PARALLEL));
+                CPPUNIT_ASSERT(expected == actual);
+                expected = collectKeys(fstReader.GetFuzzyIterator(query,d,2,isDamerau));
+                actual = collectKeys(fstReader.GetFuzzyIterator(query,d,2,isDamerau,FstReader::FUZZY_ALGORITHM_BIT_PARALLEL));
+                CPPUNIT_ASSERT(expected == actual);
+            }
+        }
+    }
+
+    //long query spans multiple 64 bits blocks, checked with full dynamic programming
+    string query;
+    for (size_t i = 0; i < 130; ++i) query.push_back("abc"[(i * 7 + i / 5) % 3]);
+    set<string> keySet;
+    keySet.insert(query);
+    for (uint32_t i = 0; i < 800; ++i) {
+        string key = query;
+        uint32_t editCount = Random<uint32_t>::RandomIntBetween(0,5);
+        for (uint32_t k = 0; k < editCount && key.size() > 2; ++k) {
+            size_t pos = Random<uint32_t>::RandomIntBetween(0,key.size() - 2);
+            switch (Random<uint32_t>::RandomIntBetween(0,3)) {
+                case 0: key.erase(pos, 1); break;
+                case 1: key.insert(pos, 1, "abcd"[Random<uint32_t>::RandomIntBetween(0,3)]); break;
+                case 2: key[pos] = "abcd"[Random<uint32_t>::RandomIntBetween(0,3)]; break;
+                default: std::swap(key[pos], key[pos+1]); break;
+            }
+        }
+        keySet.insert(key);
+    }
+    vector<string> keys(keySet.begin(), keySet.end());
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader longFstReader((uint8_t*)fstData.data());
+    for (uint32_t d : {1,4}) {
+        for (bool isDamerau : {false,true}) {
+            vector<string> expected;
+            for (const string& key : keys) {
+                if (editDistanceByDp(query,key,isDamerau) <= d) expected.push_back(key);
+            }
+            AutomatonPtr aut = std::make_shared<BitParallelLevenshteinAutomaton>(query,d,isDamerau);
+            vector<string> actual = collectKeys(longFstReader.GetIterator(noBound,noBound,aut));
+            TLOG_LOG(DEBUG,"long query distance:[%u],damerau:[%d] got [%zu] results",d,isDamerau,actual.size());
+            CPPUNIT_ASSERT(expected == actual);
+        }
+    }
+}
+
+void FstTest::testFuzzyAutomatonCache() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+    FstReader cachedFstReader(dictFst.GetData());
+    FuzzyAutomatonCachePtr cache = std::make_shared<FuzzyAutomatonCache>(100 * 1024 * 1024);
+    cachedFstReader.SetFuzzyAutomatonCache(cache);
+
+    vector<string> expected = collectKeys(fstReader.GetFuzzyIterator("hair",2,0,false));
+    CPPUNIT_ASSERT(expected == collectKeys(cachedFstReader.GetFuzzyIterator("hair",2,0,false)));
+    CPPUNIT_ASSERT(expected == collectKeys(cachedFstReader.GetFuzzyIterator("hair",2,0,false)));
+    CPPUNIT_ASSERT_EQUAL(2ul,cache->GetTotalQueryTimes());
+    CPPUNIT_ASSERT_EQUAL(1ul,cache->GetHitQueryTimes());
+    CPPUNIT_ASSERT_EQUAL(1ul,cache->GetKeyCount());
+
+    //variant and prefix length are parts of key
+    CPPUNIT_ASSERT(collectKeys(fstReader.GetFuzzyIterator("hair",2,0,true))
+                   == collectKeys(cachedFstReader.GetFuzzyIterator("hair",2,0,true)));
+    CPPUNIT_ASSERT(collectKeys(fstReader.GetFuzzyIterator("hair",2,1,false))
+                   == collectKeys(cachedFstReader.GetFuzzyIterator("hair",2,1,false)));
+    CPPUNIT_ASSERT_EQUAL(3ul,cache->GetKeyCount());
+    CPPUNIT_ASSERT_EQUAL(1ul,cache->GetHitQueryTimes());
+    CPPUNIT_ASSERT(cache->GetCacheSizeUsed() > 0);
+    cache->ResetHitStatistics();
+    CPPUNIT_ASSERT_EQUAL(0ul,cache->GetTotalQueryTimes());
+
+    //concurrent iterators share cached automatons
+    vector<string> queries = {"hair","hello","abc","zz"};
+    vector<vector<string> > expectedResults;
+    for (const string& query : queries) {
+        expectedResults.push_back(collectKeys(fstReader.GetFuzzyIterator(query,2,0,true)));
+    }
+    std::atomic<uint32_t> failedCount(0);
+    vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&,t]() {
+            FstReader reader(dictFst.GetData());
+            reader.SetFuzzyAutomatonCache(cache);
+            for (uint32_t i = 0; i < 20; ++i) {
+                size_t ix = (t + i) % queries.size();
+                if (collectKeys(reader.GetFuzzyIterator(queries[ix],2,0,true)) != expectedResults[ix]) ++failedCount;
+            }
+        }));
+    }
+    for (std::thread& th : threads) th.join();
+    CPPUNIT_ASSERT_EQUAL(0u,failedCount.load());
+    CPPUNIT_ASSERT_EQUAL(80ul,cache->GetTotalQueryTimes());
+    CPPUNIT_ASSERT(cache->GetHitRatio() > 0.5);
+
+    //memory is bounded, least recently used automatons are evicted
+    ByteDfaAutomatonPtr aut = ParametricLevenshteinAutomaton("hair",2,false).CompileToByteDfa();
+    uint64_t entrySize = FuzzyAutomatonCache::GetFuzzyAutomatonCacheKeySize()(FuzzyAutomatonCacheKey("hair",2,0,false))
+                         + FuzzyAutomatonCache::GetByteDfaAutomatonSize()(aut);
+    CPPUNIT_ASSERT(entrySize > aut->GetMemoryBytes());
+    FuzzyAutomatonCachePtr smallCache = std::make_shared<FuzzyAutomatonCache>(entrySize * 3);
+    cachedFstReader.SetFuzzyAutomatonCache(smallCache);
+    for (const char* query : {"hair","hail","hain","haie","haig"}) {
+        cachedFstReader.GetFuzzyIterator(query,2,0,false);
+        CPPUNIT_ASSERT(smallCache->GetCacheSizeUsed() <= smallCache->GetCacheSize());
+    }
+    CPPUNIT_ASSERT(smallCache->GetKeyCount() <= 3);
+    CPPUNIT_ASSERT(nullptr == smallCache->Get(FuzzyAutomatonCacheKey("hair",2,0,false)));
+    CPPUNIT_ASSERT(nullptr != smallCache->Get(FuzzyAutomatonCacheKey("haig",2,0,false)));
+}
+
+void FstTest::testTopKFuzzy() {
+    Dict2Fst dictFst;
+
+    //map fst whose output is order number of key
+    vector<string> keys;
+    ifstream ifs(dictFst.GetSortOutputFile());
+    string line;
+    while (getline(ifs,line)) {
+        if (!line.empty()) keys.push_back(line);
+    }
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader fstReader((uint8_t*)fstData.data());
+
+    vector<string> queries = {"hair","helo","abc","mississippi"};
+    for (const string& query : queries) {
+        for (bool isDamerau : {false,true}) {
+            //all results ordered by distance, output descending
+            vector<pair<uint32_t,uint64_t> > all;
+            for (size_t i = 0; i < keys.size(); ++i) {
+                uint32_t distance = editDistanceByDp(query,keys[i],isDamerau);
+                if (distance <= 2) all.push_back(std::make_pair(distance,i + 1));
+            }
+            std::sort(all.begin(),all.end(),[](const pair<uint32_t,uint64_t>& p1, const pair<uint32_t,uint64_t>& p2) {
+                return p1.first != p2.first ? p1.first < p2.first : p1.second > p2.second;
+            });
+            for (uint32_t topK : {1,5,50,100000}) {
+                for (FstReader::FUZZY_ALGORITHM_ENUM algorithm : {FstReader::FUZZY_ALGORITHM_DFA,FstReader::FUZZY_ALGORITHM_BIT_PARALLEL}) {
+                    vector<FstReader::FuzzyResultPtr> results = fstReader.GetTopKFuzzyResults(query,2,topK,0,isDamerau,algorithm);
+                    CPPUNIT_ASSERT_EQUAL(std::min((size_t)topK,all.size()),results.size());
+                    for (size_t i = 0; i < results.size(); ++i) {
+                        CPPUNIT_ASSERT_EQUAL(all[i].first,results[i]->m_distance);
+                        CPPUNIT_ASSERT_EQUAL(all[i].second,results[i]->m_output);
+                        CPPUNIT_ASSERT_EQUAL(keys[all[i].second - 1],results[i]->GetInputStr());
+                    }
+                }
+            }
+        }
+    }
+    //same prefix
+    vector<FstReader::FuzzyResultPtr> results = fstReader.GetTopKFuzzyResults("hair",2,10,2,false);
+    CPPUNIT_ASSERT_EQUAL(10ul,results.size());
+    for (const FstReader::FuzzyResultPtr& result : results) {
+        CPPUNIT_ASSERT(result->GetInputStr().substr(0,2) == "ha");
+    }
+
+    //edit distance beyond parametric tables uses row-based automaton intersected with same prefix
+    vector<pair<uint32_t,uint64_t> > all;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        uint32_t distance = editDistanceByDp("hair",keys[i],false);
+        if (distance <= 4 && keys[i][0] == 'h') all.push_back(std::make_pair(distance,i + 1));
+    }
+    std::sort(all.begin(),all.end(),[](const pair<uint32_t,uint64_t>& p1, const pair<uint32_t,uint64_t>& p2) {
+        return p1.first != p2.first ? p1.first < p2.first : p1.second > p2.second;
+    });
+    results = fstReader.GetTopKFuzzyResults("hair",4,200,1,false);
+    CPPUNIT_ASSERT_EQUAL(std::min((size_t)200,all.size()),results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        CPPUNIT_ASSERT_EQUAL(all[i].first,results[i]->m_distance);
+        CPPUNIT_ASSERT_EQUAL(all[i].second,results[i]->m_output);
+    }
+
+    //set fst ranks keys of the same distance in key order, and a pass stops once 'topK' results collected
+    string setData;
+    buildFstInMemory(keys,false,setData);
+    FstReader setReader((uint8_t*)setData.data());
+    for (bool isDamerau : {false,true}) {
+        vector<pair<uint32_t,size_t> > expected;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            uint32_t distance = editDistanceByDp("helo",keys[i],isDamerau);
+            if (distance <= 2) expected.push_back(std::make_pair(distance,i));
+        }
+        std::sort(expected.begin(),expected.end());
+        for (uint32_t topK : {1,5,50}) {
+            for (FstReader::FUZZY_ALGORITHM_ENUM algorithm : {FstReader::FUZZY_ALGORITHM_DFA,FstReader::FUZZY_ALGORITHM_BIT_PARALLEL}) {
+                results = setReader.GetTopKFuzzyResults("helo",2,topK,0,isDamerau,algorithm);
+                CPPUNIT_ASSERT_EQUAL(std::min((size_t)topK,expected.size()),results.size());
+                for (size_t i = 0; i < results.size(); ++i) {
+                    CPPUNIT_ASSERT_EQUAL(expected[i].first,results[i]->m_distance);
+                    CPPUNIT_ASSERT_EQUAL(keys[expected[i].second],results[i]->GetInputStr());
+                }
+            }
+        }
+    }
+}
+
+void FstTest::testMultiQueryFuzzy() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+
+    //some queries share first characters, so that one traversal still saves subtrees with same prefix
+    vector<string> queries = {"hair","helo","hapy","the","thier","quik","qiet","brown","bred","fox","jumpd","ovr","the","lazzy","lasy","dgo","doog"};
+    for (uint32_t samePrefixLen : {0,1}) {
+        for (bool isDamerau : {false,true}) {
+            //every key with indexes of queries matched, by separate fuzzy iterators. best of some rounds is
+            //taken as consumed time of either way
+            map<string,vector<uint32_t> > expected;
+            vector<FstReader::MultiFuzzyResultPtr> results;
+            uint64_t separateTime = (uint64_t)-1;
+            uint64_t unionTime = (uint64_t)-1;
+            for (uint32_t round = 0; round < 3; ++round) {
+                expected.clear();
+                uint64_t bTime = TimeUtility::CurrentTimeInMicroSeconds();
+                for (uint32_t i = 0; i < queries.size(); ++i) {
+                    for (const string& key : collectKeys(fstReader.GetFuzzyIterator(queries[i],2,samePrefixLen,isDamerau))) {
+                        expected[key].push_back(i);
+                    }
+                }
+                uint64_t mTime = TimeUtility::CurrentTimeInMicroSeconds();
+                results = fstReader.GetMultiFuzzyResults(queries,2,samePrefixLen,isDamerau);
+                uint64_t eTime = TimeUtility::CurrentTimeInMicroSeconds();
+                separateTime = std::min(separateTime, mTime - bTime);
+                unionTime = std::min(unionTime, eTime - mTime);
+            }
+            TLOG_LOG(INFO,"[%zu] queries fuzzy search with same prefix length [%u] consumed [%lu] us by separate iterators, [%lu] us by one traversal.",
+                     queries.size(), samePrefixLen, separateTime, unionTime);
+            CPPUNIT_ASSERT(unionTime * 10 < separateTime * 9);
+
+            CPPUNIT_ASSERT_EQUAL(expected.size(),results.size());
+            auto it = expected.begin();
+            for (size_t i = 0; i < results.size(); ++i, ++it) {
+                CPPUNIT_ASSERT_EQUAL(it->first,results[i]->GetInputStr());
+                CPPUNIT_ASSERT(it->second == results[i]->m_queryIndexes);
+            }
+        }
+    }
+    CPPUNIT_ASSERT(fstReader.GetMultiFuzzyResults(vector<string>(),2,0,false).empty());
+}
+
+void FstTest::testFuzzyPrefix() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+    FstReader::FstIterBound noBound;
+    vector<string> allKeys = collectKeys(fstReader.GetIterator(noBound,noBound));
+
+    vector<string> queries = {"helo","quik","jumpd","bron","a"};
+    for (const string& query : queries) {
+        for (uint32_t d = 1; d <= 2; ++d) {
+            for (bool isDamerau : {false,true}) {
+                for (uint32_t samePrefixLen : {0,1}) {
+                    //key matches if some prefix of it is within edit distance
+                    vector<string> expected;
+                    for (const string& key : allKeys) {
+                        if (key.compare(0,samePrefixLen,query,0,samePrefixLen) != 0) continue;
+                        for (size_t len = 0; len <= key.size(); ++len) {
+                            if (editDistanceByDp(query,key.substr(0,len),isDamerau) <= d) {
+                                expected.push_back(key);
+                                break;
+                            }
+                        }
+                    }
+                    vector<string> keys = collectKeys(fstReader.GetFuzzyPrefixIterator(query,d,samePrefixLen,isDamerau));
+                    CPPUNIT_ASSERT(expected == keys);
+
+                    //capped results are the first ones in key order
+                    keys = collectKeys(fstReader.GetFuzzyPrefixIterator(query,d,samePrefixLen,isDamerau,10));
+                    CPPUNIT_ASSERT_EQUAL(std::min<size_t>(10,expected.size()),keys.size());
+                    CPPUNIT_ASSERT(std::equal(keys.begin(),keys.end(),expected.begin()));
+                }
+            }
+        }
+    }
+
+    //without cache, fuzzy prefix is walked by the parametric automaton itself but not wrapped by
+    //StartsWithAutomaton, and every match stays in the one accepting sink state
+    FstReader::Iterator prefixIt = fstReader.GetFuzzyPrefixIterator("helo",1,0,false);
+    AutomatonStatePtr sinkState;
+    size_t matchCount = 0;
+    for (FstReader::IteratorResultPtr item = prefixIt.Next(); nullptr != item; item = prefixIt.Next(), ++matchCount) {
+        CPPUNIT_ASSERT(nullptr != dynamic_pointer_cast<ParametricLevenshteinAutomatonState>(item->m_autState));
+        if (nullptr == sinkState) sinkState = item->m_autState;
+        CPPUNIT_ASSERT(sinkState == item->m_autState);
+    }
+    CPPUNIT_ASSERT(matchCount > 1);
+
+    //fuzzy prefix automaton is cached apart from fuzzy automaton of the same query
+    FuzzyAutomatonCachePtr cache = std::make_shared<FuzzyAutomatonCache>(1024 * 1024);
+    fstReader.SetFuzzyAutomatonCache(cache);
+    vector<string> fuzzyKeys = collectKeys(fstReader.GetFuzzyIterator("helo",1,0,false));
+    vector<string> prefixKeys = collectKeys(fstReader.GetFuzzyPrefixIterator("helo",1,0,false));
+    CPPUNIT_ASSERT_EQUAL(2ul,cache->GetKeyCount());
+    CPPUNIT_ASSERT(fuzzyKeys.size() < prefixKeys.size());
+    CPPUNIT_ASSERT(prefixKeys == collectKeys(fstReader.GetFuzzyPrefixIterator("helo",1,0,false)));
+    CPPUNIT_ASSERT_EQUAL(2ul,cache->GetKeyCount());
+}
+
+void FstTest::testRegex() {
+    Dict2Fst dictFst;
+    FstReader fstReader(dictFst.GetData());
+    FstReader::FstIterBound noBound;
+    vector<string> allKeys = collectKeys(fstReader.GetIterator(noBound,noBound));
+
+    vector<string> patterns = {"hello", "hel+o.*", "^qu(i|a)ck?s?$", "[a-c][^aeiou]{2,3}", "(ab|cd|xy)+z*",
+                               ".*ing", "a.b.*", "\\w{3}\\d?", "(?:re)?fresh(es|ed|ing)?", "[x-z].{0,4}q.*", ""};
+    for (const string& pattern : patterns) {
+        std::regex re(pattern);
+        vector<string> expected;
+        for (const string& key : allKeys) {
+            if (std::regex_match(key, re)) expected.push_back(key);
+        }
+        FstReader::Iterator it;
+        CPPUNIT_ASSERT(fstReader.GetRegexIterator(pattern,it));
+        CPPUNIT_ASSERT(expected == collectKeys(it));
+
+        //tiny state cache is cleared again and again but results are the same
+        RegexAutomatonPtr aut = std::make_shared<RegexAutomaton>(pattern,1024);
+        CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(noBound,noBound,aut)));
+        CPPUNIT_ASSERT(aut->GetCacheBytes() <= 1024 || aut->GetCachedStateCount() == 1);
+    }
+    //dfa of '.*a.{6}' has 2^7 states which never fit into tiny cache
+    std::regex re(".*a.{6}");
+    vector<string> expected;
+    for (const string& key : allKeys) {
+        if (std::regex_match(key, re)) expected.push_back(key);
+    }
+    RegexAutomatonPtr aut = std::make_shared<RegexAutomaton>(".*a.{6}",1024);
+    CPPUNIT_ASSERT(expected == collectKeys(fstReader.GetIterator(noBound,noBound,aut)));
+    CPPUNIT_ASSERT(aut->GetCacheClearCount() > 0);
+    CPPUNIT_ASSERT(aut->GetBuiltStateCount() > aut->GetCachedStateCount());
+
+    for (const char* pattern : {"(ab", "ab)", "[a-", "*a", "a{3,1}", "a{2000}", "a^b", "\\q", "[z-a]"}) {
+        FstReader::Iterator it;
+        CPPUNIT_ASSERT(!fstReader.GetRegexIterator(pattern,it));
+    }
+
+    //utf8 multiple bytes characters
+    vector<string> keys = {"a中","\xe4\xb8","中国","中国人","中国人民","中国心","北七","北七家","北京","北平","南京"};
+    string fstData;
+    buildFstInMemory(keys,false,fstData);
+    FstReader utf8Reader((uint8_t*)fstData.data());
+    auto regexKeys = [&utf8Reader](const string& pattern) {
+        FstReader::Iterator it;
+        bool isValid = utf8Reader.GetRegexIterator(pattern,it);
+        CPPUNIT_ASSERT(isValid);
+        return collectKeys(it);
+    };
+    CPPUNIT_ASSERT(regexKeys("中国.*") == vector<string>({"中国","中国人","中国人民","中国心"}));
+    CPPUNIT_ASSERT(regexKeys("中国.") == vector<string>({"中国人","中国心"}));
+    CPPUNIT_ASSERT(regexKeys("..") == vector<string>({"a中","中国","北七","北京","北平","南京"}));
+    CPPUNIT_ASSERT(regexKeys("[^中a].+") == vector<string>({"北七","北七家","北京","北平","南京"}));
+    CPPUNIT_ASSERT(regexKeys("[北南]京|中国[人心]") == vector<string>({"中国人","中国心","北京","南京"}));
+    CPPUNIT_ASSERT(regexKeys("\\W+") == vector<string>({"中国","中国人","中国人民","中国心","北七","北七家","北京","北平","南京"}));
+    CPPUNIT_ASSERT(regexKeys("[一-龥]{3}") == vector<string>({"中国人","中国心","北七家"}));
+}
+
+void FstTest::testDeadStateMemo() {
+    //every prefix shares the same suffixes subgraph after '_'
+    vector<string> prefixes, suffixes;
+    for (uint32_t i = 0; i < 300; ++i) {
+        prefixes.push_back(string(1, 'a' + i % 26) + string(1, 'a' + i / 26 % 26) + "xy");
+    }
+    for (uint32_t i = 0; i < 400; ++i) {
+        suffixes.push_back("s" + std::to_string(i * 7919 % 100000) + (i % 3 ? "tail" : "end"));
+    }
+    std::sort(prefixes.begin(), prefixes.end());
+    std::sort(suffixes.begin(), suffixes.end());
+    vector<string> keys;
+    for (const string& prefix : prefixes) {
+        for (const string& suffix : suffixes) {
+            keys.push_back(prefix + "_" + suffix);
+        }
+    }
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader fstReader((uint8_t*)fstData.data());
+    FstReader::FstIterBound noBound;
+
+    auto collectResults = [](FstReader::Iterator& it) {
+        vector<pair<string,uint64_t> > results;
+        while (true) {
+            FstReader::IteratorResultPtr item = it.Next();
+            if (nullptr == item) break;
+            results.push_back(std::make_pair(item->GetInputStr(), item->m_output));
+        }
+        return results;
+    };
+    for (const string pattern : {"[a-z]+xy_s.*9tail", "[a-z]+_s1.*q", "(ab|cd)xy_.*end", "[a-c]+xy_.*"}) {
+        FstReader::Iterator it;
+        CPPUNIT_ASSERT(fstReader.GetRegexIterator(pattern,it));
+        vector<pair<string,uint64_t> > expected = collectResults(it);
+
+        FstReader::Iterator memoIt;
+        CPPUNIT_ASSERT(fstReader.GetRegexIterator(pattern,memoIt));
+        CPPUNIT_ASSERT(memoIt.EnableDeadStateMemo(1024 * 1024));
+        CPPUNIT_ASSERT(expected == collectResults(memoIt));
+        TLOG_LOG(INFO,"pattern [%s] got [%zu] results, [%lu] subtrees pruned by [%lu] memo entries.",
+                 pattern.c_str(), expected.size(), memoIt.GetMemoPrunedCount(), memoIt.GetMemoEntryCount());
+    }
+
+    //shared suffixes subgraph is walked once when nothing matched there
+    FstReader::Iterator memoIt;
+    CPPUNIT_ASSERT(fstReader.GetRegexIterator("[a-z]+_s1.*q",memoIt));
+    CPPUNIT_ASSERT(memoIt.EnableDeadStateMemo(1024 * 1024));
+    CPPUNIT_ASSERT(collectResults(memoIt).empty());
+    CPPUNIT_ASSERT(memoIt.GetMemoPrunedCount() > 0);
+
+    //memory bound
+    CPPUNIT_ASSERT(fstReader.GetRegexIterator("[a-z]+_s1.*q",memoIt));
+    CPPUNIT_ASSERT(memoIt.EnableDeadStateMemo(1024));
+    CPPUNIT_ASSERT(collectResults(memoIt).empty());
+    CPPUNIT_ASSERT(memoIt.GetMemoEntryCount() * sizeof(FstReader::DeadStateMemoKey) <= 1024);
+
+    //default fuzzy automatons support memo, with or without cache, and get the same results
+    auto checkMemo = [&collectResults](const std::function<FstReader::Iterator()>& makeIt) {
+        FstReader::Iterator it = makeIt();
+        vector<pair<string,uint64_t> > expected = collectResults(it);
+        CPPUNIT_ASSERT(!expected.empty());
+        FstReader::Iterator memoIt = makeIt();
+        CPPUNIT_ASSERT(memoIt.EnableDeadStateMemo(1024 * 1024));
+        CPPUNIT_ASSERT(expected == collectResults(memoIt));
+    };
+    for (bool isCached : {false,true}) {
+        fstReader.SetFuzzyAutomatonCache(isCached ? std::make_shared<FuzzyAutomatonCache>(1024 * 1024) : nullptr);
+        for (uint32_t samePrefixLen : {0,2}) {
+            for (bool isDamerau : {false,true}) {
+                checkMemo([&]() { return fstReader.GetFuzzyIterator("abxy_s1000tail",2,samePrefixLen,isDamerau); });
+                checkMemo([&]() { return fstReader.GetFuzzyPrefixIterator("abxy_s1000",1,samePrefixLen,isDamerau); });
+            }
+        }
+        checkMemo([&]() { return fstReader.GetFuzzyIterator("abxy_s1000tail",4,0,false); });
+    }
+    fstReader.SetFuzzyAutomatonCache(nullptr);
+
+    //state ids are composed by intersection and starts with automatons whose inner automatons tell them
+    checkMemo([&]() {
+        AutomatonPtr aut1 = std::make_shared<ParametricLevenshteinAutomaton>("abxy_s1000tail",2,false);
+        AutomatonPtr aut2 = std::make_shared<ParametricLevenshteinAutomaton>("abxy_s100tail",2,true);
+        return fstReader.GetIterator(noBound,noBound,Intersect(aut1,aut2));
+    });
+    checkMemo([&]() {
+        AutomatonPtr aut = std::make_shared<ParametricLevenshteinAutomaton>("abxy_s1000",1,false);
+        return fstReader.GetIterator(noBound,noBound,StartsWith(aut));
+    });
+
+    //bit-parallel automaton can not tell state ids
+    FstReader::Iterator bitParallelIt = fstReader.GetFuzzyIterator("abxy_s1000tail",2,0,false,FstReader::FUZZY_ALGORITHM_BIT_PARALLEL);
+    CPPUNIT_ASSERT(!bitParallelIt.EnableDeadStateMemo(1024 * 1024));
+}
+
+void FstTest::testLongKeyRangeScan() {
+    //long keys sharing long prefixes, so every step of old full comparison with bound walked long inputs
+    std::set<string> keySet;
+    string commonPrefix(400, 'k');
+    while (keySet.size() < 500) {
+        string key = commonPrefix;
+        uint32_t len = Random<uint32_t>::RandomIntBetween(0, 600);
+        for (uint32_t i = 0; i < len; ++i) {
+            key.push_back('a' + Random<uint32_t>::RandomIntBetween(0, 2));
+        }
+        keySet.insert(key);
+    }
+    keySet.insert("");
+    keySet.insert("k");
+    keySet.insert("zz");
+    vector<string> keys(keySet.begin(), keySet.end());
+    string fstData;
+    buildFstInMemory(keys,true,fstData);
+    FstReader fstReader((uint8_t*)fstData.data());
+
+    typedef FstReader::FstIterBound Bound;
+    auto scan = [&fstReader](const Bound& min, const Bound& max) {
+        vector<pair<string,uint64_t> > results;
+        FstReader::Iterator it = fstReader.GetRangeIterator(min,max);
+        while (true) {
+            FstReader::IteratorResultPtr item = it.Next();
+            if (nullptr == item) break;
+            results.push_back(std::make_pair(item->GetInputStr(), item->m_output));
+        }
+        return results;
+    };
+    auto expectedScan = [&keys](const Bound& min, const Bound& max) {
+        vector<pair<string,uint64_t> > results;
+        string minStr(min.m_bound.begin(), min.m_bound.end()), maxStr(max.m_bound.begin(), max.m_bound.end());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (min.m_type == Bound::FST_ITER_BOUND_TYPE_INCLUDED && keys[i] < minStr) continue;
+            if (min.m_type == Bound::FST_ITER_BOUND_TYPE_EXCLUDED && keys[i] <= minStr) continue;
+            if (max.m_type == Bound::FST_ITER_BOUND_TYPE_INCLUDED && keys[i] > maxStr) continue;
+            if (max.m_type == Bound::FST_ITER_BOUND_TYPE_EXCLUDED && keys[i] >= maxStr) continue;
+            results.push_back(std::make_pair(keys[i], i + 1));
+        }
+        return results;
+    };
+
+    //bounds are keys themselves, their prefixes, extensions and keys not in fst
+    vector<string> boundStrs = {"", "k", "kk", "zz", "zzz", "a", commonPrefix, commonPrefix + "b"};
+    for (uint32_t i = 0; i < 20; ++i) {
+        const string& key = keys[Random<uint32_t>::RandomIntBetween(0, keys.size() - 1)];
+        boundStrs.push_back(key);
+        boundStrs.push_back(key.substr(0, key.size() / 2));
+        boundStrs.push_back(key + "b");
+    }
+    vector<Bound::FST_ITER_BOUND_TYPE_ENUM> types = {Bound::FST_ITER_BOUND_TYPE_INCLUDED,
+                                                    Bound::FST_ITER_BOUND_TYPE_EXCLUDED,
+                                                    Bound::FST_ITER_BOUND_TYPE_UNBOUNDED};
+    for (uint32_t i = 0; i < 90; ++i) {
+        Bound min(types[i % 3], boundStrs[Random<uint32_t>::RandomIntBetween(0, boundStrs.size() - 1)]);
+        Bound max(types[i / 3 % 3], boundStrs[Random<uint32_t>::RandomIntBetween(0, boundStrs.size() - 1)]);
+        CPPUNIT_ASSERT(expectedScan(min,max) == scan(min,max));
+    }
+
+    //benchmark: bounded scan costs about the same as unbounded scan since bound check is O(1) per step
+    uint64_t keyBytes = 0;
+    for (const string& key : keys) keyBytes += key.size();
+    Bound min(Bound::FST_ITER_BOUND_TYPE_INCLUDED, keys[1]);
+    Bound max(Bound::FST_ITER_BOUND_TYPE_INCLUDED, keys[keys.size() - 2]);
+    uint64_t bTime = TimeUtility::CurrentTimeInMicroSeconds();
+    size_t boundedCount = scan(min,max).size();
+    uint64_t mTime = TimeUtility::CurrentTimeInMicroSeconds();
+    size_t unboundedCount = scan(Bound(),Bound()).size();
+    uint64_t eTime = TimeUtility::CurrentTimeInMicroSeconds();
+    CPPUNIT_ASSERT_EQUAL(keys.size() - 2, boundedCount);
+    CPPUNIT_ASSERT_EQUAL(keys.size(), unboundedCount);
+    TLOG_LOG(INFO,"range scan of [%zu] keys averaging [%lu] bytes consumed [%lu] us with bounds, [%lu] us without bounds.",
+             keys.size(), keyBytes / keys.size(), mTime - bTime, eTime - mTime);
+}
+
+void FstTest::testFstSetOp() {
+    //sources of different density, the last one is sparse so that others are sought ahead
+    vector<uint32_t> keepRatios = {2, 3, 50};
+    vector<vector<string> > sourceKeys(keepRatios.size());
+    vector<map<string,uint64_t> > sourceMaps(keepRatios.size());
+    for (uint32_t i = 0; i < 20000; ++i) {
+        string key = Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(0, 6));
+        for (size_t s = 0; s < keepRatios.size(); ++s) {
+            if (Random<uint32_t>::RandomIntBetween(0, keepRatios[s] - 1) == 0) sourceMaps[s][key] = 0;
+        }
+    }
+    vector<string> fstDatas(keepRatios.size());
+    vector<FstReaderPtr> readers;
+    vector<FstReader*> readerPtrs;
+    for (size_t s = 0; s < keepRatios.size(); ++s) {
+        for (auto& kv : sourceMaps[s]) sourceKeys[s].push_back(kv.first);
+        buildFstInMemory(sourceKeys[s],true,fstDatas[s]);
+        //outputs of buildFstInMemory are key index plus one
+        for (size_t i = 0; i < sourceKeys[s].size(); ++i) sourceMaps[s][sourceKeys[s][i]] = i + 1;
+        readers.push_back(std::make_shared<FstReader>((uint8_t*)fstDatas[s].data()));
+        readerPtrs.push_back(readers.back().get());
+    }
+
+    typedef FstSetOpStream Op;
+    for (Op::SET_OP_ENUM op : {Op::SET_OP_UNION, Op::SET_OP_INTERSECTION, Op::SET_OP_DIFFERENCE}) {
+        for (Op::MERGE_FUNC_ENUM mergeFunc : {Op::MERGE_FUNC_SUM, Op::MERGE_FUNC_MIN, Op::MERGE_FUNC_MAX, Op::MERGE_FUNC_FIRST}) {
+            map<string, vector<pair<uint32_t,uint64_t> > > all;
+            for (uint32_t s = 0; s < sourceMaps.size(); ++s) {
+                for (auto& kv : sourceMaps[s]) all[kv.first].push_back(std::make_pair(s, kv.second));
+            }
+            vector<pair<string,uint64_t> > expected;
+            for (auto& kv : all) {
+                const vector<pair<uint32_t,uint64_t> >& outputs = kv.second;
+                if (op == Op::SET_OP_INTERSECTION && outputs.size() != sourceMaps.size()) continue;
+                if (op == Op::SET_OP_DIFFERENCE && (outputs.size() != 1 || outputs[0].first != 0)) continue;
+                uint64_t merged = outputs[0].second;
+                for (size_t i = 1; i < outputs.size(); ++i) {
+                    if (mergeFunc == Op::MERGE_FUNC_SUM) merged += outputs[i].second;
+                    if (mergeFunc == Op::MERGE_FUNC_MIN) merged = std::min(merged, outputs[i].second);
+                    if (mergeFunc == Op::MERGE_FUNC_MAX) merged = std::max(merged, outputs[i].second);
+                }
+                expected.push_back(std::make_pair(kv.first, merged));
+            }
+
+            Op stream(readerPtrs, op, mergeFunc);
+            vector<pair<string,uint64_t> > results;
+            while (true) {
+                Op::SetOpResultPtr result = stream.Next();
+                if (nullptr == result) break;
+                results.push_back(std::make_pair(result->GetInputStr(), result->m_output));
+                CPPUNIT_ASSERT(all[results.back().first] == result->m_sourceOutputs || op == Op::SET_OP_DIFFERENCE);
+            }
+            CPPUNIT_ASSERT(expected == results);
+            if (op != Op::SET_OP_UNION) CPPUNIT_ASSERT(stream.GetSeekCount() > 0);
+        }
+    }
+
+    //shared automaton filters every source, iterators of sources may have their own bounds
+    AutomatonPtr prefixAut = std::make_shared<PrefixAutomaton>("a");
+    Op prefixStream(readerPtrs, Op::SET_OP_UNION, Op::MERGE_FUNC_FIRST, prefixAut);
+    vector<FstReader::Iterator> iterators;
+    FstReader::FstIterBound noBound;
+    FstReader::FstIterBound max(FstReader::FstIterBound::FST_ITER_BOUND_TYPE_EXCLUDED, "b");
+    FstReader::FstIterBound min(FstReader::FstIterBound::FST_ITER_BOUND_TYPE_INCLUDED, "a");
+    for (FstReader* reader : readerPtrs) iterators.push_back(reader->GetIterator(min,max));
+    Op boundStream(iterators, Op::SET_OP_UNION, Op::MERGE_FUNC_FIRST);
+    uint64_t count = 0;
+    while (true) {
+        Op::SetOpResultPtr result = prefixStream.Next();
+        Op::SetOpResultPtr boundResult = boundStream.Next();
+        CPPUNIT_ASSERT((nullptr == result) == (nullptr == boundResult));
+        if (nullptr == result) break;
+        CPPUNIT_ASSERT(result->m_inputs == boundResult->m_inputs && result->m_inputs[0] == 'a');
+        ++count;
+    }
+    CPPUNIT_ASSERT(count > 0);
+
+    //materialize union into a new fst
+    ostringstream oss;
+    StdostreamOutputStream outputStream(oss);
+    FstBuilder builder(&outputStream, true, 1000000);
+    uint64_t keyCount = 0;
+    Op unionStream(readerPtrs, Op::SET_OP_UNION, Op::MERGE_FUNC_SUM);
+    CPPUNIT_ASSERT(unionStream.Build(builder, keyCount));
+    string unionData = oss.str();
+    FstReader unionReader((uint8_t*)unionData.data());
+    FstReader::Iterator it = unionReader.GetIterator(noBound,noBound);
+    Op checkStream(readerPtrs, Op::SET_OP_UNION, Op::MERGE_FUNC_SUM);
+    uint64_t readCount = 0;
+    while (true) {
+        FstReader::IteratorResultPtr item = it.Next();
+        Op::SetOpResultPtr expectedItem = checkStream.Next();
+        CPPUNIT_ASSERT((nullptr == item) == (nullptr == expectedItem));
+        if (nullptr == item) break;
+        CPPUNIT_ASSERT(item->m_inputs == expectedItem->m_inputs);
+        CPPUNIT_ASSERT_EQUAL(expectedItem->m_output, item->m_output);
+        ++readCount;
+    }
+    CPPUNIT_ASSERT_EQUAL(keyCount, readCount);
+
+    //no source at all
+    CPPUNIT_ASSERT(nullptr == Op(vector<FstReader*>(), Op::SET_OP_INTERSECTION, Op::MERGE_FUNC_SUM).Next());
+}
+
+///all keys and values of updatable fst snapshot in key order
+static map<string,uint64_t> collectSnapshot(const UpdatableFst::SnapshotPtr& snapshot) {
+    map<string,uint64_t> result;
+    FstReader::FstIterBound noBound;
+    UpdatableFst::Iterator it = snapshot->GetIterator(noBound,noBound);
+    string lastKey;
+    while (true) {
+        FstReader::IteratorResultPtr item = it.Next();
+        if (nullptr == item) break;
+        CPPUNIT_ASSERT(result.empty() || lastKey < item->GetInputStr());
+        lastKey = item->GetInputStr();
+        result[lastKey] = item->m_output;
+    }
+    return result;
+}
+
+void FstTest::testUpdatableFst() {
+    vector<string> baseKeys;
+    set<string> baseKeySet;
+    for (uint32_t i = 0; i < 5000; ++i) baseKeySet.insert(Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(1, 6)));
+    baseKeys.assign(baseKeySet.begin(), baseKeySet.end());
+    string baseData;
+    buildFstInMemory(baseKeys,true,baseData);
+    map<string,uint64_t> model;
+    //outputs of buildFstInMemory are key index plus one
+    for (size_t i = 0; i < baseKeys.size(); ++i) model[baseKeys[i]] = i + 1;
+
+    //maintained in caller thread, snapshots taken while updating must not change afterwards
+    {
+        string data = baseData;
+        UpdatableFst updatableFst(FstSegment::FromData(data), 50, 4, false);
+        CPPUNIT_ASSERT(!updatableFst.Put("a", UpdatableFst::TOMBSTONE_OUTPUT_FLAG));
+        map<string,uint64_t> curModel = model;
+        vector<pair<UpdatableFst::SnapshotPtr, map<string,uint64_t> > > snapshots;
+        for (uint32_t i = 0; i < 3000; ++i) {
+            string key = (i % 2 == 0) ? baseKeys[Random<uint32_t>::RandomIntBetween(0, baseKeys.size() - 1)]
+                                      : Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(0, 6));
+            if (Random<uint32_t>::RandomIntBetween(0, 2) == 0) {
+                CPPUNIT_ASSERT(updatableFst.Delete(key));
+                curModel.erase(key);
+            }
+            else {
+                CPPUNIT_ASSERT(updatableFst.Put(key, 100000 + i));
+                curModel[key] = 100000 + i;
+            }
+            uint64_t value = 0;
+            CPPUNIT_ASSERT_EQUAL(curModel.count(key) > 0, updatableFst.Get(key, value));
+            if (curModel.count(key)) CPPUNIT_ASSERT_EQUAL(curModel[key], value);
+            if (i % 500 == 0) snapshots.push_back(std::make_pair(updatableFst.GetSnapshot(), curModel));
+            CPPUNIT_ASSERT(updatableFst.GetSegmentCount() <= 4);
+        }
+        CPPUNIT_ASSERT(updatableFst.GetFlushCount() > 0);
+        CPPUNIT_ASSERT(updatableFst.GetCompactionCount() > 0);
+        for (auto& snapshot : snapshots) {
+            CPPUNIT_ASSERT(snapshot.second == collectSnapshot(snapshot.first));
+            for (auto& kv : snapshot.second) {
+                uint64_t value = 0;
+                CPPUNIT_ASSERT(snapshot.first->Get(kv.first, value));
+                CPPUNIT_ASSERT_EQUAL(kv.second, value);
+            }
+        }
+        CPPUNIT_ASSERT(curModel == collectSnapshot(updatableFst.GetSnapshot()));
+
+        //full compaction leaves one segment without tombstones
+        CPPUNIT_ASSERT(updatableFst.Flush());
+        CPPUNIT_ASSERT_EQUAL(0ul, updatableFst.GetDeltaEntryCount());
+        CPPUNIT_ASSERT(updatableFst.Compact(true));
+        CPPUNIT_ASSERT_EQUAL(1u, updatableFst.GetSegmentCount());
+        UpdatableFst::SnapshotPtr snapshot = updatableFst.GetSnapshot();
+        CPPUNIT_ASSERT(curModel == collectSnapshot(snapshot));
+
+        //snapshot freezes delta as its newest layer without building segment, later updates go to a new delta
+        uint64_t flushCount = updatableFst.GetFlushCount();
+        CPPUNIT_ASSERT(updatableFst.Put("a_new", 7));
+        CPPUNIT_ASSERT(updatableFst.Delete(baseKeys[0]));
+        snapshot = updatableFst.GetSnapshot();
+        CPPUNIT_ASSERT_EQUAL(1u, snapshot->GetSegmentCount());
+        CPPUNIT_ASSERT_EQUAL(2ul, snapshot->GetDeltaEntryCount());
+        CPPUNIT_ASSERT_EQUAL(flushCount, updatableFst.GetFlushCount());
+        CPPUNIT_ASSERT(updatableFst.Put("a_new", 8));
+        CPPUNIT_ASSERT(updatableFst.Put(baseKeys[0], 9));
+        CPPUNIT_ASSERT(updatableFst.Put("a_newer", 10));
+        curModel["a_new"] = 7;
+        curModel.erase(baseKeys[0]);
+        CPPUNIT_ASSERT(curModel == collectSnapshot(snapshot));
+        uint64_t value = 0;
+        CPPUNIT_ASSERT(snapshot->Get("a_new", value) && value == 7);
+        CPPUNIT_ASSERT(!snapshot->Get(baseKeys[0], value));
+        CPPUNIT_ASSERT(updatableFst.Get("a_new", value) && value == 8);
+
+        //automaton and bounds filter all layers
+        FstReader::FstIterBound noBound;
+        UpdatableFst::Iterator prefixIt = snapshot->GetIterator(noBound,noBound,std::make_shared<PrefixAutomaton>("a_"));
+        FstReader::IteratorResultPtr item = prefixIt.Next();
+        CPPUNIT_ASSERT(nullptr != item && item->GetInputStr() == "a_new" && item->m_output == 7);
+        CPPUNIT_ASSERT(nullptr == prefixIt.Next());
+        FstReader::FstIterBound minBound(FstReader::FstIterBound::FST_ITER_BOUND_TYPE_EXCLUDED, "a_new");
+        UpdatableFst::Iterator rangeIt = updatableFst.GetSnapshot()->GetIterator(minBound,noBound,std::make_shared<PrefixAutomaton>("a_"));
+        item = rangeIt.Next();
+        CPPUNIT_ASSERT(nullptr != item && item->GetInputStr() == "a_newer" && item->m_output == 10);
+        CPPUNIT_ASSERT(nullptr == rangeIt.Next());
+
+        //materialize into a new base fst
+        ostringstream oss;
+        StdostreamOutputStream outputStream(oss);
+        FstBuilder builder(&outputStream, true, 1000000);
+        uint64_t keyCount = 0;
+        CPPUNIT_ASSERT(snapshot->Build(builder, keyCount));
+        CPPUNIT_ASSERT_EQUAL(curModel.size(), keyCount);
+        string rebuiltData = oss.str();
+        UpdatableFst rebuilt(FstSegment::FromData(rebuiltData), 50, 4, false);
+        CPPUNIT_ASSERT(curModel == collectSnapshot(rebuilt.GetSnapshot()));
+    }
+
+    //maintained in background while readers run concurrently
+    {
+        string data = baseData;
+        UpdatableFst updatableFst(FstSegment::FromData(data), 200, 4, true);
+        std::atomic<bool> isWriting(true);
+        std::atomic<uint32_t> failedCount(0);
+        vector<std::thread> readers;
+        for (uint32_t t = 0; t < 3; ++t) {
+            readers.push_back(std::thread([&]() {
+                while (isWriting) {
+                    UpdatableFst::SnapshotPtr snapshot = updatableFst.GetSnapshot();
+                    map<string,uint64_t> keys = collectSnapshot(snapshot);
+                    //writer only puts, base keys are never gone
+                    uint64_t value = 0;
+                    if (!snapshot->Get(baseKeys[0], value) || keys.size() < baseKeys.size()) ++failedCount;
+                }
+            }));
+        }
+        for (uint32_t i = 0; i < 5000; ++i) {
+            string key = Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(1, 8));
+            updatableFst.Put(key, i);
+            model[key] = i;
+        }
+        isWriting = false;
+        for (std::thread& reader : readers) reader.join();
+        CPPUNIT_ASSERT_EQUAL(0u, failedCount.load());
+        CPPUNIT_ASSERT(model == collectSnapshot(updatableFst.GetSnapshot()));
+        for (auto& kv : model) {
+            uint64_t value = 0;
+            CPPUNIT_ASSERT(updatableFst.Get(kv.first, value));
+            CPPUNIT_ASSERT_EQUAL(kv.second, value);
+        }
+        TLOG_LOG(INFO,"updatable fst got [%lu] flushes, [%lu] compactions, [%u] segments.", updatableFst.GetFlushCount(),
+                 updatableFst.GetCompactionCount(), updatableFst.GetSegmentCount());
+    }
+}
+
+void FstTest::testFstReaderRegistry() {
+    //version 'v' of dictionary has keys "k<v>_0".."k<v>_<v*100>", so a reader can tell which version it walked
+    auto buildVersion = [](uint32_t v) {
+        set<string> keySet;
+        for (uint32_t i = 0; i <= v * 100; ++i) keySet.insert("k" + std::to_string(v) + "_" + std::to_string(i));
+        string data;
+        buildFstInMemory(vector<string>(keySet.begin(), keySet.end()), true, data);
+        return FstSegment::FromData(data);
+    };
+    FstReaderRegistry registry;
+    CPPUNIT_ASSERT(!registry.Acquire().IsValid());
+    CPPUNIT_ASSERT(registry.Swap(buildVersion(1)));
+    FstReaderRegistry::Handle pinned = registry.Acquire();
+    CPPUNIT_ASSERT_EQUAL(1ul, pinned.GetVersion());
+
+    std::atomic<bool> isSwapping(true);
+    std::atomic<uint32_t> failedCount(0);
+    std::atomic<uint64_t> iterCount(0);
+    vector<std::thread> readers;
+    for (uint32_t t = 0; t < 4; ++t) {
+        readers.push_back(std::thread([&]() {
+            while (isSwapping) {
+                FstReaderRegistry::Handle handle = registry.Acquire();
+                FstReader::FstIterBound noBound;
+                FstReader::Iterator it = handle->GetIterator(noBound, noBound);
+                uint64_t count = 0;
+                string prefix = "k" + std::to_string(handle.GetVersion()) + "_";
+                while (true) {
+                    FstReader::IteratorResultPtr item = it.Next();
+                    if (nullptr == item) break;
+                    if (item->GetInputStr().compare(0, prefix.size(), prefix) != 0) ++failedCount;
+                    ++count;
+                }
+                if (count != handle.GetVersion() * 100 + 1) ++failedCount;
+                ++iterCount;
+            }
+        }));
+    }
+    for (uint32_t v = 2; v <= 30; ++v) {
+        CPPUNIT_ASSERT(registry.Swap(buildVersion(v)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    isSwapping = false;
+    for (std::thread& reader : readers) reader.join();
+    CPPUNIT_ASSERT_EQUAL(0u, failedCount.load());
+    CPPUNIT_ASSERT(iterCount.load() > 0);
+    CPPUNIT_ASSERT_EQUAL(30ul, registry.Acquire().GetVersion());
+
+    //pinned handle still reads version 1, which is released together with the last handle
+    uint64_t value = 0;
+    CPPUNIT_ASSERT(pinned->Get("k1_100", value));
+    CPPUNIT_ASSERT_EQUAL(2ul, registry.GetLiveMappingCount());
+    pinned = FstReaderRegistry::Handle();
+    CPPUNIT_ASSERT_EQUAL(1ul, registry.GetLiveMappingCount());
+
+    //replace dictionary file under the same path
+    string fstFile = string() + TEST_DATA_PATH + "/" + Random<uint32_t>::RandomString(32);
+    RemoveFileRAII removeFile(fstFile);
+    for (uint32_t v = 1; v <= 2; ++v) {
+        FileOutputStreamPtr outputStream = std::make_shared<FileOutputStream>();
+        string tmpFile = fstFile + ".tmp";
+        outputStream->Open(tmpFile);
+        FstBuilder builder(outputStream.get(), true, 1000000);
+        string key = "file_v" + std::to_string(v);
+        builder.Insert((const uint8_t*)key.c_str(), key.size(), v);
+        builder.Finish();
+        outputStream->Close();
+        CPPUNIT_ASSERT_EQUAL(0, rename(tmpFile.c_str(), fstFile.c_str()));
+        CPPUNIT_ASSERT(registry.Load(fstFile));
+        FstReaderRegistry::Handle handle = registry.Acquire();
+        CPPUNIT_ASSERT(handle->Get(key, value));
+        CPPUNIT_ASSERT_EQUAL((uint64_t)v, value);
+    }
+    CPPUNIT_ASSERT(!registry.Load(fstFile + ".not_exist"));
+    CPPUNIT_ASSERT_EQUAL(32ul, registry.GetVersion());
+}
+
+///all keys and outputs of fst
+static vector<pair<string,uint64_t> > collectFstResults(FstReader& fstReader) {
+    vector<pair<string,uint64_t> > results;
+    FstReader::FstIterBound noBound;
+    FstReader::Iterator it = fstReader.GetIterator(noBound, noBound);
+    while (true) {
+        FstReader::IteratorResultPtr item = it.Next();
+        if (nullptr == item) break;
+        results.push_back(std::make_pair(item->GetInputStr(), item->m_output));
+    }
+    return results;
+}
+
+void FstTest::testFstContainer() {
+    //fsts of different sizes and types, the second one has odd length so that next one needs padding
+    vector<vector<string> > fstKeys = {{"", "apple", "banana", "cherry"}, {"x"}, {}, {"中国", "中国人", "北京"}};
+    vector<bool> isMaps = {true, false, true, true};
+    for (uint32_t i = 0; i < 3000; ++i) fstKeys[2].push_back(Random<uint32_t>::RandomString(8));
+    std::sort(fstKeys[2].begin(), fstKeys[2].end());
+    fstKeys[2].erase(std::unique(fstKeys[2].begin(), fstKeys[2].end()), fstKeys[2].end());
+    vector<string> fstDatas(fstKeys.size());
+    for (size_t i = 0; i < fstKeys.size(); ++i) buildFstInMemory(fstKeys[i], isMaps[i], fstDatas[i]);
+
+    string fstFile = string() + TEST_DATA_PATH + "/" + Random<uint32_t>::RandomString(32);
+    string containerFile = string() + TEST_DATA_PATH + "/" + Random<uint32_t>::RandomString(32);
+    RemoveFileRAII removeFstFile(fstFile);
+    RemoveFileRAII removeContainerFile(containerFile);
+    {
+        ofstream ofs(fstFile);
+        ofs << fstDatas[3];
+    }
+    {
+        FstContainerWriter writer;
+        CPPUNIT_ASSERT(writer.Open(containerFile));
+        CPPUNIT_ASSERT(writer.AddFstData("title", (const uint8_t*)fstDatas[0].data(), fstDatas[0].size()));
+        CPPUNIT_ASSERT(writer.AddFstData("tag", (const uint8_t*)fstDatas[1].data(), fstDatas[1].size()));
+        CPPUNIT_ASSERT(!writer.AddFstData("title", (const uint8_t*)fstDatas[1].data(), fstDatas[1].size()));
+        //built in place
+        OutputStreamBase* outputStream = writer.BeginFst("body");
+        CPPUNIT_ASSERT(nullptr != outputStream);
+        CPPUNIT_ASSERT(nullptr == writer.BeginFst("other"));
+        FstBuilder builder(outputStream, isMaps[2], 1000000);
+        for (size_t i = 0; i < fstKeys[2].size(); ++i) {
+            builder.Insert((const uint8_t*)fstKeys[2][i].c_str(), fstKeys[2][i].size(), i + 1);
+        }
+        builder.Finish();
+        CPPUNIT_ASSERT(writer.EndFst());
+        CPPUNIT_ASSERT(writer.AddFstFile("city", fstFile));
+        CPPUNIT_ASSERT(writer.Finish());
+    }
+
+    FstContainer container;
+    CPPUNIT_ASSERT(container.Open(containerFile, true));
+    vector<string> names = {"title", "tag", "body", "city"};
+    CPPUNIT_ASSERT(names == container.GetNames());
+    for (size_t i = 0; i < names.size(); ++i) {
+        FstReader* reader = container.GetReader(names[i]);
+        CPPUNIT_ASSERT(nullptr != reader);
+        FstReader expectedReader((uint8_t*)fstDatas[i].data());
+        CPPUNIT_ASSERT_EQUAL(expectedReader.HasOutput(), reader->HasOutput());
+        CPPUNIT_ASSERT(collectFstResults(expectedReader) == collectFstResults(*reader));
+        uint8_t* data = nullptr;
+        uint64_t length = 0;
+        CPPUNIT_ASSERT(container.GetFstData(names[i], data, length));
+        CPPUNIT_ASSERT(string((const char*)data, length) == fstDatas[i]);
+        CPPUNIT_ASSERT_EQUAL(0ul, (uint64_t)data % FstContainerFormat::DATA_ALIGNMENT);
+    }
+    CPPUNIT_ASSERT(nullptr == container.GetReader("not_exist"));
+
+    //truncated container and plain fst file are refused
+    string truncatedFile = containerFile + ".truncated";
+    RemoveFileRAII removeTruncatedFile(truncatedFile);
+    {
+        ifstream ifs(containerFile);
+        string content((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+        ofstream ofs(truncatedFile);
+        ofs << content.substr(0, content.size() - 10);
+    }
+    FstContainer truncatedContainer;
+    CPPUNIT_ASSERT(!truncatedContainer.Open(truncatedFile));
+    FstContainer fstFileContainer;
+    CPPUNIT_ASSERT(!fstFileContainer.Open(fstFile));
+}
+
+void FstTest::testFstFormat() {
+    //check value of crc32c, extended piece by piece with unaligned start
+    string digits = "0123456789";
+    CPPUNIT_ASSERT_EQUAL(0xE3069283u, Crc32c::Value((const uint8_t*)digits.data() + 1, 9));
+    uint32_t crc = Crc32c::Extend(0, (const uint8_t*)digits.data() + 1, 4);
+    CPPUNIT_ASSERT_EQUAL(0xE3069283u, Crc32c::Extend(crc, (const uint8_t*)digits.data() + 5, 5));
+
+    //random keys make fst body span several checksum blocks
+    vector<string> keys;
+    for (uint32_t i = 0; i < 20000; ++i) keys.push_back(Random<uint32_t>::RandomString(32));
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    ostringstream oss;
+    StdostreamOutputStream outputStream(oss);
+    FstBuilder builder(&outputStream, true, 1000000);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        CPPUNIT_ASSERT(builder.Insert((const uint8_t*)keys[i].c_str(), keys[i].size(), i + 1));
+    }
+    //updating value of the last key does not count a new key
+    CPPUNIT_ASSERT(builder.Insert((const uint8_t*)keys.back().c_str(), keys.back().size(), keys.size()));
+    builder.Finish();
+    string fstData = oss.str();
+    uint8_t* data = (uint8_t*)fstData.data();
+
+    FstFormat::FstInfo info;
+    CPPUNIT_ASSERT(FstFormat::Validate(data, fstData.size(), FstFormat::VALIDATE_LEVEL_FULL, 4, &info));
+    CPPUNIT_ASSERT(!info.m_isLegacy);
+    CPPUNIT_ASSERT(info.m_hasOutput);
+    CPPUNIT_ASSERT(info.m_blockCount > 1);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)keys.size(), info.m_keyCount);
+    CPPUNIT_ASSERT_EQUAL(builder.GetKeyCount(), info.m_keyCount);
+    CPPUNIT_ASSERT_EQUAL(builder.GetNodeCount(), info.m_nodeCount);
+    CPPUNIT_ASSERT(FstFormat::ValidateBlocks(data, 0, info.m_blockCount));
+    FstReaderPtr reader = FstReader::Create(data, fstData.size(), FstFormat::VALIDATE_LEVEL_FULL, 2);
+    CPPUNIT_ASSERT(nullptr != reader);
+    uint64_t value = 0;
+    CPPUNIT_ASSERT(reader->Get(keys[keys.size() / 2], value));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)keys.size() / 2 + 1, value);
+
+    //flipped body byte is only found by checksumming blocks
+    string corruptData = fstData;
+    uint64_t lastBlock = info.m_blockCount - 1;
+    corruptData[FstFormat::HEADER_LENGTH + lastBlock * FstFormat::CHECKSUM_BLOCK_SIZE] ^= 0x1;
+    uint8_t* corrupt = (uint8_t*)corruptData.data();
+    CPPUNIT_ASSERT(nullptr != FstReader::Create(corrupt, corruptData.size()));
+    CPPUNIT_ASSERT(nullptr == FstReader::Create(corrupt, corruptData.size(), FstFormat::VALIDATE_LEVEL_FULL, 4));
+    CPPUNIT_ASSERT(FstFormat::ValidateBlocks(corrupt, 0, lastBlock));
+    CPPUNIT_ASSERT(!FstFormat::ValidateBlocks(corrupt, lastBlock, lastBlock + 1));
+
+    //corrupt header, corrupt trailer and truncated data are refused when opened
+    corruptData = fstData;
+    corruptData[16] ^= 0x1;
+    CPPUNIT_ASSERT(nullptr == FstReader::Create((uint8_t*)corruptData.data(), corruptData.size()));
+    corruptData = fstData;
+    corruptData[corruptData.size() - FstFormat::TRAILER_LENGTH] ^= 0x1;
+    CPPUNIT_ASSERT(nullptr == FstReader::Create((uint8_t*)corruptData.data(), corruptData.size()));
+    CPPUNIT_ASSERT(nullptr == FstReader::Create(data, fstData.size() - 1));
+    CPPUNIT_ASSERT(nullptr == FstReader::Create(data, 5));
+
+    //old format of root address offset and has output flag is still readable
+    uint64_t rootAddrOffset = FstFormat::GetRootAddrOffset(data);
+    string legacyData = fstData.substr(0, FstFormat::HEADER_LENGTH + info.m_bodyLength);
+    memset((char*)legacyData.data(), 0, FstFormat::HEADER_LENGTH);
+    memcpy((char*)legacyData.data(), &rootAddrOffset, 8);
+    legacyData[8] = 1;
+    FstFormat::FstInfo legacyInfo;
+    CPPUNIT_ASSERT(FstFormat::Validate((uint8_t*)legacyData.data(), legacyData.size(), FstFormat::VALIDATE_LEVEL_FULL, 1, &legacyInfo));
+    CPPUNIT_ASSERT(legacyInfo.m_isLegacy);
+    FstReaderPtr legacyReader = FstReader::Create((uint8_t*)legacyData.data(), legacyData.size());
+    CPPUNIT_ASSERT(nullptr != legacyReader);
+    CPPUNIT_ASSERT(legacyReader->HasOutput());
+    CPPUNIT_ASSERT(collectFstResults(*reader) == collectFstResults(*legacyReader));
+}
+
+COMMON_END_NAMESPACE
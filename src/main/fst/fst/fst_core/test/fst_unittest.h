@@ -26,11 +26,41 @@ class FstTest: public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testFst);
     CPPUNIT_TEST(testFstFuzzy);
     CPPUNIT_TEST(testDamerauLevenshteinFstFuzzy);
+    CPPUNIT_TEST(testParametricLevenshteinFstFuzzy);
+    CPPUNIT_TEST(testByteDfaFstFuzzy);
+    CPPUNIT_TEST(testBitParallelFstFuzzy);
+    CPPUNIT_TEST(testFuzzyAutomatonCache);
+    CPPUNIT_TEST(testTopKFuzzy);
+    CPPUNIT_TEST(testMultiQueryFuzzy);
+    CPPUNIT_TEST(testFuzzyPrefix);
+    CPPUNIT_TEST(testRegex);
+    CPPUNIT_TEST(testDeadStateMemo);
+    CPPUNIT_TEST(testLongKeyRangeScan);
+    CPPUNIT_TEST(testFstSetOp);
+    CPPUNIT_TEST(testUpdatableFst);
+    CPPUNIT_TEST(testFstReaderRegistry);
+    CPPUNIT_TEST(testFstContainer);
+    CPPUNIT_TEST(testFstFormat);
     CPPUNIT_TEST_SUITE_END();
 public:
     void testFst();
     void testFstFuzzy();
     void testDamerauLevenshteinFstFuzzy();
+    void testParametricLevenshteinFstFuzzy();
+    void testByteDfaFstFuzzy();
+    void testBitParallelFstFuzzy();
+    void testFuzzyAutomatonCache();
+    void testTopKFuzzy();
+    void testMultiQueryFuzzy();
+    void testFuzzyPrefix();
+    void testRegex();
+    void testDeadStateMemo();
+    void testLongKeyRangeScan();
+    void testFstSetOp();
+    void testUpdatableFst();
+    void testFstReaderRegistry();
+    void testFstContainer();
+    void testFstFormat();
 private:
     TLOG_DECLARE();
 };
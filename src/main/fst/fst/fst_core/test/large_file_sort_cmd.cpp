@@ -25,22 +25,35 @@ int main(int argc, char** argv) {
     app.footer("Please contact dingbinthu@163.com for related questions and other matters not covered. Enjoy it!"); // 最后一行打印
     app.get_formatter()->column_width(40); // 列的宽度
 
-    string inputFile, outputFile, workDir;
+    string inputFile, outputFile, combineFuncName;
+    vector<string> workDirs;
     uint32_t threadNum,splitFileNum, parallelTaskNum;
+    uint64_t memoryBudget;
     bool ignoreEmptyLines;
     app.add_option("-f,--input-file",inputFile,"input file which is often a huge large file to sort")->check(CLI::ExistingFile)->required(true);
     app.add_option("-o,--output-file",outputFile,"output file which store result sorted from input file")->check(CLI::NonexistentPath)->required(true);
-    app.add_option("-w,--work-directory",workDir,"work directory specified for total processing,default /tmp if not set")->default_val("/tmp")->check(CLI::ExistingDirectory)->required(false);
+    app.add_option("-w,--work-directory",workDirs,"work directories specified for total processing, such as one for every disk, intermediate files are spread across them by their free space,default /tmp if not set")->check(CLI::ExistingDirectory)->required(false);
     app.add_option("-t,--thread-count",threadNum,"threads count used for sort large file,default 4 if not set")->default_val(4)->check(CLI::Range(1,32))->required(false);
-    app.add_option("-s,--split-file-count",splitFileNum,"count number of large file split,default 8 if not set")->default_val(6)->check(CLI::Range(1,1000))->required(false);
-    app.add_option("-p,--parallel-task-count",parallelTaskNum,"paralleled running task count for merge sorted intermediate files, default 3 if not set")->default_val(3)->check(CLI::Range(2,20))->required(false);
+    app.add_option("-s,--split-file-count",splitFileNum,"count number of key ranges sorted runs are split into and merged in parallel,default 6 if not set")->default_val(6)->check(CLI::Range(1,1000))->required(false);
+    app.add_option("-p,--parallel-task-count",parallelTaskNum,"max count of sorted intermediate files merged at once, default 256 if not set")->default_val(256)->check(CLI::Range(2,4096))->required(false);
+    app.add_option("-m,--memory-budget",memoryBudget,"memory used to sort with unit MB bytes, input file fits in it is sorted in memory, otherwise sorted runs about twice of it are generated and merged,default 1024M if not set")->default_val(1024)->check(CLI::PositiveNumber)->required(false);
+    app.add_option("-d,--duplicate",combineFuncName,"how lines of duplicate keys are combined into one, key is the part of line before the first comma and value is the number after it unless none. one of none, first, last, sum, min and max,default none if not set")->default_val("none")->check(CLI::IsMember({"none","first","last","sum","min","max"}))->required(false);
     app.add_flag("-i,--ignore-empty-line",ignoreEmptyLines,"whether ignore all empty lines to result file,default false if not set")->required(false);
     CLI11_PARSE(app, argc, argv);
     bool ret = false;
     if (app.parsed()) {
         Random<uint32_t>::seedDefault();
         Random<uint64_t>::seedDefault();
-        LargeFileSorter largeFileSorter(inputFile,outputFile,workDir,threadNum,splitFileNum,parallelTaskNum,!ignoreEmptyLines);
+        LargeFileSorter largeFileSorter(inputFile,outputFile,"/tmp",threadNum,splitFileNum,parallelTaskNum,!ignoreEmptyLines);
+        if (!workDirs.empty()) {
+            largeFileSorter.SetWorkDirPaths(workDirs);
+        }
+        largeFileSorter.SetMemoryBudget(memoryBudget * 1024 * 1024);
+        largeFileSorter.SetCombineFunc(combineFuncName == "first" ? LargeFileSorter::COMBINE_FUNC_FIRST :
+                                       combineFuncName == "last" ? LargeFileSorter::COMBINE_FUNC_LAST :
+                                       combineFuncName == "sum" ? LargeFileSorter::COMBINE_FUNC_SUM :
+                                       combineFuncName == "min" ? LargeFileSorter::COMBINE_FUNC_MIN :
+                                       combineFuncName == "max" ? LargeFileSorter::COMBINE_FUNC_MAX : LargeFileSorter::COMBINE_FUNC_NONE);
         bool ret = largeFileSorter.Run();
     }
     return ret?0:1;
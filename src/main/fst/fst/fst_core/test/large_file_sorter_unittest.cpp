@@ -12,6 +12,9 @@
 #include "fst/fst_core/test/large_file_sorter_unittest.h"
 #include "fst/fst_core/large_file_sorter.h"
 #include "common/util/time_util.h"
+#include "common/util/string_util.h"
+#include <map>
+#include <numeric>
 
 
 STD_USE_NAMESPACE;
@@ -76,4 +79,158 @@ void LargeFileSorterTest::testLargeFileSorterIgnoreEmptyLine() {
     CPPUNIT_ASSERT_EQUAL(oss1.str(),oss2.str());
 }
 
+void LargeFileSorterTest::testLargeFileSorterExternalMerge() {
+    string inputFile = string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32);
+    RemoveFileRAII removeInputFileRaii(inputFile);
+    vector<string> lines;
+    {
+        ofstream ofs(inputFile);
+        for (uint32_t i = 0; i < 200000; ++i) {
+            lines.push_back(Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(1,16)));
+            //same key padded by white spaces keeps its input order
+            if (i % 1000 == 0) {
+                lines.push_back(" \t" + lines.back() + " ");
+            }
+            //lots of the same key
+            if (i % 100 == 0) {
+                lines.push_back("same_key");
+            }
+        }
+        for (const string& line : lines) {
+            ofs << line << std::endl;
+        }
+    }
+    std::stable_sort(lines.begin(), lines.end(), [](const string& lhs, const string& rhs) {
+        return StringUtil::TrimString(lhs) < StringUtil::TrimString(rhs);
+    });
+
+    //sorted in memory by many threads, or generated into sorted runs by a small memory budget, whose files
+    //of every key range are merged by rounds of fan-in 3
+    for (uint64_t memoryBudget : {LargeFileSorter::DEFAULT_MEMORY_BUDGET, (uint64_t)256 * 1024}) {
+        for (uint32_t splitFileNum : {1, 16}) {
+            string outputFile = string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32);
+            RemoveFileRAII removeFileRaii(outputFile);
+            LargeFileSorter largeFileSorter(inputFile,
+                                            outputFile,
+                                            "/tmp",
+                                            4,splitFileNum,3,false);
+            largeFileSorter.SetMemoryBudget(memoryBudget);
+            //lines with white spaces around keys are rebuilt from front coded intermediate files
+            largeFileSorter.SetRunChecksum(1 == splitFileNum);
+            //intermediate files are striped across work directories
+            if (16 == splitFileNum) {
+                largeFileSorter.SetWorkDirPaths({"/tmp", TEST_DATA_PATH});
+            }
+            CPPUNIT_ASSERT_EQUAL(true,largeFileSorter.Run());
+            vector<string> sortedLines;
+            string line;
+            ifstream ifs(outputFile);
+            while (getline(ifs,line)) {
+                sortedLines.push_back(line);
+            }
+            CPPUNIT_ASSERT(lines == sortedLines);
+        }
+    }
+
+    //empty input gives empty result
+    string emptyFile = inputFile + ".empty";
+    string outputFile = inputFile + ".output";
+    RemoveFileRAII removeEmptyFileRaii(emptyFile);
+    RemoveFileRAII removeFileRaii(outputFile);
+    {
+        ofstream ofs(emptyFile);
+    }
+    LargeFileSorter largeFileSorter(emptyFile, outputFile, "/tmp", 2, 4, 2, false);
+    largeFileSorter.SetMemoryBudget(0);
+    CPPUNIT_ASSERT_EQUAL(true,largeFileSorter.Run());
+    CPPUNIT_ASSERT(FileUtility::IsFileExists(outputFile));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0, FileUtility::GetFileLineNumber(outputFile));
+}
+
+void LargeFileSorterTest::testLargeFileSorterStreamOutput() {
+    string inputFile = string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32);
+    RemoveFileRAII removeInputFileRaii(inputFile);
+    vector<string> lines;
+    {
+        ofstream ofs(inputFile);
+        for (uint32_t i = 0; i < 50000; ++i) {
+            lines.push_back(Random<uint32_t>::RandomString(Random<uint32_t>::RandomIntBetween(1,16)) + "," + std::to_string(i));
+            ofs << lines.back() << std::endl;
+        }
+    }
+    std::stable_sort(lines.begin(), lines.end());
+
+    //sorted lines are streamed to consumer without result file, whether sorted in memory or merged
+    for (uint64_t memoryBudget : {LargeFileSorter::DEFAULT_MEMORY_BUDGET, (uint64_t)64 * 1024}) {
+        LargeFileSorter largeFileSorter(inputFile, "", "/tmp", 4, 8, 3, false);
+        largeFileSorter.SetMemoryBudget(memoryBudget);
+        vector<string> sortedLines;
+        CPPUNIT_ASSERT_EQUAL(true, largeFileSorter.Run([&sortedLines](const char* line, size_t lineLen) {
+            sortedLines.push_back(string(line, lineLen));
+            return true;
+        }));
+        CPPUNIT_ASSERT(lines == sortedLines);
+    }
+
+    //consumer stops sorting
+    LargeFileSorter largeFileSorter(inputFile, "", "/tmp", 4, 8, 3, false);
+    largeFileSorter.SetMemoryBudget(64 * 1024);
+    uint32_t consumedLineNum = 0;
+    CPPUNIT_ASSERT_EQUAL(false, largeFileSorter.Run([&consumedLineNum](const char* line, size_t lineLen) {
+        return ++consumedLineNum < 100;
+    }));
+    CPPUNIT_ASSERT_EQUAL((uint32_t)100, consumedLineNum);
+}
+
+void LargeFileSorterTest::testLargeFileSorterCombineDuplicateKey() {
+    string inputFile = string() + TEST_DATA_PATH + "/" +  Random<uint32_t>::RandomString(32);
+    RemoveFileRAII removeInputFileRaii(inputFile);
+    //values of every key in input order
+    map<string,vector<uint64_t> > keyValues;
+    {
+        ofstream ofs(inputFile);
+        for (uint32_t i = 0; i < 50000; ++i) {
+            string key = "key_" + std::to_string(Random<uint32_t>::RandomIntBetween(0,4999));
+            uint64_t value = Random<uint32_t>::RandomIntBetween(0,1000000);
+            keyValues[key].push_back(value);
+            //key is trimmed and sorted without value
+            ofs << (0 == i % 3 ? " " : "") << key << "," << value << std::endl;
+        }
+    }
+    map<LargeFileSorter::COMBINE_FUNC_ENUM,std::function<uint64_t(const vector<uint64_t>&)> > combineFuncs = {
+        {LargeFileSorter::COMBINE_FUNC_FIRST, [](const vector<uint64_t>& values) { return values.front(); }},
+        {LargeFileSorter::COMBINE_FUNC_LAST, [](const vector<uint64_t>& values) { return values.back(); }},
+        {LargeFileSorter::COMBINE_FUNC_SUM, [](const vector<uint64_t>& values) {
+            return std::accumulate(values.begin(), values.end(), (uint64_t)0); }},
+        {LargeFileSorter::COMBINE_FUNC_MIN, [](const vector<uint64_t>& values) {
+            return *std::min_element(values.begin(), values.end()); }},
+        {LargeFileSorter::COMBINE_FUNC_MAX, [](const vector<uint64_t>& values) {
+            return *std::max_element(values.begin(), values.end()); }},
+    };
+    //duplicates are combined in memory, while runs are generated and at every merge
+    for (const auto& combineFunc : combineFuncs) {
+        for (uint64_t memoryBudget : {LargeFileSorter::DEFAULT_MEMORY_BUDGET, (uint64_t)64 * 1024}) {
+            LargeFileSorter largeFileSorter(inputFile, "", "/tmp", 4, 8, 3, false);
+            largeFileSorter.SetMemoryBudget(memoryBudget);
+            largeFileSorter.SetCombineFunc(combineFunc.first);
+            vector<string> keys;
+            vector<uint64_t> values;
+            CPPUNIT_ASSERT_EQUAL(true, largeFileSorter.Run([&](const char* line, size_t lineLen) {
+                vector<string> arr;
+                StringUtil::Split(string(line, lineLen), ",", arr, false);
+                keys.push_back(StringUtil::TrimString(arr[0]));
+                values.push_back(std::stoull(arr[1]));
+                return true;
+            }));
+            CPPUNIT_ASSERT_EQUAL(keyValues.size(), keys.size());
+            size_t i = 0;
+            for (const auto& keyValue : keyValues) {
+                CPPUNIT_ASSERT_EQUAL(keyValue.first, keys[i]);
+                CPPUNIT_ASSERT_EQUAL(combineFunc.second(keyValue.second), values[i]);
+                ++i;
+            }
+        }
+    }
+}
+
 COMMON_END_NAMESPACE
\ No newline at end of file
@@ -24,10 +24,16 @@ class LargeFileSorterTest: public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST_SUITE(LargeFileSorterTest);
     CPPUNIT_TEST(testLargeFileSorterContainEmptyLine);
     CPPUNIT_TEST(testLargeFileSorterIgnoreEmptyLine);
+    CPPUNIT_TEST(testLargeFileSorterExternalMerge);
+    CPPUNIT_TEST(testLargeFileSorterStreamOutput);
+    CPPUNIT_TEST(testLargeFileSorterCombineDuplicateKey);
     CPPUNIT_TEST_SUITE_END();
 public:
     void testLargeFileSorterContainEmptyLine();
     void testLargeFileSorterIgnoreEmptyLine();
+    void testLargeFileSorterExternalMerge();
+    void testLargeFileSorterStreamOutput();
+    void testLargeFileSorterCombineDuplicateKey();
 private:
     TLOG_DECLARE();
 };
@@ -0,0 +1,535 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       updatable_fst.cpp
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file implements updatable dictionary on top of immutable fst segments
+**********************************************************************************/
+#include "fst/fst_core/updatable_fst.h"
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+TLOG_SETUP(COMMON_NS,FstSegment);
+TLOG_SETUP(COMMON_NS,UpdatableFst);
+
+const uint64_t UpdatableFst::TOMBSTONE_OUTPUT_FLAG;
+const uint64_t UpdatableFst::DEFAULT_MAX_DELTA_ENTRY_COUNT;
+const uint32_t UpdatableFst::DEFAULT_MAX_SEGMENT_COUNT;
+const uint32_t UpdatableFst::MAX_FROZEN_DELTA_COUNT;
+const uint64_t UpdatableFst::DEFAULT_BUILD_CACHE_MEM_SIZE;
+const uint64_t UpdatableFst::COMPACTION_SIZE_RATIO;
+
+FstSegmentPtr FstSegment::FromData(string& data) {
+    FstSegmentPtr segment = std::make_shared<FstSegment>();
+    segment->m_data.swap(data);
+    segment->m_dataLength = segment->m_data.size();
+    segment->m_reader = FstReader::Create((uint8_t*)segment->m_data.data(), segment->m_dataLength);
+    if (nullptr == segment->m_reader) {
+        TLOG_LOG(ERROR,"invalid fst data of length:[%lu].", segment->m_dataLength);
+        data.swap(segment->m_data);
+        return nullptr;
+    }
+    return segment;
+}
+
+FstSegmentPtr FstSegment::Load(const string& fstFile) {
+    FstSegmentPtr segment = std::make_shared<FstSegment>();
+    segment->m_mmapDataPiece = std::make_shared<MMapDataPiece>();
+    if (!segment->m_mmapDataPiece->OpenRead(fstFile.c_str(), true)) {
+        TLOG_LOG(ERROR,"failed to memory map fst file:[%s].", fstFile.c_str());
+        return nullptr;
+    }
+    segment->m_dataLength = segment->m_mmapDataPiece->GetDataLength();
+    segment->m_reader = FstReader::Create(segment->m_mmapDataPiece->GetData(), segment->m_dataLength);
+    if (nullptr == segment->m_reader) {
+        TLOG_LOG(ERROR,"invalid fst file:[%s] of length:[%lu].", fstFile.c_str(), segment->m_dataLength);
+        return nullptr;
+    }
+    return segment;
+}
+
+///compare key of delta with inputs of fst in byte order
+static int compareKey(const string& key, const vector<uint8_t>& inputs) {
+    size_t len = std::min(key.size(), inputs.size());
+    int ret = (len > 0) ? memcmp(key.data(), inputs.data(), len) : 0;
+    if (ret != 0) return ret;
+    if (key.size() == inputs.size()) return 0;
+    return key.size() < inputs.size() ? -1 : 1;
+}
+
+UpdatableFst::Iterator::Iterator(const DeltaListPtr& deltas, const SegmentListPtr& segments,
+                                 const FstReader::FstIterBound& min, const FstReader::FstIterBound& max, AutomatonPtr aut)
+: m_max(max)
+, m_automaton(aut)
+, m_segments(segments)
+{
+    vector<FstReader::Iterator> iterators;
+    for (const FstSegmentPtr& segment : *m_segments) {
+        iterators.push_back(segment->GetReader()->GetIterator(min, max, aut));
+    }
+    //sources are newest first, so output of first source is the latest value
+    m_stream = std::make_shared<FstSetOpStream>(iterators, FstSetOpStream::SET_OP_UNION, FstSetOpStream::MERGE_FUNC_FIRST);
+    m_streamHead = m_stream->Next();
+
+    string minKey(min.m_bound.begin(), min.m_bound.end());
+    for (const DeltaPtr& delta : *deltas) {
+        DeltaCursor cursor;
+        cursor.m_delta = delta;
+        switch (min.m_type) {
+            case FstReader::FstIterBound::FST_ITER_BOUND_TYPE_INCLUDED:
+                cursor.m_it = delta->lower_bound(minKey);
+                break;
+            case FstReader::FstIterBound::FST_ITER_BOUND_TYPE_EXCLUDED:
+                cursor.m_it = delta->upper_bound(minKey);
+                break;
+            default:
+                cursor.m_it = delta->begin();
+                break;
+        }
+        seekMatched(cursor);
+        m_deltaCursors.push_back(cursor);
+    }
+}
+
+bool UpdatableFst::Iterator::matchKey(const string& key, AutomatonStatePtr& autState) {
+    autState = m_automaton->Start();
+    m_inputs.clear();
+    for (char ch : key) {
+        if (!m_automaton->CanMatch(autState)) return false;
+        m_inputs.push_back((uint8_t)ch);
+        autState = m_automaton->Accept(autState, m_inputs);
+    }
+    return m_automaton->IsMatch(autState);
+}
+
+void UpdatableFst::Iterator::seekMatched(DeltaCursor& cursor) {
+    for (; cursor.m_it != cursor.m_delta->end(); ++cursor.m_it) {
+        m_inputs.assign(cursor.m_it->first.begin(), cursor.m_it->first.end());
+        if (m_max.ExceededBy(m_inputs)) {
+            cursor.m_it = cursor.m_delta->end();
+            return;
+        }
+        if (matchKey(cursor.m_it->first, cursor.m_autState)) {
+            return;
+        }
+    }
+}
+
+FstReader::IteratorResultPtr UpdatableFst::Iterator::Next() {
+    while (true) {
+        //least key of deltas, newest delta wins
+        DeltaCursor* minCursor = nullptr;
+        for (DeltaCursor& cursor : m_deltaCursors) {
+            if (cursor.m_it == cursor.m_delta->end()) continue;
+            if (nullptr == minCursor || cursor.m_it->first < minCursor->m_it->first) {
+                minCursor = &cursor;
+            }
+        }
+        if (nullptr == minCursor && nullptr == m_streamHead) {
+            return nullptr;
+        }
+        //deltas are newer than all segments
+        int cmp = (nullptr == minCursor) ? 1 : (nullptr == m_streamHead ? -1 : compareKey(minCursor->m_it->first, m_streamHead->m_inputs));
+        FstReader::IteratorResultPtr result;
+        if (cmp <= 0) {
+            result = std::make_shared<FstReader::IteratorResult>();
+            result->m_inputs.assign(minCursor->m_it->first.begin(), minCursor->m_it->first.end());
+            result->m_output = minCursor->m_it->second;
+            result->m_autState = minCursor->m_autState;
+            if (cmp == 0) {
+                m_streamHead = m_stream->Next();
+            }
+        }
+        else {
+            result = m_streamHead;
+            m_streamHead = m_stream->Next();
+        }
+        for (DeltaCursor& cursor : m_deltaCursors) {
+            if (cursor.m_it != cursor.m_delta->end() && compareKey(cursor.m_it->first, result->m_inputs) == 0) {
+                ++cursor.m_it;
+                seekMatched(cursor);
+            }
+        }
+        if (0 == (result->m_output & TOMBSTONE_OUTPUT_FLAG)) {
+            return result;
+        }
+    }
+}
+
+bool UpdatableFst::Snapshot::Get(const string& key, uint64_t& value) const {
+    for (const DeltaPtr& delta : *m_deltas) {
+        uint64_t output = 0;
+        if (lookupDelta(*delta, key, output)) {
+            if (output & TOMBSTONE_OUTPUT_FLAG) {
+                return false;
+            }
+            value = output;
+            return true;
+        }
+    }
+    for (const FstSegmentPtr& segment : *m_segments) {
+        uint64_t output = 0;
+        if (segment->GetReader()->Get(key, output)) {
+            if (output & TOMBSTONE_OUTPUT_FLAG) {
+                return false;
+            }
+            value = output;
+            return true;
+        }
+    }
+    return false;
+}
+
+UpdatableFst::Iterator UpdatableFst::Snapshot::GetIterator(const FstReader::FstIterBound& min,
+                                                           const FstReader::FstIterBound& max, AutomatonPtr aut) const {
+    return Iterator(m_deltas, m_segments, min, max, aut);
+}
+
+uint64_t UpdatableFst::Snapshot::GetDeltaEntryCount() const {
+    uint64_t entryCount = 0;
+    for (const DeltaPtr& delta : *m_deltas) {
+        entryCount += delta->size();
+    }
+    return entryCount;
+}
+
+bool UpdatableFst::Snapshot::Build(FstBuilder& builder, uint64_t& keyCount) const {
+    Iterator it = GetIterator(FstReader::FstIterBound(), FstReader::FstIterBound());
+    return FstSetOpStream::Build([&it]() { return it.Next(); }, builder, keyCount);
+}
+
+UpdatableFst::UpdatableFst(const FstSegmentPtr& base, uint64_t maxDeltaEntryCount, uint32_t maxSegmentCount,
+                           bool isBackgroundMaintain)
+: m_maxDeltaEntryCount(std::max(maxDeltaEntryCount, (uint64_t)1))
+, m_maxSegmentCount(std::max(maxSegmentCount, (uint32_t)1))
+, m_delta(std::make_shared<map<string,uint64_t> >())
+, m_frozenDeltas(std::make_shared<const vector<DeltaPtr> >())
+, m_frozenEntryCount(0)
+, m_flushCount(0)
+, m_compactionCount(0)
+, m_isBackgroundMaintain(isBackgroundMaintain)
+, m_isStopped(false)
+{
+    std::shared_ptr<vector<FstSegmentPtr> > segments = std::make_shared<vector<FstSegmentPtr> >();
+    if (nullptr != base) {
+        segments->push_back(base);
+    }
+    m_segments = segments;
+    if (m_isBackgroundMaintain) {
+        m_maintainThread = std::thread(&UpdatableFst::maintainLoop, this);
+    }
+}
+
+UpdatableFst::~UpdatableFst() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isStopped = true;
+    }
+    m_maintainCond.notify_all();
+    if (m_maintainThread.joinable()) {
+        m_maintainThread.join();
+    }
+}
+
+bool UpdatableFst::Put(const string& key, uint64_t value) {
+    if (value & TOMBSTONE_OUTPUT_FLAG) {
+        TLOG_LOG(ERROR,"value:[%lu] of key:[%s] has tombstone flag.", value, key.c_str());
+        return false;
+    }
+    bool isMaintainNeeded = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        (*m_delta)[key] = value;
+        isMaintainNeeded = isMaintainNeededWithLock();
+    }
+    if (isMaintainNeeded) {
+        if (m_isBackgroundMaintain) m_maintainCond.notify_one();
+        else maintain();
+    }
+    return true;
+}
+
+bool UpdatableFst::Delete(const string& key) {
+    bool isMaintainNeeded = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        (*m_delta)[key] = TOMBSTONE_OUTPUT_FLAG;
+        isMaintainNeeded = isMaintainNeededWithLock();
+    }
+    if (isMaintainNeeded) {
+        if (m_isBackgroundMaintain) m_maintainCond.notify_one();
+        else maintain();
+    }
+    return true;
+}
+
+bool UpdatableFst::lookupDelta(const map<string,uint64_t>& delta, const string& key, uint64_t& output) {
+    map<string,uint64_t>::const_iterator it = delta.find(key);
+    if (it == delta.end()) {
+        return false;
+    }
+    output = it->second;
+    return true;
+}
+
+bool UpdatableFst::Get(const string& key, uint64_t& value) {
+    uint64_t output = 0;
+    DeltaListPtr frozenDeltas;
+    SegmentListPtr segments;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (lookupDelta(*m_delta, key, output)) {
+            if (output & TOMBSTONE_OUTPUT_FLAG) return false;
+            value = output;
+            return true;
+        }
+        frozenDeltas = m_frozenDeltas;
+        segments = m_segments;
+    }
+    return Snapshot(frozenDeltas, segments).Get(key, value);
+}
+
+UpdatableFst::SnapshotPtr UpdatableFst::GetSnapshot() {
+    bool isMaintainNeeded = false;
+    SnapshotPtr snapshot;
+    {
+        //delta, frozen deltas and segments only change together under lock, so no update is missed or repeated
+        std::lock_guard<std::mutex> lock(m_mutex);
+        freezeDeltaWithLock();
+        snapshot = std::make_shared<Snapshot>(m_frozenDeltas, m_segments);
+        isMaintainNeeded = isMaintainNeededWithLock();
+    }
+    if (isMaintainNeeded) {
+        if (m_isBackgroundMaintain) m_maintainCond.notify_one();
+        else maintain();
+    }
+    return snapshot;
+}
+
+void UpdatableFst::freezeDeltaWithLock() {
+    if (m_delta->empty()) {
+        return;
+    }
+    std::shared_ptr<vector<DeltaPtr> > frozenDeltas = std::make_shared<vector<DeltaPtr> >();
+    frozenDeltas->reserve(m_frozenDeltas->size() + 1);
+    frozenDeltas->push_back(m_delta);
+    frozenDeltas->insert(frozenDeltas->end(), m_frozenDeltas->begin(), m_frozenDeltas->end());
+    m_frozenDeltas = frozenDeltas;
+    m_frozenEntryCount += m_delta->size();
+    m_delta = std::make_shared<map<string,uint64_t> >();
+}
+
+bool UpdatableFst::Flush() {
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+    if (!flushWithLock()) {
+        return false;
+    }
+    if (!m_isBackgroundMaintain) {
+        compactIfNeeded();
+    }
+    return true;
+}
+
+bool UpdatableFst::flushWithLock() {
+    DeltaListPtr frozenDeltas;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        freezeDeltaWithLock();
+        if (m_frozenDeltas->empty()) {
+            return true;
+        }
+        frozenDeltas = m_frozenDeltas;
+    }
+
+    //building happens without lock, readers look up frozen deltas meanwhile. newer deltas are applied later
+    //so that their updates win
+    map<string,uint64_t> mergedDelta;
+    uint64_t frozenEntryCount = 0;
+    for (vector<DeltaPtr>::const_reverse_iterator it = frozenDeltas->rbegin(); it != frozenDeltas->rend(); ++it) {
+        for (const pair<const string,uint64_t>& kv : **it) {
+            mergedDelta[kv.first] = kv.second;
+        }
+        frozenEntryCount += (*it)->size();
+    }
+    ostringstream oss;
+    StdostreamOutputStream outputStream(oss);
+    uint64_t cacheMemSize = std::min(DEFAULT_BUILD_CACHE_MEM_SIZE, std::max((uint64_t)(1024 * 1024), mergedDelta.size() * 256));
+    FstBuilder builder(&outputStream, true, cacheMemSize);
+    bool isOk = true;
+    for (const pair<const string,uint64_t>& kv : mergedDelta) {
+        if (!builder.Insert((const uint8_t*)kv.first.data(), kv.first.size(), kv.second)) {
+            isOk = false;
+            break;
+        }
+    }
+    FstSegmentPtr segment;
+    if (isOk) {
+        builder.Finish();
+        string data = oss.str();
+        segment = FstSegment::FromData(data);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (nullptr == segment) {
+        //frozen deltas are left to be looked up and flushed again
+        TLOG_LOG(ERROR,"failed to build segment from deltas of [%zu] entries.", mergedDelta.size());
+        return false;
+    }
+    //deltas frozen while building are in front of the ones built, which are replaced by segment
+    m_frozenDeltas = std::make_shared<const vector<DeltaPtr> >(m_frozenDeltas->begin(), m_frozenDeltas->end() - frozenDeltas->size());
+    m_frozenEntryCount -= frozenEntryCount;
+    std::shared_ptr<vector<FstSegmentPtr> > segments = std::make_shared<vector<FstSegmentPtr> >();
+    segments->reserve(m_segments->size() + 1);
+    segments->push_back(segment);
+    segments->insert(segments->end(), m_segments->begin(), m_segments->end());
+    m_segments = segments;
+    ++m_flushCount;
+    if (m_isBackgroundMaintain && m_segments->size() > m_maxSegmentCount) {
+        m_maintainCond.notify_one();
+    }
+    return true;
+}
+
+size_t UpdatableFst::selectCompactionCount(const vector<FstSegmentPtr>& segments) {
+    //size tiered: merge from newest while next older one is not much larger, so base fst is rarely rewritten
+    uint64_t mergedLength = segments[0]->GetDataLength();
+    size_t count = 1;
+    while (count < segments.size()) {
+        if (count >= 2 && segments[count]->GetDataLength() > mergedLength * COMPACTION_SIZE_RATIO) {
+            break;
+        }
+        mergedLength += segments[count]->GetDataLength();
+        ++count;
+    }
+    return count;
+}
+
+bool UpdatableFst::Compact(bool isFull) {
+    std::lock_guard<std::mutex> compactLock(m_compactMutex);
+    SegmentListPtr segments;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        segments = m_segments;
+    }
+    if (segments->empty() || (segments->size() == 1 && !isFull)) {
+        return true;
+    }
+    size_t mergeCount = isFull ? segments->size() : selectCompactionCount(*segments);
+    //nothing older can be shadowed by tombstones once the oldest segment is merged
+    bool isDropTombstone = (mergeCount == segments->size());
+
+    SegmentListPtr mergeSegments = std::make_shared<const vector<FstSegmentPtr> >(segments->begin(), segments->begin() + mergeCount);
+    ostringstream oss;
+    StdostreamOutputStream outputStream(oss);
+    FstBuilder builder(&outputStream, true, DEFAULT_BUILD_CACHE_MEM_SIZE);
+    uint64_t keyCount = 0;
+    bool isOk = false;
+    if (isDropTombstone) {
+        Iterator it(std::make_shared<const vector<DeltaPtr> >(), mergeSegments, FstReader::FstIterBound(), FstReader::FstIterBound(), std::make_shared<AlwaysAutomaton>());
+        isOk = FstSetOpStream::Build([&it]() { return it.Next(); }, builder, keyCount);
+    }
+    else {
+        vector<FstReader::Iterator> iterators;
+        for (const FstSegmentPtr& segment : *mergeSegments) {
+            iterators.push_back(segment->GetReader()->GetIterator(FstReader::FstIterBound(), FstReader::FstIterBound()));
+        }
+        FstSetOpStream stream(iterators, FstSetOpStream::SET_OP_UNION, FstSetOpStream::MERGE_FUNC_FIRST);
+        isOk = stream.Build(builder, keyCount);
+    }
+    FstSegmentPtr merged;
+    if (isOk) {
+        string data = oss.str();
+        merged = FstSegment::FromData(data);
+    }
+    if (nullptr == merged) {
+        TLOG_LOG(ERROR,"failed to compact [%zu] segments.", mergeCount);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    //flushes only push newer segments in front, so merged ones are still adjacent
+    const vector<FstSegmentPtr>& curSegments = *m_segments;
+    size_t pos = std::find(curSegments.begin(), curSegments.end(), mergeSegments->front()) - curSegments.begin();
+    std::shared_ptr<vector<FstSegmentPtr> > newSegments = std::make_shared<vector<FstSegmentPtr> >();
+    newSegments->insert(newSegments->end(), curSegments.begin(), curSegments.begin() + pos);
+    newSegments->push_back(merged);
+    newSegments->insert(newSegments->end(), curSegments.begin() + pos + mergeCount, curSegments.end());
+    m_segments = newSegments;
+    ++m_compactionCount;
+    TLOG_LOG(DEBUG,"compacted [%zu] segments into one of [%lu] keys and [%lu] bytes, [%zu] segments now.",
+             mergeCount, keyCount, merged->GetDataLength(), newSegments->size());
+    return true;
+}
+
+bool UpdatableFst::isMaintainNeededWithLock() {
+    return m_delta->size() + m_frozenEntryCount >= m_maxDeltaEntryCount
+           || m_frozenDeltas->size() > MAX_FROZEN_DELTA_COUNT
+           || m_segments->size() > m_maxSegmentCount;
+}
+
+void UpdatableFst::maintain() {
+    bool isFlushNeeded = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        isFlushNeeded = (m_delta->size() + m_frozenEntryCount >= m_maxDeltaEntryCount
+                         || m_frozenDeltas->size() > MAX_FROZEN_DELTA_COUNT);
+    }
+    if (isFlushNeeded) {
+        Flush();
+    }
+    compactIfNeeded();
+}
+
+void UpdatableFst::compactIfNeeded() {
+    while (GetSegmentCount() > m_maxSegmentCount) {
+        if (!Compact(false)) break;
+    }
+}
+
+void UpdatableFst::maintainLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_isStopped) {
+        if (!isMaintainNeededWithLock()) {
+            m_maintainCond.wait(lock);
+            continue;
+        }
+        uint64_t doneCount = m_flushCount + m_compactionCount;
+        lock.unlock();
+        maintain();
+        lock.lock();
+        //no progress means building failed, retry later instead of spinning
+        if (!m_isStopped && doneCount == m_flushCount + m_compactionCount) {
+            m_maintainCond.wait_for(lock, std::chrono::seconds(1));
+        }
+    }
+}
+
+uint64_t UpdatableFst::GetDeltaEntryCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_delta->size() + m_frozenEntryCount;
+}
+
+uint32_t UpdatableFst::GetSegmentCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_segments->size();
+}
+
+uint64_t UpdatableFst::GetFlushCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_flushCount;
+}
+
+uint64_t UpdatableFst::GetCompactionCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_compactionCount;
+}
+
+COMMON_END_NAMESPACE
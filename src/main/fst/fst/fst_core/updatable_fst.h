@@ -0,0 +1,227 @@
+/*********************************************************************************
+  *Copyright(C),dingbinthu@163.com
+  *All rights reserved.
+  *
+  *FileName:       updatable_fst.h
+  *Author:         dingbinthu@163.com
+  *Version:        1.0
+  *Date:           10/18/26
+  *Description:    file defines an updatable dictionary on top of immutable fsts, organized like
+  *                a log structured merge tree:
+  *                  1) puts and deletes go into a sorted in-memory delta, a delete is kept as a
+  *                     tombstone so that it shadows the key in older layers.
+  *                  2) delta is frozen into a small in-memory fst segment when it grows large
+  *                     or is flushed, segments are stacked newest first above the base fst.
+  *                  3) compaction merge-streams newest segments into one fst segment, tombstones
+  *                     are dropped when the oldest segment takes part in the merge.
+  *                Every layer below the delta is immutable. Taking a snapshot freezes the delta as
+  *                it is and swaps in an empty one, so a snapshot is just the lists of frozen deltas
+  *                and segments at some moment: it builds nothing, copies no entry and never blocks
+  *                on flushing. Frozen deltas are built into one segment by the next flush. Flush
+  *                and compaction run in a background thread unless disabled.
+**********************************************************************************/
+#ifndef __CPPFST_FST_CORE_UPDATABLE_FST__H__
+#define __CPPFST_FST_CORE_UPDATABLE_FST__H__
+#include "common/common.h"
+#include "tulip/TLogDefine.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "common/util/output_stream_util.h"
+#include "fst/fst_core/fst.h"
+#include "fst/fst_core/fst_set_op.h"
+
+STD_USE_NAMESPACE;
+COMMON_BEGIN_NAMESPACE
+
+///immutable fst of one layer, whose data is held in memory or memory mapped from file
+class FstSegment;
+TYPEDEF_PTR(FstSegment);
+class FstSegment {
+public:
+    FstSegment() {}
+private:
+    FstSegment(const FstSegment& rhs);
+    FstSegment& operator=(const FstSegment& rhs);
+public:
+    ///take over fst data built in memory, nullptr and data left untouched if data is not a fst
+    static FstSegmentPtr FromData(string& data);
+    ///memory map fst file, nullptr if failed or header or footer of fst is corrupt
+    static FstSegmentPtr Load(const string& fstFile);
+public:
+    FstReader* GetReader() { return m_reader.get(); }
+    uint64_t GetDataLength() const { return m_dataLength; }
+private:
+    string                  m_data;
+    MMapDataPiecePtr        m_mmapDataPiece;
+    FstReaderPtr            m_reader;
+    uint64_t                m_dataLength;
+private:
+    TLOG_DECLARE();
+};
+
+class UpdatableFst {
+public:
+    ///output flag of deleted key in delta and segments, so values put must be less than it
+    static const uint64_t TOMBSTONE_OUTPUT_FLAG = (1ul << 63);
+    static const uint64_t DEFAULT_MAX_DELTA_ENTRY_COUNT = 65536;
+    static const uint32_t DEFAULT_MAX_SEGMENT_COUNT = 8;
+    ///frozen deltas are flushed when there are more of them, so that lookups check few maps
+    static const uint32_t MAX_FROZEN_DELTA_COUNT = 16;
+    ///node hash cache memory of fst builder used by flush and compaction
+    static const uint64_t DEFAULT_BUILD_CACHE_MEM_SIZE = 64ul * 1024 * 1024;
+    ///newer segments are merged together while older one is not larger than this times of their size
+    static const uint64_t COMPACTION_SIZE_RATIO = 4;
+
+    ///segments newest first
+    typedef std::shared_ptr<const vector<FstSegmentPtr> > SegmentListPtr;
+    ///sorted entries of frozen delta, which is never modified
+    typedef std::shared_ptr<const map<string,uint64_t> > DeltaPtr;
+    ///frozen deltas newest first
+    typedef std::shared_ptr<const vector<DeltaPtr> > DeltaListPtr;
+
+    ///iterates keys of a snapshot in key order, newest layer wins and deleted keys are skipped
+    class Iterator {
+    public:
+        Iterator(const DeltaListPtr& deltas, const SegmentListPtr& segments, const FstReader::FstIterBound& min,
+                 const FstReader::FstIterBound& max, AutomatonPtr aut);
+    public:
+        FstReader::IteratorResultPtr Next();
+    private:
+        ///position of one delta layer, at next key within bounds and matched by automaton
+        struct DeltaCursor {
+            DeltaPtr                                    m_delta;
+            map<string,uint64_t>::const_iterator        m_it;
+            AutomatonStatePtr                           m_autState;
+        };
+    private:
+        void seekMatched(DeltaCursor& cursor);
+        ///walk automaton through key, false if not matched
+        bool matchKey(const string& key, AutomatonStatePtr& autState);
+    private:
+        ///newest first
+        vector<DeltaCursor>             m_deltaCursors;
+        FstReader::FstIterBound         m_max;
+        AutomatonPtr                    m_automaton;
+        ///keeps fst data of segments alive while iterating
+        SegmentListPtr                  m_segments;
+        FstSetOpStreamPtr               m_stream;
+        ///head of merged segments stream, nullptr if exhausted
+        FstReader::IteratorResultPtr    m_streamHead;
+        vector<uint8_t>                 m_inputs;
+    };
+
+    ///consistent view of all layers at one moment, which never changes by later updates
+    class Snapshot;
+    TYPEDEF_PTR(Snapshot);
+    class Snapshot {
+    public:
+        Snapshot(const DeltaListPtr& deltas, const SegmentListPtr& segments)
+        : m_deltas(deltas)
+        , m_segments(segments)
+        {}
+    public:
+        bool Get(const string& key, uint64_t& value) const;
+        Iterator GetIterator(const FstReader::FstIterBound& min, const FstReader::FstIterBound& max,
+                             AutomatonPtr aut = std::make_shared<AlwaysAutomaton>()) const;
+        /**
+         *@brief     materialize snapshot into one fst without tombstones, such as a new base fst file
+         *@param     builder       ---- builder of map fst, which must not have any key inserted yet
+         *@param     keyCount      ---- count of keys inserted
+         *@return    false if builder refused any key
+         */
+        bool Build(FstBuilder& builder, uint64_t& keyCount) const;
+        uint32_t GetSegmentCount() const { return m_segments->size(); }
+        ///entries of frozen deltas, of which same keys are counted once per delta
+        uint64_t GetDeltaEntryCount() const;
+    private:
+        ///deltas newer than all segments
+        DeltaListPtr            m_deltas;
+        SegmentListPtr          m_segments;
+    };
+public:
+    /**
+     *@brief     constructor
+     *@param     base                  ---- base fst, map or set, nullptr for empty dictionary
+     *@param     maxDeltaEntryCount    ---- delta is flushed into a segment when it has so many entries
+     *@param     maxSegmentCount       ---- segments are compacted when there are more of them
+     *@param     isBackgroundMaintain  ---- flush and compact in background thread, otherwise in the
+     *                                      call reaching the limit, such as 'Put' or 'GetSnapshot'
+     */
+    UpdatableFst(const FstSegmentPtr& base,
+                 uint64_t maxDeltaEntryCount = DEFAULT_MAX_DELTA_ENTRY_COUNT,
+                 uint32_t maxSegmentCount = DEFAULT_MAX_SEGMENT_COUNT,
+                 bool isBackgroundMaintain = true);
+    ~UpdatableFst();
+private:
+    UpdatableFst(const UpdatableFst& rhs);
+    UpdatableFst& operator=(const UpdatableFst& rhs);
+public:
+    ///insert or update, false if value has tombstone flag
+    bool Put(const string& key, uint64_t value);
+    ///delete key, which is visible at once
+    bool Delete(const string& key);
+    ///latest value of key, false if not exist or deleted
+    bool Get(const string& key, uint64_t& value);
+    ///take a snapshot of all layers, delta is frozen as its newest layer
+    SnapshotPtr GetSnapshot();
+    ///build delta and frozen deltas into a new segment, false if building segment failed
+    bool Flush();
+    /**
+     *@brief     merge segments into one
+     *@param     isFull        ---- merge all segments including base and drop tombstones, otherwise
+     *                            merge newest segments of similar size
+     *@return    false if building merged segment failed
+     */
+    bool Compact(bool isFull);
+
+    ///entries of delta and frozen deltas, which are not built into segments yet
+    uint64_t GetDeltaEntryCount();
+    uint32_t GetSegmentCount();
+    uint64_t GetFlushCount();
+    uint64_t GetCompactionCount();
+private:
+    bool flushWithLock();
+    ///push delta in front of frozen deltas and swap in an empty delta
+    void freezeDeltaWithLock();
+    bool isMaintainNeededWithLock();
+    ///flush and compact if limits are reached
+    void maintain();
+    void compactIfNeeded();
+    void maintainLoop();
+    ///newest segments to merge in non-full compaction
+    static size_t selectCompactionCount(const vector<FstSegmentPtr>& segments);
+    static bool lookupDelta(const map<string,uint64_t>& delta, const string& key, uint64_t& output);
+private:
+    uint64_t                                    m_maxDeltaEntryCount;
+    uint32_t                                    m_maxSegmentCount;
+
+    ///guards delta, frozen delta, segment list and counters
+    std::mutex                                  m_mutex;
+    ///serializes flushes, so that frozen delta is pushed on segments in order
+    std::mutex                                  m_flushMutex;
+    ///serializes compactions, so that segments selected are still adjacent when replaced
+    std::mutex                                  m_compactMutex;
+
+    std::shared_ptr<map<string,uint64_t> >      m_delta;
+    ///deltas frozen by snapshots or being built into segment, still looked up until segment is pushed
+    DeltaListPtr                                m_frozenDeltas;
+    uint64_t                                    m_frozenEntryCount;
+    SegmentListPtr                              m_segments;
+    uint64_t                                    m_flushCount;
+    uint64_t                                    m_compactionCount;
+
+    bool                                        m_isBackgroundMaintain;
+    bool                                        m_isStopped;
+    std::condition_variable                     m_maintainCond;
+    std::thread                                 m_maintainThread;
+private:
+    TLOG_DECLARE();
+};
+TYPEDEF_PTR(UpdatableFst);
+
+COMMON_END_NAMESPACE
+#endif //__CPPFST_FST_CORE_UPDATABLE_FST__H__